@@ -2,10 +2,13 @@
 #include "logger.h"
 #include "sensors.h"
 #include "command_parser.h"
+#include "command_buffer.h"
 #include "commands.h"
 #include "commands_dependencies.h"
 #include "chrono.h"
 #include "event_buffer.h"
+#include "state_machine_trace.h"
+#include "state_residency.h"
 #include "wolksensor_dependencies.h"
 #include "system_buffer.h"
 #include "communication_module.h"
@@ -16,14 +19,19 @@
 #include "sensor_readings_buffer.h"
 #include "global_dependencies.h"
 #include "sensors.h"
+#include "software_timer.h"
 
 #define EVENTS_BUFFER_SIZE 10
-#define COMMANDS_BUFFER_SIZE 10
-#define COMMAND_STRING_BUFFER_SIZE MAX_BUFFER_SIZE
+#define COMMUNICATION_PROTOCOL_RESERVED_EVENTS 2 /* one pending process/done event, one left over from previous state */
+#define COMMANDS_BUFFER_SIZE 160 /* bytes, see command_buffer.h */
+#define COMMAND_DATA_BUFFER_SIZE 128 /* raw characters received over UART waiting to be parsed */
 #define COMMAND_RESPONSE_BUFFER_SIZE MAX_BUFFER_SIZE
+#define COMMAND_RESPONSE_MAX_LENGTH 128 /* longest single response item, see protocol.c */
+#define UART_COMMAND_RESPONSE_BUFFER_SIZE (2 * COMMAND_RESPONSE_MAX_LENGTH) /* flushed to UART whenever it fills up */
 #define MAX_ALARM_RETRIES 2
 #define MAX_NO_CONNECTION_HEARTBEAT	60
 #define COMMUNICATION_MODULE_MINIMUM_REQUIRED_VOLTAGE 280
+#define ACQUISITION_TIMEOUT 1000 // ms
 
 typedef enum
 {
@@ -34,6 +42,7 @@ typedef enum
 	STATE_DATA_EXCHANGE,
 		STATE_SEND,
 		STATE_RECEIVE,
+		STATE_SEND_COMMAND_RESPONSES,
 		STATE_DISCONNECT,
 		STATE_STOP_COMMUNICATION_MODULE
 }
@@ -50,24 +59,51 @@ typedef enum
 	EVENT_ALARM,
 	EVENT_COMMUNICATION_PROTOCOL_PROCESS,
 	EVENT_COMMUNICATION_PROTOCOL_DONE,
-	EVENT_RESET
+	EVENT_RESET,
+	EVENT_SENSORS_ACQUIRED
 }
 wolksensor_events_t;
 
 static state_machine_state_t state_machine;
-static state_machine_state_t states[9];
+static state_machine_state_t states[10];
 
 static circular_buffer_t events_buffer;
 static event_t events_buffer_storage[EVENTS_BUFFER_SIZE];
 
-static circular_buffer_t command_string_buffer;
-static char command_string_buffer_storage[COMMAND_STRING_BUFFER_SIZE];
+static circular_buffer_t deferred_events_buffer;
+static event_t deferred_events_buffer_storage[EVENTS_BUFFER_SIZE];
 
-static circular_buffer_t commands_buffer;
-static command_t commands_buffer_storage[COMMANDS_BUFFER_SIZE];
+static state_machine_event_queue_t events_queue;
 
-static circular_buffer_t command_response_buffer;
-static char command_response_buffer_storage[COMMAND_RESPONSE_BUFFER_SIZE];
+static command_parser_t command_parser;
+
+/*
+* Commands from single source, responses are sent back to the source they came from.
+* Command being executed partially is kept in executing_command.
+*/
+typedef struct
+{
+	circular_buffer_t commands_buffer;
+	circular_buffer_t response_buffer;
+	
+	command_t executing_command;
+	bool command_executing;
+}
+command_queue_t;
+
+/* received from server and answered in command responses batch */
+static command_queue_t server_commands;
+static uint8_t server_commands_storage[COMMANDS_BUFFER_SIZE];
+static char server_command_responses_storage[COMMAND_RESPONSE_BUFFER_SIZE];
+
+/* parsed from UART data and answered over UART */
+static command_queue_t uart_commands;
+static uint8_t uart_commands_storage[COMMANDS_BUFFER_SIZE];
+static char uart_command_responses_storage[UART_COMMAND_RESPONSE_BUFFER_SIZE];
+
+static circular_buffer_t command_data_buffer;
+static char command_data_buffer_storage[COMMAND_DATA_BUFFER_SIZE];
+static volatile bool command_data_dropped = false;
 
 static uint16_t current_heartbeat = 0;
 static uint16_t	heartbeat_timer = 0;
@@ -85,9 +121,12 @@ static uint16_t sent_sensor_readings = 0;
 static uint16_t battery_voltage = 0;
 
 static communication_and_battery_data_t communication_and_battery_data;
+static uint32_t reported_charge = 0;
 
 static communication_protocol_process_handle_t communication_protocol_process_handle;
 
+static software_timer_t acquisition_timer;
+
 wolksensor_dependencies_t wolksensor_dependencies; 
 
 static bool wolksensor_handler(state_machine_state_t* state, event_t* event);
@@ -98,6 +137,7 @@ static bool state_acquisition(state_machine_state_t* state, event_t* event);
 static bool state_data_exchange(state_machine_state_t* state, event_t* event);
 static bool state_send(state_machine_state_t* state, event_t* event);
 static bool state_receive(state_machine_state_t* state, event_t* event);
+static bool state_send_command_responses(state_machine_state_t* state, event_t* event);
 static bool state_disconnect(state_machine_state_t* state, event_t* event);
 static bool state_stop_communication_module(state_machine_state_t* state, event_t* event);
 
@@ -113,36 +153,107 @@ static void transition(wolksensor_states_t new_state_id)
 
 static void init_events_buffer(void)
 {
-	circular_buffer_init(&events_buffer, events_buffer_storage, EVENTS_BUFFER_SIZE, sizeof(event_t), true, true);
+	circular_buffer_init(&events_buffer, events_buffer_storage, EVENTS_BUFFER_SIZE, sizeof(event_t), false, true);
+	circular_buffer_register(&events_buffer, PSTR("EVENTS"));
+	circular_buffer_init(&deferred_events_buffer, deferred_events_buffer_storage, EVENTS_BUFFER_SIZE, sizeof(event_t), false, true);
+	circular_buffer_register(&deferred_events_buffer, PSTR("DEFERRED_EVENTS"));
+	state_machine_init_event_queue(&events_queue, &events_buffer, &deferred_events_buffer, COMMUNICATION_PROTOCOL_RESERVED_EVENTS);
 }
 
-void init_commands_buffer(void)
+static void queue_event(wolksensor_events_t event_type)
 {
-	circular_buffer_init(&commands_buffer, commands_buffer_storage, COMMANDS_BUFFER_SIZE, sizeof(command_t), true, true);
+	if(!state_machine_queue_event(&events_queue, event_type, false))
+	{
+		LOG_PRINT(1, PSTR("Event %u dropped, %u events dropped so far\r\n"), event_type, events_queue.dropped_events);
+	}
 }
 
-static void init_command_string_buffer(void)
+static void queue_urgent_event(wolksensor_events_t event_type)
 {
-	circular_buffer_init(&command_string_buffer, command_string_buffer_storage, COMMAND_STRING_BUFFER_SIZE, sizeof(char), true, true);
+	if(!state_machine_queue_event(&events_queue, event_type, true))
+	{
+		LOG_PRINT(1, PSTR("Urgent event %u dropped, %u events dropped so far\r\n"), event_type, events_queue.dropped_events);
+	}
+}
+
+/* communication protocol process/done events drive the state machine themselves, losing one stalls it */
+static void queue_communication_protocol_event(wolksensor_events_t event_type)
+{
+	if(!state_machine_queue_reserved_event(&events_queue, event_type))
+	{
+		LOG_PRINT(1, PSTR("Communication protocol event %u dropped, %u events dropped so far\r\n"), event_type, events_queue.dropped_events);
+	}
+}
+
+void init_commands_buffer(void)
+{
+	circular_buffer_init(&server_commands.commands_buffer, server_commands_storage, COMMANDS_BUFFER_SIZE, sizeof(uint8_t), false, true);
+	circular_buffer_register(&server_commands.commands_buffer, PSTR("COMMANDS"));
+	
+	circular_buffer_init(&uart_commands.commands_buffer, uart_commands_storage, COMMANDS_BUFFER_SIZE, sizeof(uint8_t), false, true);
+	circular_buffer_register(&uart_commands.commands_buffer, PSTR("UART_COMMANDS"));
+	
+	circular_buffer_init(&command_data_buffer, command_data_buffer_storage, COMMAND_DATA_BUFFER_SIZE, sizeof(char), false, true);
+	circular_buffer_register(&command_data_buffer, PSTR("COMMAND_DATA"));
 }
 
 static void init_command_response_buffer(void)
 {
-	circular_buffer_init(&command_response_buffer, command_response_buffer_storage, COMMAND_RESPONSE_BUFFER_SIZE, sizeof(char), false, true);
+	circular_buffer_init(&server_commands.response_buffer, server_command_responses_storage, COMMAND_RESPONSE_BUFFER_SIZE, sizeof(char), false, true);
+	circular_buffer_register(&server_commands.response_buffer, PSTR("COMMAND_RESPONSES"));
+	server_commands.command_executing = false;
+	
+	circular_buffer_init(&uart_commands.response_buffer, uart_command_responses_storage, UART_COMMAND_RESPONSE_BUFFER_SIZE, sizeof(char), false, true);
+	circular_buffer_register(&uart_commands.response_buffer, PSTR("UART_COMMAND_RESPONSES"));
+	uart_commands.command_executing = false;
 }
 
+/*
+* Runs in UART interrupt context, data is only buffered here and parsed by parse_command_data in main context.
+*/
 static void command_data_listener(char *data, uint16_t length)
 {
-	circular_buffer_add_array(&command_string_buffer, data, length);
+	if(!circular_buffer_add_array(&command_data_buffer, data, length))
+	{
+		command_data_dropped = true;
+		return;
+	}
+	
+	if(memchr(data, COMMAND_TERMINATOR, length))
+	{
+		queue_event(EVENT_COMMAND_RECEIVED);
+	}
+}
+
+/*
+* Feeds buffered UART data to command parser, completed commands are added to UART commands.
+*/
+static void parse_command_data(void)
+{
+	char data[16];
+	uint16_t length;
 	
-	uint16_t i;
-	for(i = 0; i < length; i++)
+	do
 	{
-		if(data[i] == COMMAND_TERMINATOR)
+		SYNCHRONIZED_BLOCK_START
+		
+		length = circular_buffer_pop_array(&command_data_buffer, sizeof(data), data);
+		
+		bool dropped = command_data_dropped;
+		command_data_dropped = false;
+		
+		SYNCHRONIZED_BLOCK_END
+		
+		if(dropped)
 		{
-			add_event_type(&events_buffer, EVENT_COMMAND_RECEIVED);
+			LOG(1, "Command data dropped, discarding partially received command");
+			
+			command_parser_init(&command_parser);
 		}
+		
+		command_parser_feed_array(&command_parser, data, length, &uart_commands.commands_buffer);
 	}
+	while(length == sizeof(data));
 }
 
 static void send_command_response_string(const char* response)
@@ -152,24 +263,30 @@ static void send_command_response_string(const char* response)
 
 static bool process_wolksensor_event(void)
 {
-	event_t event;
-	if(pop_event(&events_buffer, &event))
+	return state_machine_dispatch_event(states, &state_machine, &events_queue);
+}
+
+bool wolksensor_process(void)
+{
+	bool processing = process_wolksensor_event();
+	
+	// protocol drives itself during data exchange, connection kept open in between is maintained here
+	if((state_machine.current_state == STATE_IDLE) && (communication_protocol.process != NULL))
 	{
-		state_machine_process_event(states, &state_machine, &event);
-		return true;
+		processing |= communication_protocol.process();
 	}
 	
-	return false;
+	return processing;
 }
 
-bool wolksensor_process(void)
+bool wolksensor_events_pending(void)
 {
-	return process_wolksensor_event();
+	return !circular_buffer_empty(&events_buffer);
 }
 
 static void minute_expired_listener(void)
 {
-	add_event_type(&events_buffer, EVENT_ACQUIRE);
+	queue_event(EVENT_ACQUIRE);
 	
 	if (current_heartbeat)
 	{
@@ -179,7 +296,7 @@ static void minute_expired_listener(void)
 		if (heartbeat_timer == current_heartbeat)
 		{
 			LOG(1, "Heartbeat!");
-			add_event_type(&events_buffer, EVENT_HEARTBEAT);
+			queue_event(EVENT_HEARTBEAT);
 			heartbeat_timer = 0;
 		}
 	}
@@ -210,12 +327,12 @@ static void start_heartbeat(uint16_t period)
 
 static void exchange_data(void)
 {
-	add_event_type(&events_buffer, EVENT_HEARTBEAT);
+	queue_event(EVENT_HEARTBEAT);
 }
 
 static void reset(void)
 {
-	add_event_type(&events_buffer, EVENT_RESET);
+	queue_urgent_event(EVENT_RESET);
 }
 
 static void get_status(char* status, uint16_t status_length)
@@ -243,13 +360,13 @@ static void process_alarms(sensor_state_t* sensors_states, uint8_t sensors_count
 	{
 		LOG(1, "Sounding new alarms");
 		sound_alarm_retries = 0;
-		add_event_type(&events_buffer, EVENT_ALARM);
+		queue_event(EVENT_ALARM);
 	}
 	else if(sensors_have_unsounded_alarms() && (sound_alarm_retries < MAX_ALARM_RETRIES))
 	{
 		LOG(1, "Retry sounding old alarms");
 		sound_alarm_retries++;
-		add_event_type(&events_buffer, EVENT_ALARM);
+		queue_event(EVENT_ALARM);
 	}
 }
 
@@ -289,6 +406,18 @@ static void sensors_states_listener(sensor_state_t* sensors_states, uint8_t sens
 	}
 }
 
+static void sensors_acquisition_done_listener(void)
+{
+	queue_event(EVENT_SENSORS_ACQUIRED);
+}
+
+static void acquisition_timeout(void* argument)
+{
+	LOG(1, "Acquisition timeout");
+	
+	queue_event(EVENT_SENSORS_ACQUIRED);
+}
+
 static void battery_voltage_listener(uint16_t voltage)
 {
 	if((battery_voltage == 0) || (voltage < battery_voltage))
@@ -303,13 +432,13 @@ static void usb_state_change_listener(bool usb_state)
 	{
 		LOG(1, "USB connected");
 		
-		add_event_type(&events_buffer, EVENT_USB_CONNECTED);
+		queue_urgent_event(EVENT_USB_CONNECTED);
 	}
 	else
 	{
 		LOG(1, "USB disconnected");
 		
-		add_event_type(&events_buffer, EVENT_USB_DISCONNECTED);
+		queue_urgent_event(EVENT_USB_DISCONNECTED);
 	}
 }
 
@@ -323,6 +452,7 @@ void init_wolksensor(start_type_t start_type)
 	wolksensor_dependencies.add_command_data_received_listener(command_data_listener);
 	wolksensor_dependencies.add_battery_voltage_listener(battery_voltage_listener);
 	wolksensor_dependencies.add_sensors_states_listener(sensors_states_listener);
+	wolksensor_dependencies.add_sensors_acquisition_done_listener(sensors_acquisition_done_listener);
 	
 	// plug into commands
 	commands_dependencies.exchange_data  = exchange_data;
@@ -350,7 +480,7 @@ void init_wolksensor(start_type_t start_type)
 		
 	init_events_buffer();
 	init_commands_buffer();
-	init_command_string_buffer();
+	command_parser_init(&command_parser);
 	init_command_response_buffer();
 	
 	state_machine.id = -1;
@@ -358,6 +488,8 @@ void init_wolksensor(start_type_t start_type)
 	state_machine.parent = NULL;
 	state_machine.current_state = STATE_IDLE;
 	state_machine.handler = wolksensor_handler;
+	state_machine_trace_register(&state_machine, STATE_MACHINE_TRACE_WOLKSENSOR);
+	state_residency_register(STATE_MACHINE_TRACE_WOLKSENSOR, STATE_STOP_COMMUNICATION_MODULE + 1);
 	 
 	init_state(STATE_IDLE, NULL, &state_machine, start_type == BROWNOUT_RESET ? STATE_BROWNOUT : STATE_NORMAL, state_idle);
 		init_state(STATE_BROWNOUT, PSTR("BROWNOUT"), &states[STATE_IDLE], -1, state_brownout);
@@ -366,9 +498,18 @@ void init_wolksensor(start_type_t start_type)
 	init_state(STATE_DATA_EXCHANGE, NULL, &state_machine, STATE_SEND, state_data_exchange);
 		init_state(STATE_SEND, NULL, &states[STATE_DATA_EXCHANGE], -1, state_send);
 		init_state(STATE_RECEIVE, NULL, &states[STATE_DATA_EXCHANGE], -1, state_receive);
+		init_state(STATE_SEND_COMMAND_RESPONSES, NULL, &states[STATE_DATA_EXCHANGE], -1, state_send_command_responses);
 		init_state(STATE_DISCONNECT, NULL, &states[STATE_DATA_EXCHANGE], -1, state_disconnect);
 		init_state(STATE_STOP_COMMUNICATION_MODULE, NULL, &states[STATE_DATA_EXCHANGE], -1, state_stop_communication_module);
 	
+	// acquisitions and heartbeats wait for data exchange to finish
+	state_machine_defer_events(&states[STATE_DATA_EXCHANGE], STATE_MACHINE_EVENT_MASK(EVENT_ACQUIRE) | STATE_MACHINE_EVENT_MASK(EVENT_HEARTBEAT));
+	// sensors convert while MCU sleeps, everything but USB state waits for acquisition to finish
+	state_machine_defer_events(&states[STATE_ACQUISITION], STATE_MACHINE_EVENT_MASK(EVENT_ACQUIRE) | STATE_MACHINE_EVENT_MASK(EVENT_HEARTBEAT) | STATE_MACHINE_EVENT_MASK(EVENT_ALARM) | STATE_MACHINE_EVENT_MASK(EVENT_COMMAND_RECEIVED) | STATE_MACHINE_EVENT_MASK(EVENT_RESET));
+	
+	state_residency_enter(STATE_MACHINE_TRACE_WOLKSENSOR, states[STATE_IDLE].current_state);
+	reported_charge = state_residency_get_charge();
+	
 	chrono_init(start_type == POWER_ON);
 	
 	if(brownout)
@@ -384,7 +525,7 @@ void init_wolksensor(start_type_t start_type)
 	
 	transition(STATE_IDLE);
 	
-	add_event_type(&events_buffer, EVENT_ACQUIRE);
+	queue_event(EVENT_ACQUIRE);
 }
 
 static bool wolksensor_handler(state_machine_state_t* state, event_t* event)
@@ -406,26 +547,33 @@ static bool wolksensor_handler(state_machine_state_t* state, event_t* event)
 					
 			start_heartbeat(system_heartbeat);
 					
-			circular_buffer_clear(&command_string_buffer); // TODO Reconsider...
+			command_parser_init(&command_parser);
+			
+			if(communication_protocol.set_persistent_connection)
+			{
+				communication_protocol.set_persistent_connection(true);
+			}
 					
 			return true;
 		}
 		case EVENT_USB_DISCONNECTED:
 		{
 			LOG(1, "Usb OFF");
-
-			return true;
-		}
-		case EVENT_ACQUIRE:
-		{
-			add_event_type(&events_buffer, EVENT_ACQUIRE);
-		
-			return true;
-		}
-		case EVENT_HEARTBEAT:
-		{
-			add_event_type(&events_buffer, EVENT_HEARTBEAT);
 			
+			if(communication_protocol.set_persistent_connection)
+			{
+				bool connection_kept = (communication_protocol.keeps_connection != NULL) && communication_protocol.keeps_connection();
+				
+				communication_protocol.set_persistent_connection(false);
+				
+				if(connection_kept)
+				{
+					LOG(1, "Closing connection kept while on USB power");
+					
+					exchange_data();
+				}
+			}
+
 			return true;
 		}
 		case EVENT_LEAVING_STATE:
@@ -439,32 +587,77 @@ static bool wolksensor_handler(state_machine_state_t* state, event_t* event)
 	}
 }
 
-static void execute_commands(bool allow_write)
+/*
+* Commands buffers are also written from protocol and KNX code, see command_buffer_add.
+*/
+static bool pop_command(command_queue_t* queue, command_t* command)
+{
+	SYNCHRONIZED_BLOCK_START
+	
+	bool command_read = command_buffer_pop(&queue->commands_buffer, command);
+	
+	SYNCHRONIZED_BLOCK_END
+	
+	return command_read;
+}
+
+/*
+* Executes queued commands packing their responses into queue response buffer.
+* Returns false when response buffer has to be flushed before execution can continue.
+*/
+static bool execute_commands_into_response_buffer(command_queue_t* queue, bool allow_write)
 {
-	command_t command;
-	while(circular_buffer_pop(&commands_buffer, &command))
+	while(queue->command_executing || pop_command(queue, &queue->executing_command))
 	{
-		if(!allow_write && (command.has_argument || command.type == COMMAND_RELOAD))
+		queue->command_executing = true;
+		
+		if(circular_buffer_free_space(&queue->response_buffer) < COMMAND_RESPONSE_MAX_LENGTH)
 		{
-			circular_buffer_clear(&command_response_buffer);
-			append_busy(&command_response_buffer);
-			global_dependencies.send_response(command_response_buffer.storage, circular_buffer_size(&command_response_buffer));
+			return false;
 		}
-		else
+		
+		if(!allow_write && (queue->executing_command.has_argument || queue->executing_command.type == COMMAND_RELOAD))
 		{
-			command_execution_result_t command_execution_result;
-			do
-			{
-				circular_buffer_clear(&command_response_buffer);
-				command_execution_result = execute_command(&command, &command_response_buffer);
-				global_dependencies.send_response(command_response_buffer.storage, circular_buffer_size(&command_response_buffer));
-				
-			}
-			while (command_execution_result == COMMAND_EXECUTED_PARTIALLY);
+			append_busy(&queue->response_buffer);
+		}
+		else if(execute_command(&queue->executing_command, &queue->response_buffer) == COMMAND_EXECUTED_PARTIALLY)
+		{
+			return false;
 		}
+		
+		queue->command_executing = false;
+	}
+	
+	return true;
+}
+
+static bool command_responses_pending(command_queue_t* queue)
+{
+	return queue->command_executing || (circular_buffer_size(&queue->commands_buffer) > 0);
+}
+
+static void flush_command_responses(command_queue_t* queue)
+{
+	if(!circular_buffer_empty(&queue->response_buffer))
+	{
+		global_dependencies.send_response(queue->response_buffer.storage, circular_buffer_size(&queue->response_buffer));
+		circular_buffer_clear(&queue->response_buffer);
 	}
 }
 
+/*
+* Executes queued commands sending their responses over UART.
+*/
+static void execute_commands(command_queue_t* queue, bool allow_write)
+{
+	while(!execute_commands_into_response_buffer(queue, allow_write))
+	{
+		flush_command_responses(queue);
+	}
+	
+	flush_command_responses(queue);
+}
+
 static bool state_idle(state_machine_state_t* state, event_t* event)
 {
 	switch (event->type)
@@ -494,9 +687,9 @@ static bool state_idle(state_machine_state_t* state, event_t* event)
 		{
 			LOG(1, "Command received in idle state");
 			
-			extract_commands_from_string_buffer(&command_string_buffer, &commands_buffer);
+			parse_command_data();
 			
-			execute_commands(true);
+			execute_commands(&uart_commands, true);
 			
 			return true;
 		}
@@ -619,21 +812,33 @@ static bool state_acquisition(state_machine_state_t* state, event_t* event)
 			
 			if(wolksensor_dependencies.get_sensors_states(value_on_demand_sensors_ids, value_on_demand_sensors_count))
 			{
-				LOG(1, "Sensors values read");
+				LOG(1, "Sensors acquisition started");
+				
+				software_timer_start(&acquisition_timer, acquisition_timeout, NULL, ACQUISITION_TIMEOUT, 0);
 			}
 			else
 			{
 				LOG(1, "Unable to read sensors values");
+				
+				transition(STATE_IDLE);
 			}
 
+			return true;
+		}
+		case EVENT_SENSORS_ACQUIRED:
+		{
+			LOG(1, "Sensors values read");
+			
 			transition(STATE_IDLE);
-
+			
 			return true;
 		}
 		case EVENT_LEAVING_STATE:
 		{
 			LOG(1, "Leaving acquisition state"); 
 			
+			software_timer_stop(&acquisition_timer);
+			
 			return false;
 		}
 		default:
@@ -643,6 +848,19 @@ static bool state_acquisition(state_machine_state_t* state, event_t* event)
 	}
 }
 
+static uint16_t get_charge_since_report(void)
+{
+	state_residency_update();
+	
+	uint32_t charge = state_residency_get_charge();
+	
+	/* counters were cleared since previous report */
+	uint32_t charge_since_report = (charge >= reported_charge) ? charge - reported_charge : charge;
+	reported_charge = charge;
+	
+	return charge_since_report < 0xFFFF ? charge_since_report : 0xFFFF;
+}
+
 static void adjust_heartbeat_on_error(void)
 {
 	if(wolksensor_dependencies.get_usb_state())
@@ -696,9 +914,9 @@ static bool state_data_exchange(state_machine_state_t* state, event_t* event)
 		{
 			LOG(1, "Command received in data exchange state");
 			
-			extract_commands_from_string_buffer(&command_string_buffer, &commands_buffer);
+			parse_command_data();
 			
-			execute_commands(false);
+			execute_commands(&uart_commands, false);
 			
 			return true;
 		}
@@ -706,11 +924,11 @@ static bool state_data_exchange(state_machine_state_t* state, event_t* event)
 		{
 			if(communication_protocol_process_handle())
 			{
-				add_event_type(&events_buffer, EVENT_COMMUNICATION_PROTOCOL_PROCESS);
+				queue_communication_protocol_event(EVENT_COMMUNICATION_PROTOCOL_PROCESS);
 			}
 			else
 			{
-				add_event_type(&events_buffer, EVENT_COMMUNICATION_PROTOCOL_DONE);
+				queue_communication_protocol_event(EVENT_COMMUNICATION_PROTOCOL_DONE);
 			}
 			
 			return true;
@@ -723,6 +941,7 @@ static bool state_data_exchange(state_machine_state_t* state, event_t* event)
 			wolksensor_dependencies.disable_battery_voltage_monitor();
 						
 			communication_and_battery_data.battery_min_voltage = battery_voltage;
+			communication_and_battery_data.charge = get_charge_since_report();
 			add_communication_and_battery_data(&communication_and_battery_data);
 			LOG_PRINT(1, PSTR("\n\rBattery Voltage: %d\n\r"), battery_voltage);
 						
@@ -782,7 +1001,7 @@ static bool state_send(state_machine_state_t* state, event_t* event)
 			sent_sensor_readings = 0;
 			
 			communication_protocol_process_handle = communication_protocol.send_sensor_readings_and_system_data(&sensor_readings_buffer, &system_buffer, &sent_sensor_readings, &sent_system_items);
-			add_event_type(&events_buffer, EVENT_COMMUNICATION_PROTOCOL_PROCESS);
+			queue_communication_protocol_event(EVENT_COMMUNICATION_PROTOCOL_PROCESS);
 			
 			return true;
 		}
@@ -831,8 +1050,8 @@ static bool state_receive(state_machine_state_t* state, event_t* event)
 		{
 			LOG(1,"Entering wolksensor receive state");
 			
-			communication_protocol_process_handle = communication_protocol.receive_commands(&commands_buffer);
-			add_event_type(&events_buffer, EVENT_COMMUNICATION_PROTOCOL_PROCESS);
+			communication_protocol_process_handle = communication_protocol.receive_commands(&server_commands.commands_buffer);
+			queue_communication_protocol_event(EVENT_COMMUNICATION_PROTOCOL_PROCESS);
 			
 			return true;
 		}
@@ -847,16 +1066,23 @@ static bool state_receive(state_machine_state_t* state, event_t* event)
 			{
 				LOG(1,"Receiving succeded");
 				
-				if(circular_buffer_size(&commands_buffer) > 0)
+				if(circular_buffer_size(&server_commands.commands_buffer) > 0)
 				{
 					LOG(1, "Commands received from server");
 					
 					remove_system_data(sent_system_items);
 					remove_sensor_readings(sent_sensor_readings);
 					
-					execute_commands(true);
-					
-					transition(sensor_readings_count() > 0 ? STATE_SEND : STATE_DISCONNECT);
+					if(communication_protocol.send_command_responses != NULL)
+					{
+						transition(STATE_SEND_COMMAND_RESPONSES);
+					}
+					else
+					{
+						execute_commands(&server_commands, true);
+						
+						transition(sensor_readings_count() > 0 ? STATE_SEND : STATE_DISCONNECT);
+					}
 				}
 				else
 				{
@@ -887,6 +1113,71 @@ static bool state_receive(state_machine_state_t* state, event_t* event)
 	}
 }
 
+static void send_command_responses(void)
+{
+	circular_buffer_clear(&server_commands.response_buffer);
+	execute_commands_into_response_buffer(&server_commands, true);
+	
+	communication_protocol_process_handle = communication_protocol.send_command_responses(&server_commands.response_buffer);
+	queue_communication_protocol_event(EVENT_COMMUNICATION_PROTOCOL_PROCESS);
+}
+
+static bool state_send_command_responses(state_machine_state_t* state, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG(1, "Entering wolksensor send command responses state");
+			
+			send_command_responses();
+			
+			return true;
+		}
+		case EVENT_COMMUNICATION_PROTOCOL_DONE:
+		{
+			LOG(1, "Sending command responses finished");
+			
+			communication_protocol_type_data_t send_result = communication_protocol.get_communication_result();
+			append_communication_protocol_type_data(&send_result, &communication_and_battery_data.communication_protocol_type_data);
+			
+			if(is_communication_protocol_success(&send_result))
+			{
+				if(command_responses_pending(&server_commands))
+				{
+					LOG(1, "Command response buffer was full, sending rest of command responses");
+					
+					send_command_responses();
+				}
+				else
+				{
+					transition(sensor_readings_count() > 0 ? STATE_SEND : STATE_DISCONNECT);
+				}
+			}
+			else
+			{
+				LOG(1, "Sending command responses failed");
+				
+				transition(STATE_STOP_COMMUNICATION_MODULE);
+			}
+			
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG(1, "Leaving wolksensor send command responses state");
+			
+			circular_buffer_clear(&server_commands.response_buffer);
+			
+			return false;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
 static bool state_disconnect(state_machine_state_t* state, event_t* event)
 {	
 	switch (event->type)
@@ -896,7 +1187,7 @@ static bool state_disconnect(state_machine_state_t* state, event_t* event)
 			LOG(1, "Entering wolksensor disconnect communication protocol state");
 			
 			communication_protocol_process_handle = communication_protocol.disconnect();
-			add_event_type(&events_buffer, EVENT_COMMUNICATION_PROTOCOL_PROCESS);
+			queue_communication_protocol_event(EVENT_COMMUNICATION_PROTOCOL_PROCESS);
 			
 			return true;
 		}
@@ -916,7 +1207,16 @@ static bool state_disconnect(state_machine_state_t* state, event_t* event)
 				LOG(1, "Unable to disconnect communication protocol.");
 			}
 			
-			transition(STATE_STOP_COMMUNICATION_MODULE);
+			if(communication_protocol.keeps_connection != NULL && communication_protocol.keeps_connection())
+			{
+				LOG(1, "Communication protocol keeps connection, communication module stays on");
+				
+				transition(STATE_IDLE);
+			}
+			else
+			{
+				transition(STATE_STOP_COMMUNICATION_MODULE);
+			}
 			
 			return true;
 		}
@@ -944,7 +1244,7 @@ static bool state_stop_communication_module(state_machine_state_t* state, event_
 			LOG(1, "Entering wolksensor stop communication module state");
 			
 			handle = communication_module.stop();
-			add_event_type(&events_buffer, EVENT_COMMUNICATION_PROTOCOL_PROCESS);
+			queue_communication_protocol_event(EVENT_COMMUNICATION_PROTOCOL_PROCESS);
 			
 			return true;
 		}
@@ -952,11 +1252,11 @@ static bool state_stop_communication_module(state_machine_state_t* state, event_
 		{
 			if(handle())
 			{
-				add_event_type(&events_buffer, EVENT_COMMUNICATION_PROTOCOL_PROCESS);
+				queue_communication_protocol_event(EVENT_COMMUNICATION_PROTOCOL_PROCESS);
 			}
 			else
 			{
-				add_event_type(&events_buffer, EVENT_COMMUNICATION_PROTOCOL_DONE);
+				queue_communication_protocol_event(EVENT_COMMUNICATION_PROTOCOL_DONE);
 			}
 			
 			return true;
@@ -20,6 +20,9 @@ start_type_t;
 void init_wolksensor(start_type_t start_type);
 bool wolksensor_process(void);
 
+/* true if events are queued, events may be queued from interrupts so call it with interrupts disabled before sleeping */
+bool wolksensor_events_pending(void);
+
 #ifdef __cplusplus
 }
 #endif
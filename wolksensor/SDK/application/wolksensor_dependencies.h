@@ -21,6 +21,7 @@ typedef struct
 	void (*add_command_data_received_listener)(void (*listener)(char *data, uint16_t length));
 	void (*add_battery_voltage_listener)(void (*listener)(uint16_t voltage));
 	void (*add_sensors_states_listener)(void (*listener)(sensor_state_t* sensors_states, uint8_t sensors_count));
+	void (*add_sensors_acquisition_done_listener)(void (*listener)(void));
 }
 wolksensor_dependencies_t;
 
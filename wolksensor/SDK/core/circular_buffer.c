@@ -15,6 +15,39 @@ static void increase_pointer(uint16_t* pointer, uint16_t storage_size)
 	}
 }
 
+#ifdef CIRCULAR_BUFFER_STATISTICS
+
+typedef struct
+{
+	circular_buffer_t* buffer;
+	const char* name;
+}
+registered_buffer_t;
+
+static registered_buffer_t registered_buffers[CIRCULAR_BUFFER_MAX_REGISTERED];
+static uint8_t registered_buffers_count = 0;
+
+static void count_elements(uint16_t* counter, uint16_t count)
+{
+	*counter = (*counter > 0xFFFF - count) ? 0xFFFF : *counter + count;
+}
+
+static void update_peak_size(circular_buffer_t* buffer)
+{
+	uint16_t size = circular_buffer_size(buffer);
+	if(size > buffer->peak_size)
+	{
+		buffer->peak_size = size;
+	}
+}
+
+#else
+
+#define count_elements(counter, count)
+#define update_peak_size(buffer)
+
+#endif
+
 static void decrease_pointer(uint16_t* pointer, uint16_t storage_size)
 {
 	if((*pointer) == 0)
@@ -36,6 +69,9 @@ void circular_buffer_init(circular_buffer_t* circular_buffer, void* storage, uin
 	if(clear)
 	{
 		circular_buffer_clear(circular_buffer);
+#ifdef CIRCULAR_BUFFER_STATISTICS
+		circular_buffer_clear_statistics(circular_buffer);
+#endif
 	}	
 }
 
@@ -59,9 +95,11 @@ bool circular_buffer_add(circular_buffer_t* buffer, void* element)
 		{
 			/* if buffer is full the oldest element will be discarded, new one will come to its place */
 			increase_pointer(&buffer->head, buffer->storage_size);
+			count_elements(&buffer->overwritten, 1);
 		}
 		else
 		{
+			count_elements(&buffer->rejected, 1);
 			return false;
 		}
 	}
@@ -74,6 +112,42 @@ bool circular_buffer_add(circular_buffer_t* buffer, void* element)
 	buffer->empty = false;
 	/* but it can happen that it is full */
 	buffer->full = (buffer->tail == buffer->head);
+	
+	update_peak_size(buffer);
+
+	return true;
+}
+
+bool circular_buffer_add_to_beginning(circular_buffer_t* buffer, void* element)
+{
+	if(!buffer || !element)
+	{
+		return false;
+	}
+
+	if(buffer->full)
+	{
+		if(buffer->wrap)
+		{
+			/* if buffer is full the newest element will be discarded to make room at the beginning */
+			decrease_pointer(&buffer->tail, buffer->storage_size);
+			count_elements(&buffer->overwritten, 1);
+		}
+		else
+		{
+			count_elements(&buffer->rejected, 1);
+			return false;
+		}
+	}
+	
+	decrease_pointer(&buffer->head, buffer->storage_size);
+	
+	copy_bytes(buffer->storage, buffer->head, element, 0, buffer->element_size);
+
+	buffer->empty = false;
+	buffer->full = (buffer->tail == buffer->head);
+	
+	update_peak_size(buffer);
 
 	return true;
 }
@@ -91,9 +165,41 @@ bool circular_buffer_add_array(circular_buffer_t* buffer, const void* elements_a
 	uint16_t free_space = circular_buffer_free_space(buffer);
 	if(!buffer->wrap && (length > free_space))
 	{
+		count_elements(&buffer->rejected, length);
 		return false;
 	}
 
+	if(!buffer->wrap)
+	{
+		if(!length)
+		{
+			return true;
+		}
+		
+		/* there is enough space, so elements are copied in at most two parts, up to end of storage and from its beginning */
+		uint16_t first_part_length = buffer->storage_size - buffer->tail;
+		if(first_part_length > length)
+		{
+			first_part_length = length;
+		}
+		
+		memcpy((unsigned char*)buffer->storage + buffer->tail * buffer->element_size, elements_array, first_part_length * buffer->element_size);
+		memcpy(buffer->storage, (const unsigned char*)elements_array + first_part_length * buffer->element_size, (length - first_part_length) * buffer->element_size);
+		
+		buffer->tail += length;
+		if(buffer->tail >= buffer->storage_size)
+		{
+			buffer->tail -= buffer->storage_size;
+		}
+		
+		buffer->empty = false;
+		buffer->full = (buffer->tail == buffer->head);
+		
+		update_peak_size(buffer);
+		
+		return true;
+	}
+	
 	uint16_t i = 0;
 	for(i = 0; i < length; i++)
 	{
@@ -118,6 +224,8 @@ uint16_t circular_buffer_add_as_many_as_possible(circular_buffer_t* buffer, cons
 		to_add = length;
 	}
 	
+	count_elements(&buffer->rejected, length - to_add);
+	
 	uint16_t i = 0;
 	for(i = 0; i < to_add; i++)
 	{
@@ -301,3 +409,54 @@ void circular_buffer_clear(circular_buffer_t* buffer)
 		memset(buffer->storage, 0, buffer->storage_size * buffer->element_size);
 	}
 }
+
+#ifdef CIRCULAR_BUFFER_STATISTICS
+
+void circular_buffer_register(circular_buffer_t* buffer, const char* name)
+{
+	uint8_t i;
+	for(i = 0; i < registered_buffers_count; i++)
+	{
+		if(registered_buffers[i].buffer == buffer)
+		{
+			return;
+		}
+	}
+	
+	if(registered_buffers_count == CIRCULAR_BUFFER_MAX_REGISTERED)
+	{
+		LOG(1, "Buffer not registered");
+		return;
+	}
+	
+	registered_buffers[registered_buffers_count].buffer = buffer;
+	registered_buffers[registered_buffers_count].name = name;
+	registered_buffers_count++;
+}
+
+bool circular_buffer_get_registered(uint8_t index, circular_buffer_t** buffer, const char** name)
+{
+	if(index >= registered_buffers_count)
+	{
+		return false;
+	}
+	
+	*buffer = registered_buffers[index].buffer;
+	*name = registered_buffers[index].name;
+	
+	return true;
+}
+
+uint8_t circular_buffer_registered_count(void)
+{
+	return registered_buffers_count;
+}
+
+void circular_buffer_clear_statistics(circular_buffer_t* buffer)
+{
+	buffer->peak_size = circular_buffer_size(buffer);
+	buffer->overwritten = 0;
+	buffer->rejected = 0;
+}
+
+#endif
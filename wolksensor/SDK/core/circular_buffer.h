@@ -25,9 +25,16 @@ typedef struct
 	bool empty; /* set when buffer is empty. Initially should be set to true. */
 	bool full; /* set when buffer is full. Initially should be set to false. */
 	bool wrap; /* should buffer overwrite oldest values if there is no more free space to store new values */
+#ifdef CIRCULAR_BUFFER_STATISTICS
+	uint16_t peak_size; /* highest number of elements held since statistics were cleared */
+	uint16_t overwritten; /* elements discarded to make room in wrapping buffer */
+	uint16_t rejected; /* elements not added because non wrapping buffer was full */
+#endif
 } 
 circular_buffer_t;
 
+#define CIRCULAR_BUFFER_MAX_REGISTERED 20
+
 void circular_buffer_init(circular_buffer_t* circular_buffer, void* storage, uint16_t storage_size, uint16_t element_size, bool wrap, bool clear);
 
 /**
@@ -35,6 +42,11 @@ void circular_buffer_init(circular_buffer_t* circular_buffer, void* storage, uin
 */
 bool circular_buffer_add(circular_buffer_t* buffer, void* element);
 
+/**
+ * Adds element in front of all other elements so it is popped first. If buffer is full it will overwrite the newest element.
+*/
+bool circular_buffer_add_to_beginning(circular_buffer_t* buffer, void* element);
+
 /**
  * Adds array of elements to buffer. If buffer is full it will overwrite the oldest element.
 */
@@ -91,6 +103,32 @@ uint16_t circular_buffer_free_space(circular_buffer_t* buffer);
 */
 void circular_buffer_clear(circular_buffer_t* buffer);
 
+#ifdef CIRCULAR_BUFFER_STATISTICS
+
+/**
+ * Makes buffer statistics available under name (string in PROGMEM), see BUFFERS command.
+*/
+void circular_buffer_register(circular_buffer_t* buffer, const char* name);
+
+/**
+ * Returns registered buffer and its name, false if there is no buffer with index.
+*/
+bool circular_buffer_get_registered(uint8_t index, circular_buffer_t** buffer, const char** name);
+
+uint8_t circular_buffer_registered_count(void);
+
+/**
+ * Restarts peak size from current size and zeroes counters.
+*/
+void circular_buffer_clear_statistics(circular_buffer_t* buffer);
+
+#else
+
+#define circular_buffer_register(buffer, name)
+#define circular_buffer_registered_count() 0
+
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,982 @@
+#include "coap_communication_protocol.h"
+#include "coap_communication_protocol_dependencies.h"
+#include "platform_specific.h"
+#include "event_buffer.h"
+#include "circular_buffer.h"
+#include "logger.h"
+#include "config.h"
+#include "chrono.h"
+#include "wifi_communication_module.h"
+#include "commands_dependencies.h"
+#include "state_machine_table.h"
+#include "state_machine_trace.h"
+#include "state_residency.h"
+#include "protocol.h"
+#include "command_parser.h"
+
+#include <stdlib.h>
+
+#define COAP_COMMUNICATION_PROTOCOL_EVENT_BUFFER_SIZE 10
+
+#define COAP_VERSION 1
+#define COAP_TOKEN_LENGTH 2
+
+#define COAP_TYPE_CONFIRMABLE 0
+#define COAP_TYPE_NON_CONFIRMABLE 1
+#define COAP_TYPE_ACKNOWLEDGEMENT 2
+#define COAP_TYPE_RESET 3
+
+#define COAP_CODE_EMPTY 0x00
+#define COAP_CODE_POST 0x02
+#define COAP_CODE_CONTINUE 0x5F // 2.31
+#define COAP_CODE_CLASS(code) ((code) >> 5)
+
+#define COAP_OPTION_URI_PATH 11
+#define COAP_OPTION_BLOCK1 27
+
+#define COAP_PAYLOAD_MARKER 0xFF
+
+// payload larger than one block is sent block-wise, block size is 16 << COAP_BLOCK_SZX
+#define COAP_BLOCK_SZX 4
+#define COAP_BLOCK_SIZE (16 << COAP_BLOCK_SZX)
+
+// request is retransmitted when response does not arrive within retransmission timeout, which starts
+// at random value between ACK_TIMEOUT and ACK_TIMEOUT * ACK_RANDOM_FACTOR and doubles each time (RFC 7252 4.8)
+#define COAP_ACK_TIMEOUT 2000 // ms
+#define COAP_ACK_RANDOM_FACTOR_PERCENT 150
+#define COAP_MAX_RETRANSMIT 4
+
+// header, token, uri path sensors/<device_id>, block1 and payload marker
+#define COAP_HEADER_MAX_SIZE (4 + COAP_TOKEN_LENGTH + 8 + (MAX_DEVICE_ID_SIZE + 2) + 4 + 1)
+#define COAP_BUFFER_SIZE (COAP_HEADER_MAX_SIZE + COAP_BLOCK_SIZE)
+
+// payload is encrypted in place, encryption pads it to 16 bytes
+#define COAP_PAYLOAD_BUFFER_SIZE (MAX_BUFFER_SIZE + 16)
+
+typedef enum
+{
+	STATE_COAP_IDLE = 0,
+	STATE_COAP_EXCHANGE,
+		STATE_COAP_SEND_REQUEST,
+		STATE_COAP_RECEIVE_RESPONSE,
+		STATE_COAP_SEND_ACK
+}
+coap_communication_protocol_states_t;
+
+typedef enum
+{
+	EVENT_COAP_POST = 0,
+	EVENT_COAP_RECEIVE,
+	EVENT_COAP_DISCONNECT,
+	EVENT_COMMUNICATION_MODULE_PROCESS,
+	EVENT_COMMUNICATION_MODULE_DONE
+}
+coap_communication_protocol_events_t;
+
+typedef struct
+{
+	uint8_t type;
+	uint8_t code;
+	uint16_t message_id;
+	uint8_t token[COAP_TOKEN_LENGTH];
+	uint8_t token_length;
+	uint8_t* payload;
+	uint16_t payload_size;
+	bool has_block1;
+	uint32_t block1;
+}
+coap_message_t;
+
+static state_machine_table_t coap_communication_protocol_state_machine;
+
+static circular_buffer_t coap_communication_protocol_event_buffer;
+static event_t coap_communication_protocol_event_buffer_storage[COAP_COMMUNICATION_PROTOCOL_EVENT_BUFFER_SIZE];
+
+static uint8_t coap_buffer[COAP_BUFFER_SIZE];
+static uint16_t received_data_size = 0;
+
+// request payload, after the exchange it holds commands piggybacked on the response
+static uint8_t coap_payload_buffer[COAP_PAYLOAD_BUFFER_SIZE];
+static uint16_t coap_payload_size = 0;
+static uint16_t received_commands_size = 0;
+
+static coap_message_t coap_message;
+
+static uint16_t message_id = 0;
+static uint8_t token[COAP_TOKEN_LENGTH];
+static uint16_t block_number = 0;
+static bool sending_next_block = false;
+static uint8_t retransmissions = 0;
+static uint16_t retransmission_timeout = COAP_ACK_TIMEOUT; // ms
+
+static uint16_t serialized_sensor_readings = 0;
+static uint16_t serialized_system_items = 0;
+
+static circular_buffer_t* sending_sensor_readings_buffer = NULL;
+static uint16_t* sensor_readings_sent = NULL;
+
+static circular_buffer_t* sending_system_buffer = NULL;
+static uint16_t* system_items_sent = NULL;
+
+static actuator_t* sending_actuator = NULL;
+static actuator_state_t* sending_actuator_state = NULL;
+
+static circular_buffer_t* sending_command_responses_buffer = NULL;
+static command_parser_t command_parser;
+
+static communication_module_process_handle_t communication_module_process_handle = NULL;
+
+static communication_protocol_type_data_t communication_protocol_type_data;
+
+coap_communication_protocol_dependencies_t coap_communication_protocol_dependencies;
+
+static bool coap_communication_protocol_handler(int8_t state_id, event_t* event);
+static bool state_coap_idle(int8_t state_id, event_t* event);
+static bool state_coap_exchange(int8_t state_id, event_t* event);
+	static bool state_coap_send_request(int8_t state_id, event_t* event);
+	static bool state_coap_receive_response(int8_t state_id, event_t* event);
+	static bool state_coap_send_ack(int8_t state_id, event_t* event);
+
+/* indexed by coap_communication_protocol_states_t */
+static const state_machine_table_state_t coap_communication_protocol_states[] PROGMEM =
+{
+	{ STATE_MACHINE_TABLE_NO_STATE, STATE_MACHINE_TABLE_NO_STATE, STATE_MACHINE_TABLE_STATE(STATE_COAP_IDLE), NULL, state_coap_idle },
+	{ STATE_MACHINE_TABLE_NO_STATE, STATE_COAP_SEND_REQUEST, STATE_MACHINE_TABLE_STATE(STATE_COAP_EXCHANGE), NULL, state_coap_exchange },
+		{ STATE_COAP_EXCHANGE, STATE_MACHINE_TABLE_NO_STATE, STATE_MACHINE_TABLE_STATE(STATE_COAP_EXCHANGE) | STATE_MACHINE_TABLE_STATE(STATE_COAP_SEND_REQUEST), NULL, state_coap_send_request },
+		{ STATE_COAP_EXCHANGE, STATE_MACHINE_TABLE_NO_STATE, STATE_MACHINE_TABLE_STATE(STATE_COAP_EXCHANGE) | STATE_MACHINE_TABLE_STATE(STATE_COAP_RECEIVE_RESPONSE), NULL, state_coap_receive_response },
+		{ STATE_COAP_EXCHANGE, STATE_MACHINE_TABLE_NO_STATE, STATE_MACHINE_TABLE_STATE(STATE_COAP_EXCHANGE) | STATE_MACHINE_TABLE_STATE(STATE_COAP_SEND_ACK), NULL, state_coap_send_ack }
+};
+
+static void init_coap_communication_protocol_event_buffer(void)
+{
+	circular_buffer_init(&coap_communication_protocol_event_buffer, coap_communication_protocol_event_buffer_storage, COAP_COMMUNICATION_PROTOCOL_EVENT_BUFFER_SIZE, sizeof(event_t), true, true);
+	circular_buffer_register(&coap_communication_protocol_event_buffer, PSTR("COAP_EVENTS"));
+}
+
+static void add_coap_communication_protocol_event_type(uint8_t event_type)
+{
+	add_event_type(&coap_communication_protocol_event_buffer, event_type);
+}
+
+static bool coap_communication_protocol_process(void)
+{
+	event_t event;
+	if(pop_event(&coap_communication_protocol_event_buffer, &event))
+	{
+		state_machine_table_process_event(&coap_communication_protocol_state_machine, &event);
+		return true;
+	}
+	
+	return false;
+}
+
+static void transition(coap_communication_protocol_states_t new_state_id)
+{
+	state_machine_table_transition(&coap_communication_protocol_state_machine, new_state_id);
+}
+
+void coap_protocol_init(void)
+{
+	LOG(1, "CoAP communication protocol init");
+	
+	// buffers
+	init_coap_communication_protocol_event_buffer();
+	
+	// parameters
+	load_device_id();
+	load_device_preshared_key();
+	load_location_status();
+	
+	// message ids should not repeat after reset
+	message_id = (uint16_t)rtc_get_ts();
+	srand(message_id);
+	
+	/* init state machine */
+	state_machine_table_init(&coap_communication_protocol_state_machine, coap_communication_protocol_states, coap_communication_protocol_handler);
+	state_machine_trace_register(&coap_communication_protocol_state_machine, STATE_MACHINE_TRACE_COAP_COMMUNICATION_PROTOCOL);
+	state_residency_register(STATE_MACHINE_TRACE_COAP_COMMUNICATION_PROTOCOL, STATE_COAP_SEND_ACK + 1);
+	
+	transition(STATE_COAP_IDLE);
+}
+
+static void clear_communication_protocol_data(void)
+{
+	memset(&communication_protocol_type_data, 0, sizeof(communication_protocol_type_data_t));
+	communication_protocol_type_data.type = COMMUNICATION_PROTOCOL_COAP;
+}
+
+static void set_coap_communication_protocol_error(coap_communication_protocol_error_type_t error_type, uint8_t state)
+{
+	communication_protocol_type_data.data.coap_communication_protocol_data.error = error_type | state;
+}
+
+communication_protocol_process_handle_t coap_protocol_send_sensor_readings_and_system_data(circular_buffer_t* sensor_readings_buffer, circular_buffer_t* system_buffer, uint16_t* sent_sensor_readings, uint16_t* sent_system_items)
+{
+	LOG(1, "CoAP send sensor readings and system data");
+	
+	sending_sensor_readings_buffer = sensor_readings_buffer;
+	sensor_readings_sent = sent_sensor_readings;
+	
+	sending_system_buffer = system_buffer;
+	system_items_sent = sent_system_items;
+	
+	sending_actuator_state = NULL;
+	sending_command_responses_buffer = NULL;
+	
+	clear_communication_protocol_data();
+	
+	add_coap_communication_protocol_event_type(EVENT_COAP_POST);
+	
+	return coap_communication_protocol_process;
+}
+
+communication_protocol_process_handle_t coap_protocol_send_actuator_state(actuator_t* actuator, actuator_state_t* actuator_state)
+{
+	LOG(1, "CoAP send actuator state");
+	
+	sending_actuator = actuator;
+	sending_actuator_state = actuator_state;
+	
+	sending_sensor_readings_buffer = NULL;
+	sensor_readings_sent = NULL;
+	sending_system_buffer = NULL;
+	system_items_sent = NULL;
+	sending_command_responses_buffer = NULL;
+	
+	clear_communication_protocol_data();
+	
+	add_coap_communication_protocol_event_type(EVENT_COAP_POST);
+	
+	return coap_communication_protocol_process;
+}
+
+communication_protocol_process_handle_t coap_protocol_send_command_responses(circular_buffer_t* command_response_buffer)
+{
+	LOG(1, "CoAP send command responses");
+	
+	sending_command_responses_buffer = command_response_buffer;
+	
+	sending_actuator = NULL;
+	sending_actuator_state = NULL;
+	sending_sensor_readings_buffer = NULL;
+	sensor_readings_sent = NULL;
+	sending_system_buffer = NULL;
+	system_items_sent = NULL;
+	
+	clear_communication_protocol_data();
+	
+	add_coap_communication_protocol_event_type(EVENT_COAP_POST);
+	
+	return coap_communication_protocol_process;
+}
+
+/*
+* Commands arrive piggybacked on the response to the last request, socket is not read.
+*/
+communication_protocol_process_handle_t coap_protocol_receive_commands(circular_buffer_t* commands_buffer)
+{
+	LOG(1, "CoAP receive commands");
+	
+	clear_communication_protocol_data();
+	
+	if(received_commands_size > 0)
+	{
+		LOG_PRINT(1, PSTR("Received data: %.*s length %u\r\n"), received_commands_size, coap_payload_buffer, received_commands_size);
+		
+		command_parser_init(&command_parser);
+		command_parser_feed_array(&command_parser, (char*)coap_payload_buffer, received_commands_size, commands_buffer);
+		
+		received_commands_size = 0;
+	}
+	
+	add_coap_communication_protocol_event_type(EVENT_COAP_RECEIVE);
+	
+	return coap_communication_protocol_process;
+}
+
+communication_protocol_process_handle_t coap_protocol_disconnect(void)
+{
+	LOG(1, "CoAP disconnect");
+	
+	clear_communication_protocol_data();
+	
+	add_coap_communication_protocol_event_type(EVENT_COAP_DISCONNECT);
+	
+	return coap_communication_protocol_process;
+}
+
+communication_protocol_type_data_t get_coap_communication_result(void)
+{
+	return communication_protocol_type_data;
+}
+
+static bool coap_parameters_set(void)
+{
+	return (*device_id != 0) && (*device_preshared_key != 0) && (*server_ip != 0) && (server_port != 0);
+}
+
+/*
+* Serializes pending data as encrypted request payload.
+*/
+static void serialize_payload(void)
+{
+	serialized_sensor_readings = 0;
+	serialized_system_items = 0;
+	
+	circular_buffer_t message_buffer;
+	circular_buffer_init(&message_buffer, coap_payload_buffer, MAX_BUFFER_SIZE, sizeof(char), false, true);
+	
+	if(sending_actuator != NULL && sending_actuator_state != NULL)
+	{
+		append_actuator_state(sending_actuator, sending_actuator_state, &message_buffer);
+		
+		LOG_PRINT(1, PSTR("Packed status message: %s\r\n"), message_buffer.storage);
+	}
+	else if(sending_command_responses_buffer != NULL)
+	{
+		circular_buffer_add_array(&message_buffer, sending_command_responses_buffer->storage, circular_buffer_size(sending_command_responses_buffer));
+		
+		LOG_PRINT(1, PSTR("Packed command responses message: %s\r\n"), message_buffer.storage);
+	}
+	else
+	{
+		append_rtc(rtc_get_ts(), &message_buffer);
+		
+		if(location && (commands_dependencies.get_surroundig_wifi_networks != NULL))
+		{
+			wifi_network_t networks[10];
+			uint8_t networks_number = commands_dependencies.get_surroundig_wifi_networks(networks, 10);
+			
+			append_detected_wifi_networks(networks, networks_number, &message_buffer);
+		}
+		
+		if(sending_system_buffer != NULL)
+		{
+			serialized_system_items = append_system_info(sending_system_buffer, 0, &message_buffer, false);
+		}
+		
+		if(sending_sensor_readings_buffer != NULL)
+		{
+			serialized_sensor_readings = append_sensor_readings(sending_sensor_readings_buffer, 0, &message_buffer, false);
+		}
+		
+		LOG_PRINT(1, PSTR("Packed readings message: %s\r\n"), message_buffer.storage);
+	}
+	
+	// there is no transport security, payload is always encrypted
+	coap_payload_size = coap_communication_protocol_dependencies.encrypt(coap_payload_buffer, circular_buffer_size(&message_buffer), device_preshared_key);
+}
+
+static void report_posted(bool success)
+{
+	if(sensor_readings_sent != NULL) *sensor_readings_sent = success ? serialized_sensor_readings : 0;
+	if(system_items_sent != NULL) *system_items_sent = success ? serialized_system_items : 0;
+}
+
+static uint16_t encode_option_nibble(uint16_t value, uint8_t* extended, uint8_t* extended_size)
+{
+	if(value < 13)
+	{
+		*extended_size = 0;
+		return value;
+	}
+	
+	if(value < 269)
+	{
+		extended[0] = value - 13;
+		*extended_size = 1;
+		return 13;
+	}
+	
+	extended[0] = (value - 269) >> 8;
+	extended[1] = (value - 269) & 0x00FF;
+	*extended_size = 2;
+	return 14;
+}
+
+/*
+* Encodes option following the one with previous_number.
+* Returns size of the option.
+*/
+static uint16_t encode_option(uint8_t* buffer, uint16_t previous_number, uint16_t number, const uint8_t* value, uint16_t length)
+{
+	uint8_t delta_extended[2];
+	uint8_t delta_extended_size;
+	uint8_t length_extended[2];
+	uint8_t length_extended_size;
+	
+	uint16_t delta_nibble = encode_option_nibble(number - previous_number, delta_extended, &delta_extended_size);
+	uint16_t length_nibble = encode_option_nibble(length, length_extended, &length_extended_size);
+	
+	uint16_t size = 0;
+	buffer[size++] = (delta_nibble << 4) | length_nibble;
+	
+	memcpy(buffer + size, delta_extended, delta_extended_size);
+	size += delta_extended_size;
+	
+	memcpy(buffer + size, length_extended, length_extended_size);
+	size += length_extended_size;
+	
+	memcpy(buffer + size, value, length);
+	size += length;
+	
+	return size;
+}
+
+static void start_request(void)
+{
+	message_id++;
+	retransmissions = 0;
+	retransmission_timeout = COAP_ACK_TIMEOUT + rand() % ((uint32_t)COAP_ACK_TIMEOUT * (COAP_ACK_RANDOM_FACTOR_PERCENT - 100) / 100 + 1);
+}
+
+static bool is_last_block(void)
+{
+	return (uint32_t)(block_number + 1) * COAP_BLOCK_SIZE >= coap_payload_size;
+}
+
+/*
+* Serializes POST of the current block to sensors/<device_id>.
+* Returns size of the request.
+*/
+static uint16_t serialize_request(uint8_t* buffer)
+{
+	uint16_t size = 0;
+	
+	buffer[size++] = (COAP_VERSION << 6) | (COAP_TYPE_CONFIRMABLE << 4) | COAP_TOKEN_LENGTH;
+	buffer[size++] = COAP_CODE_POST;
+	buffer[size++] = message_id >> 8;
+	buffer[size++] = message_id & 0x00FF;
+	
+	memcpy(buffer + size, token, COAP_TOKEN_LENGTH);
+	size += COAP_TOKEN_LENGTH;
+	
+	size += encode_option(buffer + size, 0, COAP_OPTION_URI_PATH, (const uint8_t*)"sensors", 7);
+	size += encode_option(buffer + size, COAP_OPTION_URI_PATH, COAP_OPTION_URI_PATH, (const uint8_t*)device_id, strlen(device_id));
+	
+	uint16_t block_offset = 0;
+	uint16_t block_size = coap_payload_size;
+	
+	if(coap_payload_size > COAP_BLOCK_SIZE)
+	{
+		uint32_t block_option = ((uint32_t)block_number << 4) | (is_last_block() ? 0 : 0x08) | COAP_BLOCK_SZX;
+		
+		uint8_t block_value[3];
+		uint8_t block_value_size = 0;
+		if(block_option > 0xFFFF) block_value[block_value_size++] = block_option >> 16;
+		if(block_option > 0xFF) block_value[block_value_size++] = (block_option >> 8) & 0xFF;
+		block_value[block_value_size++] = block_option & 0xFF;
+		
+		size += encode_option(buffer + size, COAP_OPTION_URI_PATH, COAP_OPTION_BLOCK1, block_value, block_value_size);
+		
+		block_offset = block_number * COAP_BLOCK_SIZE;
+		block_size = is_last_block() ? coap_payload_size - block_offset : COAP_BLOCK_SIZE;
+	}
+	
+	if(block_size > 0)
+	{
+		buffer[size++] = COAP_PAYLOAD_MARKER;
+		
+		memcpy(buffer + size, coap_payload_buffer + block_offset, block_size);
+		size += block_size;
+	}
+	
+	return size;
+}
+
+static uint16_t serialize_empty_ack(uint8_t* buffer, uint16_t acked_message_id)
+{
+	buffer[0] = (COAP_VERSION << 6) | (COAP_TYPE_ACKNOWLEDGEMENT << 4);
+	buffer[1] = COAP_CODE_EMPTY;
+	buffer[2] = acked_message_id >> 8;
+	buffer[3] = acked_message_id & 0x00FF;
+	
+	return 4;
+}
+
+static bool coap_parse_message(uint8_t* buffer, uint16_t size, coap_message_t* message)
+{
+	if(size < 4 || (buffer[0] >> 6) != COAP_VERSION)
+	{
+		return false;
+	}
+	
+	message->type = (buffer[0] >> 4) & 0x03;
+	message->token_length = buffer[0] & 0x0F;
+	message->code = buffer[1];
+	message->message_id = (buffer[2] << 8) | buffer[3];
+	message->payload = NULL;
+	message->payload_size = 0;
+	message->has_block1 = false;
+	message->block1 = 0;
+	
+	if(message->token_length > COAP_TOKEN_LENGTH || 4 + message->token_length > size)
+	{
+		return false;
+	}
+	
+	memcpy(message->token, buffer + 4, message->token_length);
+	
+	// responses are matched by message id and token, only Block1 option is decoded
+	uint16_t position = 4 + message->token_length;
+	uint16_t option_number = 0;
+	while(position < size && buffer[position] != COAP_PAYLOAD_MARKER)
+	{
+		uint8_t delta_nibble = buffer[position] >> 4;
+		uint16_t length = buffer[position] & 0x0F;
+		position++;
+		
+		if(delta_nibble == 15 || length == 15)
+		{
+			return false;
+		}
+		
+		uint8_t extended_delta_size = (delta_nibble == 13) ? 1 : ((delta_nibble == 14) ? 2 : 0);
+		uint8_t extended_length_size = (length == 13) ? 1 : ((length == 14) ? 2 : 0);
+		if(size - position < extended_delta_size + extended_length_size)
+		{
+			return false;
+		}
+		
+		if(delta_nibble == 13)
+		{
+			option_number += buffer[position] + 13;
+		}
+		else if(delta_nibble == 14)
+		{
+			option_number += ((buffer[position] << 8) | buffer[position + 1]) + 269;
+		}
+		else
+		{
+			option_number += delta_nibble;
+		}
+		
+		position += extended_delta_size;
+		
+		if(length == 13)
+		{
+			length = buffer[position++] + 13;
+		}
+		else if(length == 14)
+		{
+			uint16_t extended_length = (buffer[position] << 8) | buffer[position + 1];
+			if(extended_length > UINT16_MAX - 269)
+			{
+				return false;
+			}
+			
+			length = extended_length + 269;
+			position += 2;
+		}
+		
+		// option value must end within received message
+		if(length > size - position)
+		{
+			return false;
+		}
+		
+		if(option_number == COAP_OPTION_BLOCK1 && length <= 3)
+		{
+			message->has_block1 = true;
+			for(uint16_t i = 0; i < length; i++)
+			{
+				message->block1 = (message->block1 << 8) | buffer[position + i];
+			}
+		}
+		
+		position += length;
+	}
+	
+	if(position < size)
+	{
+		message->payload = buffer + position + 1;
+		message->payload_size = size - position - 1;
+	}
+	
+	return true;
+}
+
+static bool coap_communication_protocol_handler(int8_t state_id, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			return true;
+		}
+		case EVENT_COMMUNICATION_MODULE_PROCESS:
+		{
+			if(communication_module_process_handle())
+			{
+				add_coap_communication_protocol_event_type(EVENT_COMMUNICATION_MODULE_PROCESS);
+			}
+			else
+			{
+				add_coap_communication_protocol_event_type(EVENT_COMMUNICATION_MODULE_DONE);
+			}
+			
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			return false;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static bool state_coap_idle(int8_t state_id, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG(1, "Entering coap idle state");
+			
+			circular_buffer_clear(&coap_communication_protocol_event_buffer);
+			
+			return true;
+		}
+		case EVENT_COAP_POST:
+		{
+			LOG(1, "CoAP post received in idle state");
+			
+			if(coap_parameters_set())
+			{
+				strcpy(destination_address, server_ip);
+				destination_port = server_port;
+				bind_port = 0;
+				
+				serialize_payload();
+				
+				received_commands_size = 0;
+				block_number = 0;
+				sending_next_block = false;
+				start_request();
+				token[0] = rtc_get_ts() & 0xFF;
+				token[1] = message_id & 0xFF;
+				
+				transition(STATE_COAP_EXCHANGE);
+			}
+			else
+			{
+				LOG(1, "CoAP protocol parameters not set");
+				
+				report_posted(false);
+				
+				set_coap_communication_protocol_error(ERROR_COAP_PARAMETERS_MISSING, state_id);
+			}
+			
+			return true;
+		}
+		case EVENT_COAP_RECEIVE:
+		case EVENT_COAP_DISCONNECT:
+		{
+			// there is no session, nothing to receive or close
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG(1, "Leaving coap idle state");
+			
+			return false;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static bool state_coap_exchange(int8_t state_id, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG(1, "Entering coap exchange state");
+			
+			return true;
+		}
+		case EVENT_COAP_POST:
+		case EVENT_COAP_RECEIVE:
+		case EVENT_COAP_DISCONNECT:
+		{
+			add_coap_communication_protocol_event_type(event->type); // retain event until exchange is done
+			
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG(1, "Leaving coap exchange state");
+			
+			return false;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static bool state_coap_send_request(int8_t state_id, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG(1, "Entering coap send request state");
+			
+			sending_next_block = false;
+			
+			uint16_t request_size = serialize_request(coap_buffer);
+			
+			LOG_PRINT(1, PSTR("CoAP post block %u size %u\r\n"), block_number, request_size);
+			
+			communication_module_process_handle = wifi_communication_module_send_to(coap_buffer, request_size);
+			add_coap_communication_protocol_event_type(EVENT_COMMUNICATION_MODULE_PROCESS);
+			
+			return true;
+		}
+		case EVENT_COMMUNICATION_MODULE_DONE:
+		{
+			communication_module_type_data_t send_result = get_wifi_communication_result();
+			append_communication_module_type_data(&send_result, &communication_protocol_type_data.communication_module_type_data);
+			
+			if(is_communication_module_success(&send_result))
+			{
+				LOG(1, "CoAP request sent");
+				
+				transition(STATE_COAP_RECEIVE_RESPONSE);
+			}
+			else
+			{
+				LOG(1, "Error sending coap request");
+				
+				report_posted(false);
+				
+				set_coap_communication_protocol_error(ERROR_SENDING_COAP_MESSAGE, state_id);
+				
+				transition(STATE_COAP_IDLE);
+			}
+			
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG(1, "Leaving coap send request state");
+			
+			return false;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+/*
+* Response is either piggybacked on ack or sent separately after empty ack, separate confirmable response is acked.
+*/
+static bool state_coap_receive_response(int8_t state_id, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG(1, "Entering coap receive response state");
+			
+			received_data_size = 0;
+			
+			communication_module_process_handle = wifi_communication_module_receive_from_with_timeout(coap_buffer, COAP_BUFFER_SIZE, &received_data_size, retransmission_timeout);
+			add_coap_communication_protocol_event_type(EVENT_COMMUNICATION_MODULE_PROCESS);
+			
+			return true;
+		}
+		case EVENT_COMMUNICATION_MODULE_DONE:
+		{
+			communication_module_type_data_t receive_result = get_wifi_communication_result();
+			append_communication_module_type_data(&receive_result, &communication_protocol_type_data.communication_module_type_data);
+			
+			if(!is_communication_module_success(&receive_result))
+			{
+				LOG(1, "Error receiving coap response");
+				
+				report_posted(false);
+				
+				set_coap_communication_protocol_error(ERROR_RECEIVING_COAP_MESSAGE, state_id);
+				
+				transition(STATE_COAP_IDLE);
+				
+				return true;
+			}
+			
+			if(coap_parse_message(coap_buffer, received_data_size, &coap_message))
+			{
+				bool acknowledgement = (coap_message.type == COAP_TYPE_ACKNOWLEDGEMENT || coap_message.type == COAP_TYPE_RESET) && coap_message.message_id == message_id;
+				bool separate_response = (coap_message.type == COAP_TYPE_CONFIRMABLE || coap_message.type == COAP_TYPE_NON_CONFIRMABLE) && coap_message.token_length == COAP_TOKEN_LENGTH && memcmp(coap_message.token, token, COAP_TOKEN_LENGTH) == 0;
+				
+				if(acknowledgement && coap_message.type == COAP_TYPE_RESET)
+				{
+					LOG(1, "CoAP request reset");
+					
+					report_posted(false);
+					
+					set_coap_communication_protocol_error(ERROR_COAP_REQUEST_REJECTED, state_id);
+					
+					transition(STATE_COAP_IDLE);
+					
+					return true;
+				}
+				
+				if(acknowledgement && coap_message.code == COAP_CODE_EMPTY)
+				{
+					LOG(1, "CoAP empty ack received, waiting for separate response");
+					
+					retransmissions = COAP_MAX_RETRANSMIT; // request is not retransmitted after ack
+					
+					transition(STATE_COAP_RECEIVE_RESPONSE);
+					
+					return true;
+				}
+				
+				if(acknowledgement || separate_response)
+				{
+					LOG_PRINT(1, PSTR("CoAP response %u.%02u received\r\n"), COAP_CODE_CLASS(coap_message.code), coap_message.code & 0x1F);
+					
+					if(COAP_CODE_CLASS(coap_message.code) != 2)
+					{
+						report_posted(false);
+						
+						set_coap_communication_protocol_error(ERROR_COAP_REQUEST_REJECTED, state_id);
+					}
+					else if(!is_last_block())
+					{
+						// 2.31 or, from server that stores blocks as they come, 2.04 acknowledging this block
+						if(coap_message.code == COAP_CODE_CONTINUE || (coap_message.has_block1 && (coap_message.block1 >> 4) == block_number))
+						{
+							block_number++;
+							sending_next_block = true;
+							start_request();
+						}
+						else
+						{
+							LOG(1, "CoAP block not acknowledged");
+							
+							report_posted(false);
+							
+							set_coap_communication_protocol_error(ERROR_COAP_REQUEST_REJECTED, state_id);
+						}
+					}
+					else
+					{
+						report_posted(true);
+						
+						if(coap_message.payload_size > 0 && coap_message.payload_size <= COAP_PAYLOAD_BUFFER_SIZE)
+						{
+							memcpy(coap_payload_buffer, coap_message.payload, coap_message.payload_size);
+							coap_communication_protocol_dependencies.decrypt(coap_payload_buffer, coap_message.payload_size, device_preshared_key);
+							
+							// decrypted data is zero padded
+							received_commands_size = strnlen((char*)coap_payload_buffer, coap_message.payload_size);
+						}
+					}
+					
+					if(coap_message.type == COAP_TYPE_CONFIRMABLE)
+					{
+						transition(STATE_COAP_SEND_ACK);
+					}
+					else if(sending_next_block)
+					{
+						transition(STATE_COAP_SEND_REQUEST);
+					}
+					else
+					{
+						transition(STATE_COAP_IDLE);
+					}
+					
+					return true;
+				}
+			}
+			
+			if(retransmissions < COAP_MAX_RETRANSMIT)
+			{
+				LOG(1, "CoAP response not received, retransmitting request");
+				
+				// same message id, request is serialized again as receive overwrote it
+				retransmissions++;
+				retransmission_timeout *= 2;
+				
+				transition(STATE_COAP_SEND_REQUEST);
+				
+				return true;
+			}
+			
+			LOG(1, "CoAP response not received");
+			
+			report_posted(false);
+			
+			set_coap_communication_protocol_error(ERROR_COAP_RESPONSE_NOT_RECEIVED, state_id);
+			
+			transition(STATE_COAP_IDLE);
+			
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG(1, "Leaving coap receive response state");
+			
+			return false;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static bool state_coap_send_ack(int8_t state_id, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG(1, "Entering coap send ack state");
+			
+			uint16_t ack_size = serialize_empty_ack(coap_buffer, coap_message.message_id);
+			
+			communication_module_process_handle = wifi_communication_module_send_to(coap_buffer, ack_size);
+			add_coap_communication_protocol_event_type(EVENT_COMMUNICATION_MODULE_PROCESS);
+			
+			return true;
+		}
+		case EVENT_COMMUNICATION_MODULE_DONE:
+		{
+			communication_module_type_data_t send_result = get_wifi_communication_result();
+			append_communication_module_type_data(&send_result, &communication_protocol_type_data.communication_module_type_data);
+			
+			if(!is_communication_module_success(&send_result))
+			{
+				// server repeats the response, result is already known
+				LOG(1, "Error sending coap ack");
+			}
+			
+			transition(sending_next_block ? STATE_COAP_SEND_REQUEST : STATE_COAP_IDLE);
+			
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG(1, "Leaving coap send ack state");
+			
+			return false;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
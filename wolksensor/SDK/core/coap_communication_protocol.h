@@ -0,0 +1,27 @@
+#ifndef COAP_H_
+#define COAP_H_
+
+#include "platform_specific.h"
+#include "communication_protocol.h"
+#include "system.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+void coap_protocol_init(void);
+
+communication_protocol_process_handle_t coap_protocol_send_sensor_readings_and_system_data(circular_buffer_t* sensor_readings_buffer, circular_buffer_t* system_buffer, uint16_t* sent_sensor_readings, uint16_t* sent_system_items);
+communication_protocol_process_handle_t coap_protocol_send_actuator_state(actuator_t* actuator, actuator_state_t* actuator_state);
+communication_protocol_process_handle_t coap_protocol_receive_commands(circular_buffer_t* commands_buffer);
+communication_protocol_process_handle_t coap_protocol_send_command_responses(circular_buffer_t* command_response_buffer);
+communication_protocol_process_handle_t coap_protocol_disconnect(void);
+
+communication_protocol_type_data_t get_coap_communication_result(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COAP_H_ */
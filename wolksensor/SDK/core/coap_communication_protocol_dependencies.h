@@ -0,0 +1,13 @@
+#ifndef COAP_COMMUNICATION_PROTOCOL_DEPENDENCIES_H_
+#define COAP_COMMUNICATION_PROTOCOL_DEPENDENCIES_H_
+
+typedef struct  
+{
+	uint16_t (*encrypt)(uint8_t* buff, uint16_t size, uint8_t* key);
+	void (*decrypt)(uint8_t* message, uint16_t message_len, uint8_t* key);
+}
+coap_communication_protocol_dependencies_t;
+
+extern coap_communication_protocol_dependencies_t coap_communication_protocol_dependencies;
+
+#endif /* COAP_COMMUNICATION_PROTOCOL_DEPENDENCIES_H_ */
@@ -0,0 +1,55 @@
+#include "command_buffer.h"
+
+static uint8_t get_argument_length(command_t* command)
+{
+	uint8_t* argument = (uint8_t*)&command->argument;
+	uint8_t length = sizeof(command_argument_t);
+	while((length > 0) && (argument[length - 1] == 0))
+	{
+		length--;
+	}
+	
+	return length;
+}
+
+bool command_buffer_add(circular_buffer_t* command_buffer, command_t* command)
+{
+	uint8_t argument_length = command->has_argument ? get_argument_length(command) : 0;
+	
+	uint8_t header[COMMAND_RECORD_HEADER_SIZE];
+	header[0] = command->type;
+	header[1] = argument_length | (command->has_argument ? COMMAND_RECORD_HAS_ARGUMENT : 0);
+	
+	bool added = false;
+	
+	/* header and argument must be added as one record, buffer is shared with commands popped in other context */
+	SYNCHRONIZED_BLOCK_START
+	
+	if(circular_buffer_free_space(command_buffer) >= COMMAND_RECORD_HEADER_SIZE + argument_length)
+	{
+		circular_buffer_add_array(command_buffer, header, COMMAND_RECORD_HEADER_SIZE);
+		circular_buffer_add_array(command_buffer, &command->argument, argument_length);
+		added = true;
+	}
+	
+	SYNCHRONIZED_BLOCK_END
+	
+	return added;
+}
+
+bool command_buffer_pop(circular_buffer_t* command_buffer, command_t* command)
+{
+	uint8_t header[COMMAND_RECORD_HEADER_SIZE];
+	if(circular_buffer_pop_array(command_buffer, COMMAND_RECORD_HEADER_SIZE, header) != COMMAND_RECORD_HEADER_SIZE)
+	{
+		return false;
+	}
+	
+	command->type = header[0];
+	command->has_argument = (header[1] & COMMAND_RECORD_HAS_ARGUMENT) != 0;
+	
+	memset(&command->argument, 0, sizeof(command_argument_t));
+	circular_buffer_pop_array(command_buffer, header[1] & COMMAND_RECORD_ARGUMENT_LENGTH_MASK, &command->argument);
+	
+	return true;
+}
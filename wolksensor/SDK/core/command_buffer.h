@@ -0,0 +1,27 @@
+#ifndef COMMAND_BUFFER_H_
+#define COMMAND_BUFFER_H_
+
+#include "commands.h"
+
+/*
+* Commands are queued in byte circular buffer as variable length records:
+* command type, argument length (with has argument flag) and argument bytes.
+* Trailing zero bytes of argument are not stored, so commands without
+* argument take only two bytes.
+*/
+
+#define COMMAND_RECORD_HEADER_SIZE 2
+#define COMMAND_RECORD_HAS_ARGUMENT 0x80
+#define COMMAND_RECORD_ARGUMENT_LENGTH_MASK 0x7F
+
+/**
+ * Adds command record to byte buffer. Returns false if there is not enough free space for entire record.
+*/
+bool command_buffer_add(circular_buffer_t* command_buffer, command_t* command);
+
+/**
+ * Reads oldest command record into command and removes it. Returns false if buffer is empty.
+*/
+bool command_buffer_pop(circular_buffer_t* command_buffer, command_t* command);
+
+#endif /* COMMAND_BUFFER_H_ */
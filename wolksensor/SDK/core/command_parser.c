@@ -1,5 +1,7 @@
 #include "command_parser.h"
+#include "command_buffer.h"
 #include "commands.h"
+#include "config.h"
 #include "logger.h"
 
 typedef struct
@@ -9,155 +11,140 @@ typedef struct
 }
 command_table_t;
 
+/*
+* Sorted by token (plain ASCII order, '_' sorts after letters) so that
+* lookup_command can binary search it. Keep it sorted when adding commands.
+*/
 static const command_table_t command_table[] PROGMEM =
 {
-	{ COMMAND_BAD, "" },
+	{ COMMAND_ALARM, "ALARM" },
+	{ COMMAND_ATMO, "ATMO" },
+	{ COMMAND_AUTH, "AUTH" },
+	{ COMMAND_BUFFERS, "BUFFERS" },
+	{ COMMAND_ENERGY, "ENERGY" },
+	{ COMMAND_HEARTBEAT, "HEARTBEAT" },
+	{ COMMAND_ID, "ID" },
+	{ COMMAND_KNX_GROUP_ADDRESS, "KNX_GROUP_ADDRESS" },
+	{ COMMAND_KNX_MULTICAST_ADDRESS, "KNX_MULTICAST_ADDRESS" },
+	{ COMMAND_KNX_MULTICAST_PORT, "KNX_MULTICAST_PORT" },
+	{ COMMAND_KNX_NAT, "KNX_NAT" },
+	{ COMMAND_KNX_PHYSICAL_ADDRESS, "KNX_PHYSICAL_ADDRESS" },
+	{ COMMAND_LOCATION, "LOCATION" },
 	{ COMMAND_MAC, "MAC" },
+	{ COMMAND_MOVEMENT, "MOVEMENT" },
+	{ COMMAND_MQTT_PASSWORD, "MQTT_PASSWORD" },
+	{ COMMAND_MQTT_USERNAME, "MQTT_USERNAME" },
 	{ COMMAND_NOW, "NOW" },
+	{ COMMAND_PASS, "PASS" },
+	{ COMMAND_PORT, "PORT" },
+	{ COMMAND_READINGS, "READINGS" },
 	{ COMMAND_RELOAD, "RELOAD" },
-	{ COMMAND_HEARTBEAT, "HEARTBEAT" },
 	{ COMMAND_RTC, "RTC" },
-	{ COMMAND_VERSION, "VERSION" },
-	{ COMMAND_STATUS, "STATUS" },
-	{ COMMAND_READINGS, "READINGS" },
-	{ COMMAND_ID, "ID" },
+	{ COMMAND_SET, "SET" },
 	{ COMMAND_SIGNATURE, "SIGNATURE" },
-	{ COMMAND_URL, "URL" },
-	{ COMMAND_PORT, "PORT" },
 	{ COMMAND_SSID, "SSID" },
-	{ COMMAND_PASS, "PASS" },
-	{ COMMAND_AUTH, "AUTH" },
-	{ COMMAND_MOVEMENT, "MOVEMENT" },
-	{ COMMAND_ATMO, "ATMO" },
-	{ COMMAND_SYSTEM, "SYSTEM" },
+	{ COMMAND_SSL, "SSL" },
+	{ COMMAND_STATIC_DNS, "STATIC_DNS" },
+	{ COMMAND_STATIC_GATEWAY, "STATIC_GATEWAY" },
 	{ COMMAND_STATIC_IP, "STATIC_IP" },
 	{ COMMAND_STATIC_MASK, "STATIC_MASK" },
-	{ COMMAND_STATIC_GATEWAY, "STATIC_GATEWAY" },
-	{ COMMAND_STATIC_DNS, "STATIC_DNS" },
-	{ COMMAND_ALARM, "ALARM" },
-	{ COMMAND_SET, "SET" },
-	{ COMMAND_KNX_PHYSICAL_ADDRESS, "KNX_PHYSICAL_ADDRESS" },
-	{ COMMAND_KNX_GROUP_ADDRESS, "KNX_GROUP_ADDRESS" },
-	{ COMMAND_KNX_MULTICAST_ADDRESS, "KNX_MULTICAST_ADDRESS" },
-	{ COMMAND_KNX_MULTICAST_PORT, "KNX_MULTICAST_PORT" },
-	{ COMMAND_KNX_NAT, "KNX_NAT" },
-	{ COMMAND_LOCATION, "LOCATION" },
-	{ COMMAND_SSL, "SSL" }
+	{ COMMAND_STATUS, "STATUS" },
+	{ COMMAND_SYSTEM, "SYSTEM" },
+	{ COMMAND_TRACE, "TRACE" },
+	{ COMMAND_URL, "URL" },
+	{ COMMAND_VERSION, "VERSION" }
 };
 
 /*
-* Used to split values by |
+* Compares first token_length characters of command string with token from command table.
+* Token from table must end exactly there, so that eg. STATIC does not match STATIC_IP.
 */
-static uint8_t find_argument_item(char* items_list)
+static int compare_command_token(const char* command_string, uint8_t token_length, const command_table_t* command_table_entry)
 {
-	uint8_t length = strlen(items_list);
-	if(length == 0)
+	int result = strncmp_P(command_string, command_table_entry->token, token_length);
+	if((result == 0) && (pgm_read_byte(&command_table_entry->token[token_length]) != '\0'))
 	{
-		return 0;
+		result = -1;
 	}
 	
-	uint8_t end_position = 0;
-	while((items_list[end_position++] != ARGUMENT_ITEMS_SEPARATOR) && (end_position < length));
-
-	return end_position;
+	return result;
 }
 
-static bool parse_alarm_argument_item(char* argument, uint8_t size, char* sensor_id, sensor_alarms_t* sensor_alarms)
-{	
-	LOG_PRINT(1, PSTR("Alarm item %s \r\n"), argument);
+static commands_t lookup_command(const char* command_string, uint8_t token_length)
+{
+	uint8_t low = 0;
+	uint8_t high = sizeof(command_table) / sizeof(command_table_t);
 	
-	*sensor_id = argument[0];
+	while(low < high)
+	{
+		uint8_t middle = (low + high) / 2;
+		
+		int result = compare_command_token(command_string, token_length, &command_table[middle]);
+		if(result == 0)
+		{
+			return pgm_read_byte(&command_table[middle].type);
+		}
+		
+		if(result < 0)
+		{
+			high = middle;
+		}
+		else
+		{
+			low = middle + 1;
+		}
+	}
 	
-	LOG_PRINT(1, PSTR("Alarm for %c \r\n"), *sensor_id);
+	return COMMAND_BAD;
+}
+
+static bool parse_alarm_argument_item(char* item, char* sensor_id, sensor_alarms_t* sensor_alarms)
+{
+	*sensor_id = item[0];
 	
-	if(argument[1] != ARGUMENT_ITEM_KEY_VALUE_SEPARATOR)
+	if(item[1] != ARGUMENT_ITEM_KEY_VALUE_SEPARATOR)
 	{
 		return false;
 	}
 	
-	/* search for ',' */
-	uint8_t values_separator_position = 0;
-	while(argument[values_separator_position++] != ARGUMENT_ITEM_VALUES_SEPARATOR)
+	char* high_value = strchr(item + 2, ARGUMENT_ITEM_VALUES_SEPARATOR);
+	if(high_value == NULL)
 	{
-		if(values_separator_position == size) /* end reached */
-		{
-			return false;
-		}
+		return false;
 	}
 	
-	int alarm_value;
-	/* low value */
-	
+	*high_value++ = '\0';
 	
-	if(strncmp_P(argument + 2, PSTR("OFF"), 3) == 0)
+	/* low value */
+	if(strcmp_P(item + 2, PSTR("OFF")) == 0)
 	{
-		LOG(1, "Alarm low off");
 		sensor_alarms->alarm_low.enabled = false;
 	}
 	else
 	{
-		alarm_value = atoi(argument + 2);
 		sensor_alarms->alarm_low.enabled = true;
-		sensor_alarms->alarm_low.value = alarm_value;
-		LOG_PRINT(1, PSTR("Alarm low %d \r\n"), sensor_alarms->alarm_low.value);
+		sensor_alarms->alarm_low.value = atoi(item + 2);
 	}
 	
 	/* high value */
-	if(strncmp_P(argument + values_separator_position, PSTR("OFF"), 3) == 0)
+	if(strcmp_P(high_value, PSTR("OFF")) == 0)
 	{
-		LOG(1, "Alarm high off");
 		sensor_alarms->alarm_high.enabled = false;
 	}
 	else
 	{
-		alarm_value = atoi(argument + values_separator_position);
 		sensor_alarms->alarm_high.enabled = true;
-		sensor_alarms->alarm_high.value = alarm_value;
-		LOG_PRINT(1, PSTR("Alarm high %d \r\n"), sensor_alarms->alarm_high.value);
+		sensor_alarms->alarm_high.value = atoi(high_value);
 	}
 	
 	return true;
 }
 
-static bool parse_alarm_argument(command_t* command, char* argument)
-{		
-	LOG_PRINT(1, PSTR("Alarm argument %s \r\n"), argument);
-	
-	memcpy(&command->argument.sensors_alarms_argument, &sensors_alarms, sizeof(sensors_alarms));
-	
-	uint8_t item_start_position = 0;
-	uint8_t item_end_position = find_argument_item(argument);
-	
-	while(item_start_position != item_end_position)
-	{
-		char sensor_id;
-		sensor_alarms_t sensor_alarms;
-		
-		if(!parse_alarm_argument_item(argument + item_start_position, item_end_position, &sensor_id, &sensor_alarms))
-		{
-			return false;
-		}
-
-		int8_t sensor_index = get_index_of_sensor(sensor_id);
-		if(sensor_index >= 0)
-		{
-			command->argument.sensors_alarms_argument[sensor_index].alarm_low.enabled = sensor_alarms.alarm_low.enabled;
-			command->argument.sensors_alarms_argument[sensor_index].alarm_low.value = sensor_alarms.alarm_low.value;
-			
-			command->argument.sensors_alarms_argument[sensor_index].alarm_high.enabled = sensor_alarms.alarm_high.enabled;
-			command->argument.sensors_alarms_argument[sensor_index].alarm_high.value = sensor_alarms.alarm_high.value;
-		}
-		
-		item_start_position = item_end_position;
-		item_end_position += find_argument_item(argument + item_end_position);
-	}
-
-	return true;
-}
-
 static bool parse_set_argument(command_t* command, char* argument)
 {
-	char* id = strtok(argument, ":");
+	char* save_position;
+	
+	char* id = strtok_r(argument, ":", &save_position);
 	if(id == NULL)
 	{
 		return false;
@@ -180,7 +167,7 @@ static bool parse_set_argument(command_t* command, char* argument)
 	
 	LOG_PRINT(1, PSTR("Actuator id %s\r\n"), command->argument.set_argument.id);
 	
-	char* value = strtok(NULL, ":");
+	char* value = strtok_r(NULL, ":", &save_position);
 	actuator_type_t actuator_type = actuators[i].type;
 	switch(actuator_type)
 	{
@@ -229,11 +216,12 @@ static bool parse_set_argument(command_t* command, char* argument)
 static bool parse_knx_physical_address_argument(command_t* command, unsigned char* argument)
 {
 	char* address_segments[3];
+	char* save_position;
 	
 	uint8_t i;
 	for(i = 0; i < 3; i++)
 	{
-		address_segments[i] = strtok((i == 0 ? argument : NULL), ".");
+		address_segments[i] = strtok_r((i == 0 ? (char*)argument : NULL), ".", &save_position);
 		if(address_segments[i] == NULL)
 		{
 			return false;
@@ -257,11 +245,12 @@ static bool parse_knx_physical_address_argument(command_t* command, unsigned cha
 static bool parse_knx_group_address_argument(command_t* command, unsigned char* argument)
 {
 	char* address_segments[3];
+	char* save_position;
 	
 	uint8_t i;
 	for(i = 0; i < 3; i++)
 	{
-		address_segments[i] = strtok((i == 0 ? argument : NULL), ".");
+		address_segments[i] = strtok_r((i == 0 ? (char*)argument : NULL), ".", &save_position);
 		if(address_segments[i] == NULL)
 		{
 			return false;
@@ -282,7 +271,7 @@ static bool parse_knx_group_address_argument(command_t* command, unsigned char*
 	return true;
 }
 
-static bool parse_commad_argument(command_t* command, char* argument)
+static bool parse_keyword_argument(command_t* command, char* argument)
 {
 	switch (command->type) {
 		case COMMAND_MOVEMENT:
@@ -306,34 +295,6 @@ static bool parse_commad_argument(command_t* command, char* argument)
 				return false;
 			}
 		}
-		case COMMAND_HEARTBEAT:
-		case COMMAND_PORT:
-		case COMMAND_KNX_MULTICAST_PORT:
-		{
-			uint64_t value = atoi(argument);
-			command->argument.uint32_argument = value;
-			return true;
-		}
-		case COMMAND_RTC:
-		{
-			uint64_t rtc = strtoul(argument, NULL, 10);
-			command->argument.uint32_argument = rtc;
-			return true;
-		}
-		case COMMAND_ID:
-		case COMMAND_SIGNATURE:
-		case COMMAND_URL:
-		case COMMAND_SSID:
-		case COMMAND_PASS:
-		case COMMAND_STATIC_IP:
-		case COMMAND_STATIC_MASK:
-		case COMMAND_STATIC_GATEWAY:
-		case COMMAND_STATIC_DNS:
-		case COMMAND_KNX_MULTICAST_ADDRESS:
-		{
-			strncpy(command->argument.string_argument, argument, COMMAND_ARGUMENT_MAX_LENGTH);
-			return true;
-		}
 		case COMMAND_AUTH:
 		{
 			if(!strcmp_P(argument, PSTR("NONE")))
@@ -358,6 +319,9 @@ static bool parse_commad_argument(command_t* command, char* argument)
 		}
 		case COMMAND_READINGS:
 		case COMMAND_SYSTEM:
+		case COMMAND_TRACE:
+		case COMMAND_ENERGY:
+		case COMMAND_BUFFERS:
 		{
 			if(!strcmp_P(argument, PSTR("CLEAR")))
 			{
@@ -369,10 +333,6 @@ static bool parse_commad_argument(command_t* command, char* argument)
 				return false;
 			}
 		}
-		case COMMAND_ALARM:
-		{
-			return parse_alarm_argument(command, argument);
-		}
 		case COMMAND_SET:
 		{
 			return parse_set_argument(command, argument);
@@ -387,106 +347,406 @@ static bool parse_commad_argument(command_t* command, char* argument)
 		}
 		default:
 		{
-			memset(&command->argument, 0, sizeof(command_argument_t));
 			return false;
 		}
 	}
 }
 
-static bool parse_command(char* command_string, uint16_t command_string_length, command_t* command)
+/*
+* Size of configuration field string argument is copied into, including terminating zero.
+*/
+static uint8_t get_string_argument_size(commands_t type)
+{
+	switch (type) {
+		case COMMAND_ID:
+		{
+			return MAX_DEVICE_ID_SIZE;
+		}
+		case COMMAND_SIGNATURE:
+		{
+			return MAX_PRESHARED_KEY_SIZE;
+		}
+		case COMMAND_URL:
+		{
+			return MAX_SERVER_IP_SIZE;
+		}
+		case COMMAND_SSID:
+		{
+			return MAX_WIFI_SSID_SIZE;
+		}
+		case COMMAND_PASS:
+		{
+			return MAX_WIFI_PASSWORD_SIZE;
+		}
+		case COMMAND_STATIC_IP:
+		{
+			return MAX_WIFI_STATIC_IP_SIZE;
+		}
+		case COMMAND_STATIC_MASK:
+		{
+			return MAX_WIFI_STATIC_MASK_SIZE;
+		}
+		case COMMAND_STATIC_GATEWAY:
+		{
+			return MAX_WIFI_STATIC_GATEWAY_SIZE;
+		}
+		case COMMAND_STATIC_DNS:
+		{
+			return MAX_WIFI_STATIC_DNS_SIZE;
+		}
+		case COMMAND_KNX_MULTICAST_ADDRESS:
+		{
+			return MAX_KNX_MULTICAST_ADDRESS_SIZE;
+		}
+		case COMMAND_MQTT_USERNAME:
+		{
+			return MQTT_USERNAME_SIZE;
+		}
+		case COMMAND_MQTT_PASSWORD:
+		{
+			return MQTT_PASSWORD_SIZE;
+		}
+		default:
+		{
+			return COMMAND_ARGUMENT_MAX_LENGTH;
+		}
+	}
+}
+
+static command_argument_sink_t get_argument_sink(commands_t type)
+{
+	switch (type) {
+		case COMMAND_HEARTBEAT:
+		case COMMAND_PORT:
+		case COMMAND_KNX_MULTICAST_PORT:
+		case COMMAND_RTC:
+		{
+			return ARGUMENT_SINK_NUMBER;
+		}
+		case COMMAND_ID:
+		case COMMAND_SIGNATURE:
+		case COMMAND_URL:
+		case COMMAND_SSID:
+		case COMMAND_PASS:
+		case COMMAND_STATIC_IP:
+		case COMMAND_STATIC_MASK:
+		case COMMAND_STATIC_GATEWAY:
+		case COMMAND_STATIC_DNS:
+		case COMMAND_KNX_MULTICAST_ADDRESS:
+		case COMMAND_MQTT_USERNAME:
+		case COMMAND_MQTT_PASSWORD:
+		{
+			return ARGUMENT_SINK_STRING;
+		}
+		case COMMAND_ALARM:
+		{
+			return ARGUMENT_SINK_ALARMS;
+		}
+		case COMMAND_MOVEMENT:
+		case COMMAND_ATMO:
+		case COMMAND_KNX_NAT:
+		case COMMAND_LOCATION:
+		case COMMAND_SSL:
+		case COMMAND_AUTH:
+		case COMMAND_READINGS:
+		case COMMAND_SYSTEM:
+		case COMMAND_TRACE:
+		case COMMAND_ENERGY:
+		case COMMAND_BUFFERS:
+		case COMMAND_SET:
+		case COMMAND_KNX_PHYSICAL_ADDRESS:
+		case COMMAND_KNX_GROUP_ADDRESS:
+		{
+			return ARGUMENT_SINK_KEYWORD;
+		}
+		default:
+		{
+			return ARGUMENT_SINK_NONE;
+		}
+	}
+}
+
+static bool append_item_character(command_parser_t* parser, char character)
 {
-	LOG_PRINT(1, PSTR("Processing command string %s of length %u\r\n"), command_string, command_string_length);
+	if(parser->item_length >= COMMAND_ARGUMENT_ITEM_MAX_LENGTH - 1)
+	{
+		return false;
+	}
+	
+	parser->item[parser->item_length++] = character;
+	return true;
+}
+
+/*
+* Alarm list is consumed one item at a time, so its total length is not limited.
+*/
+static bool finish_alarm_item(command_parser_t* parser)
+{
+	if(parser->item_length == 0)
+	{
+		return true;
+	}
+	
+	parser->item[parser->item_length] = '\0';
+	parser->item_length = 0;
 	
-	if(command_string[command_string_length - 1] != COMMAND_TERMINATOR)
+	char sensor_id;
+	sensor_alarms_t sensor_alarms;
+	if(!parse_alarm_argument_item(parser->item, &sensor_id, &sensor_alarms))
 	{
-		LOG(1, "Command does not end with command terminator");
 		return false;
 	}
 	
-	uint8_t number_of_commands = sizeof(command_table) / sizeof(command_table_t);
-	uint8_t i;
-	for (i = 1; i < number_of_commands; i++)
+	int8_t sensor_index = get_index_of_sensor(sensor_id);
+	if(sensor_index >= 0)
 	{
-		/* command name from command table */
-		char command_token[COMMAND_NAME_MAX_LENGTH];
-		strcpy_P(command_token, command_table[i].token);
-		uint8_t command_token_length = strlen(command_token);
+		parser->command.argument.sensors_alarms_argument[sensor_index].alarm_low.enabled = sensor_alarms.alarm_low.enabled;
+		parser->command.argument.sensors_alarms_argument[sensor_index].alarm_low.value = sensor_alarms.alarm_low.value;
+		
+		parser->command.argument.sensors_alarms_argument[sensor_index].alarm_high.enabled = sensor_alarms.alarm_high.enabled;
+		parser->command.argument.sensors_alarms_argument[sensor_index].alarm_high.value = sensor_alarms.alarm_high.value;
+	}
+	
+	return true;
+}
 
-		if(strncmp(command_string, command_token, command_token_length))
+static bool start_argument(command_parser_t* parser)
+{
+	parser->argument_sink = get_argument_sink(parser->command.type);
+	parser->argument_length = 0;
+	parser->argument_max_length = 0;
+	parser->item_length = 0;
+	
+	parser->command.has_argument = true;
+	memset(&parser->command.argument, 0, sizeof(command_argument_t));
+	
+	if(parser->argument_sink == ARGUMENT_SINK_ALARMS)
+	{
+		memcpy(&parser->command.argument.sensors_alarms_argument, &sensors_alarms, sizeof(sensors_alarms));
+	}
+	else if(parser->argument_sink == ARGUMENT_SINK_STRING)
+	{
+		uint8_t string_argument_size = get_string_argument_size(parser->command.type);
+		if(string_argument_size > COMMAND_ARGUMENT_MAX_LENGTH)
 		{
-			continue;
+			string_argument_size = COMMAND_ARGUMENT_MAX_LENGTH;
 		}
+		
+		parser->argument_max_length = string_argument_size - 1;
+	}
+	
+	return parser->argument_sink != ARGUMENT_SINK_NONE;
+}
 
-		/* command type */
-		command->type = pgm_read_byte(&command_table[i].type);
-
-		/* command without argument */
-		if(command_string[command_token_length] == COMMAND_TERMINATOR)
+static bool consume_argument_character(command_parser_t* parser, char character)
+{
+	switch (parser->argument_sink) {
+		case ARGUMENT_SINK_NUMBER:
+		{
+			if((character < '0') || (character > '9'))
+			{
+				return false;
+			}
+			
+			uint8_t digit = character - '0';
+			if(parser->command.argument.uint32_argument > (UINT32_MAX - digit) / 10)
+			{
+				return false;
+			}
+			
+			parser->command.argument.uint32_argument = parser->command.argument.uint32_argument * 10 + digit;
+			parser->argument_length++;
+			return true;
+		}
+		case ARGUMENT_SINK_STRING:
 		{
-			command->has_argument = false;
-			memset(&command->argument, 0, sizeof(command_argument_t));
-			LOG(1, "Command parsed sucesfully");
+			if(parser->argument_length >= parser->argument_max_length)
+			{
+				return false;
+			}
+			
+			parser->command.argument.string_argument[parser->argument_length++] = character;
 			return true;
 		}
+		case ARGUMENT_SINK_ALARMS:
+		{
+			if(character == ARGUMENT_ITEMS_SEPARATOR)
+			{
+				return finish_alarm_item(parser);
+			}
+			
+			return append_item_character(parser, character);
+		}
+		case ARGUMENT_SINK_KEYWORD:
+		{
+			return append_item_character(parser, character);
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
 
-		/* command with argument */
-		if(command_string[command_token_length] == COMMAND_ARGUMENT_SEPARATOR)
+static bool finish_argument(command_parser_t* parser)
+{
+	switch (parser->argument_sink) {
+		case ARGUMENT_SINK_NUMBER:
+		{
+			return parser->argument_length > 0;
+		}
+		case ARGUMENT_SINK_STRING:
+		{
+			return true;
+		}
+		case ARGUMENT_SINK_ALARMS:
+		{
+			return finish_alarm_item(parser);
+		}
+		case ARGUMENT_SINK_KEYWORD:
 		{
-			/* extract argument */
-			char* argument_start_position = command_string + command_token_length + 1;
-			command_string[command_string_length - 1] = '\0';
+			parser->item[parser->item_length] = '\0';
+			return parse_keyword_argument(&parser->command, parser->item);
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static void reset_parser(command_parser_t* parser)
+{
+	parser->state = COMMAND_PARSER_STATE_TOKEN;
+	parser->token_length = 0;
+}
+
+static void discard_command(command_parser_t* parser)
+{
+	parser->state = COMMAND_PARSER_STATE_DISCARD;
+}
 
-			LOG_PRINT(2, PSTR("Argument %s of length %u\r\n"), argument_start_position, strlen(argument_start_position));
+void command_parser_init(command_parser_t* parser)
+{
+	memset(parser, 0, sizeof(command_parser_t));
+	reset_parser(parser);
+}
 
-			if(parse_commad_argument(command, argument_start_position))
+bool command_parser_feed(command_parser_t* parser, char character, command_t* command)
+{
+	switch (parser->state) {
+		case COMMAND_PARSER_STATE_TOKEN:
+		{
+			if(character == COMMAND_TERMINATOR || character == COMMAND_ARGUMENT_SEPARATOR)
+			{
+				if(parser->token_length == 0)
+				{
+					if(character == COMMAND_ARGUMENT_SEPARATOR)
+					{
+						return false;
+					}
+					
+					discard_command(parser);
+					break;
+				}
+				
+				parser->command.type = lookup_command(parser->token, parser->token_length);
+				if(parser->command.type == COMMAND_BAD)
+				{
+					discard_command(parser);
+					break;
+				}
+				
+				if(character == COMMAND_TERMINATOR)
+				{
+					parser->command.has_argument = false;
+					memset(&parser->command.argument, 0, sizeof(command_argument_t));
+					
+					memcpy(command, &parser->command, sizeof(command_t));
+					reset_parser(parser);
+					return true;
+				}
+				
+				if(!start_argument(parser))
+				{
+					discard_command(parser);
+					break;
+				}
+				
+				parser->state = COMMAND_PARSER_STATE_ARGUMENT;
+				return false;
+			}
+			
+			/* line endings between commands, eg. from terminal */
+			if((parser->token_length == 0) && (character == '\r' || character == '\n'))
+			{
+				return false;
+			}
+			
+			if(parser->token_length >= COMMAND_NAME_MAX_LENGTH)
+			{
+				discard_command(parser);
+				break;
+			}
+			
+			parser->token[parser->token_length++] = character;
+			return false;
+		}
+		case COMMAND_PARSER_STATE_ARGUMENT:
+		{
+			if(character == COMMAND_TERMINATOR)
 			{
-				command->has_argument = true;
-				LOG(1, "Command parsed sucesfully");
+				if(!finish_argument(parser))
+				{
+					discard_command(parser);
+					break;
+				}
+				
+				memcpy(command, &parser->command, sizeof(command_t));
+				reset_parser(parser);
 				return true;
 			}
-			else
+			
+			if(!consume_argument_character(parser, character))
 			{
-				LOG(1, "Command argument is invalid");
+				discard_command(parser);
 			}
+			
+			return false;
+		}
+		default:
+		{
+			break;
 		}
 	}
 	
-	LOG(1, "Command could not be parsed or is not reckognized");
-	return false;
-}
-
-bool extract_command_from_string_buffer(circular_buffer_t* command_string_buffer, command_t* command)
-{
-	uint16_t command_string_length = 0;
-	char command_character = '\0';
-	while(circular_buffer_peek(command_string_buffer, command_string_length++, &command_character) && (command_character != COMMAND_TERMINATOR));
-	
-	if(command_character != COMMAND_TERMINATOR)
+	/* discarding, bad command is reported once its terminator arrives */
+	if(character != COMMAND_TERMINATOR)
 	{
-		//circular_buffer_clear(command_string_buffer);
 		return false;
 	}
-
-	char command_string[COMMAND_MAX_LENGTH];
-	circular_buffer_pop_array(command_string_buffer, command_string_length, command_string);
 	
-	if(!parse_command(command_string, command_string_length, command))
-	{
-		command->type = COMMAND_BAD;
-	}
-
+	command->type = COMMAND_BAD;
+	command->has_argument = false;
+	memset(&command->argument, 0, sizeof(command_argument_t));
+	
+	reset_parser(parser);
 	return true;
 }
 
-uint8_t extract_commands_from_string_buffer(circular_buffer_t* command_string_buffer, circular_buffer_t* command_buffer)
+uint8_t command_parser_feed_array(command_parser_t* parser, const char* data, uint16_t length, circular_buffer_t* command_buffer)
 {
 	command_t command;
-	uint8_t commands_extracted = 0;
-	while(extract_command_from_string_buffer(command_string_buffer, &command))
+	uint8_t commands_parsed = 0;
+	
+	uint16_t i;
+	for(i = 0; i < length; i++)
 	{
-		circular_buffer_add(command_buffer, &command);
-		commands_extracted++;
+		if(command_parser_feed(parser, data[i], &command) && command_buffer_add(command_buffer, &command))
+		{
+			commands_parsed++;
+		}
 	}
 	
-	return commands_extracted;
+	return commands_parsed;
 }
@@ -3,7 +3,60 @@
 
 #include "commands.h"
 
-bool extract_command_from_string_buffer(circular_buffer_t* command_string_buffer, command_t* command);
-uint8_t extract_commands_from_string_buffer(circular_buffer_t* command_string_buffer, circular_buffer_t* command_buffer);
+#define COMMAND_ARGUMENT_ITEM_MAX_LENGTH 24 /* single keyword, address or alarm list item */
+
+typedef enum
+{
+	COMMAND_PARSER_STATE_TOKEN = 0,
+	COMMAND_PARSER_STATE_ARGUMENT,
+	COMMAND_PARSER_STATE_DISCARD
+}
+command_parser_state_t;
+
+typedef enum
+{
+	ARGUMENT_SINK_NONE = 0, /* command does not take an argument */
+	ARGUMENT_SINK_NUMBER, /* digits accumulated directly into uint32_argument */
+	ARGUMENT_SINK_STRING, /* characters written directly into string_argument */
+	ARGUMENT_SINK_ALARMS, /* | separated key:value list, applied item by item */
+	ARGUMENT_SINK_KEYWORD /* short value decoded at command terminator */
+}
+command_argument_sink_t;
+
+/*
+* Incremental command parser. Characters are fed as they arrive and
+* command is complete as soon as its terminator is fed.
+*/
+typedef struct
+{
+	command_parser_state_t state;
+	command_argument_sink_t argument_sink;
+	
+	char token[COMMAND_NAME_MAX_LENGTH];
+	uint8_t token_length;
+	
+	char item[COMMAND_ARGUMENT_ITEM_MAX_LENGTH];
+	uint8_t item_length;
+	
+	uint8_t argument_length;
+	uint8_t argument_max_length; /* string argument characters that fit destination configuration field */
+	
+	command_t command;
+}
+command_parser_t;
+
+void command_parser_init(command_parser_t* parser);
+
+/**
+ * Feeds single character to parser. Returns true and fills command when command terminator is reached.
+ * Commands that could not be parsed are returned with type COMMAND_BAD.
+*/
+bool command_parser_feed(command_parser_t* parser, char character, command_t* command);
+
+/**
+ * Feeds array of characters to parser and adds every completed command to command_buffer (see command_buffer.h).
+ * Returns number of commands added.
+*/
+uint8_t command_parser_feed_array(command_parser_t* parser, const char* data, uint16_t length, circular_buffer_t* command_buffer);
 
 #endif /* COMMAND_PARSER_H_ */
@@ -2,6 +2,8 @@
 #include "platform_specific.h"
 #include "sensor_readings_buffer.h"
 #include "system_buffer.h"
+#include "state_machine_trace.h"
+#include "state_residency.h"
 #include "mqtt_communication_protocol.h"
 #include "wifi_communication_module.h"
 #include "config.h"
@@ -21,6 +23,15 @@ void init_commands(void)
 	memset(&commands_dependencies, 0, sizeof(commands_dependencies_t));
 }
 
+/*
+* Copies string argument into configuration field, result is always terminated.
+*/
+static void copy_string_argument(void* destination, const char* argument, size_t destination_size)
+{
+	strncpy((char *)destination, argument, destination_size - 1);
+	((char *)destination)[destination_size - 1] = '\0';
+}
+
 command_execution_result_t cmd_now(command_t* command, circular_buffer_t* response_buffer)
 {
 	LOG(1, "Executing command NOW");
@@ -116,7 +127,7 @@ command_execution_result_t cmd_id(command_t* command, circular_buffer_t* respons
 	{
 		if(!(*device_id))
 		{
-			strncpy((char *)device_id, command->argument.string_argument, sizeof(device_id));
+			copy_string_argument(device_id, command->argument.string_argument, sizeof(device_id));
 			global_dependencies.config_write(device_id, CFG_DEVICE_ID, 1, sizeof(device_id));
 		}
 		else
@@ -138,7 +149,7 @@ command_execution_result_t cmd_signature(command_t* command, circular_buffer_t*
 	{
 		if(!(*device_preshared_key))
 		{
-			strncpy((char *)device_preshared_key, command->argument.string_argument, sizeof(device_preshared_key));
+			copy_string_argument(device_preshared_key, command->argument.string_argument, sizeof(device_preshared_key));
 			global_dependencies.config_write(device_preshared_key, CFG_DEVICE_PRESHARED_KEY, 1, sizeof(device_preshared_key));
 		}
 		else
@@ -217,6 +228,81 @@ command_execution_result_t cmd_readings(command_t* command, circular_buffer_t* r
 	return (command->argument.uint16_argument == circular_buffer_size(&sensor_readings_buffer)) ? COMMAND_EXECUTED_SUCCESSFULLY : COMMAND_EXECUTED_PARTIALLY;
 }
 
+static void clear_buffers_statistics(void)
+{
+#ifdef CIRCULAR_BUFFER_STATISTICS
+	LOG(1, "Clearing buffers statistics");
+	
+	circular_buffer_t* buffer;
+	const char* name;
+	uint8_t i;
+	for(i = 0; circular_buffer_get_registered(i, &buffer, &name); i++)
+	{
+		SYNCHRONIZED_BLOCK_START
+		
+		circular_buffer_clear_statistics(buffer);
+		
+		SYNCHRONIZED_BLOCK_END
+	}
+#endif
+}
+
+command_execution_result_t cmd_trace(command_t* command, circular_buffer_t* response_buffer)
+{
+	LOG(1, "Executing command TRACE");
+	
+	if(command->has_argument && command->argument.bool_argument)
+	{
+		state_machine_trace_clear();
+		
+		// bool_argument shares storage with resume index, clear only once
+		command->has_argument = false;
+		command->argument.uint16_argument = 0;
+	}
+	
+	command->argument.uint16_argument += append_state_machine_trace(&state_machine_trace_buffer, command->argument.uint16_argument, response_buffer, true);
+	return (command->argument.uint16_argument == circular_buffer_size(&state_machine_trace_buffer)) ? COMMAND_EXECUTED_SUCCESSFULLY : COMMAND_EXECUTED_PARTIALLY;
+}
+
+command_execution_result_t cmd_energy(command_t* command, circular_buffer_t* response_buffer)
+{
+	LOG(1, "Executing command ENERGY");
+	
+	if(command->has_argument && command->argument.bool_argument)
+	{
+		state_residency_clear();
+		
+		// bool_argument shares storage with resume index, clear only once
+		command->has_argument = false;
+		command->argument.uint16_argument = 0;
+	}
+	
+	if(command->argument.uint16_argument == 0)
+	{
+		state_residency_update();
+	}
+	
+	command->argument.uint16_argument += append_state_residency(command->argument.uint16_argument, response_buffer, true);
+	return (command->argument.uint16_argument == state_residency_slots_count()) ? COMMAND_EXECUTED_SUCCESSFULLY : COMMAND_EXECUTED_PARTIALLY;
+}
+
+command_execution_result_t cmd_buffers(command_t* command, circular_buffer_t* response_buffer)
+{
+	LOG(1, "Executing command BUFFERS");
+	
+	if(command->has_argument && command->argument.bool_argument)
+	{
+		clear_buffers_statistics();
+		
+		// bool_argument shares storage with resume index, clear only once
+		command->has_argument = false;
+		command->argument.uint16_argument = 0;
+	}
+	
+	command->argument.uint16_argument += append_buffers_statistics(command->argument.uint16_argument, response_buffer, true);
+	return (command->argument.uint16_argument == circular_buffer_registered_count()) ? COMMAND_EXECUTED_SUCCESSFULLY : COMMAND_EXECUTED_PARTIALLY;
+}
+
 command_execution_result_t cmd_alarm(command_t* command, circular_buffer_t* response_buffer)
 {
 	LOG(1, "Executing command ALARM");
@@ -244,7 +330,7 @@ command_execution_result_t cmd_url(command_t* command, circular_buffer_t* respon
 	
 	if (command->has_argument)
 	{
-		strncpy(server_ip, command->argument.string_argument, sizeof(server_ip));
+		copy_string_argument(server_ip, command->argument.string_argument, sizeof(server_ip));
 		global_dependencies.config_write(server_ip, CFG_SERVER_IP, 1, sizeof(server_ip));
 		
 		if(commands_dependencies.communication_module_close_socket)
@@ -290,7 +376,7 @@ command_execution_result_t cmd_ssid(command_t* command, circular_buffer_t* respo
 		}
 		else
 		{
-			strncpy(wifi_ssid, command->argument.string_argument, sizeof(wifi_ssid));
+			copy_string_argument(wifi_ssid, command->argument.string_argument, sizeof(wifi_ssid));
 		}
 		global_dependencies.config_write(wifi_ssid, CFG_WIFI_SSID, 1, sizeof(wifi_ssid));
 		
@@ -317,7 +403,7 @@ command_execution_result_t cmd_pass(command_t* command, circular_buffer_t* respo
 		}
 		else
 		{
-			strncpy(wifi_password, command->argument.string_argument, sizeof(wifi_password));
+			copy_string_argument(wifi_password, command->argument.string_argument, sizeof(wifi_password));
 		}
 		global_dependencies.config_write(&wifi_password, CFG_WIFI_PASS, 1, sizeof(wifi_password));
 		
@@ -378,7 +464,7 @@ command_execution_result_t cmd_static_ip(command_t* command, circular_buffer_t*
 		}
 		else
 		{
-			strcpy(wifi_static_ip, command->argument.string_argument);
+			copy_string_argument(wifi_static_ip, command->argument.string_argument, sizeof(wifi_static_ip));
 			global_dependencies.config_write(&wifi_static_ip, CFG_WIFI_STATIC_IP, 1, sizeof(wifi_static_ip));
 			
 			if(commands_dependencies.is_static_ip_set && commands_dependencies.wifi_communication_module_disconnect)
@@ -402,7 +488,7 @@ command_execution_result_t cmd_static_mask(command_t* command, circular_buffer_t
 	
 	if(command->has_argument)
 	{
-		strcpy(wifi_static_mask, command->argument.string_argument);
+		copy_string_argument(wifi_static_mask, command->argument.string_argument, sizeof(wifi_static_mask));
 		global_dependencies.config_write(&wifi_static_mask, CFG_WIFI_STATIC_MASK, 1, sizeof(wifi_static_mask));
 		
 		if(commands_dependencies.is_static_ip_set && commands_dependencies.wifi_communication_module_disconnect)
@@ -425,7 +511,7 @@ command_execution_result_t cmd_static_gateway(command_t* command, circular_buffe
 	
 	if(command->has_argument)
 	{
-		strcpy(wifi_static_gateway, command->argument.string_argument);
+		copy_string_argument(wifi_static_gateway, command->argument.string_argument, sizeof(wifi_static_gateway));
 		global_dependencies.config_write(&wifi_static_gateway, CFG_WIFI_STATIC_GATEWAY, 1, sizeof(wifi_static_gateway));
 		
 		if(commands_dependencies.is_static_ip_set && commands_dependencies.wifi_communication_module_disconnect)
@@ -448,7 +534,7 @@ command_execution_result_t cmd_static_dns(command_t* command, circular_buffer_t*
 	
 	if(command->has_argument)
 	{
-		strcpy(wifi_static_dns, command->argument.string_argument);
+		copy_string_argument(wifi_static_dns, command->argument.string_argument, sizeof(wifi_static_dns));
 		global_dependencies.config_write(&wifi_static_dns, CFG_WIFI_STATIC_DNS, 1, sizeof(wifi_static_dns));
 		
 		if(commands_dependencies.is_static_ip_set && commands_dependencies.wifi_communication_module_disconnect)
@@ -531,7 +617,7 @@ command_execution_result_t cmd_multicast_address(command_t* command, circular_bu
 	
 	if (command->has_argument)
 	{
-		strncpy(knx_multicast_address, command->argument.string_argument, sizeof(knx_multicast_address));
+		copy_string_argument(knx_multicast_address, command->argument.string_argument, sizeof(knx_multicast_address));
 		global_dependencies.config_write(knx_multicast_address, CFG_KNX_MULTICAST_ADDRESS, 1, sizeof(knx_multicast_address));
 		
 		if(commands_dependencies.communication_module_close_socket)
@@ -607,6 +693,34 @@ command_execution_result_t cmd_ssl(command_t* command, circular_buffer_t* respon
 	return COMMAND_EXECUTED_SUCCESSFULLY;
 }
 
+command_execution_result_t cmd_mqtt_username(command_t* command, circular_buffer_t* response_buffer)
+{
+	LOG(1, "Executing command MQTT_USERNAME");
+	
+	if(command->has_argument)
+	{
+		copy_string_argument(mqtt_username, command->argument.string_argument, sizeof(mqtt_username));
+		global_dependencies.config_write(mqtt_username, CFG_MQTT_USERNAME, 1, sizeof(mqtt_username));
+	}
+	
+	append_mqtt_username(mqtt_username, response_buffer);
+	return COMMAND_EXECUTED_SUCCESSFULLY;
+}
+
+command_execution_result_t cmd_mqtt_password(command_t* command, circular_buffer_t* response_buffer)
+{
+	LOG(1, "Executing command MQTT_PASSWORD");
+	
+	if(command->has_argument)
+	{
+		copy_string_argument(mqtt_password, command->argument.string_argument, sizeof(mqtt_password));
+		global_dependencies.config_write(mqtt_password, CFG_MQTT_PASSWORD, 1, sizeof(mqtt_password));
+	}
+	
+	append_mqtt_password(mqtt_password, response_buffer);
+	return COMMAND_EXECUTED_SUCCESSFULLY;
+}
+
 command_execution_result_t execute_command(command_t* command, circular_buffer_t* response_buffer)
 {
 	switch(command->type)
@@ -735,6 +849,26 @@ command_execution_result_t execute_command(command_t* command, circular_buffer_t
 		{
 			return cmd_ssl(command, response_buffer);
 		}
+		case COMMAND_MQTT_USERNAME:
+		{
+			return cmd_mqtt_username(command, response_buffer);
+		}
+		case COMMAND_MQTT_PASSWORD:
+		{
+			return cmd_mqtt_password(command, response_buffer);
+		}
+		case COMMAND_TRACE:
+		{
+			return cmd_trace(command, response_buffer);
+		}
+		case COMMAND_ENERGY:
+		{
+			return cmd_energy(command, response_buffer);
+		}
+		case COMMAND_BUFFERS:
+		{
+			return cmd_buffers(command, response_buffer);
+		}
 		default:
 		{
 			append_bad_request(response_buffer);
@@ -21,8 +21,7 @@ extern "C"
 #define ARGUMENT_ITEM_KEY_VALUE_SEPARATOR ':'
 #define ARGUMENT_ITEM_VALUES_SEPARATOR ','
 
-#define COMMAND_ARGUMENT_MAX_LENGTH 32
-#define COMMAND_MAX_LENGTH (COMMAND_NAME_MAX_LENGTH + COMMAND_ARGUMENT_MAX_LENGTH + 2) /* ' ' + ';' */
+#define COMMAND_ARGUMENT_MAX_LENGTH 32 /* string arguments only, other arguments are parsed while streaming */
 
 typedef enum
 {
@@ -58,7 +57,11 @@ typedef enum
 	COMMAND_KNX_NAT,
 	COMMAND_LOCATION,
 	COMMAND_SSL,
-	COMMAND_MQTT_USERNAME
+	COMMAND_MQTT_USERNAME,
+	COMMAND_MQTT_PASSWORD,
+	COMMAND_TRACE,
+	COMMAND_ENERGY,
+	COMMAND_BUFFERS
 }
 commands_t;
 
@@ -140,6 +143,9 @@ command_execution_result_t cmd_location(command_t* command, circular_buffer_t* r
 command_execution_result_t cmd_ssl(command_t* command, circular_buffer_t* response_buffer);
 command_execution_result_t cmd_mqtt_username(command_t* command, circular_buffer_t* response_buffer);
 command_execution_result_t cmd_mqtt_password(command_t* command, circular_buffer_t* response_buffer);
+command_execution_result_t cmd_trace(command_t* command, circular_buffer_t* response_buffer);
+command_execution_result_t cmd_energy(command_t* command, circular_buffer_t* response_buffer);
+command_execution_result_t cmd_buffers(command_t* command, circular_buffer_t* response_buffer);
 
 #ifdef __cplusplus
 }
@@ -18,6 +18,7 @@ typedef struct
 	communication_module_process_handle_t (*stop)(void);
 	communication_module_type_data_t (*get_communication_result)(void);
 	void (*get_status)(char* status, uint16_t status_length);
+	bool (*waiting_for_data)(void);
 }
 communication_module_t;
 
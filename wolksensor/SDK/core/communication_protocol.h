@@ -18,8 +18,12 @@ typedef struct
 	communication_protocol_process_handle_t (*send_sensor_readings_and_system_data)(circular_buffer_t* sensor_readings_buffer, circular_buffer_t* system_buffer, uint16_t* sent_sensor_readings, uint16_t* sent_system_items);
 	communication_protocol_process_handle_t (*send_actuator_state)(actuator_t* actuator, actuator_state_t* actuator_state);
 	communication_protocol_process_handle_t (*receive_commands)(circular_buffer_t* commands_buffer);
+	communication_protocol_process_handle_t (*send_command_responses)(circular_buffer_t* command_response_buffer);
 	communication_protocol_process_handle_t (*disconnect)(void);
 	communication_protocol_type_data_t (*get_communication_result)(void);
+	bool (*keeps_connection)(void); // optional, communication module stays on after disconnect while it returns true
+	void (*set_persistent_connection)(bool persistent); // optional, keep connection open between data exchanges
+	bool (*process)(void); // optional, upkeep of kept connection, called while application is idle
 }
 communication_protocol_t;
 
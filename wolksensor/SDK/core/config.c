@@ -367,7 +367,7 @@ bool load_mqtt_password(void)
 {
 	if (global_dependencies.config_read(&mqtt_password, CFG_MQTT_PASSWORD, 1, sizeof(mqtt_password)))
 	{
-		LOG_PRINT(1, PSTR("Mqtt password was read: %s\r\n"), mqtt_password);
+		LOG(1, "Mqtt password was read");
 		return true;
 	}
 
@@ -9,26 +9,44 @@
 #include "event.h"
 #include "logger.h"
 
-void add_event_type(circular_buffer_t* event_buffer, uint8_t event_type)
+bool add_event_type(circular_buffer_t* event_buffer, uint8_t event_type)
 {
 	SYNCHRONIZED_BLOCK_START
 	event_t event;
 	event.type = event_type;
 	
 	event.timestamp = rtc_get_ts();
-	circular_buffer_add(event_buffer, &event);
+	bool event_added = circular_buffer_add(event_buffer, &event);
 
 	SYNCHRONIZED_BLOCK_END
+	
+	return event_added;
 }
 
-void add_event(circular_buffer_t* event_buffer, event_t* event)
+bool add_event(circular_buffer_t* event_buffer, event_t* event)
 {
 	SYNCHRONIZED_BLOCK_START
 	
 	event->timestamp = rtc_get_ts();
-	circular_buffer_add(event_buffer, event);
+	bool event_added = circular_buffer_add(event_buffer, event);
 	
 	SYNCHRONIZED_BLOCK_END
+	
+	return event_added;
+}
+
+bool add_urgent_event_type(circular_buffer_t* event_buffer, uint8_t event_type)
+{
+	SYNCHRONIZED_BLOCK_START
+	event_t event;
+	event.type = event_type;
+	
+	event.timestamp = rtc_get_ts();
+	bool event_added = circular_buffer_add_to_beginning(event_buffer, &event);
+
+	SYNCHRONIZED_BLOCK_END
+	
+	return event_added;
 }
 
 bool pop_event(circular_buffer_t* event_buffer, event_t* event)
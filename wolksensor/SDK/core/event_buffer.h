@@ -17,8 +17,10 @@ extern "C"
 #include "platform_specific.h"
 #include "event.h"
 
-void add_event_type(circular_buffer_t* event_buffer, uint8_t event_type);
-void add_event(circular_buffer_t* event_buffer, event_t* event);
+bool add_event_type(circular_buffer_t* event_buffer, uint8_t event_type);
+bool add_event(circular_buffer_t* event_buffer, event_t* event);
+/* urgent events are queued in front of already waiting events */
+bool add_urgent_event_type(circular_buffer_t* event_buffer, uint8_t event_type);
 bool pop_event(circular_buffer_t* event_buffer, event_t* event);
 void clear_event_buffer(circular_buffer_t* event_buffer);
 uint16_t events_count(circular_buffer_t* event_buffer);
@@ -6,6 +6,11 @@
 typedef struct
 {
 	uint32_t (*rtc_get)(void);
+	// Free running RTC ticks, used for fine grained time differences.
+	uint32_t (*rtc_get_ticks)(void);
+	// RTC interrupt calling software_timer_expired at RTC ticks, or right away if ticks already passed.
+	void (*rtc_set_alarm)(uint32_t ticks);
+	void (*rtc_clear_alarm)(void);
 	// This function sends response over eg. UART.
 	void (*send_response) (const char* response, uint16_t length);
 	void (*log)(const char* message, uint16_t length);
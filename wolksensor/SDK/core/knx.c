@@ -3,20 +3,39 @@
 #include "config.h"
 #include "event_buffer.h"
 #include "state_machine.h"
+#include "state_machine_trace.h"
 #include "communication_module.h"
 #include "wifi_communication_module.h"
 #include "wifi_communication_module_dependencies.h"
+#include "command_buffer.h"
+#include "software_timer.h"
 
 #define EVENTS_BUFFER_SIZE 10
 #define KNX_BUFFER_SIZE 256
 
+// tunneling requests sent before waiting for acks, KNXnet/IP tunneling servers accept one outstanding request
+#define KNX_TUNNELING_WINDOW_SIZE 1
+
+// tunneling server drops connection not checked within 120 seconds
+#define KNX_CONNECTION_STATE_PERIOD 60
+#define KNX_CONNECTION_STATE_REQUESTS 3
+
+#define KNX_DPT_1_BIT 1
+#define KNX_DPT_2_BYTE_FLOAT 9
+
+#define KNX_GROUP_WRITE_MAX_DATA 4
+
+#define KNX_DATAPOINTS_COUNT (sizeof(knx_datapoints) / sizeof(knx_datapoint_t))
+
 typedef enum
 {
 	KNX_ROUTING_MESSAGE = 0,
 	KNX_TUNNELING_CONNECT_RESPONSE,
 	KNX_TUNNELING_ACK,
 	KNX_TUNNELING_VALUE_CONFIRMATION,
-	KNX_TUNNELING_DISCONNECT_RESPONSE
+	KNX_TUNNELING_DISCONNECT_REQUEST,
+	KNX_TUNNELING_DISCONNECT_RESPONSE,
+	KNX_TUNNELING_CONNECTION_STATE_RESPONSE
 }
 knx_message_type_t;
 
@@ -26,19 +45,54 @@ typedef struct
 }
 knx_tunneling_connect_response_t;
 
+typedef struct
+{
+	uint8_t channel;
+	uint8_t sequence_counter;
+	uint8_t status;
+}
+knx_tunneling_header_t;
+
 typedef union
 {
 	knx_tunneling_connect_response_t knx_tunneling_connect_response;
+	knx_tunneling_header_t knx_tunneling_header;
 }
 knx_message_data_t;
 
+typedef struct
+{
+	uint16_t group_address;
+	uint8_t data[KNX_GROUP_WRITE_MAX_DATA];
+	uint8_t data_length; // 0 if message is not group value write
+}
+knx_group_write_t;
+
 typedef struct
 {
 	knx_message_type_t type;
 	knx_message_data_t data;
+	knx_group_write_t group_write;
 }
 knx_message_t;
 
+typedef struct
+{
+	char sensor_id;
+	uint8_t main_type;
+	uint16_t multiplier; // sensor value to DPT 9 value in hundredths
+	uint8_t group_address_offset; // added to configured group address
+}
+knx_datapoint_t;
+
+typedef struct
+{
+	uint8_t group_address_offset; // added to configured group address
+	uint8_t count; // consecutive group addresses, one per actuator or datapoint
+	bool (*decode)(knx_group_write_t* group_write, uint8_t index, command_t* command);
+}
+knx_group_object_t;
+
 typedef enum
 {
 	STATE_KNX_ROUTING = 0,
@@ -50,6 +104,9 @@ typedef enum
 	STATE_KNX_TUNNELING,
 		STATE_KNX_TUNELING_SEND,
 		STATE_KNX_TUNELING_RECEIVE_ACK,
+		STATE_KNX_TUNELING_SEND_ACK,
+		STATE_KNX_SEND_CONNECTION_STATE_REQUEST,
+		STATE_KNX_RECEIVE_CONNECTION_STATE_RESPONSE,
 	STATE_KNX_DISCONNECTING,
 		STATE_KNX_SEND_DISCONNECT_REQUEST,
 		STATE_KNX_RECEIVE_DISCONNECT_RESPONSE
@@ -59,22 +116,71 @@ knx_states_t;
 typedef enum
 {
 	EVENT_SEND = 0,
-	EVENT_RECEIVE_ACK,
+	EVENT_RECEIVE,
 	EVENT_DISCONNECT,
+	EVENT_CONNECTION_STATE,
 	EVENT_COMMUNICATION_MODULE_PROCESS,
 	EVENT_COMMUNICATION_MODULE_DONE
 }
 knx_events_t;
 
 static state_machine_state_t state_machine;
-static state_machine_state_t states[12];
+static state_machine_state_t states[15];
 
 static circular_buffer_t events_buffer;
 static event_t events_buffer_storage[EVENTS_BUFFER_SIZE];
 
+static const knx_datapoint_t knx_datapoints[] =
+{
+	{'T', KNX_DPT_2_BYTE_FLOAT, 10, 0}, // DPT 9.001 temperature, value in 0.1 C
+	{'P', KNX_DPT_2_BYTE_FLOAT, 1000, 1}, // DPT 9.006 pressure, value in 0.1 hPa sent in Pa
+	{'H', KNX_DPT_2_BYTE_FLOAT, 10, 2}, // DPT 9.007 humidity, value in 0.1 %
+	{'M', KNX_DPT_1_BIT, 1, 3} // DPT 1.002 movement
+};
+
+static bool decode_actuator_set(knx_group_write_t* group_write, uint8_t index, command_t* command);
+static bool decode_heartbeat(knx_group_write_t* group_write, uint8_t index, command_t* command);
+static bool decode_alarm_low(knx_group_write_t* group_write, uint8_t index, command_t* command);
+static bool decode_alarm_high(knx_group_write_t* group_write, uint8_t index, command_t* command);
+
+// group writes received from bus are decoded directly to commands
+static const knx_group_object_t knx_group_objects[] =
+{
+	{0x10, NUMBER_OF_ACTUATORS, decode_actuator_set}, // DPT 1.001 switch, DPT 8.001 motor and servo
+	{0x20, 1, decode_heartbeat}, // DPT 7.006 minutes
+	{0x30, KNX_DATAPOINTS_COUNT, decode_alarm_low}, // DPT 9 threshold of datapoint
+	{0x40, KNX_DATAPOINTS_COUNT, decode_alarm_high} // DPT 9 threshold of datapoint
+};
+
+#define KNX_GROUP_OBJECTS_COUNT (sizeof(knx_group_objects) / sizeof(knx_group_object_t))
+
+static circular_buffer_t* received_commands_buffer = NULL;
+static bool receiving_commands = false;
+
 static circular_buffer_t* sending_sensor_readings_buffer = NULL;
 static uint16_t* sensor_readings_sent = NULL;
 
+// group values are states, only the latest reading of each sensor is sent
+static sensor_readings_t sending_reading;
+static uint8_t sending_datapoint = 0;
+static bool sending_readings = false;
+static uint8_t tunneling_acks_pending = 0;
+static uint8_t tunneling_confirmations_pending = 0;
+static uint16_t tunneling_received_data_size = 0;
+
+// tunnel is kept open between sends when persistent, server is polled with connection state requests
+static bool persistent_tunnel = false;
+static bool tunnel_open = false;
+static bool reconnect_attempted = false;
+static software_timer_t connection_state_timer;
+static volatile bool connection_state_due = false;
+static uint8_t connection_state_requests = 0;
+
+// tunneling requests from server must be acknowledged or server closes connection
+static bool server_request_to_ack = false;
+static uint8_t server_sequence_counter = 0;
+static uint8_t server_request_sequence_counter = 0;
+
 static communication_protocol_type_data_t communication_protocol_type_data;
 
 static circular_buffer_t knx_buffer;
@@ -96,6 +202,9 @@ static bool state_connecting(state_machine_state_t* state, event_t* event);
 static bool state_tunneling(state_machine_state_t* state, event_t* event);
 	static bool state_tunneling_send(state_machine_state_t* state, event_t* event);
 	static bool state_tunneling_receive_ack(state_machine_state_t* state, event_t* event);
+	static bool state_tunneling_send_ack(state_machine_state_t* state, event_t* event);
+	static bool state_send_connection_state_request(state_machine_state_t* state, event_t* event);
+	static bool state_receive_connection_state_response(state_machine_state_t* state, event_t* event);
 static bool state_disconnecting(state_machine_state_t* state, event_t* event);
 	static bool state_send_disconnect_request(state_machine_state_t* state, event_t* event);
 	static bool state_receive_disconnect_response(state_machine_state_t* state, event_t* event);
@@ -113,11 +222,13 @@ static void transition(knx_states_t new_state_id)
 static void init_events_buffer(void)
 {
 	circular_buffer_init(&events_buffer, events_buffer_storage, EVENTS_BUFFER_SIZE, sizeof(event_t), true, true);
+	circular_buffer_register(&events_buffer, PSTR("KNX_EVENTS"));
 }
 
 static void init_knx_buffer(void)
 {
 	circular_buffer_init(&knx_buffer, knx_buffer_storage, KNX_BUFFER_SIZE, sizeof(uint8_t), true, true);
+	circular_buffer_register(&knx_buffer, PSTR("KNX"));
 }
 
 static bool knx_process(void)
@@ -137,6 +248,21 @@ static void clear_communication_protocol_data(void)
 	memset(&communication_protocol_type_data, 0, sizeof(communication_protocol_type_data_t));
 	communication_protocol_type_data.type = COMMUNICATION_PROTOCOL_KNX;
 }
+
+static void connection_state_timer_expired(void* argument)
+{
+	if(tunnel_open)
+	{
+		connection_state_due = true;
+		add_event_type(&events_buffer, EVENT_CONNECTION_STATE);
+	}
+}
+
+static void restart_connection_state_timer(void)
+{
+	connection_state_due = false;
+	software_timer_start(&connection_state_timer, connection_state_timer_expired, NULL, KNX_CONNECTION_STATE_PERIOD * 1000UL, 0);
+}
 	
 void knx_init(void)
 {
@@ -155,6 +281,7 @@ void knx_init(void)
 	state_machine.parent = NULL;
 	state_machine.current_state = -1;
 	state_machine.handler = knx_handler;
+	state_machine_trace_register(&state_machine, STATE_MACHINE_TRACE_KNX);
 	
 	init_state(STATE_KNX_ROUTING, NULL, &state_machine, -1, state_routing);
 		init_state(STATE_KNX_ROUTING_SEND, NULL, &states[STATE_KNX_ROUTING], -1, state_routing_send);
@@ -165,6 +292,9 @@ void knx_init(void)
 	init_state(STATE_KNX_TUNNELING, NULL, &state_machine, -1, state_tunneling);
 		init_state(STATE_KNX_TUNELING_SEND, NULL, &states[STATE_KNX_TUNNELING], -1, state_tunneling_send);
 		init_state(STATE_KNX_TUNELING_RECEIVE_ACK, NULL, &states[STATE_KNX_TUNNELING], -1, state_tunneling_receive_ack);
+		init_state(STATE_KNX_TUNELING_SEND_ACK, NULL, &states[STATE_KNX_TUNNELING], -1, state_tunneling_send_ack);
+		init_state(STATE_KNX_SEND_CONNECTION_STATE_REQUEST, NULL, &states[STATE_KNX_TUNNELING], -1, state_send_connection_state_request);
+		init_state(STATE_KNX_RECEIVE_CONNECTION_STATE_RESPONSE, NULL, &states[STATE_KNX_TUNNELING], -1, state_receive_connection_state_response);
 	init_state(STATE_KNX_DISCONNECTING, NULL, &state_machine, -1, state_disconnecting);
 		init_state(STATE_KNX_SEND_DISCONNECT_REQUEST, NULL, &states[STATE_KNX_DISCONNECTING], -1, state_send_disconnect_request);
 		init_state(STATE_KNX_RECEIVE_DISCONNECT_RESPONSE, NULL, &states[STATE_KNX_DISCONNECTING], -1, state_receive_disconnect_response);
@@ -195,6 +325,7 @@ communication_protocol_process_handle_t knx_protocol_send_sensor_readings_and_sy
 	
 	sending_sensor_readings_buffer = sensor_readings_buffer;
 	sensor_readings_sent = sent_sensor_readings;
+	reconnect_attempted = false;
 	
 	add_event_type(&events_buffer, EVENT_SEND);
 	
@@ -207,7 +338,9 @@ communication_protocol_process_handle_t knx_protocol_receive_commands(circular_b
 	
 	clear_communication_protocol_data();
 	
-	add_event_type(&events_buffer, EVENT_RECEIVE_ACK);
+	received_commands_buffer = commands_buffer;
+	
+	add_event_type(&events_buffer, EVENT_RECEIVE);
 	
 	return knx_process;
 }
@@ -228,6 +361,21 @@ communication_protocol_type_data_t get_knx_communication_result(void)
 	return communication_protocol_type_data;
 }
 
+void knx_set_persistent_tunnel(bool persistent)
+{
+	persistent_tunnel = persistent;
+}
+
+bool knx_protocol_keeps_connection(void)
+{
+	return persistent_tunnel && tunnel_open;
+}
+
+bool knx_protocol_process(void)
+{
+	return knx_process();
+}
+
 static bool knx_tunneling_parameters_set(void)
 {
 	return *server_ip != 0 && server_port != 0;
@@ -290,65 +438,77 @@ static uint16_t create_knx_connect_message(uint8_t* buffer, uint32_t ip_address,
 	return total_size;
 }
 
-static void encode_knx_float_16(int16_t sensor_value, uint8_t* knx_encoded_float_value)
+/*
+* Encodes value given in hundredths as 2 byte float (DPT 9) without floating point arithmetic.
+*/
+static void encode_knx_float_16(int32_t value, uint8_t* knx_encoded_float_value)
 {
-	float float_value = (float)sensor_value;
-	float_value *= 10; // not 100 since our value is already multiplied with 10
-	int exp = 0;
-	while (abs(float_value) > 2047)
+	uint8_t exponent = 0;
+	while((value > 2047 || value < -2048) && exponent < 15)
 	{
-		float_value /= 2;
-		exp++;
+		value /= 2;
+		exponent++;
 	}
 	
-	int mantisse = (int)float_value;
-	knx_encoded_float_value[0] = (uint8_t)((((mantisse >> 8) & 8) << 4) | (exp << 3) | ((mantisse >> 8) & 7));
-	knx_encoded_float_value[1] = (uint8_t)mantisse;
+	uint16_t mantissa = (uint16_t)value & 0x07FF;
+	knx_encoded_float_value[0] = (value < 0 ? 0x80 : 0x00) | (exponent << 3) | (mantissa >> 8);
+	knx_encoded_float_value[1] = mantissa & 0x00FF;
 }
 
-uint16_t create_knx_cEMI_temperature_message(uint8_t* buffer, int16_t temperature, uint8_t physical_address[2])
-{		
+static uint16_t create_knx_cEMI_datapoint_message(uint8_t* buffer, const knx_datapoint_t* datapoint, int16_t value)
+{
+	uint16_t group_address = ((knx_group_address[0] << 8) | knx_group_address[1]) + datapoint->group_address_offset;
+	
 	buffer[0] = 0xBC;
 	buffer[1] = 0xE0;
 	buffer[2] = knx_physical_address[0];
 	buffer[3] = knx_physical_address[1];
-	buffer[4] = knx_group_address[0];
-	buffer[5] = knx_group_address[1];
-	buffer[6] = 0x03;
+	buffer[4] = group_address >> 8;
+	buffer[5] = group_address & 0x00FF;
 	buffer[7] = 0x00;
+	
+	if(datapoint->main_type == KNX_DPT_1_BIT)
+	{
+		buffer[6] = 0x01;
+		buffer[8] = 0x80 | (value ? 0x01 : 0x00); // value is part of group value write
+		
+		return 9;
+	}
+	
+	buffer[6] = 0x03;
 	buffer[8] = 0x80;
-	encode_knx_float_16(temperature, &buffer[9]);
+	encode_knx_float_16((int32_t)value * datapoint->multiplier, &buffer[9]);
 	
 	return 11;
 }
 
-uint16_t create_knx_routing_temperature_message(uint8_t* buffer, int16_t temperature, uint8_t physical_address[2])
+static uint16_t create_knx_routing_message(uint8_t* buffer, const knx_datapoint_t* datapoint, int16_t value)
 {
+	uint16_t datapoint_message_size = create_knx_cEMI_datapoint_message(buffer + 8, datapoint, value);
+	
 	buffer[0] = 0x06; // header size
 	buffer[1] = 0x10; // protocol version
 	buffer[2] = 0x05; // service type
 	buffer[3] = 0x30; // service type
-	buffer[4] = 0x00; // total size
-	buffer[5] = 0x13; // total size
+	buffer[4] = (datapoint_message_size + 8) >> 8; // total size
+	buffer[5] = (datapoint_message_size + 8) & 0x00FF; // total size
 	
 	buffer[6] = 0x29; // type
 	buffer[7] = 0x00; // reserved
 	
-	uint16_t temperature_message_size = create_knx_cEMI_temperature_message(buffer + 8, temperature, physical_address);
-	
-	return temperature_message_size + 8;
+	return datapoint_message_size + 8;
 }
 
-static uint16_t create_knx_tunneling_temperature_message(uint8_t* buffer, int16_t temperature, uint8_t physical_address[2], uint8_t communication_channel, uint8_t counter)
+static uint16_t create_knx_tunneling_message(uint8_t* buffer, const knx_datapoint_t* datapoint, int16_t value, uint8_t communication_channel, uint8_t counter)
 {
-	uint16_t temperature_message_size = create_knx_cEMI_temperature_message(buffer + 12, temperature, physical_address);
+	uint16_t datapoint_message_size = create_knx_cEMI_datapoint_message(buffer + 12, datapoint, value);
 	
 	buffer[0] = 0x06; // header size
 	buffer[1] = 0x10; // protocol version
 	buffer[2] = 0x04; // service type
 	buffer[3] = 0x20; // service type
-	buffer[4] = (temperature_message_size + 6) >> 8; // total size
-	buffer[5] = (temperature_message_size + 6) & 0x00FF; // total size
+	buffer[4] = (datapoint_message_size + 12) >> 8; // total size
+	buffer[5] = (datapoint_message_size + 12) & 0x00FF; // total size
 	
 	buffer[6] = 0x04; // header size
 	buffer[7] = communication_channel; // communication channel
@@ -358,15 +518,18 @@ static uint16_t create_knx_tunneling_temperature_message(uint8_t* buffer, int16_
 	buffer[10] = 0x11; // type
 	buffer[11] = 0x00; // reserved
 	
-	return temperature_message_size + 6 + 6;
+	return datapoint_message_size + 12;
 }
 
-static uint16_t create_knx_disconnect_message(uint8_t* buffer, uint8_t channel, uint32_t ip_address, uint16_t port)
+/*
+* Disconnect and connection state requests differ only in service type.
+*/
+static uint16_t create_knx_connection_message(uint8_t* buffer, uint16_t service_type, uint8_t channel, uint32_t ip_address, uint16_t port)
 {
 	buffer[0] = 0x06; // header size
 	buffer[1] = 0x10; // protocol version
-	buffer[2] = 0x02; // service type
-	buffer[3] = 0x09; // service type
+	buffer[2] = service_type >> 8; // service type
+	buffer[3] = service_type & 0x00FF; // service type
 	buffer[4] = 0x00; // total size
 	buffer[5] = 0x10; // total size
 	
@@ -387,6 +550,79 @@ static uint16_t create_knx_disconnect_message(uint8_t* buffer, uint8_t channel,
 	return 16;
 }
 
+static uint16_t create_knx_tunneling_ack_message(uint8_t* buffer, uint8_t channel, uint8_t counter)
+{
+	buffer[0] = 0x06; // header size
+	buffer[1] = 0x10; // protocol version
+	buffer[2] = 0x04; // service type
+	buffer[3] = 0x21; // service type
+	buffer[4] = 0x00; // total size
+	buffer[5] = 0x0A; // total size
+	
+	buffer[6] = 0x04; // structure length
+	buffer[7] = channel; // channel
+	buffer[8] = counter; // sequence counter
+	buffer[9] = 0x00; // status
+	
+	return 10;
+}
+
+/*
+* Decodes 2 byte float (DPT 9) to value in hundredths.
+*/
+static int32_t decode_knx_float_16(uint8_t* knx_encoded_float_value)
+{
+	uint8_t exponent = (knx_encoded_float_value[0] >> 3) & 0x0F;
+	int16_t mantissa = ((knx_encoded_float_value[0] & 0x07) << 8) | knx_encoded_float_value[1];
+	if(knx_encoded_float_value[0] & 0x80)
+	{
+		mantissa -= 2048;
+	}
+	
+	return (int32_t)mantissa * ((int32_t)1 << exponent);
+}
+
+/*
+* Reads group value write from cEMI L_Data.ind starting at offset of message.
+*/
+static void parse_knx_group_write(circular_buffer_t* buffer, uint16_t offset, uint16_t message_size, knx_group_write_t* group_write)
+{
+	group_write->data_length = 0;
+	
+	uint8_t header[2];
+	if(offset + 2 > message_size || circular_buffer_peek_array(buffer, offset, 2, header) != 2 || header[0] != 0x29)
+	{
+		return;
+	}
+	
+	// control fields, source and destination address, length, TPCI and APCI after additional info
+	uint16_t frame_offset = offset + 2 + header[1];
+	uint8_t frame[9];
+	if(frame_offset + 9 > message_size || circular_buffer_peek_array(buffer, frame_offset, 9, frame) != 9)
+	{
+		return;
+	}
+	
+	if(!(frame[1] & 0x80) || (frame[7] & 0x03) != 0 || (frame[8] & 0xC0) != 0x80)
+	{
+		return;
+	}
+	
+	group_write->group_address = (frame[4] << 8) | frame[5];
+	
+	if(frame[6] == 1)
+	{
+		// 6 bit value is part of group value write
+		group_write->data[0] = frame[8] & 0x3F;
+		group_write->data_length = 1;
+	}
+	else if(frame[6] > 1 && frame[6] - 1 <= KNX_GROUP_WRITE_MAX_DATA && frame_offset + 8 + frame[6] <= message_size)
+	{
+		circular_buffer_peek_array(buffer, frame_offset + 9, frame[6] - 1, group_write->data);
+		group_write->data_length = frame[6] - 1;
+	}
+}
+
 static bool parse_knx_message(circular_buffer_t* buffer, knx_message_t* knx_message)
 {
 	uint8_t message_type[] = {0, 0};		
@@ -397,6 +633,8 @@ static bool parse_knx_message(circular_buffer_t* buffer, knx_message_t* knx_mess
 	
 	LOG_PRINT(1, PSTR("Received KNX message type %02X%02X\r\n"), message_type[0],  message_type[1]);
 	
+	knx_message->group_write.data_length = 0;
+	
 	if(message_type[0] == 0x05 && message_type[1] == 0x30)
 	{
 		knx_message->type = KNX_ROUTING_MESSAGE;
@@ -429,10 +667,37 @@ static bool parse_knx_message(circular_buffer_t* buffer, knx_message_t* knx_mess
 		return true;
 	}
 	
+	if(message_type[0] == 0x02 && message_type[1] == 0x09)
+	{
+		knx_message->type = KNX_TUNNELING_DISCONNECT_REQUEST;
+		
+		circular_buffer_peek(buffer, 6, &knx_message->data.knx_tunneling_header.channel);
+		
+		circular_buffer_drop_from_beggining(buffer, 16);
+		
+		return true;
+	}
+	
+	if(message_type[0] == 0x02 && message_type[1] == 0x08)
+	{
+		knx_message->type = KNX_TUNNELING_CONNECTION_STATE_RESPONSE;
+		
+		circular_buffer_peek(buffer, 6, &knx_message->data.knx_tunneling_header.channel);
+		circular_buffer_peek(buffer, 7, &knx_message->data.knx_tunneling_header.status);
+		
+		circular_buffer_drop_from_beggining(buffer, 8);
+		
+		return true;
+	}
+	
 	if(message_type[0] == 0x04 && message_type[1] == 0x21)
 	{
 		knx_message->type = KNX_TUNNELING_ACK;
 		
+		circular_buffer_peek(buffer, 7, &knx_message->data.knx_tunneling_header.channel);
+		circular_buffer_peek(buffer, 8, &knx_message->data.knx_tunneling_header.sequence_counter);
+		circular_buffer_peek(buffer, 9, &knx_message->data.knx_tunneling_header.status);
+		
 		uint8_t routing_message_size = 0;
 		circular_buffer_peek(buffer, 5, &routing_message_size);
 		
@@ -445,9 +710,14 @@ static bool parse_knx_message(circular_buffer_t* buffer, knx_message_t* knx_mess
 	{
 		knx_message->type = KNX_TUNNELING_VALUE_CONFIRMATION;
 		
+		circular_buffer_peek(buffer, 7, &knx_message->data.knx_tunneling_header.channel);
+		circular_buffer_peek(buffer, 8, &knx_message->data.knx_tunneling_header.sequence_counter);
+		
 		uint8_t routing_message_size = 0;
 		circular_buffer_peek(buffer, 5, &routing_message_size);
 		
+		parse_knx_group_write(buffer, 10, routing_message_size, &knx_message->group_write);
+		
 		circular_buffer_drop_from_beggining(buffer, routing_message_size);
 		
 		return true;
@@ -456,6 +726,311 @@ static bool parse_knx_message(circular_buffer_t* buffer, knx_message_t* knx_mess
 	return false;
 }
 
+static bool load_latest_sensor_readings(void)
+{
+	sending_datapoint = 0;
+	
+	uint16_t count = circular_buffer_size(sending_sensor_readings_buffer);
+	
+	return count > 0 && circular_buffer_peek(sending_sensor_readings_buffer, count - 1, &sending_reading);
+}
+
+/*
+* Moves to the next datapoint, starting with the current one, whose sensor has value in the reading being sent.
+*/
+static bool find_datapoint_to_send(int16_t* value)
+{
+	for(; sending_datapoint < KNX_DATAPOINTS_COUNT; sending_datapoint++)
+	{
+		uint8_t i;
+		for(i = 0; i < NUMBER_OF_SENSORS; i++)
+		{
+			if(sensors[i].id == knx_datapoints[sending_datapoint].sensor_id && sending_reading.values[i] != SENSOR_VALUE_NOT_SET)
+			{
+				*value = sending_reading.values[i];
+				return true;
+			}
+		}
+	}
+	
+	return false;
+}
+
+static bool send_routing_message(void)
+{
+	int16_t value;
+	if(!find_datapoint_to_send(&value))
+	{
+		return false;
+	}
+	
+	circular_buffer_clear(&knx_buffer);
+	
+	uint16_t message_size = create_knx_routing_message(knx_buffer_storage, &knx_datapoints[sending_datapoint], value);
+	
+	communication_module_process_handle = wifi_communication_module_send_to(knx_buffer_storage, message_size);
+	add_event_type(&events_buffer, EVENT_COMMUNICATION_MODULE_PROCESS);
+	
+	return true;
+}
+
+static bool send_tunneling_message(void)
+{
+	int16_t value;
+	if(!find_datapoint_to_send(&value))
+	{
+		return false;
+	}
+	
+	circular_buffer_clear(&knx_buffer);
+	
+	uint16_t message_size = create_knx_tunneling_message(knx_buffer_storage, &knx_datapoints[sending_datapoint], value, channel, sequence_counter++);
+	
+	communication_module_process_handle = wifi_communication_module_send_to(knx_buffer_storage, message_size);
+	add_event_type(&events_buffer, EVENT_COMMUNICATION_MODULE_PROCESS);
+	
+	return true;
+}
+
+static void receive_tunneling_messages(void)
+{
+	circular_buffer_clear(&knx_buffer);
+	tunneling_received_data_size = 0;
+	
+	communication_module_process_handle = wifi_communication_module_receive_from(knx_buffer_storage, KNX_BUFFER_SIZE, &tunneling_received_data_size);
+	add_event_type(&events_buffer, EVENT_COMMUNICATION_MODULE_PROCESS);
+}
+
+static void open_tunnel(uint8_t tunnel_channel)
+{
+	channel = tunnel_channel;
+	sequence_counter = 0;
+	server_sequence_counter = 0;
+	server_request_to_ack = false;
+	tunneling_acks_pending = 0;
+	tunneling_confirmations_pending = 0;
+	connection_state_requests = 0;
+	tunnel_open = true;
+	restart_connection_state_timer();
+}
+
+static void close_tunnel(void)
+{
+	channel = 0;
+	tunnel_open = false;
+	software_timer_stop(&connection_state_timer);
+	server_request_to_ack = false;
+	receiving_commands = false;
+}
+
+static bool decode_actuator_set(knx_group_write_t* group_write, uint8_t index, command_t* command)
+{
+	command->type = COMMAND_SET;
+	strcpy(command->argument.set_argument.id, actuators[index].id);
+	
+	switch(actuators[index].type)
+	{
+		case ACTUATOR_TYPE_SWITCH:
+		{
+			command->argument.set_argument.target_value.switch_value = group_write->data[0] & 0x01;
+			return true;
+		}
+		case ACTUATOR_TYPE_DC_MOTOR:
+		{
+			if(group_write->data_length != 2)
+			{
+				return false;
+			}
+			
+			command->argument.set_argument.target_value.dc_motor_value = (int16_t)((group_write->data[0] << 8) | group_write->data[1]);
+			return true;
+		}
+		case ACTUATOR_TYPE_SERVO:
+		{
+			if(group_write->data_length != 2)
+			{
+				return false;
+			}
+			
+			command->argument.set_argument.target_value.servo_value = (int16_t)((group_write->data[0] << 8) | group_write->data[1]);
+			return true;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static bool decode_heartbeat(knx_group_write_t* group_write, uint8_t index, command_t* command)
+{
+	if(group_write->data_length != 2)
+	{
+		return false;
+	}
+	
+	command->type = COMMAND_HEARTBEAT;
+	command->argument.uint32_argument = (group_write->data[0] << 8) | group_write->data[1];
+	
+	return true;
+}
+
+/*
+* Alarms command carries thresholds of all sensors, only threshold of datapoint's sensor is changed.
+*/
+static sensor_alarm_t* decode_alarm(knx_group_write_t* group_write, uint8_t index, command_t* command, bool high)
+{
+	const knx_datapoint_t* datapoint = &knx_datapoints[index];
+	if(datapoint->main_type != KNX_DPT_2_BYTE_FLOAT || group_write->data_length != 2)
+	{
+		return NULL;
+	}
+	
+	uint8_t i;
+	for(i = 0; i < NUMBER_OF_SENSORS; i++)
+	{
+		if(sensors[i].id == datapoint->sensor_id)
+		{
+			command->type = COMMAND_ALARM;
+			memcpy(&command->argument.sensors_alarms_argument, &sensors_alarms, sizeof(sensors_alarms));
+			
+			sensor_alarm_t* alarm = high ? &command->argument.sensors_alarms_argument[i].alarm_high : &command->argument.sensors_alarms_argument[i].alarm_low;
+			alarm->enabled = true;
+			alarm->value = decode_knx_float_16(group_write->data) / datapoint->multiplier;
+			
+			return alarm;
+		}
+	}
+	
+	return NULL;
+}
+
+static bool decode_alarm_low(knx_group_write_t* group_write, uint8_t index, command_t* command)
+{
+	return decode_alarm(group_write, index, command, false) != NULL;
+}
+
+static bool decode_alarm_high(knx_group_write_t* group_write, uint8_t index, command_t* command)
+{
+	return decode_alarm(group_write, index, command, true) != NULL;
+}
+
+/*
+* Finds group object of group write and queues its command for execution.
+*/
+static void dispatch_group_write(knx_group_write_t* group_write)
+{
+	if(received_commands_buffer == NULL)
+	{
+		return;
+	}
+	
+	uint16_t base_group_address = (knx_group_address[0] << 8) | knx_group_address[1];
+	
+	uint8_t i;
+	for(i = 0; i < KNX_GROUP_OBJECTS_COUNT; i++)
+	{
+		uint16_t group_address = base_group_address + knx_group_objects[i].group_address_offset;
+		if(group_write->group_address < group_address || group_write->group_address >= group_address + knx_group_objects[i].count)
+		{
+			continue;
+		}
+		
+		command_t command;
+		memset(&command, 0, sizeof(command_t));
+		command.has_argument = true;
+		
+		if(knx_group_objects[i].decode(group_write, group_write->group_address - group_address, &command))
+		{
+			LOG_PRINT(1, PSTR("Knx group write %04X queued as command %u\r\n"), group_write->group_address, command.type);
+			
+			command_buffer_add(received_commands_buffer, &command);
+		}
+		
+		return;
+	}
+}
+
+/*
+* Server tunneling requests, value confirmations of sent requests and group writes from bus,
+* are acknowledged every time and handled only once.
+*/
+static void handle_server_tunneling_request(knx_message_t* knx_message)
+{
+	knx_tunneling_header_t* header = &knx_message->data.knx_tunneling_header;
+	
+	if(header->sequence_counter == server_sequence_counter)
+	{
+		server_sequence_counter++;
+		
+		if(knx_message->group_write.data_length > 0)
+		{
+			dispatch_group_write(&knx_message->group_write);
+		}
+		else if(tunneling_confirmations_pending > 0)
+		{
+			tunneling_confirmations_pending--;
+		}
+	}
+	
+	server_request_sequence_counter = header->sequence_counter;
+	server_request_to_ack = true;
+}
+
+/*
+* Lost tunnel is connected again once per send while readings are being sent.
+*/
+static bool reconnect_tunnel(void)
+{
+	close_tunnel();
+	
+	if(!sending_readings || reconnect_attempted)
+	{
+		sending_readings = false;
+		return false;
+	}
+	
+	LOG(1, "Knx tunnel lost, reconnecting");
+	
+	reconnect_attempted = true;
+	sending_readings = false;
+	
+	add_event_type(&events_buffer, EVENT_SEND);
+	transition(STATE_KNX_CONNECTING);
+	
+	return true;
+}
+
+static void continue_tunneling(void)
+{
+	int16_t value;
+	
+	if(server_request_to_ack)
+	{
+		transition(STATE_KNX_TUNELING_SEND_ACK);
+	}
+	else if(sending_readings && tunneling_acks_pending < KNX_TUNNELING_WINDOW_SIZE && find_datapoint_to_send(&value))
+	{
+		transition(STATE_KNX_TUNELING_SEND);
+	}
+	else if(tunneling_acks_pending > 0 || tunneling_confirmations_pending > 0 || receiving_commands)
+	{
+		transition(STATE_KNX_TUNELING_RECEIVE_ACK);
+	}
+	else
+	{
+		if(sending_readings)
+		{
+			LOG(1, "Knx all tunneling messages acknowledged");
+			
+			sending_readings = false;
+			*sensor_readings_sent = circular_buffer_size(sending_sensor_readings_buffer);
+		}
+		
+		transition(STATE_KNX_TUNNELING);
+	}
+}
+
 static bool knx_handler(state_machine_state_t* state, event_t* event)
 {
 	switch (event->type)
@@ -562,17 +1137,7 @@ static bool state_routing_send(state_machine_state_t* state, event_t* event)
 		{
 			LOG(1, "Entering knx routing send state");
 			
-			sensor_readings_t sensor_reading;
-			if(circular_buffer_peek(sending_sensor_readings_buffer, 0, &sensor_reading))
-			{
-				circular_buffer_clear(&knx_buffer);
-				
-				uint16_t message_size = create_knx_routing_temperature_message(knx_buffer_storage, sensor_reading.values[0], knx_physical_address);
-				
-				communication_module_process_handle = wifi_communication_module_send_to(knx_buffer_storage, message_size);
-				add_event_type(&events_buffer, EVENT_COMMUNICATION_MODULE_PROCESS);
-			}
-			else
+			if(!load_latest_sensor_readings() || !send_routing_message())
 			{
 				LOG(1, "KNX no messsages to send");
 				
@@ -590,9 +1155,14 @@ static bool state_routing_send(state_machine_state_t* state, event_t* event)
 			{
 				LOG(1, "Knx routing message sent");
 				
-				*sensor_readings_sent = 1;
-				
-				transition(STATE_KNX_ROUTING);
+				// routing frames are not acknowledged, next one is sent right away
+				sending_datapoint++;
+				if(!send_routing_message())
+				{
+					*sensor_readings_sent = circular_buffer_size(sending_sensor_readings_buffer);
+					
+					transition(STATE_KNX_ROUTING);
+				}
 			}
 			else
 			{
@@ -788,8 +1358,7 @@ static bool state_receive_connect_response(state_machine_state_t* state, event_t
 					{
 						LOG(1, "Knx connect response received");
 						
-						channel = knx_message.data.knx_tunneling_connect_response.channel;
-						sequence_counter = 0;
+						open_tunnel(knx_message.data.knx_tunneling_connect_response.channel);
 						
 						transition(STATE_KNX_TUNNELING);
 						
@@ -841,21 +1410,65 @@ static bool state_tunneling(state_machine_state_t* state, event_t* event)
 			
 			state->current_state = -1;
 			
+			// connection state check postponed while tunnel was busy
+			if(tunnel_open && connection_state_due)
+			{
+				add_event_type(&events_buffer, EVENT_CONNECTION_STATE);
+			}
+			
 			return true;
 		}
 		case EVENT_SEND:
 		{
 			LOG(1, "Send received in knx tunneling state");
 			
-			transition(STATE_KNX_TUNELING_SEND);
+			if(state->current_state != -1)
+			{
+				// connection state check in progress
+				add_event_type(&events_buffer, EVENT_SEND);
+			}
+			else if(load_latest_sensor_readings())
+			{
+				sending_readings = true;
+				tunneling_acks_pending = 0;
+				
+				continue_tunneling();
+			}
+			else
+			{
+				LOG(1, "KNX no messages to send");
+			}
 			
 			return true;
 		}
-		case EVENT_RECEIVE_ACK:
+		case EVENT_RECEIVE:
 		{
-			LOG(1, "Receive ack received in knx tunneling state");
+			LOG(1, "Receive received in knx tunneling state");
 			
-			transition(STATE_KNX_TUNELING_RECEIVE_ACK);
+			if(state->current_state != -1)
+			{
+				add_event_type(&events_buffer, EVENT_RECEIVE);
+			}
+			else
+			{
+				// group writes are received until there are no more messages
+				receiving_commands = true;
+				
+				continue_tunneling();
+			}
+			
+			return true;
+		}
+		case EVENT_CONNECTION_STATE:
+		{
+			if(state->current_state == -1)
+			{
+				LOG(1, "Connection state check in knx tunneling state");
+				
+				connection_state_requests = 0;
+				
+				transition(STATE_KNX_SEND_CONNECTION_STATE_REQUEST);
+			}
 			
 			return true;
 		}
@@ -863,7 +1476,18 @@ static bool state_tunneling(state_machine_state_t* state, event_t* event)
 		{
 			LOG(1, "Disconnect received in knx tunneling state");
 			
-			transition(STATE_KNX_DISCONNECTING);
+			if(state->current_state != -1)
+			{
+				add_event_type(&events_buffer, EVENT_DISCONNECT);
+			}
+			else if(persistent_tunnel)
+			{
+				LOG(1, "Knx tunnel kept open");
+			}
+			else
+			{
+				transition(STATE_KNX_DISCONNECTING);
+			}
 			
 			return true;
 		}
@@ -888,17 +1512,7 @@ static bool state_tunneling_send(state_machine_state_t* state, event_t* event)
 		{
 			LOG(1, "Entering knx tunneling send state");
 			
-			sensor_readings_t sensor_reading;
-			if(circular_buffer_peek(sending_sensor_readings_buffer, 0, &sensor_reading))
-			{
-				circular_buffer_clear(&knx_buffer);
-				
-				uint16_t message_size = create_knx_tunneling_temperature_message(knx_buffer_storage, sensor_reading.values[0], knx_physical_address, channel, sequence_counter++);
-				
-				communication_module_process_handle = wifi_communication_module_send_to(knx_buffer_storage, message_size);
-				add_event_type(&events_buffer, EVENT_COMMUNICATION_MODULE_PROCESS);
-			}
-			else
+			if(!send_tunneling_message())
 			{
 				LOG(1, "KNX no messages to send");
 				
@@ -916,14 +1530,19 @@ static bool state_tunneling_send(state_machine_state_t* state, event_t* event)
 			{
 				LOG(1, "Knx tunneling message sent");
 				
-				*sensor_readings_sent = 1;
+				sending_datapoint++;
+				tunneling_acks_pending++;
+				tunneling_confirmations_pending++;
 				
-				transition(STATE_KNX_TUNNELING);
+				continue_tunneling();
 			}
 			else
 			{
 				LOG(1, "Error sending knx tunneling message");
 				
+				close_tunnel();
+				sending_readings = false;
+				
 				set_knx_error(ERROR_SENDING_KNX_MESSAGE, state->id);
 				
 				transition(STATE_KNX_ROUTING);
@@ -946,18 +1565,13 @@ static bool state_tunneling_send(state_machine_state_t* state, event_t* event)
 
 static bool state_tunneling_receive_ack(state_machine_state_t* state, event_t* event)
 {
-	static uint16_t received_data_size;
-	
 	switch (event->type)
 	{
 		case EVENT_ENTERING_STATE:
 		{
 			LOG(1, "Entering knx receive ack state");
 			
-			circular_buffer_clear(&knx_buffer);
-			
-			communication_module_process_handle = wifi_communication_module_receive_from(knx_buffer_storage, KNX_BUFFER_SIZE, &received_data_size);
-			add_event_type(&events_buffer, EVENT_COMMUNICATION_MODULE_PROCESS);
+			receive_tunneling_messages();
 			
 			return true;
 		}
@@ -968,31 +1582,85 @@ static bool state_tunneling_receive_ack(state_machine_state_t* state, event_t* e
 			
 			if(is_communication_module_success(&receive_result))
 			{
-				circular_buffer_add_array(&knx_buffer, knx_buffer_storage, received_data_size);
+				circular_buffer_add_array(&knx_buffer, knx_buffer_storage, tunneling_received_data_size);
 				knx_message_t knx_message;
+				bool message_received = false;
+				bool tunnel_lost = false;
 				
 				while(parse_knx_message(&knx_buffer, &knx_message))
 				{
-					if(knx_message.type == KNX_TUNNELING_ACK)
+					knx_tunneling_header_t* header = &knx_message.data.knx_tunneling_header;
+					
+					if(knx_message.type == KNX_TUNNELING_ACK && header->channel == channel)
+					{
+						if(header->status != 0)
+						{
+							LOG_PRINT(1, PSTR("Knx tunneling ack error %02X\r\n"), header->status);
+							
+							tunnel_lost = true;
+						}
+						else if(tunneling_acks_pending > 0 && header->sequence_counter == (uint8_t)(sequence_counter - tunneling_acks_pending))
+						{
+							LOG(1, "Knx tunneling ack received");
+							
+							tunneling_acks_pending--;
+							message_received = true;
+						}
+					}
+					else if(knx_message.type == KNX_TUNNELING_VALUE_CONFIRMATION && header->channel == channel)
 					{
-						LOG(1, "Knx tunneling ack received");
+						LOG(1, "Knx tunneling request received");
 						
-						transition(STATE_KNX_TUNNELING);
+						handle_server_tunneling_request(&knx_message);
+						message_received = true;
+					}
+					else if(knx_message.type == KNX_TUNNELING_DISCONNECT_REQUEST && header->channel == channel)
+					{
+						LOG(1, "Knx disconnect request received");
 						
-						return true;
+						tunnel_lost = true;
 					}
 				}
 				
-				LOG(1, "Knx tunneling ack not received");
+				if(!tunnel_lost && message_received)
+				{
+					continue_tunneling();
+					
+					return true;
+				}
 				
-				set_knx_error(ERROR_INCORRECT_KNX_MESSAGE_RECEIVED, state->id);
+				if(!tunnel_lost && tunneling_acks_pending == 0)
+				{
+					if(tunneling_confirmations_pending > 0)
+					{
+						// not every server confirms values, all of them are acknowledged
+						LOG(1, "Knx tunneling confirmations not received");
+						
+						tunneling_confirmations_pending = 0;
+					}
+					
+					receiving_commands = false;
+					continue_tunneling();
+					
+					return true;
+				}
 				
-				transition(STATE_KNX_ROUTING);
+				LOG(1, "Knx tunneling ack not received");
+				
+				if(!reconnect_tunnel())
+				{
+					set_knx_error(ERROR_INCORRECT_KNX_MESSAGE_RECEIVED, state->id);
+					
+					transition(STATE_KNX_ROUTING);
+				}
 			}
 			else
 			{
 				LOG(1, "Error receiving knx ack");
 				
+				close_tunnel();
+				sending_readings = false;
+				
 				set_knx_error(ERROR_RECEIVING_KNX_MESSAGE, state->id);
 				
 				transition(STATE_KNX_ROUTING);
@@ -1013,6 +1681,202 @@ static bool state_tunneling_receive_ack(state_machine_state_t* state, event_t* e
 	}
 }
 
+static bool state_tunneling_send_ack(state_machine_state_t* state, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG(1, "Entering knx tunneling send ack state");
+			
+			circular_buffer_clear(&knx_buffer);
+			
+			uint16_t message_size = create_knx_tunneling_ack_message(knx_buffer_storage, channel, server_request_sequence_counter);
+			server_request_to_ack = false;
+			
+			communication_module_process_handle = wifi_communication_module_send_to(knx_buffer_storage, message_size);
+			add_event_type(&events_buffer, EVENT_COMMUNICATION_MODULE_PROCESS);
+			
+			return true;
+		}
+		case EVENT_COMMUNICATION_MODULE_DONE:
+		{
+			communication_module_type_data_t send_result = get_wifi_communication_result();
+			append_communication_module_type_data(&send_result, &communication_protocol_type_data.communication_module_type_data);
+			
+			if(is_communication_module_success(&send_result))
+			{
+				LOG(1, "Knx tunneling ack sent");
+				
+				continue_tunneling();
+			}
+			else
+			{
+				LOG(1, "Error sending knx tunneling ack");
+				
+				close_tunnel();
+				sending_readings = false;
+				
+				set_knx_error(ERROR_SENDING_KNX_MESSAGE, state->id);
+				
+				transition(STATE_KNX_ROUTING);
+			}
+			
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG(1, "Leaving knx tunneling send ack state");
+			
+			return false;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static bool state_send_connection_state_request(state_machine_state_t* state, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG(1, "Entering knx send connection state request state");
+			
+			circular_buffer_clear(&knx_buffer);
+			
+			char ip_address[15];
+			uint32_t ip_adress_hex = wifi_communication_module_dependencies.get_ip_address(ip_address);
+			
+			uint16_t message_size = create_knx_connection_message(knx_buffer_storage, 0x0207, channel, ip_adress_hex, server_port);
+			
+			communication_module_process_handle = wifi_communication_module_send_to(knx_buffer_storage, message_size);
+			add_event_type(&events_buffer, EVENT_COMMUNICATION_MODULE_PROCESS);
+			
+			return true;
+		}
+		case EVENT_COMMUNICATION_MODULE_DONE:
+		{
+			communication_module_type_data_t send_result = get_wifi_communication_result();
+			
+			if(is_communication_module_success(&send_result))
+			{
+				LOG(1, "Knx connection state request sent");
+				
+				connection_state_requests++;
+				
+				transition(STATE_KNX_RECEIVE_CONNECTION_STATE_RESPONSE);
+			}
+			else
+			{
+				LOG(1, "Error sending knx connection state request, tunnel closed");
+				
+				close_tunnel();
+				
+				transition(STATE_KNX_ROUTING);
+			}
+			
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG(1, "Leaving knx send connection state request state");
+			
+			return false;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static bool state_receive_connection_state_response(state_machine_state_t* state, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG(1, "Entering knx receive connection state response state");
+			
+			receive_tunneling_messages();
+			
+			return true;
+		}
+		case EVENT_COMMUNICATION_MODULE_DONE:
+		{
+			communication_module_type_data_t receive_result = get_wifi_communication_result();
+			
+			if(is_communication_module_success(&receive_result))
+			{
+				circular_buffer_add_array(&knx_buffer, knx_buffer_storage, tunneling_received_data_size);
+				knx_message_t knx_message;
+				bool response_received = false;
+				bool tunnel_lost = false;
+				
+				while(parse_knx_message(&knx_buffer, &knx_message))
+				{
+					knx_tunneling_header_t* header = &knx_message.data.knx_tunneling_header;
+					
+					if(knx_message.type == KNX_TUNNELING_CONNECTION_STATE_RESPONSE && header->channel == channel)
+					{
+						LOG_PRINT(1, PSTR("Knx connection state response %02X received\r\n"), header->status);
+						
+						response_received = true;
+						tunnel_lost = header->status != 0;
+					}
+					else if(knx_message.type == KNX_TUNNELING_VALUE_CONFIRMATION && header->channel == channel)
+					{
+						handle_server_tunneling_request(&knx_message);
+					}
+					else if(knx_message.type == KNX_TUNNELING_DISCONNECT_REQUEST && header->channel == channel)
+					{
+						tunnel_lost = true;
+					}
+				}
+				
+				if(response_received && !tunnel_lost)
+				{
+					restart_connection_state_timer();
+					
+					continue_tunneling();
+					
+					return true;
+				}
+				
+				if(!tunnel_lost && connection_state_requests < KNX_CONNECTION_STATE_REQUESTS)
+				{
+					LOG(1, "Knx connection state response not received");
+					
+					transition(STATE_KNX_SEND_CONNECTION_STATE_REQUEST);
+					
+					return true;
+				}
+			}
+			
+			LOG(1, "Knx tunnel lost");
+			
+			close_tunnel();
+			
+			transition(STATE_KNX_ROUTING);
+			
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG(1, "Leaving knx receive connection state response state");
+			
+			return false;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
 static bool state_disconnecting(state_machine_state_t* state, event_t* event)
 {
 	switch (event->type)
@@ -1051,7 +1915,8 @@ static bool state_send_disconnect_request(state_machine_state_t* state, event_t*
 			char ip_address[15];
 			uint32_t ip_adress_hex = wifi_communication_module_dependencies.get_ip_address(ip_address);
 			
-			uint16_t message_size = create_knx_disconnect_message(knx_buffer_storage, channel, ip_adress_hex, server_port);
+			uint16_t message_size = create_knx_connection_message(knx_buffer_storage, 0x0209, channel, ip_adress_hex, server_port);
+			close_tunnel();
 			
 			communication_module_process_handle = wifi_communication_module_send_to(knx_buffer_storage, message_size);
 			add_event_type(&events_buffer, EVENT_COMMUNICATION_MODULE_PROCESS);
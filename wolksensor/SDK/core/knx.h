@@ -30,6 +30,15 @@ communication_protocol_process_handle_t knx_protocol_disconnect(void);
 
 communication_protocol_type_data_t get_knx_communication_result(void);
 
+/*
+* Persistent tunnel stays open after disconnect and is checked with connection state requests,
+* knx_protocol_process has to be called while device is idle. Wired as communication protocol
+* set_persistent_connection, keeps_connection and process hooks.
+*/
+void knx_set_persistent_tunnel(bool persistent);
+bool knx_protocol_keeps_connection(void);
+bool knx_protocol_process(void);
+
 #ifdef __cplusplus
 }
 #endif
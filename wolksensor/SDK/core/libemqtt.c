@@ -42,6 +42,12 @@
 #define MQTT_USERNAME_FLAG  1<<7
 #define MQTT_PASSWORD_FLAG  1<<6
 
+/* MQTT 5 property identifiers */
+#define MQTT_PROPERTY_SESSION_EXPIRY_INTERVAL  0x11
+#define MQTT_PROPERTY_RECEIVE_MAXIMUM          0x21
+#define MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM      0x22
+#define MQTT_PROPERTY_TOPIC_ALIAS              0x23
+
 uint8_t mqtt_num_rem_len_bytes(const uint8_t* buf) {
 	uint8_t num_bytes = 1;
 	
@@ -60,9 +66,10 @@ uint8_t mqtt_num_rem_len_bytes(const uint8_t* buf) {
 }
 
 uint16_t mqtt_parse_rem_len(const uint8_t* buf) {
-	uint16_t multiplier = 1;
-	uint16_t value = 0;
+	uint32_t multiplier = 1;
+	uint32_t value = 0;
 	uint8_t digit;
+	uint8_t num_bytes = 0;
 	
 	/* printf("mqtt_parse_rem_len\n"); */
 	
@@ -73,15 +80,64 @@ uint16_t mqtt_parse_rem_len(const uint8_t* buf) {
 		value += (digit & 127) * multiplier;
 		multiplier *= 128;
 		buf++;
-	} while ((digit & 128) != 0);
+	} while ((digit & 128) != 0 && ++num_bytes < 4);
 
 	return value;
 }
 
-uint8_t mqtt_parse_msg_id(const uint8_t* buf) {
+uint8_t mqtt_encode_rem_len(uint8_t* buf, uint16_t length) {
+	uint8_t num_bytes = 0;
+	
+	do {
+		uint8_t digit = length % 128;
+		length /= 128;
+		if(length > 0) {
+			digit |= 0x80;
+		}
+		buf[num_bytes++] = digit;
+	} while(length > 0);
+	
+	return num_bytes;
+}
+
+/* Size of MQTT 5 variable byte integer */
+static uint8_t mqtt_var_int_size(uint16_t value) {
+	uint8_t buf[4];
+	return mqtt_encode_rem_len(buf, value);
+}
+
+/* Size of MQTT 5 property value, 0 for unknown property */
+static uint16_t mqtt_property_size(uint8_t id, const uint8_t* value) {
+	switch(id) {
+		case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:
+			return 1;
+		case 0x13: case 0x21: case 0x22: case 0x23:
+			return 2;
+		case 0x02: case 0x11: case 0x18: case 0x27:
+			return 4;
+		case 0x0B:
+			return mqtt_num_rem_len_bytes(value - 1);
+		case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F:
+			return 2 + ((value[0]<<8) | value[1]);
+		case 0x26: {
+			uint16_t name_size = 2 + ((value[0]<<8) | value[1]);
+			return name_size + 2 + ((value[name_size]<<8) | value[name_size+1]);
+		}
+		default:
+			return 0;
+	}
+}
+
+/* Number of bytes taken by MQTT 5 properties (including their length) at given position */
+static uint16_t mqtt_properties_size(const uint8_t* buf) {
+	/* properties length is encoded same as remaining length, parsers expect it after "flags" byte */
+	return mqtt_num_rem_len_bytes(buf - 1) + mqtt_parse_rem_len(buf - 1);
+}
+
+uint16_t mqtt_parse_msg_id(const uint8_t* buf) {
 	uint8_t type = MQTTParseMessageType(buf);
 	uint8_t qos = MQTTParseMessageQos(buf);
-	uint8_t id = 0;
+	uint16_t id = 0;
 	
 	/* printf("mqtt_parse_msg_id\n"); */
 	
@@ -91,7 +147,7 @@ uint8_t mqtt_parse_msg_id(const uint8_t* buf) {
 				/* fixed header length + Topic (UTF encoded) */
 				/* = 1 for "flags" byte + rlb for length bytes + topic size */
 				uint8_t rlb = mqtt_num_rem_len_bytes(buf);
-				uint8_t offset = *(buf+1+rlb)<<8;	/* topic UTF MSB */
+				uint16_t offset = *(buf+1+rlb)<<8;	/* topic UTF MSB */
 				offset |= *(buf+1+rlb+1);			/* topic UTF LSB */
 				offset += (1+rlb+2);					/* fixed header + topic size */
 				id = *(buf+offset)<<8;				/* id MSB */
@@ -139,12 +195,12 @@ uint16_t mqtt_parse_pub_topic_ptr(const uint8_t* buf, const uint8_t **topic_ptr)
 	return len;
 }
 
-uint16_t mqtt_parse_publish_msg(const uint8_t* buf, uint8_t* msg) {
+uint16_t mqtt_parse_publish_msg(const mqtt_broker_handle_t* broker, const uint8_t* buf, uint8_t* msg) {
 	const uint8_t* ptr;
 	
 	/*printf("mqtt_parse_publish_msg\n");*/
 	
-	uint16_t msg_len = mqtt_parse_pub_msg_ptr(buf, &ptr);
+	uint16_t msg_len = mqtt_parse_pub_msg_ptr(broker, buf, &ptr);
 	
 	if(msg_len != 0 && ptr != 0) {
 		memcpy(msg, ptr, msg_len);
@@ -153,16 +209,16 @@ uint16_t mqtt_parse_publish_msg(const uint8_t* buf, uint8_t* msg) {
 	return msg_len;
 }
 
-uint16_t mqtt_parse_pub_msg_ptr(const uint8_t* buf, const uint8_t **msg_ptr) {
+uint16_t mqtt_parse_pub_msg_ptr(const mqtt_broker_handle_t* broker, const uint8_t* buf, const uint8_t **msg_ptr) {
 	uint16_t len = 0;
 	
 	/*printf("mqtt_parse_pub_msg_ptr\n");*/
 	
 	if(MQTTParseMessageType(buf) == MQTT_MSG_PUBLISH) {
 		/* message starts at */
-		/* fixed header length + Topic (UTF encoded) + msg id (if QoS>0) */
+		/* fixed header length + Topic (UTF encoded) + msg id (if QoS>0) + properties (MQTT 5) */
 		uint8_t rlb = mqtt_num_rem_len_bytes(buf);
-		uint8_t offset = (*(buf+1+rlb))<<8;	/* topic UTF MSB */
+		uint16_t offset = (*(buf+1+rlb))<<8;	/* topic UTF MSB */
 		offset |= *(buf+1+rlb+1);			/* topic UTF LSB */
 		offset += (1+rlb+2);				/* fixed header + topic size */
 
@@ -170,6 +226,10 @@ uint16_t mqtt_parse_pub_msg_ptr(const uint8_t* buf, const uint8_t **msg_ptr) {
 			offset += 2;					/* add two bytes of msg id */
 		}
 
+		if(broker->protocol_version == MQTT_PROTOCOL_VERSION_5) {
+			offset += mqtt_properties_size(buf + offset);
+		}
+
 		*msg_ptr = (buf + offset);
 				
 		/* offset is now pointing to start of message */
@@ -184,10 +244,53 @@ uint16_t mqtt_parse_pub_msg_ptr(const uint8_t* buf, const uint8_t **msg_ptr) {
 	return len;
 }
 
+uint8_t mqtt_parse_connack(mqtt_broker_handle_t* broker, const uint8_t* buf) {
+	if(MQTTParseMessageType(buf) != MQTT_MSG_CONNACK) {
+		return 0xFF;
+	}
+	
+	uint8_t rlb = mqtt_num_rem_len_bytes(buf);
+	const uint8_t* ptr = buf + 1 + rlb;
+	const uint8_t* end = ptr + mqtt_parse_rem_len(buf);
+	
+	/* acknowledge flags, return code */
+	broker->session_present = ptr[0] & 0x01;
+	uint8_t return_code = ptr[1];
+	ptr += 2;
+	
+	broker->topic_alias_maximum = 0;
+	
+	if(broker->protocol_version == MQTT_PROTOCOL_VERSION_5 && ptr < end) {
+		const uint8_t* properties_end = ptr + mqtt_properties_size(ptr);
+		ptr += mqtt_num_rem_len_bytes(ptr - 1);
+		
+		while(ptr < properties_end && properties_end <= end) {
+			uint8_t id = *ptr++;
+			uint16_t size = mqtt_property_size(id, ptr);
+			if(size == 0) {
+				break;
+			}
+			
+			if(id == MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM) {
+				broker->topic_alias_maximum = (ptr[0]<<8) | ptr[1];
+			}
+			
+			ptr += size;
+		}
+	}
+	
+	return return_code;
+}
+
 void mqttlib_init(mqtt_broker_handle_t* broker, const char* clientid) {
 	/* Connection options */
 	broker->alive = 300; /* 300 seconds = 5 minutes */
 	broker->seq = 1; /* Sequency for message indetifiers */
+	broker->protocol_version = MQTT_PROTOCOL_VERSION_3_1_1;
+	broker->session_expiry_interval = 0;
+	broker->receive_maximum = 0;
+	broker->topic_alias_maximum = 0;
+	broker->topic_aliases_count = 0;
 	/* Client options */
 	memset(broker->clientid, 0, sizeof(broker->clientid));
 	memset(broker->username, 0, sizeof(broker->username));
@@ -199,6 +302,7 @@ void mqttlib_init(mqtt_broker_handle_t* broker, const char* clientid) {
 	}
 	/* Will topic */
 	broker->clean_session = 1;
+	broker->session_present = 0;
 }
 
 void mqtt_init_will(mqtt_broker_handle_t* broker, const char * topic, const char *msg, uint8_t qos, uint8_t retain) {
@@ -219,16 +323,34 @@ void mqtt_set_alive(mqtt_broker_handle_t* broker, uint16_t alive) {
 	broker->alive = alive;
 }
 
+void mqtt_set_protocol_version(mqtt_broker_handle_t* broker, uint8_t protocol_version) {
+	broker->protocol_version = protocol_version;
+}
+
+void mqtt_set_clean_session(mqtt_broker_handle_t* broker, uint8_t clean_session) {
+	broker->clean_session = clean_session;
+}
+
+void mqtt_set_session_properties(mqtt_broker_handle_t* broker, uint32_t session_expiry_interval, uint16_t receive_maximum) {
+	broker->session_expiry_interval = session_expiry_interval;
+	broker->receive_maximum = receive_maximum;
+}
+
 int mqtt_connect(mqtt_broker_handle_t* broker, uint8_t* packet, uint16_t packet_size)
 {
 	uint8_t flags = 0x00;
 	uint16_t willMsgLen = 0;
 	uint16_t willTopicLen = 0;
+	bool mqtt5 = broker->protocol_version == MQTT_PROTOCOL_VERSION_5;
 
 	uint16_t clientidlen = strlen(broker->clientid);
 	uint16_t usernamelen = strlen(broker->username);
 	uint16_t passwordlen = strlen(broker->password);
 
+	/* topic aliases are valid for one network connection only */
+	broker->topic_alias_maximum = 0;
+	broker->topic_aliases_count = 0;
+
 	if (broker->will_msg != NULL)
 	{
 		willMsgLen = strlen(broker->will_msg);
@@ -260,6 +382,11 @@ int mqtt_connect(mqtt_broker_handle_t* broker, uint8_t* packet, uint16_t packet_
 		payload_len += willMsgLen + 2;
 		flags |= MQTT_WILL_FLAG;
 
+		if(mqtt5)
+		{
+			payload_len += 1; /* empty will properties */
+		}
+
 		if (broker->will_retain)
 		{
 			flags |= MQTT_WILL_RETAIN;
@@ -272,53 +399,81 @@ int mqtt_connect(mqtt_broker_handle_t* broker, uint8_t* packet, uint16_t packet_
 			return -1;
 		}
 	}
+	else
+	{
+		willTopicLen = 0;
+		willMsgLen = 0;
+	}
 
 	/* Variable header */
 	uint8_t var_header[] = {
-		0x00,0x06,0x4d,0x51,0x49,0x73,0x64,0x70, /* Protocol name: MQIsdp */
-		0x03, /* Protocol version */
+		0x00,0x04,0x4d,0x51,0x54,0x54, /* Protocol name: MQTT */
+		broker->protocol_version, /* Protocol level */
 		flags, /* Connect flags */
 		broker->alive>>8, broker->alive&0xFF, /* Keep alive */
 	};
 
+	/* MQTT 5 connect properties */
+	uint8_t properties_len = 0;
+	if(mqtt5)
+	{
+		if(broker->session_expiry_interval)
+		{
+			properties_len += 5;
+		}
+		if(broker->receive_maximum)
+		{
+			properties_len += 3;
+		}
+	}
 
-   	/* Fixed header */
-    uint8_t fixedHeaderSize = 2;    /* Default size = one byte Message Type + one byte Remaining Length */
-    uint8_t remainLen = sizeof(var_header)+payload_len;
-    if (remainLen > 127) {
-        fixedHeaderSize++;          /* add an additional byte for Remaining Length */
-    }
-
-    uint8_t fixed_header[3];
-    
-    /* Message Type */
-    fixed_header[0] = MQTT_MSG_CONNECT;
-
-    /* Remaining Length */
-    if (remainLen <= 127) {
-        fixed_header[1] = remainLen;
-    } else {
-        /* first byte is remainder (mod) of 128, then set the MSB to indicate more bytes */
-        fixed_header[1] = remainLen % 128;
-        fixed_header[1] = fixed_header[1] | 0x80;
-        /* second byte is number of 128s */
-        fixed_header[2] = remainLen / 128;
-    }
+	uint16_t remainLen = sizeof(var_header) + (mqtt5 ? 1 + properties_len : 0) + payload_len;
 
 	uint16_t offset = 0;
-	uint16_t message_size = fixedHeaderSize + sizeof(var_header) + payload_len;
 
-	memset(packet, 0, message_size);
-	memcpy(packet, fixed_header, fixedHeaderSize);
-	offset += fixedHeaderSize;
+	/* Fixed header */
+	packet[offset++] = MQTT_MSG_CONNECT;
+	offset += mqtt_encode_rem_len(packet+offset, remainLen);
+
+	uint16_t message_size = offset + remainLen;
+	if(message_size > packet_size)
+	{
+		return -1;
+	}
+
 	memcpy(packet+offset, var_header, sizeof(var_header));
 	offset += sizeof(var_header);
+
+	if(mqtt5)
+	{
+		packet[offset++] = properties_len;
+		if(broker->session_expiry_interval)
+		{
+			packet[offset++] = MQTT_PROPERTY_SESSION_EXPIRY_INTERVAL;
+			packet[offset++] = broker->session_expiry_interval>>24;
+			packet[offset++] = (broker->session_expiry_interval>>16)&0xFF;
+			packet[offset++] = (broker->session_expiry_interval>>8)&0xFF;
+			packet[offset++] = broker->session_expiry_interval&0xFF;
+		}
+		if(broker->receive_maximum)
+		{
+			packet[offset++] = MQTT_PROPERTY_RECEIVE_MAXIMUM;
+			packet[offset++] = broker->receive_maximum>>8;
+			packet[offset++] = broker->receive_maximum&0xFF;
+		}
+	}
+
 	/* Client ID - UTF encoded */
 	packet[offset++] = clientidlen>>8;
 	packet[offset++] = clientidlen&0xFF;
 	memcpy(packet+offset, broker->clientid, clientidlen);
 	offset += clientidlen;
 
+	if (willTopicLen && mqtt5)
+	{
+		packet[offset++] = 0x00; /* Will properties length */
+	}
+
 	if (willTopicLen)
 	{
 		packet[offset++] = willTopicLen>>8;
@@ -358,7 +513,7 @@ int mqtt_connect(mqtt_broker_handle_t* broker, uint8_t* packet, uint16_t packet_
 int mqtt_disconnect(mqtt_broker_handle_t* broker, uint8_t* packet, uint16_t packet_size) 
 {
 	packet[0] = MQTT_MSG_DISCONNECT; /* Message Type, DUP flag, QoS level, Retain */
-	packet[1] = 0x00; /* Remaining length */
+	packet[1] = 0x00; /* Remaining length, MQTT 5 normal disconnection reason is implied */
 
 	return 2;
 }
@@ -371,38 +526,194 @@ int mqtt_ping(mqtt_broker_handle_t* broker, uint8_t* packet, uint16_t packet_siz
 	return 2;
 }
 
-int mqtt_subscribe(mqtt_broker_handle_t* broker, const char* topic, uint16_t* message_id, uint8_t* packet, uint16_t packet_size) {
+int mqtt_subscribe(mqtt_broker_handle_t* broker, const char* topic, uint8_t qos, uint16_t* message_id, uint8_t* packet, uint16_t packet_size) {
 	uint16_t topiclen = strlen(topic);
+	bool mqtt5 = broker->protocol_version == MQTT_PROTOCOL_VERSION_5;
+
+	/* Message ID, properties length (MQTT 5), utf topic, QoS byte */
+	uint16_t remainLen = 2 + (mqtt5 ? 1 : 0) + 2 + topiclen + 1;
+
+	uint16_t offset = 0;
+
+	/* Fixed header */
+	packet[offset++] = MQTT_MSG_SUBSCRIBE | MQTT_QOS1_FLAG; /* Message Type, DUP flag, QoS level, Retain */
+	offset += mqtt_encode_rem_len(packet+offset, remainLen);
+
+	uint16_t message_size = offset + remainLen;
+	if(message_size > packet_size) {
+		return -1;
+	}
 
 	/* Variable header */
-	uint8_t var_header[2]; /* Message ID */
-	var_header[0] = broker->seq>>8;
-	var_header[1] = broker->seq&0xFF;
+	packet[offset++] = broker->seq>>8;
+	packet[offset++] = broker->seq&0xFF;
 	if(message_id) { /* Returning message id */
 		*message_id = broker->seq;
 	}
 	broker->seq++;
 
+	if(mqtt5) {
+		packet[offset++] = 0x00; /* Properties length */
+	}
+
 	/* utf topic */
-	uint8_t utf_topic_size = topiclen+3;
-	uint8_t utf_topic[32]; /* Topic size (2 bytes), utf-encoded topic, QoS byte */
-	memset(utf_topic, 0, sizeof(utf_topic));
-	utf_topic[0] = topiclen>>8;
-	utf_topic[1] = topiclen&0xFF;
-	memcpy(utf_topic+2, topic, topiclen);
+	packet[offset++] = topiclen>>8;
+	packet[offset++] = topiclen&0xFF;
+	memcpy(packet+offset, topic, topiclen);
+	offset += topiclen;
+	packet[offset++] = qos; /* Requested QoS */
 
-	/* Fixed header */
-	uint8_t fixed_header[] = {
-		MQTT_MSG_SUBSCRIBE | MQTT_QOS1_FLAG, /* Message Type, DUP flag, QoS level, Retain */
-		sizeof(var_header)+utf_topic_size
-	};
+	return message_size;
+}
 
-	uint8_t message_size = sizeof(var_header)+sizeof(fixed_header)+utf_topic_size;
+int mqtt_puback(mqtt_broker_handle_t* broker, uint16_t message_id, uint8_t* packet, uint16_t packet_size) {
+	if(packet_size < 4) {
+		return -1;
+	}
 
-	memset(packet, 0, packet_size);
-	memcpy(packet, fixed_header, sizeof(fixed_header));
-	memcpy(packet+sizeof(fixed_header), var_header, sizeof(var_header));
-	memcpy(packet+sizeof(fixed_header)+sizeof(var_header), utf_topic, utf_topic_size);
+	packet[0] = MQTT_MSG_PUBACK; /* Message Type, DUP flag, QoS level, Retain */
+	packet[1] = 0x02; /* Remaining length, reason code is omitted for success with MQTT 5 */
+	packet[2] = message_id>>8;
+	packet[3] = message_id&0xFF;
 
-	return message_size;
+	return 4;
+}
+
+uint16_t mqtt_publish_in_place(mqtt_broker_handle_t* broker, const char* topic, uint8_t* payload, uint16_t payload_size, uint8_t** packet) {
+	uint16_t topiclen = strlen(topic);
+	uint16_t sent_topiclen = topiclen;
+	uint16_t topic_alias = 0;
+	uint8_t properties_len = 0;
+	bool mqtt5 = broker->protocol_version == MQTT_PROTOCOL_VERSION_5;
+
+	if(mqtt5 && broker->topic_alias_maximum) {
+		uint8_t i;
+		for(i = 0; i < broker->topic_aliases_count; i++) {
+			if(strcmp(broker->topic_aliases[i], topic) == 0) {
+				/* topic already mapped, send empty topic with alias only */
+				topic_alias = i + 1;
+				sent_topiclen = 0;
+				break;
+			}
+		}
+
+		if(!topic_alias && broker->topic_aliases_count < MQTT_CONF_TOPIC_ALIASES && broker->topic_aliases_count < broker->topic_alias_maximum && topiclen < MQTT_CONF_TOPIC_ALIAS_LENGTH) {
+			/* map topic with its first publish */
+			strcpy(broker->topic_aliases[broker->topic_aliases_count], topic);
+			topic_alias = ++broker->topic_aliases_count;
+		}
+
+		if(topic_alias) {
+			properties_len = 3;
+		}
+	}
+
+	/* utf topic + properties (MQTT 5) + payload */
+	uint16_t remainLen = 2 + sent_topiclen + (mqtt5 ? 1 + properties_len : 0) + payload_size;
+	uint16_t header_size = 1 + mqtt_var_int_size(remainLen) + (remainLen - payload_size);
+
+	uint8_t* header = payload - header_size;
+	*packet = header;
+
+	*header++ = MQTT_MSG_PUBLISH;
+	header += mqtt_encode_rem_len(header, remainLen);
+	*header++ = sent_topiclen>>8;
+	*header++ = sent_topiclen&0xFF;
+	memcpy(header, topic, sent_topiclen);
+	header += sent_topiclen;
+
+	if(mqtt5) {
+		*header++ = properties_len;
+		if(topic_alias) {
+			*header++ = MQTT_PROPERTY_TOPIC_ALIAS;
+			*header++ = topic_alias>>8;
+			*header++ = topic_alias&0xFF;
+		}
+	}
+
+	return header_size + payload_size;
+}
+
+void mqtt_decoder_init(mqtt_decoder_t* decoder, uint8_t* buffer, uint16_t buffer_size) {
+	decoder->buffer = buffer;
+	decoder->buffer_size = buffer_size;
+
+	mqtt_decoder_reset(decoder);
+}
+
+void mqtt_decoder_reset(mqtt_decoder_t* decoder) {
+	decoder->length = 0;
+	decoder->consumed = 0;
+	decoder->position = 0;
+	decoder->state = MQTT_DECODER_FIXED_HEADER;
+}
+
+uint8_t* mqtt_decoder_space(mqtt_decoder_t* decoder, uint16_t* size) {
+	/* move beginning of the next packet to the start of the buffer */
+	if(decoder->consumed) {
+		decoder->length -= decoder->consumed;
+		decoder->position -= decoder->consumed;
+		memmove(decoder->buffer, decoder->buffer + decoder->consumed, decoder->length);
+		decoder->consumed = 0;
+	}
+
+	*size = decoder->buffer_size - decoder->length;
+	return decoder->buffer + decoder->length;
+}
+
+void mqtt_decoder_feed(mqtt_decoder_t* decoder, uint16_t size) {
+	decoder->length += size;
+}
+
+uint8_t* mqtt_decoder_next(mqtt_decoder_t* decoder) {
+	for(;;) {
+		switch(decoder->state) {
+			case MQTT_DECODER_FIXED_HEADER:
+				if(decoder->position >= decoder->length) {
+					return NULL;
+				}
+				decoder->position++; /* message type and flags */
+				decoder->remaining_length = 0;
+				decoder->remaining_length_bytes = 0;
+				decoder->state = MQTT_DECODER_REMAINING_LENGTH;
+				break;
+			case MQTT_DECODER_REMAINING_LENGTH: {
+				if(decoder->position >= decoder->length) {
+					return NULL;
+				}
+				uint8_t digit = decoder->buffer[decoder->position++];
+				decoder->remaining_length |= (uint32_t)(digit & 0x7F) << (7 * decoder->remaining_length_bytes);
+				decoder->remaining_length_bytes++;
+
+				if(digit & 0x80) {
+					if(decoder->remaining_length_bytes == 4) {
+						decoder->state = MQTT_DECODER_ERROR; /* malformed remaining length */
+					}
+					break;
+				}
+
+				if(decoder->remaining_length > decoder->buffer_size - 1 - decoder->remaining_length_bytes) {
+					decoder->state = MQTT_DECODER_ERROR; /* packet does not fit in the buffer */
+					break;
+				}
+
+				decoder->packet_size = 1 + decoder->remaining_length_bytes + decoder->remaining_length;
+				decoder->state = MQTT_DECODER_BODY;
+				break;
+			}
+			case MQTT_DECODER_BODY: {
+				/* variable header and payload */
+				if(decoder->length - decoder->consumed < decoder->packet_size) {
+					return NULL;
+				}
+				uint8_t* packet = decoder->buffer + decoder->consumed;
+				decoder->consumed += decoder->packet_size;
+				decoder->position = decoder->consumed;
+				decoder->state = MQTT_DECODER_FIXED_HEADER;
+				return packet;
+			}
+			default:
+				return NULL;
+		}
+	}
 }
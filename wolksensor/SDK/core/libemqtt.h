@@ -44,6 +44,22 @@ extern "C"
 	#define MQTT_CONF_PASSWORD_LENGTH 30 /* Recommended by MQTT Specification (12 + '\0') */
 #endif
 
+#ifndef MQTT_CONF_TOPIC_ALIASES
+	#define MQTT_CONF_TOPIC_ALIASES 1 /* Number of publish topics that can be replaced by alias (MQTT 5 only) */
+#endif
+
+#ifndef MQTT_CONF_TOPIC_ALIAS_LENGTH
+	#define MQTT_CONF_TOPIC_ALIAS_LENGTH 40
+#endif
+
+#define MQTT_PROTOCOL_VERSION_3_1_1 4
+#define MQTT_PROTOCOL_VERSION_5     5
+
+/** Maximum size of publish fixed and variable header for topic of given length.
+ * Flags byte, 4 bytes of remaining length, UTF encoded topic and properties length with topic alias property.
+ */
+#define MQTT_PUBLISH_HEADER_MAX_SIZE(topic_length) (1 + 4 + 2 + (topic_length) + 4)
+
 #define MQTT_MSG_IDLE          (0<<4) + 0
 
 #define MQTT_MSG_CONNECT       1<<4
@@ -93,6 +109,35 @@ extern "C"
 #define MQTTParseMessageRetain(buffer) ( *buffer & 0x01 )
 
 
+typedef struct {
+	int socket_info;
+	int (*send)(uint8_t* buffer, uint16_t size);
+	/* Connection info */
+	char clientid[50];
+	/* Auth fields */
+	char username[MQTT_CONF_USERNAME_LENGTH];
+	char password[MQTT_CONF_PASSWORD_LENGTH];
+	/* Will topic */
+	uint8_t will_retain;
+	int8_t will_qos;
+	uint8_t clean_session;
+	uint8_t session_present;
+	const char *will_topic;
+	const char *will_msg;
+	/* Management fields */
+	uint16_t seq;
+	uint16_t alive;
+	uint8_t protocol_version;
+	/* MQTT 5 session properties */
+	uint32_t session_expiry_interval;
+	uint16_t receive_maximum;
+	/* MQTT 5 topic aliases, valid for one network connection */
+	uint16_t topic_alias_maximum;
+	uint8_t topic_aliases_count;
+	char topic_aliases[MQTT_CONF_TOPIC_ALIASES][MQTT_CONF_TOPIC_ALIAS_LENGTH];
+} mqtt_broker_handle_t;
+
+
 /** Parse packet buffer for number of bytes in remaining length field.
  *
  * Given a packet, return number of bytes in remaining length
@@ -115,13 +160,22 @@ uint8_t mqtt_num_rem_len_bytes(const uint8_t* buf);
  */
 uint16_t mqtt_parse_rem_len(const uint8_t* buf);
 
+/** Encode remaining length value.
+ *
+ * @param buf Destination buffer, at least 4 bytes long.
+ * @param length Remaining length value.
+ *
+ * @retval number of bytes written
+ */
+uint8_t mqtt_encode_rem_len(uint8_t* buf, uint16_t length);
+
 /** Parse packet buffer for message id.
  *
  * @param buf Pointer to the packet.
  *
  * @retval message id
  */
-uint8_t mqtt_parse_msg_id(const uint8_t* buf);
+uint16_t mqtt_parse_msg_id(const uint8_t* buf);
 
 #define MQTTParseMessageId(buffer, rec_id)     rec_id = mqtt_parse_msg_id(buffer)
 
@@ -148,38 +202,91 @@ uint16_t mqtt_parse_pub_topic_ptr(const uint8_t* buf, const uint8_t** topic_ptr)
  * Given a packet containing an MQTT publish message,
  * return the message.
  *
+ * @param broker Data structure that contains the connection information with the broker.
  * @param buf Pointer to the packet.
  * @param msg Pointer destination buffer for message
  *
  * @retval size in bytes of topic (0 = no publish message in buffer)
  */
-uint16_t mqtt_parse_publish_msg(const uint8_t* buf, uint8_t* msg);
+uint16_t mqtt_parse_publish_msg(const mqtt_broker_handle_t* broker, const uint8_t* buf, uint8_t* msg);
 
 /** Parse a packet buffer for a pointer to the publish message.
  *
  *  Not called directly - called by mqtt_parse_pub_msg
  */
-uint16_t mqtt_parse_pub_msg_ptr(const uint8_t* buf, const uint8_t** msg_ptr);
+uint16_t mqtt_parse_pub_msg_ptr(const mqtt_broker_handle_t* broker, const uint8_t* buf, const uint8_t** msg_ptr);
+
+/** Parse connack packet.
+ *
+ * Stores session present flag, with MQTT 5 also topic alias maximum announced by the broker.
+ *
+ * @param broker Data structure that contains the connection information with the broker.
+ * @param buf Pointer to the packet.
+ *
+ * @retval connect return code (reason code for MQTT 5), 0 on success
+ */
+uint8_t mqtt_parse_connack(mqtt_broker_handle_t* broker, const uint8_t* buf);
+
 
+typedef enum {
+	MQTT_DECODER_FIXED_HEADER = 0,
+	MQTT_DECODER_REMAINING_LENGTH,
+	MQTT_DECODER_BODY,
+	MQTT_DECODER_ERROR
+} mqtt_decoder_state_t;
 
+/** Streaming decoder of received packets.
+ *
+ * Received data is appended to the decoder buffer in chunks of any size,
+ * complete packets are returned one by one and bytes of the following packet are kept.
+ */
 typedef struct {
-	int socket_info;
-	int (*send)(uint8_t* buffer, uint16_t size);
-	/* Connection info */
-	char clientid[50];
-	/* Auth fields */
-	char username[MQTT_CONF_USERNAME_LENGTH];
-	char password[MQTT_CONF_PASSWORD_LENGTH];
-	/* Will topic */
-	uint8_t will_retain;
-	int8_t will_qos;
-	uint8_t clean_session;
-	const char *will_topic;
-	const char *will_msg;
-	/* Management fields */
-	uint16_t seq;
-	uint16_t alive;
-} mqtt_broker_handle_t;
+	uint8_t* buffer;
+	uint16_t buffer_size;
+	uint16_t length;          /* bytes in buffer */
+	uint16_t consumed;        /* bytes of packets already returned */
+	uint16_t position;        /* next header byte to decode */
+	uint16_t packet_size;
+	uint32_t remaining_length;
+	uint8_t remaining_length_bytes;
+	uint8_t state;
+} mqtt_decoder_t;
+
+/** Initialize decoder.
+ * @param decoder Decoder.
+ * @param buffer Buffer for received data, packets larger than it can not be decoded.
+ * @param buffer_size Size of the buffer.
+ */
+void mqtt_decoder_init(mqtt_decoder_t* decoder, uint8_t* buffer, uint16_t buffer_size);
+
+/** Drop all received data.
+ * @param decoder Decoder.
+ */
+void mqtt_decoder_reset(mqtt_decoder_t* decoder);
+
+/** Free space behind received data, packets returned so far are dropped.
+ * @param decoder Decoder.
+ * @param size Variable that will store size of free space.
+ *
+ * @retval pointer to free space
+ */
+uint8_t* mqtt_decoder_space(mqtt_decoder_t* decoder, uint16_t* size);
+
+/** Append data written to free space.
+ * @param decoder Decoder.
+ * @param size Number of bytes written.
+ */
+void mqtt_decoder_feed(mqtt_decoder_t* decoder, uint16_t size);
+
+/** Get next complete packet.
+ * @param decoder Decoder.
+ *
+ * @retval pointer to the packet, valid until mqtt_decoder_space is called
+ * @retval NULL if packet is not complete yet or decoder is in MQTT_DECODER_ERROR state
+ */
+uint8_t* mqtt_decoder_next(mqtt_decoder_t* decoder);
+
+
 
 
 /** Initialize the information to connect to the broker.
@@ -207,6 +314,31 @@ void mqttlib_init_auth(mqtt_broker_handle_t* broker, const char* username, const
  */
 void mqtt_set_alive(mqtt_broker_handle_t* broker, uint16_t alive);
 
+/** Select protocol version, MQTT 3.1.1 is used by default.
+ * @param broker Data structure that contains the connection information with the broker.
+ * @param protocol_version MQTT_PROTOCOL_VERSION_3_1_1 or MQTT_PROTOCOL_VERSION_5.
+ *
+ * @note Only has effect before to call mqtt_connect
+ */
+void mqtt_set_protocol_version(mqtt_broker_handle_t* broker, uint8_t protocol_version);
+
+/** Set the clean session flag, clean session is used by default.
+ * @param broker Data structure that contains the connection information with the broker.
+ * @param clean_session 0 to resume session (subscriptions and queued messages) kept by the broker.
+ *
+ * @note Only has effect before to call mqtt_connect
+ */
+void mqtt_set_clean_session(mqtt_broker_handle_t* broker, uint8_t clean_session);
+
+/** Set MQTT 5 session properties sent in connect packet.
+ * @param broker Data structure that contains the connection information with the broker.
+ * @param session_expiry_interval Session expiry interval (in seconds), 0 ends session with connection.
+ * @param receive_maximum Maximum number of unacknowledged QoS 1 and 2 publishes client accepts, 0 for protocol default.
+ *
+ * @note Only has effect before to call mqtt_connect
+ */
+void mqtt_set_session_properties(mqtt_broker_handle_t* broker, uint32_t session_expiry_interval, uint16_t receive_maximum);
+
 /** Connect to the broker.
  * @param broker Data structure that contains the connection information with the broker.
  *
@@ -230,13 +362,22 @@ int mqtt_disconnect(mqtt_broker_handle_t* broker, uint8_t* packet, uint16_t pack
 /** Subscribe to a topic.
  * @param broker Data structure that contains the connection information with the broker.
  * @param topic The topic name.
+ * @param qos Requested QoS level (0 or 1).
  * @param message_id Variable that will store the Message ID, if the pointer is not NULL.
  *
  * @retval  1 On success.
  * @retval  0 On connection error.
  * @retval -1 On IO error.
  */
-int mqtt_subscribe(mqtt_broker_handle_t* broker, const char* topic, uint16_t* message_id, uint8_t* packet, uint16_t packet_size);
+int mqtt_subscribe(mqtt_broker_handle_t* broker, const char* topic, uint8_t qos, uint16_t* message_id, uint8_t* packet, uint16_t packet_size);
+
+/** Acknowledge received QoS 1 publish.
+ * @param broker Data structure that contains the connection information with the broker.
+ * @param message_id Message ID of the received publish.
+ *
+ * @retval size of the packet, -1 if it does not fit
+ */
+int mqtt_puback(mqtt_broker_handle_t* broker, uint16_t message_id, uint8_t* packet, uint16_t packet_size);
 
 /** Make a ping.
  * @param broker Data structure that contains the connection information with the broker.
@@ -247,6 +388,21 @@ int mqtt_subscribe(mqtt_broker_handle_t* broker, const char* topic, uint16_t* me
  */
 int mqtt_ping(mqtt_broker_handle_t* broker, uint8_t* packet, uint16_t packet_size);
 
+/** Publish already serialized payload with QoS 0.
+ *
+ * Header is written directly in front of the payload so payload is not copied.
+ * With MQTT 5 topic is replaced by topic alias after first publish if broker allows it.
+ *
+ * @param broker Data structure that contains the connection information with the broker.
+ * @param topic The topic name.
+ * @param payload Pointer to the payload, MQTT_PUBLISH_HEADER_MAX_SIZE(strlen(topic)) bytes in front of it must be reserved.
+ * @param payload_size Size of the payload.
+ * @param packet Variable that will store the pointer to the start of the packet.
+ *
+ * @retval size of the packet
+ */
+uint16_t mqtt_publish_in_place(mqtt_broker_handle_t* broker, const char* topic, uint8_t* payload, uint16_t payload_size, uint8_t** packet);
+
 void mqtt_init_will(mqtt_broker_handle_t* broker, const char * topic, const char *msg, uint8_t qos, uint8_t retain);
 
 #ifdef __cplusplus
@@ -12,6 +12,9 @@
 #ifdef LOG_ENABLED
 
 uint8_t log_level = 2;
+
+#ifdef LOG_TEXT
+
 char buffer[MAX_BUFFER_SIZE];
 
 void log_print_P(const char *format, ...)
@@ -20,10 +23,275 @@ void log_print_P(const char *format, ...)
 	va_start (args, format);
 	
 	uint16_t length = vsnprintf_P(buffer, MAX_BUFFER_SIZE, format, args);
-
+	
 	global_dependencies.log(buffer, length);
 	
 	va_end (args);
 }
 
+bool log_process(void)
+{
+	return false;
+}
+
+#else
+
+/*
+* Record is length byte, format string address and arguments in their native (little endian) representation,
+* %s arguments are copied as zero terminated strings. Format address 0 marks record with number of dropped records.
+*/
+
+static circular_buffer_t log_buffer;
+static uint8_t log_buffer_storage[LOG_BUFFER_SIZE];
+static uint16_t dropped_records = 0;
+
+static bool log_buffer_initialized = false;
+
+static bool append(uint8_t* record, uint8_t* length, const void* value, uint8_t size)
+{
+	if(*length + size > LOG_RECORD_MAX_SIZE)
+	{
+		return false;
+	}
+	
+	memcpy(record + *length, value, size);
+	*length += size;
+	
+	return true;
+}
+
+static bool append_string(uint8_t* record, uint8_t* length, const char* string, int precision)
+{
+	uint8_t max_length = LOG_RECORD_MAX_SIZE - *length;
+	if(!max_length)
+	{
+		return false;
+	}
+	
+	max_length--;
+	if(max_length > LOG_STRING_MAX_LENGTH)
+	{
+		max_length = LOG_STRING_MAX_LENGTH;
+	}
+	
+	if((precision >= 0) && (precision < max_length))
+	{
+		max_length = precision;
+	}
+	
+	uint8_t string_length = 0;
+	while(string && (string_length < max_length) && string[string_length])
+	{
+		record[(*length)++] = string[string_length++];
+	}
+	
+	record[(*length)++] = '\0';
+	
+	return true;
+}
+
+/*
+* Walks format in flash and copies arguments as printf would consume them.
+* Returns false when record is full, remaining arguments are left out and shown as missing by decoder.
+*/
+static bool append_arguments(uint8_t* record, uint8_t* length, const char* format, va_list args)
+{
+	char character;
+	while((character = pgm_read_byte(format++)))
+	{
+		if(character != '%')
+		{
+			continue;
+		}
+		
+		int precision = -1;
+		bool long_argument = false;
+		
+		while((character = pgm_read_byte(format++)))
+		{
+			if(character == '*')
+			{
+				int value = va_arg(args, int);
+				if(!append(record, length, &value, sizeof(value)))
+				{
+					return false;
+				}
+				
+				precision = value;
+			}
+			else if(character == '.')
+			{
+				precision = 0;
+			}
+			else if((character >= '0') && (character <= '9'))
+			{
+				if(precision >= 0)
+				{
+					precision = precision * 10 + character - '0';
+				}
+			}
+			else if(character == 'l')
+			{
+				long_argument = true;
+			}
+			else if(!strchr_P(PSTR("-+ #h"), character))
+			{
+				break;
+			}
+		}
+		
+		bool appended = true;
+		switch(character)
+		{
+			case '\0':
+			{
+				return true;
+			}
+			case '%':
+			{
+				break;
+			}
+			case 's':
+			{
+				appended = append_string(record, length, va_arg(args, const char*), precision);
+				break;
+			}
+			case 'S':
+			case 'p':
+			{
+				const void* value = va_arg(args, const void*);
+				appended = append(record, length, &value, sizeof(value));
+				break;
+			}
+			case 'c':
+			{
+				uint8_t value = va_arg(args, int);
+				appended = append(record, length, &value, sizeof(value));
+				break;
+			}
+			case 'e':
+			case 'E':
+			case 'f':
+			case 'F':
+			case 'g':
+			case 'G':
+			{
+				double value = va_arg(args, double);
+				appended = append(record, length, &value, sizeof(value));
+				break;
+			}
+			default:
+			{
+				if(long_argument)
+				{
+					long value = va_arg(args, long);
+					appended = append(record, length, &value, sizeof(value));
+				}
+				else
+				{
+					int value = va_arg(args, int);
+					appended = append(record, length, &value, sizeof(value));
+				}
+			}
+		}
+		
+		if(!appended)
+		{
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+void log_print_P(const char *format, ...)
+{
+	uint8_t record[LOG_RECORD_MAX_SIZE];
+	uint8_t length = 1;
+	append(record, &length, &format, sizeof(format));
+	
+	va_list args;
+	va_start (args, format);
+	
+	append_arguments(record, &length, format, args);
+	
+	va_end (args);
+	
+	record[0] = length;
+	
+	SYNCHRONIZED_BLOCK_START
+	
+	if(!log_buffer_initialized)
+	{
+		circular_buffer_init(&log_buffer, log_buffer_storage, LOG_BUFFER_SIZE, sizeof(uint8_t), false, true);
+		log_buffer_initialized = true;
+		circular_buffer_register(&log_buffer, PSTR("LOG"));
+	}
+	
+	if(!circular_buffer_add_array(&log_buffer, record, length) && (dropped_records < 0xFFFF))
+	{
+		dropped_records++;
+	}
+	
+	SYNCHRONIZED_BLOCK_END
+}
+
+static char hex_digit(uint8_t value)
+{
+	return value < 10 ? '0' + value : 'A' + value - 10;
+}
+
+bool log_process(void)
+{
+	uint8_t record[LOG_RECORD_MAX_SIZE];
+	uint8_t length = 0;
+	bool more_records;
+	
+	SYNCHRONIZED_BLOCK_START
+	
+	if(log_buffer_initialized && circular_buffer_peek(&log_buffer, 0, &length))
+	{
+		circular_buffer_pop_array(&log_buffer, length, record);
+	}
+	else if(dropped_records)
+	{
+		/* records were dropped after all buffered ones */
+		record[0] = 5;
+		record[1] = 0;
+		record[2] = 0;
+		record[3] = dropped_records & 0xFF;
+		record[4] = dropped_records >> 8;
+		length = 5;
+		
+		dropped_records = 0;
+	}
+	
+	more_records = dropped_records || (log_buffer_initialized && !circular_buffer_empty(&log_buffer));
+	
+	SYNCHRONIZED_BLOCK_END
+	
+	if(!length)
+	{
+		return false;
+	}
+	
+	char line[2 * LOG_RECORD_MAX_SIZE + 3];
+	uint8_t line_length = 0;
+	
+	line[line_length++] = '#';
+	for(uint8_t i = 1; i < length; i++)
+	{
+		line[line_length++] = hex_digit(record[i] >> 4);
+		line[line_length++] = hex_digit(record[i] & 0x0F);
+	}
+	line[line_length++] = '\r';
+	line[line_length++] = '\n';
+	
+	global_dependencies.log(line, line_length);
+	
+	return more_records;
+}
+
+#endif
+
 #endif
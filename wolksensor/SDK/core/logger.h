@@ -19,10 +19,25 @@ extern "C"
 
 #ifdef LOG_ENABLED
 
+	/*
+	* Unless LOG_TEXT is defined messages are not formatted on device. log_print_P stores flash address of format
+	* string and raw arguments into log buffer and log_process sends them as hex encoded records, one per line
+	* starting with '#', which are formatted on host by tools/log_decoder.py using strings from firmware ELF file.
+	*/
+
+	#define LOG_BUFFER_SIZE 256
+	#define LOG_RECORD_MAX_SIZE 48 /* length, format address and arguments */
+	#define LOG_STRING_MAX_LENGTH 24 /* characters of %s argument kept in record */
+
 	extern uint8_t log_level;
 
 	void log_print_P(const char *format, ...);
 
+	/**
+	* Sends one buffered record, returns true if there are more to send.
+	*/
+	bool log_process(void);
+
 	#define LOG(LVL, X) { \
 		if (LVL <= log_level) { \
 			log_print_P(PSTR(LOG_FORMAT), PSTR(X)); \
@@ -41,6 +56,7 @@ extern "C"
 
 	#define LOG(LVL, X)
 	#define LOG_PRINT(LVL, ...)
+	#define log_process() false
 
 #endif
 
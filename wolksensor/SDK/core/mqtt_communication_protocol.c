@@ -8,14 +8,43 @@
 #include "mqtt_communication_protocol_dependencies.h"
 #include "communication_module.h"
 #include "state_machine.h"
+#include "state_machine_trace.h"
+#include "state_residency.h"
 #include "protocol.h"
 #include "command_parser.h"
 
 #define MQTT_COMMUNICATION_PROTOCOL_EVENT_BUFFER_SIZE 10
-#define MQTT_BUFFER_SIZE (MAX_BUFFER_SIZE + 3 + MAX_DEVICE_ID_SIZE + 2)
+#define MQTT_TOPIC_SIZE (MAX_DEVICE_ID_SIZE + 10) // longest is will/<device_id>/001
+
+// send connect, subscribe and first publish in one write, validate connack and suback afterwards
+#define MQTT_PIPELINED_CONNECT 1
+
+#if MQTT_PIPELINED_CONNECT
+	#define MQTT_CONNECT_AND_SUBSCRIBE_MAX_SIZE 256 // connect with will and credentials followed by subscribe
+#else
+	#define MQTT_CONNECT_AND_SUBSCRIBE_MAX_SIZE 0
+#endif
+
+#define MQTT_BUFFER_SIZE (MAX_BUFFER_SIZE + MQTT_PUBLISH_HEADER_MAX_SIZE(MQTT_TOPIC_SIZE) + MQTT_CONNECT_AND_SUBSCRIBE_MAX_SIZE)
 
 #define MQTT_KEEP_ALIVE_PERIOD 60 // sec 
 
+// MQTT_PROTOCOL_VERSION_5 enables topic aliases and session properties
+#define MQTT_PROTOCOL_VERSION MQTT_PROTOCOL_VERSION_3_1_1
+
+// keep subscription and commands queued while sleeping on broker between connections
+#define MQTT_PERSISTENT_SESSION 1
+
+#if MQTT_PERSISTENT_SESSION
+	#define MQTT_SUBSCRIBE_QOS 1 // broker queues commands for the session
+	#define MQTT_SESSION_EXPIRY_INTERVAL 604800 // sec, one week
+#else
+	#define MQTT_SUBSCRIBE_QOS 0
+	#define MQTT_SESSION_EXPIRY_INTERVAL 0 // sec, session ends with connection
+#endif
+
+#define MQTT_RECEIVE_MAXIMUM 1 // commands are processed one publish at a time
+
 typedef enum
 {
 	STATE_MQTT_DISCONNECTED = 0,
@@ -27,6 +56,7 @@ typedef enum
 	STATE_MQTT_CONNECTED,
 		STATE_MQTT_PUBLISH,
 		STATE_MQTT_RECEIVE_PUBLISH,
+		STATE_MQTT_SEND_PUBACK,
 		STATE_MQTT_PING,
 			STATE_MQTT_SEND_PINREQ,
 			STATE_MQTT_RECEIVE_PINGRESP,
@@ -50,6 +80,8 @@ mqtt_communication_protocol_events_t;
 typedef struct
 {
 	uint8_t type;
+	uint8_t qos;
+	uint8_t return_code;
 	uint16_t message_id;
 	int8_t* topic;
 	uint8_t topic_size;
@@ -59,7 +91,7 @@ typedef struct
 mqtt_mesage_t;
 
 static state_machine_state_t mqtt_communication_protocol_state_machine;
-static state_machine_state_t mqtt_communication_protocol_states[13];
+static state_machine_state_t mqtt_communication_protocol_states[14];
 
 static circular_buffer_t mqtt_communication_protocol_event_buffer;
 static event_t mqtt_communication_protocol_event_buffer_storage[MQTT_COMMUNICATION_PROTOCOL_EVENT_BUFFER_SIZE];
@@ -68,9 +100,26 @@ static mqtt_broker_handle_t broker;
 
 static mqtt_mesage_t mqtt_message;
 
-static uint16_t mqtt_buffer_position = 0;
 static uint8_t mqtt_buffer[MQTT_BUFFER_SIZE];
 
+// received data is kept at the start of the buffer until processed, messages to send are serialized behind it
+static mqtt_decoder_t mqtt_decoder;
+static uint8_t* mqtt_packet = NULL;
+static uint16_t received_data_size = 0;
+static bool receive_successful = false;
+static communication_module_process_handle_t socket_receive_process_handle = NULL;
+
+// publish was sent together with connect and is confirmed with suback
+static bool publish_pipelined = false;
+static bool subscribe_pipelined = false;
+static uint16_t serialized_sensor_readings = 0;
+static uint16_t serialized_system_items = 0;
+
+// broker is expected to keep config subscription from previous connection
+static bool subscription_persisted = false;
+
+static uint8_t puback_buffer[4];
+
 static circular_buffer_t* sending_sensor_readings_buffer = NULL;
 static uint16_t* sensor_readings_sent = NULL;
 
@@ -82,8 +131,11 @@ static actuator_state_t* sending_actuator_state = NULL;
 
 static circular_buffer_t* received_commands_buffer = NULL;
 
+static circular_buffer_t* sending_command_responses_buffer = NULL;
+static command_parser_t command_parser;
+
 static uint16_t message_id = 0;
-static char topic[32];
+static char topic[MQTT_TOPIC_SIZE];
 
 static communication_module_process_handle_t communication_module_process_handle = NULL;
 
@@ -101,6 +153,7 @@ static bool state_mqtt_connecting(state_machine_state_t* state, event_t* event);
 static bool state_mqtt_connected(state_machine_state_t* state, event_t* event);	
 	static bool state_mqtt_publish(state_machine_state_t* state, event_t* event);
 	static bool state_mqtt_receive_publish(state_machine_state_t* state, event_t* event);
+	static bool state_mqtt_send_puback(state_machine_state_t* state, event_t* event);
 	static bool state_mqtt_ping(state_machine_state_t* state, event_t* event);
 		static bool state_mqtt_send_pingreq(state_machine_state_t* state, event_t* event);
 		static bool state_mqtt_receive_pingresp(state_machine_state_t* state, event_t* event);
@@ -109,6 +162,7 @@ static bool state_mqtt_disconnecting(state_machine_state_t* state, event_t* even
 static void init_mqtt_communication_protocol_event_buffer(void)
 {
 	circular_buffer_init(&mqtt_communication_protocol_event_buffer, mqtt_communication_protocol_event_buffer_storage, MQTT_COMMUNICATION_PROTOCOL_EVENT_BUFFER_SIZE, sizeof(event_t), true, true);
+	circular_buffer_register(&mqtt_communication_protocol_event_buffer, PSTR("MQTT_EVENTS"));
 }
 
 static void add_mqtt_communication_protocol_event_type(uint8_t event_type)
@@ -135,10 +189,105 @@ static bool mqtt_communinication_protocol_process(void)
 
 void clear_mqtt_buffer(void)
 {
-	mqtt_buffer_position = 0;
+	mqtt_decoder_init(&mqtt_decoder, mqtt_buffer, MQTT_BUFFER_SIZE);
+	mqtt_packet = NULL;
 	memset(mqtt_buffer, 0, MQTT_BUFFER_SIZE);
 }
 
+/*
+* Space for message to send, received messages that are not processed yet stay in front of it.
+*/
+static uint8_t* mqtt_send_buffer(uint16_t* size)
+{
+	mqtt_packet = NULL;
+	
+	return mqtt_decoder_space(&mqtt_decoder, size);
+}
+
+static void receive_from_socket(void)
+{
+	uint16_t space_size;
+	uint8_t* space = mqtt_decoder_space(&mqtt_decoder, &space_size);
+	
+	socket_receive_process_handle = communication_module.receive(space, space_size, &received_data_size);
+}
+
+static bool buffered_message_process(void)
+{
+	return false;
+}
+
+/*
+* Reads the socket until whole message arrives, read times out or fails.
+*/
+static bool receive_process(void)
+{
+	if(socket_receive_process_handle())
+	{
+		return true;
+	}
+	
+	communication_module_type_data_t receive_result = communication_module.get_communication_result();
+	append_communication_module_type_data(&receive_result, &communication_protocol_type_data.communication_module_type_data);
+	
+	receive_successful = is_communication_module_success(&receive_result);
+	if(!receive_successful || received_data_size == 0)
+	{
+		return false;
+	}
+	
+	mqtt_decoder_feed(&mqtt_decoder, received_data_size);
+	
+	mqtt_packet = mqtt_decoder_next(&mqtt_decoder);
+	if(mqtt_packet != NULL)
+	{
+		return false;
+	}
+	
+	if(mqtt_decoder.state == MQTT_DECODER_ERROR)
+	{
+		LOG(1, "Mqtt message malformed or too large");
+		
+		receive_successful = false;
+		
+		return false;
+	}
+	
+	LOG_PRINT(2, PSTR("Mqtt message fragment received %u\r\n"), received_data_size);
+	
+	receive_from_socket();
+	
+	return true;
+}
+
+/*
+* Starts receiving next mqtt message.
+* Message that already arrived with the previous one is taken from the buffer without reading the socket.
+*/
+static void receive_mqtt_message(void)
+{
+	mqtt_packet = mqtt_decoder_next(&mqtt_decoder);
+	if(mqtt_packet != NULL)
+	{
+		LOG(1, "Mqtt message already received");
+		
+		receive_successful = true;
+		communication_module_process_handle = buffered_message_process;
+	}
+	else
+	{
+		receive_from_socket();
+		communication_module_process_handle = receive_process;
+	}
+	
+	add_mqtt_communication_protocol_event_type(EVENT_COMMUNICATION_MODULE_PROCESS);
+}
+
+static bool mqtt_message_received(void)
+{
+	return receive_successful;
+}
+
 static void transition(mqtt_communication_protocol_states_t new_state_id)
 {
 	state_machine_transition(mqtt_communication_protocol_states, &mqtt_communication_protocol_state_machine, new_state_id);
@@ -172,6 +321,9 @@ void mqtt_protocol_init(void)
 	mqtt_communication_protocol_state_machine.parent = NULL;
 	mqtt_communication_protocol_state_machine.current_state = STATE_MQTT_DISCONNECTED;
 	mqtt_communication_protocol_state_machine.handler = mqtt_communication_protocol_handler;
+	state_machine_trace_register(&mqtt_communication_protocol_state_machine, STATE_MACHINE_TRACE_MQTT_COMMUNICATION_PROTOCOL);
+	state_residency_register(STATE_MACHINE_TRACE_MQTT_COMMUNICATION_PROTOCOL, STATE_MQTT_DISCONNECTING + 1);
+	state_residency_enter(STATE_MACHINE_TRACE_MQTT_COMMUNICATION_PROTOCOL, STATE_MQTT_DISCONNECTED);
 
 	init_state(STATE_MQTT_DISCONNECTED, NULL, &mqtt_communication_protocol_state_machine, -1, state_mqtt_disconnected);
 	init_state(STATE_MQTT_CONNECTING, NULL, &mqtt_communication_protocol_state_machine, STATE_MQTT_SEND_CONNECT, state_mqtt_connecting);
@@ -182,6 +334,7 @@ void mqtt_protocol_init(void)
 	init_state(STATE_MQTT_CONNECTED, NULL, &mqtt_communication_protocol_state_machine, -1, state_mqtt_connected);
 		init_state(STATE_MQTT_PUBLISH, NULL, &mqtt_communication_protocol_states[STATE_MQTT_CONNECTED], -1, state_mqtt_publish);
 		init_state(STATE_MQTT_RECEIVE_PUBLISH, NULL, &mqtt_communication_protocol_states[STATE_MQTT_CONNECTED], -1, state_mqtt_receive_publish);
+		init_state(STATE_MQTT_SEND_PUBACK, NULL, &mqtt_communication_protocol_states[STATE_MQTT_CONNECTED], -1, state_mqtt_send_puback);
 		init_state(STATE_MQTT_PING, NULL, &mqtt_communication_protocol_states[STATE_MQTT_CONNECTED], -1, state_mqtt_ping);
 			init_state(STATE_MQTT_SEND_PINREQ, NULL, &mqtt_communication_protocol_states[STATE_MQTT_PING], -1, state_mqtt_send_pingreq);
 			init_state(STATE_MQTT_RECEIVE_PINGRESP, NULL, &mqtt_communication_protocol_states[STATE_MQTT_PING], -1, state_mqtt_receive_pingresp);
@@ -210,6 +363,7 @@ communication_protocol_process_handle_t mqtt_protocol_send_sensor_readings_and_s
 	system_items_sent = sent_system_items;
 	
 	sending_actuator_state = NULL;
+	sending_command_responses_buffer = NULL;
 	
 	clear_communication_protocol_data();
 	
@@ -225,6 +379,27 @@ communication_protocol_process_handle_t mqtt_protocol_send_actuator_state(actuat
 	sending_actuator = actuator;
 	sending_actuator_state = actuator_state;
 	
+	sending_sensor_readings_buffer = NULL;
+	sensor_readings_sent = NULL;
+	sending_system_buffer = NULL;
+	system_items_sent = NULL;
+	sending_command_responses_buffer = NULL;
+	
+	clear_communication_protocol_data();
+	
+	add_mqtt_communication_protocol_event_type(EVENT_MQTT_PUBLISH);
+	
+	return mqtt_communinication_protocol_process;
+}
+
+communication_protocol_process_handle_t mqtt_protocol_send_command_responses(circular_buffer_t* command_response_buffer)
+{
+	LOG(1, "Mqtt send command responses");
+	
+	sending_command_responses_buffer = command_response_buffer;
+	
+	sending_actuator = NULL;
+	sending_actuator_state = NULL;
 	sending_sensor_readings_buffer = NULL;
 	sensor_readings_sent = NULL;
 	sending_system_buffer = NULL;
@@ -263,25 +438,30 @@ communication_protocol_process_handle_t mqtt_protocol_disconnect(void)
 
 static bool mqtt_parse_message(void)
 {
-	uint8_t remaining_length_bytes = mqtt_num_rem_len_bytes(mqtt_buffer);
-	uint8_t remaining_length = mqtt_parse_rem_len(mqtt_buffer);
-
-	if (mqtt_buffer_position < (remaining_length + remaining_length_bytes + 1))
+	if(mqtt_packet == NULL)
 	{
 		/* not the whole message yet */
 		LOG(2, "Not the whole mqtt message yet");
 		return false;
 	}
 
-	mqtt_message.type = MQTTParseMessageType(mqtt_buffer);
+	mqtt_message.type = MQTTParseMessageType(mqtt_packet);
 
 	switch(mqtt_message.type)
 	{
+		case MQTT_MSG_CONNACK:
+		{
+			mqtt_message.return_code = mqtt_parse_connack(&broker, mqtt_packet);
+			
+			LOG_PRINT(1, PSTR("Mqtt message received: connack %u\r\n"), mqtt_message.return_code);
+			
+			break;
+		}
 		case MQTT_MSG_SUBACK:
 		{
 			LOG(1, "Mqtt message received: suback");
 			
-			mqtt_message.message_id = mqtt_parse_msg_id(mqtt_buffer);
+			mqtt_message.message_id = mqtt_parse_msg_id(mqtt_packet);
 
 			break;
 		}
@@ -289,9 +469,11 @@ static bool mqtt_parse_message(void)
 		{
 			LOG(1, "Mqtt message received: publish");
 			
-			mqtt_message.topic_size = mqtt_parse_pub_topic_ptr(mqtt_buffer, (const uint8_t**)&mqtt_message.topic);
+			mqtt_message.qos = MQTTParseMessageQos(mqtt_packet);
+			mqtt_message.message_id = mqtt_parse_msg_id(mqtt_packet);
+			mqtt_message.topic_size = mqtt_parse_pub_topic_ptr(mqtt_packet, (const uint8_t**)&mqtt_message.topic);
 			
-			mqtt_message.data_size  = mqtt_parse_pub_msg_ptr(mqtt_buffer, (const uint8_t**)&mqtt_message.data);
+			mqtt_message.data_size  = mqtt_parse_pub_msg_ptr(&broker, mqtt_packet, (const uint8_t**)&mqtt_message.data);
 
 			break;
 		}
@@ -338,6 +520,85 @@ static bool mqtt_communication_protocol_handler(state_machine_state_t* state, ev
 	}
 }
 
+/*
+* Serializes publish message with pending data at given position.
+* Returns size of the message.
+*/
+static uint16_t serialize_publish(uint8_t* start, uint16_t capacity)
+{
+	serialized_sensor_readings = 0;
+	serialized_system_items = 0;
+	
+	sprintf_P(topic, PSTR("sensors/%s"), device_id);
+	uint16_t header_size = MQTT_PUBLISH_HEADER_MAX_SIZE(strlen(topic));
+	
+	// payload
+	circular_buffer_t message_buffer;
+	circular_buffer_init(&message_buffer, start + header_size, capacity - header_size, sizeof(char), false, true);
+	
+	if(sending_actuator != NULL && sending_actuator_state != NULL)
+	{
+		append_actuator_state(sending_actuator, sending_actuator_state, &message_buffer);
+		
+		LOG_PRINT(1, PSTR("Packed status message: %s\r\n"), message_buffer.storage);
+	}
+	else if(sending_command_responses_buffer != NULL)
+	{
+		circular_buffer_add_array(&message_buffer, sending_command_responses_buffer->storage, circular_buffer_size(sending_command_responses_buffer));
+		
+		LOG_PRINT(1, PSTR("Packed command responses message: %s\r\n"), message_buffer.storage);
+		
+		if(!ssl)
+		{
+			uint16_t encrypted_data_size = mqtt_communication_protocol_dependencies.encrypt(message_buffer.storage, circular_buffer_size(&message_buffer), device_preshared_key);
+			message_buffer.tail = encrypted_data_size;
+		}
+	}
+	else
+	{
+		append_rtc(rtc_get_ts(), &message_buffer);
+		
+		if(location && (commands_dependencies.get_surroundig_wifi_networks != NULL))
+		{
+			wifi_network_t networks[10];
+			uint8_t networks_number = commands_dependencies.get_surroundig_wifi_networks(networks, 10);
+			
+			append_detected_wifi_networks(networks, networks_number, &message_buffer);
+		}
+		
+		if(sending_system_buffer != NULL)
+		{
+			serialized_system_items = append_system_info(sending_system_buffer, 0, &message_buffer, false);
+		}
+		
+		if(sending_sensor_readings_buffer != NULL)
+		{
+			serialized_sensor_readings = append_sensor_readings(sending_sensor_readings_buffer, 0, &message_buffer, false);
+		}
+		
+		LOG_PRINT(1, PSTR("Packed readings message: %s\r\n"), message_buffer.storage);
+		
+		if(!ssl)
+		{
+			uint16_t encrypted_data_size = mqtt_communication_protocol_dependencies.encrypt(message_buffer.storage, circular_buffer_size(&message_buffer), device_preshared_key);
+			message_buffer.tail = encrypted_data_size;
+		}
+	}
+	
+	// header is placed right in front of the payload, move packet to the start to close the gap ahead of it
+	uint8_t* publish_message_start;
+	uint16_t publish_message_size = mqtt_publish_in_place(&broker, topic, start + header_size, circular_buffer_size(&message_buffer), &publish_message_start);
+	memmove(start, publish_message_start, publish_message_size);
+	
+	return publish_message_size;
+}
+
+static void report_published(bool success)
+{
+	if(sensor_readings_sent != NULL) *sensor_readings_sent = success ? serialized_sensor_readings : 0;
+	if(system_items_sent != NULL) *system_items_sent = success ? serialized_system_items : 0;
+}
+
 static bool mqtt_parameters_set(void)
 {
 	return (*device_id != 0) && (*device_preshared_key != 0);
@@ -353,6 +614,9 @@ static bool state_mqtt_disconnected(state_machine_state_t* state, event_t* event
 			
 			circular_buffer_clear(&mqtt_communication_protocol_event_buffer);
 			
+			publish_pipelined = false;
+			subscribe_pipelined = false;
+			
 			return true;
 		}
 		case EVENT_MQTT_DISCONNECT:
@@ -367,7 +631,11 @@ static bool state_mqtt_disconnected(state_machine_state_t* state, event_t* event
 			
 			if(mqtt_parameters_set())
 			{
+#if MQTT_PIPELINED_CONNECT
+				publish_pipelined = true; // sent together with connect
+#else
 				add_mqtt_communication_protocol_event_type(EVENT_MQTT_PUBLISH);
+#endif
 				transition(STATE_MQTT_CONNECTING);
 			}
 			else
@@ -464,12 +732,63 @@ static bool state_mqtt_send_connect(state_machine_state_t* state, event_t* event
 
 			mqtt_init_will(&broker, topic, "Connection break with WolkSensor", 0, 0);
 			mqtt_set_alive(&broker, MQTT_KEEP_ALIVE_PERIOD); /* 60 sec keep alive to avoid sending pings at all */
+			mqtt_set_protocol_version(&broker, MQTT_PROTOCOL_VERSION);
+			mqtt_set_session_properties(&broker, MQTT_SESSION_EXPIRY_INTERVAL, MQTT_RECEIVE_MAXIMUM);
+			mqtt_set_clean_session(&broker, !MQTT_PERSISTENT_SESSION);
+			
+			/* configured broker credentials take precedence over device credentials */
+			if(*mqtt_username)
+			{
+				mqttlib_init_auth(&broker, mqtt_username, mqtt_password);
+			}
+			else
+			{
+				mqttlib_init_auth(&broker, device_id, (char*)device_preshared_key);
+			}
+			
+			LOG_PRINT(1, PSTR("MQTT username %s\r\n"), broker.username);
+			
+			int connect_message_size = mqtt_connect(&broker, mqtt_buffer, MQTT_BUFFER_SIZE);
+			if(connect_message_size < 0)
+			{
+				LOG(1, "Unable to serialize mqtt connect message");
+				
+				set_mqtt_communication_protocol_error(ERROR_SENDING_MQTT_MESSAGE, state->id);
+				
+				transition(STATE_MQTT_DISCONNECTED);
+				
+				return true;
+			}
 			
-			mqttlib_init_auth(&broker, device_id, device_preshared_key);
+#if MQTT_PIPELINED_CONNECT
+			// when broker keeps the session subscribe is sent only if connack reports it was lost
+			subscribe_pipelined = !subscription_persisted;
+			if(subscribe_pipelined)
+			{
+				sprintf_P(topic, PSTR("config/%s"), device_id);
+				
+				int subscribe_message_size = mqtt_subscribe(&broker, topic, MQTT_SUBSCRIBE_QOS, &message_id, mqtt_buffer + connect_message_size, MQTT_BUFFER_SIZE - connect_message_size);
+				if(subscribe_message_size < 0)
+				{
+					LOG(1, "Unable to serialize mqtt subscribe message");
+					
+					set_mqtt_communication_protocol_error(ERROR_SENDING_MQTT_MESSAGE, state->id);
+					
+					transition(STATE_MQTT_DISCONNECTED);
+					
+					return true;
+				}
+				
+				connect_message_size += subscribe_message_size;
+			}
 			
-			LOG_PRINT(1, PSTR("MQTT username and password %s %s\r\n"), device_id, device_preshared_key);
+			if(publish_pipelined)
+			{
+				connect_message_size += serialize_publish(mqtt_buffer + connect_message_size, MQTT_BUFFER_SIZE - connect_message_size);
+			}
 			
-			uint16_t connect_message_size = mqtt_connect(&broker, mqtt_buffer, MQTT_BUFFER_SIZE);
+			LOG_PRINT(1, PSTR("Mqtt connect pipelined, %d bytes\r\n"), connect_message_size);
+#endif
 			
 			communication_module_process_handle = communication_module.sendd(mqtt_buffer, connect_message_size);
 			add_mqtt_communication_protocol_event_type(EVENT_COMMUNICATION_MODULE_PROCESS);
@@ -525,27 +844,52 @@ static bool state_mqtt_receive_connnack(state_machine_state_t* state, event_t* e
 		}
 		case EVENT_MQTT_RECEIVE_CONNACK:
 		{
-			clear_mqtt_buffer();
-			
-			communication_module_process_handle = communication_module.receive(mqtt_buffer, MQTT_BUFFER_SIZE, &mqtt_buffer_position);
-			add_mqtt_communication_protocol_event_type(EVENT_COMMUNICATION_MODULE_PROCESS);
+			receive_mqtt_message();
 			
 			return true;
 		}
 		case EVENT_COMMUNICATION_MODULE_DONE:
 		{
-			communication_module_type_data_t receive_result = communication_module.get_communication_result();
-			append_communication_module_type_data(&receive_result, &communication_protocol_type_data.communication_module_type_data);
-			
-			if(is_communication_module_success(&receive_result))
+			if(mqtt_message_received())
 			{				
 				if(mqtt_parse_message())
 				{
-					if(mqtt_message.type == MQTT_MSG_CONNACK)
+					if(mqtt_message.type == MQTT_MSG_CONNACK && mqtt_message.return_code == 0)
 					{
 						LOG(1, "Mqtt connack message received");
 						
-						transition(STATE_MQTT_SEND_SUBSCRIBE);
+						if(publish_pipelined)
+						{
+							LOG(1, "Mqtt pipelined publish message sent");
+							
+							publish_pipelined = false;
+							report_published(true);
+						}
+						
+						subscription_persisted = broker.session_present;
+						
+						if(subscribe_pipelined)
+						{
+							transition(STATE_MQTT_RECEIVE_SUBACK);
+						}
+						else if(subscription_persisted)
+						{
+							LOG(1, "Mqtt session present, subscription kept");
+							
+							transition(STATE_MQTT_CONNECTED);
+						}
+						else
+						{
+							transition(STATE_MQTT_SEND_SUBSCRIBE);
+						}
+					}
+					else if(mqtt_message.type == MQTT_MSG_CONNACK)
+					{
+						LOG(1, "Mqtt connection refused");
+						
+						set_mqtt_communication_protocol_error(ERROR_INCORRECT_MQTT_MESSAGE_RECEIVED, state->id);
+						
+						transition(STATE_MQTT_DISCONNECTED);
 					}
 					else
 					{
@@ -595,13 +939,24 @@ static bool state_mqtt_send_subscribe(state_machine_state_t* state, event_t* eve
 		{
 			LOG(1, "Entering mqtt send subscribe state");
 			
-			clear_mqtt_buffer();
+			uint16_t send_buffer_size;
+			uint8_t* send_buffer = mqtt_send_buffer(&send_buffer_size);
 			
 			sprintf_P(topic, PSTR("config/%s"), device_id);
 			
-			uint16_t subscribe_message_size = mqtt_subscribe(&broker, topic, &message_id, mqtt_buffer, MQTT_BUFFER_SIZE);
+			int subscribe_message_size = mqtt_subscribe(&broker, topic, MQTT_SUBSCRIBE_QOS, &message_id, send_buffer, send_buffer_size);
+			if(subscribe_message_size < 0)
+			{
+				LOG(1, "Unable to serialize mqtt subscribe message");
+				
+				set_mqtt_communication_protocol_error(ERROR_SENDING_MQTT_MESSAGE, state->id);
+				
+				transition(STATE_MQTT_DISCONNECTED);
+				
+				return true;
+			}
 			
-			communication_module_process_handle = communication_module.sendd(mqtt_buffer, subscribe_message_size);
+			communication_module_process_handle = communication_module.sendd(send_buffer, subscribe_message_size);
 			add_mqtt_communication_protocol_event_type(EVENT_COMMUNICATION_MODULE_PROCESS);
 			
 			return true;
@@ -655,19 +1010,13 @@ static bool state_mqtt_receive_suback(state_machine_state_t* state, event_t* eve
 		}
 		case EVENT_MQTT_RECEIVE_SUBACK: 
 		{
-			clear_mqtt_buffer();
-		
-			communication_module_process_handle = communication_module.receive(mqtt_buffer, MQTT_BUFFER_SIZE, &mqtt_buffer_position);
-			add_mqtt_communication_protocol_event_type(EVENT_COMMUNICATION_MODULE_PROCESS);
+			receive_mqtt_message();
 			
 			return true;
 		}
 		case EVENT_COMMUNICATION_MODULE_DONE:
 		{
-			communication_module_type_data_t receive_result = communication_module.get_communication_result();
-			append_communication_module_type_data(&receive_result, &communication_protocol_type_data.communication_module_type_data);
-			
-			if(is_communication_module_success(&receive_result))
+			if(mqtt_message_received())
 			{			
 				if(mqtt_parse_message())
 				{	
@@ -679,6 +1028,8 @@ static bool state_mqtt_receive_suback(state_machine_state_t* state, event_t* eve
 						{
 							LOG(1,"Suback message id matches");
 							
+							subscription_persisted = MQTT_PERSISTENT_SESSION;
+							
 							transition(STATE_MQTT_CONNECTED);
 						}
 						else
@@ -781,74 +1132,18 @@ static bool state_mqtt_connected(state_machine_state_t* state, event_t* event)
 
 static bool state_mqtt_publish(state_machine_state_t* state, event_t* event)
 {
-	static uint16_t serialized_sensor_readings;
-	static uint16_t serialized_system_items;
-	
 	switch (event->type)
 	{
 		case EVENT_ENTERING_STATE:
 		{
 			LOG(1, "Entering mqtt publish state");
 
-			clear_mqtt_buffer();
-			serialized_sensor_readings = 0;
-			serialized_system_items = 0;
-			
-			sprintf_P(topic, PSTR("sensors/%s"), device_id);
-			uint16_t header_size = 3 + strlen(topic) + 2;
-			
-			// payload
-			circular_buffer_t message_buffer;
-			circular_buffer_init(&message_buffer, mqtt_buffer + header_size, MQTT_BUFFER_SIZE - header_size, sizeof(char), false, true);
-			
-			if(sending_actuator != NULL && sending_actuator_state != NULL)
-			{
-				append_actuator_state(sending_actuator, sending_actuator_state, &message_buffer);
-				
-				LOG_PRINT(1, PSTR("Packed status message: %s\r\n"), message_buffer.storage);
-			}
-			else
-			{
-				append_rtc(rtc_get_ts(), &message_buffer);
-				
-				if(location && (commands_dependencies.get_surroundig_wifi_networks != NULL))
-				{
-					wifi_network_t networks[10];
-					uint8_t networks_number = commands_dependencies.get_surroundig_wifi_networks(networks, 10);
-					
-					append_detected_wifi_networks(networks, networks_number, &message_buffer);
-				}
-				
-				if(sending_system_buffer != NULL)
-				{
-					serialized_system_items = append_system_info(sending_system_buffer, 0, &message_buffer, false);
-				}
-				
-				if(sending_sensor_readings_buffer != NULL)
-				{
-					serialized_sensor_readings = append_sensor_readings(sending_sensor_readings_buffer, 0, &message_buffer, false);
-				}
-				
-				LOG_PRINT(1, PSTR("Packed readings message: %s\r\n"), message_buffer.storage);
-				
-				if(!ssl)
-				{
-					uint16_t encrypted_data_size = mqtt_communication_protocol_dependencies.encrypt(message_buffer.storage, circular_buffer_size(&message_buffer), device_preshared_key);
-					message_buffer.tail = encrypted_data_size;
-				}
-			}
+			uint16_t send_buffer_size;
+			uint8_t* send_buffer = mqtt_send_buffer(&send_buffer_size);
 			
-			uint16_t mqtt_message_size = header_size + circular_buffer_size(&message_buffer);
+			uint16_t publish_message_size = serialize_publish(send_buffer, send_buffer_size);
 			
-			uint8_t *header = mqtt_buffer;
-			*header++ = MQTT_MSG_PUBLISH;
-			*header++ = ((mqtt_message_size - 3) % 128) | 0x80;
-			*header++ = (mqtt_message_size - 3) / 128;
-			*header++ = (header_size - 5) >> 8;
-			*header++ = (header_size - 5) & 0xFF;
-			memcpy(header, topic, (header_size - 5));
-			
-			communication_module_process_handle = communication_module.sendd(mqtt_buffer, mqtt_message_size);
+			communication_module_process_handle = communication_module.sendd(send_buffer, publish_message_size);
 			add_mqtt_communication_protocol_event_type(EVENT_COMMUNICATION_MODULE_PROCESS);
 			
 			return true;
@@ -862,8 +1157,7 @@ static bool state_mqtt_publish(state_machine_state_t* state, event_t* event)
 			{
 				LOG(1, "Mqtt publish message sent");
 				
-				if(sensor_readings_sent != NULL) *sensor_readings_sent = serialized_sensor_readings;
-				if(system_items_sent != NULL) *system_items_sent = serialized_system_items;
+				report_published(true);
 	
 				transition(STATE_MQTT_CONNECTED);
 			}
@@ -873,8 +1167,7 @@ static bool state_mqtt_publish(state_machine_state_t* state, event_t* event)
 				
 				set_mqtt_communication_protocol_error(ERROR_SENDING_MQTT_MESSAGE, state->id);
 				
-				if(sensor_readings_sent != NULL) *sensor_readings_sent = 0;
-				if(system_items_sent != NULL) *system_items_sent = 0;
+				report_published(false);
 				
 				transition(STATE_MQTT_DISCONNECTED);
 			}
@@ -908,26 +1201,20 @@ static bool state_mqtt_receive_publish(state_machine_state_t* state, event_t* ev
 		}
 		case EVENT_MQTT_RECEIVE_PUBLISH:
 		{
-			clear_mqtt_buffer();
-			
-			communication_module_process_handle = communication_module.receive(mqtt_buffer, MQTT_BUFFER_SIZE, &mqtt_buffer_position);
-			add_mqtt_communication_protocol_event_type(EVENT_COMMUNICATION_MODULE_PROCESS);
+			receive_mqtt_message();
 			
 			return true;
 		}
 		case EVENT_COMMUNICATION_MODULE_DONE:
 		{
-			communication_module_type_data_t receive_result = communication_module.get_communication_result();
-			append_communication_module_type_data(&receive_result, &communication_protocol_type_data.communication_module_type_data);
-			
-			if(is_communication_module_success(&receive_result))
+			if(mqtt_message_received())
 			{				
 				if(mqtt_parse_message())
 				{
 					if(mqtt_message.type == MQTT_MSG_PUBLISH)
 					{
 						LOG(1, "Mqtt publish message received");
-						LOG_PRINT(1, PSTR("Received data from mqtt server %s\r\n"), mqtt_message.data);
+						LOG_PRINT(1, PSTR("Received data from mqtt server, length %u\r\n"), mqtt_message.data_size);
 						
 						if(mqtt_message.data_size > 0)
 						{
@@ -936,19 +1223,23 @@ static bool state_mqtt_receive_publish(state_machine_state_t* state, event_t* ev
 								mqtt_communication_protocol_dependencies.decrypt(mqtt_message.data, mqtt_message.data_size, device_preshared_key);
 							}
 							
-							circular_buffer_t command_string_buffer;
-							circular_buffer_init(&command_string_buffer, mqtt_message.data, strlen(mqtt_message.data), sizeof(char), false, false);
-							command_string_buffer.head = 0;
-							command_string_buffer.tail = 0;
-							command_string_buffer.empty = false;
-							command_string_buffer.full = true;
+							// data is not terminated, next message may follow it in the buffer
+							uint16_t data_length = strnlen((char*)mqtt_message.data, mqtt_message.data_size);
 							
-							LOG_PRINT(1, PSTR("Received data: %s length %u\r\n"), command_string_buffer.storage, circular_buffer_size(&command_string_buffer));
+							LOG_PRINT(1, PSTR("Received data: %.*s length %u\r\n"), data_length, mqtt_message.data, data_length);
 							
-							extract_commands_from_string_buffer(&command_string_buffer, received_commands_buffer);
+							command_parser_init(&command_parser);
+							command_parser_feed_array(&command_parser, (char*)mqtt_message.data, data_length, received_commands_buffer);
 						}
 						
-						transition(STATE_MQTT_CONNECTED);
+						if(mqtt_message.qos > 0)
+						{
+							transition(STATE_MQTT_SEND_PUBACK);
+						}
+						else
+						{
+							transition(STATE_MQTT_CONNECTED);
+						}
 					}
 					else
 					{
@@ -986,6 +1277,57 @@ static bool state_mqtt_receive_publish(state_machine_state_t* state, event_t* ev
 	}
 }
 
+static bool state_mqtt_send_puback(state_machine_state_t* state, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG(1, "Entering mqtt send puback state");
+			
+			// separate buffer keeps messages received together with the publish
+			uint16_t puback_message_size = mqtt_puback(&broker, mqtt_message.message_id, puback_buffer, sizeof(puback_buffer));
+			
+			communication_module_process_handle = communication_module.sendd(puback_buffer, puback_message_size);
+			add_mqtt_communication_protocol_event_type(EVENT_COMMUNICATION_MODULE_PROCESS);
+			
+			return true;
+		}
+		case EVENT_COMMUNICATION_MODULE_DONE:
+		{
+			communication_module_type_data_t send_result = communication_module.get_communication_result();
+			append_communication_module_type_data(&send_result, &communication_protocol_type_data.communication_module_type_data);
+			
+			if(is_communication_module_success(&send_result))
+			{
+				LOG(1, "Mqtt puback message sent");
+				
+				transition(STATE_MQTT_CONNECTED);
+			}
+			else
+			{
+				LOG(1, "Unable to send mqtt puback message");
+				
+				set_mqtt_communication_protocol_error(ERROR_SENDING_MQTT_MESSAGE, state->id);
+				
+				transition(STATE_MQTT_DISCONNECTED);
+			}
+			
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG(1, "Leaving mqtt send puback state");
+			
+			return false;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
 static bool state_mqtt_ping(state_machine_state_t* state, event_t* event)
 {
 	switch(event->type)
@@ -1019,11 +1361,12 @@ static bool state_mqtt_send_pingreq(state_machine_state_t* state, event_t* event
 		{
 			LOG(1, "Entering mqtt send ping request state");
 			
-			clear_mqtt_buffer();
+			uint16_t send_buffer_size;
+			uint8_t* send_buffer = mqtt_send_buffer(&send_buffer_size);
 			
-			uint16_t pingreq_message_size = mqtt_ping(&broker, mqtt_buffer, MQTT_BUFFER_SIZE);
+			uint16_t pingreq_message_size = mqtt_ping(&broker, send_buffer, send_buffer_size);
 			
-			communication_module_process_handle = communication_module.sendd(mqtt_buffer, pingreq_message_size);
+			communication_module_process_handle = communication_module.sendd(send_buffer, pingreq_message_size);
 			add_mqtt_communication_protocol_event_type(EVENT_COMMUNICATION_MODULE_PROCESS);
 			
 			return true;
@@ -1077,19 +1420,13 @@ static bool state_mqtt_receive_pingresp(state_machine_state_t* state, event_t* e
 		}
 		case EVENT_MQTT_RECEIVE_PINGRESP:
 		{
-			clear_mqtt_buffer();
-			
-			communication_module_process_handle = communication_module.receive(mqtt_buffer, MQTT_BUFFER_SIZE, &mqtt_buffer_position);
-			add_mqtt_communication_protocol_event_type(EVENT_COMMUNICATION_MODULE_PROCESS);
+			receive_mqtt_message();
 			
 			return true;
 		}
 		case EVENT_COMMUNICATION_MODULE_DONE:
 		{
-			communication_module_type_data_t receive_result = communication_module.get_communication_result();
-			append_communication_module_type_data(&receive_result, &communication_protocol_type_data.communication_module_type_data);
-			
-			if(is_communication_module_success(&receive_result))
+			if(mqtt_message_received())
 			{				
 				if(mqtt_parse_message() && mqtt_message.type == MQTT_MSG_PINGRESP)
 				{
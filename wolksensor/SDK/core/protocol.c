@@ -1,6 +1,8 @@
 #include "platform_specific.h"
 #include "sensor_readings_buffer.h"
 #include "system_buffer.h"
+#include "state_machine_trace.h"
+#include "state_residency.h"
 #include "wifi_communication_module.h"
 #include "mqtt_communication_protocol.h"
 #include "wifi_communication_module_dependencies.h"
@@ -283,6 +285,16 @@ static uint16_t serialize_knx_communication_protocol_error(knx_communication_pro
 	return 0;
 }
 
+static uint16_t serialize_coap_communication_protocol_error(coap_communication_protocol_data_t* coap_communication_protocol_data, char* buffer)
+{
+	if(coap_communication_protocol_data->error != 0)
+	{
+		return sprintf_P(buffer, PSTR("%01X%02X"), COMMUNICATION_PROTOCOL_COAP, coap_communication_protocol_data->error);
+	}
+
+	return 0;
+}
+
 static uint16_t serialize_mqtt_communication_protocol_data(mqtt_communication_protocol_data_t* mqtt_communication_protocol_data, char* buffer)
 {
 	return serialize_mqtt_communication_protocol_error(mqtt_communication_protocol_data, buffer);
@@ -293,6 +305,11 @@ static uint16_t serialize_knx_communication_protocol_data(knx_communication_prot
 	return serialize_knx_communication_protocol_error(knx_communication_protocol_data, buffer);
 }
 
+static uint16_t serialize_coap_communication_protocol_data(coap_communication_protocol_data_t* coap_communication_protocol_data, char* buffer)
+{
+	return serialize_coap_communication_protocol_error(coap_communication_protocol_data, buffer);
+}
+
 static uint16_t serialize_communication_protocol_data(communication_protocol_type_data_t* communication_protocol_type_data, char* buffer)
 {
 	uint16_t size = 0;
@@ -308,6 +325,11 @@ static uint16_t serialize_communication_protocol_data(communication_protocol_typ
 			size += serialize_knx_communication_protocol_data(&communication_protocol_type_data->data.knx_communication_protocol_data, buffer);
 			break;
 		}
+		case COMMUNICATION_PROTOCOL_COAP:
+		{
+			size += serialize_coap_communication_protocol_data(&communication_protocol_type_data->data.coap_communication_protocol_data, buffer);
+			break;
+		}
 		default:
 		{
 			break;
@@ -335,6 +357,11 @@ uint16_t serialize_communication_protocol_error(communication_protocol_type_data
 			size += serialize_knx_communication_protocol_error(&communication_protocol_type_data->data.knx_communication_protocol_data, buffer + size);
 			break;
 		}
+		case COMMUNICATION_PROTOCOL_COAP:
+		{
+			size += serialize_coap_communication_protocol_error(&communication_protocol_type_data->data.coap_communication_protocol_data, buffer + size);
+			break;
+		}
 		default:
 		{
 			break;
@@ -350,7 +377,14 @@ static uint16_t serialize_communication_and_battery_data(communication_and_batte
 {
 	uint16_t size = serialize_communication_protocol_data(&communication_and_battery_data->communication_protocol_type_data, buffer);
 	
-	return size += sprintf_P(buffer + size, PSTR(",B:%u"), communication_and_battery_data->battery_min_voltage);
+	size += sprintf_P(buffer + size, PSTR(",B:%u"), communication_and_battery_data->battery_min_voltage);
+	
+	if(communication_and_battery_data->charge)
+	{
+		size += sprintf_P(buffer + size, PSTR(",U:%u"), communication_and_battery_data->charge);
+	}
+	
+	return size;
 }
 
 static uint16_t serialize_system_item(system_t* system_item, char* buffer)
@@ -446,6 +480,128 @@ uint16_t append_system_info(circular_buffer_t* system_info_buffer, uint16_t star
 	return serialized_system_items;
 }
 
+uint16_t append_state_machine_trace(circular_buffer_t* trace_buffer, uint16_t start, circular_buffer_t* message_buffer, bool split)
+{
+	if(start == 0)
+	{
+		uint16_t size = sprintf_P(tmp, PSTR("TRACE "));
+		if(!circular_buffer_add_array(message_buffer, tmp, size))
+		{
+			return 0;
+		}
+	}
+	
+	uint16_t serialized_records = 0;
+	
+	state_machine_trace_record_t record;
+	while(circular_buffer_peek(trace_buffer, start + serialized_records, &record))
+	{
+		uint16_t size = sprintf_P(tmp, PSTR("%04X%02X%02X%02X%02X|"), record.time_delta, record.state_machine, (uint8_t)record.from_state, (uint8_t)record.to_state, record.event);
+		if(!circular_buffer_add_array(message_buffer, tmp, size))
+		{
+			break;
+		}
+		
+		serialized_records++;
+	}
+	
+	if(!split || (start + serialized_records) == circular_buffer_size(trace_buffer))
+	{
+		circular_buffer_drop_from_end(message_buffer, 1); /* remove last | */
+		circular_buffer_add(message_buffer, ";");
+	}
+	
+	return serialized_records;
+}
+
+uint16_t append_state_residency(uint16_t start, circular_buffer_t* message_buffer, bool split)
+{
+	if(start == 0)
+	{
+		uint16_t size = sprintf_P(tmp, PSTR("ENERGY %lu|"), state_residency_get_charge());
+		if(!circular_buffer_add_array(message_buffer, tmp, size))
+		{
+			return 0;
+		}
+	}
+	
+	uint16_t serialized_slots = 0;
+	
+	uint8_t id;
+	int8_t state;
+	state_residency_t residency;
+	while(start + serialized_slots < state_residency_slots_count())
+	{
+		uint16_t slot = start + serialized_slots;
+		if(state_residency_get(slot, &id, &state, &residency) && residency.entries)
+		{
+			uint16_t size = sprintf_P(tmp, PSTR("%02X%02X%08lX%04X%08lX|"), id, (uint8_t)state, residency.ticks, residency.entries, state_residency_get_slot_charge(slot));
+			if(!circular_buffer_add_array(message_buffer, tmp, size))
+			{
+				break;
+			}
+		}
+		
+		serialized_slots++;
+	}
+	
+	if(!split || (start + serialized_slots) == state_residency_slots_count())
+	{
+		circular_buffer_drop_from_end(message_buffer, 1); /* remove last | */
+		circular_buffer_add(message_buffer, ";");
+	}
+	
+	return serialized_slots;
+}
+
+uint16_t append_buffers_statistics(uint8_t start, circular_buffer_t* message_buffer, bool split)
+{
+	if(start == 0)
+	{
+		uint16_t size = sprintf_P(tmp, PSTR("BUFFERS "));
+		if(!circular_buffer_add_array(message_buffer, tmp, size))
+		{
+			return 0;
+		}
+	}
+	
+	uint16_t serialized_buffers = 0;
+	
+#ifdef CIRCULAR_BUFFER_STATISTICS
+	circular_buffer_t* buffer;
+	const char* name;
+	while(circular_buffer_get_registered(start + serialized_buffers, &buffer, &name))
+	{
+		uint16_t peak_size, overwritten, rejected;
+		
+		/* some buffers are filled from interrupts */
+		SYNCHRONIZED_BLOCK_START
+		
+		peak_size = buffer->peak_size;
+		overwritten = buffer->overwritten;
+		rejected = buffer->rejected;
+		
+		SYNCHRONIZED_BLOCK_END
+		
+		uint16_t size = sprintf_P(tmp, PSTR("%S:%u,%u,%u,%u|"), name, buffer->storage_size, peak_size, overwritten, rejected);
+		if(!circular_buffer_add_array(message_buffer, tmp, size))
+		{
+			break;
+		}
+		
+		serialized_buffers++;
+	}
+#endif
+	
+	if(!split || (start + serialized_buffers) == circular_buffer_registered_count())
+	{
+		circular_buffer_drop_from_end(message_buffer, 1); /* remove last | */
+		circular_buffer_add(message_buffer, ";");
+	}
+	
+	return serialized_buffers;
+}
+
 bool append_mac_address(unsigned char* mac, circular_buffer_t* message_buffer)
 {
 	unsigned char MAC[12+1];
@@ -817,7 +973,7 @@ bool append_mqtt_username(char* id, circular_buffer_t* response_buffer)
 
 bool append_mqtt_password(char* password, circular_buffer_t* response_buffer)
 {
-	sprintf_P(tmp, PSTR("MQTT_PASSWORD %s;"), password);
+	sprintf_P(tmp, PSTR("MQTT_PASSWORD %s;"), (*password) ? "****" : "");
 	circular_buffer_add_array(response_buffer, tmp, strlen(tmp));
 	return true;
 }
@@ -14,6 +14,9 @@
 
 uint16_t append_sensor_readings(circular_buffer_t* sensor_readings_buffer, uint16_t start_position, circular_buffer_t* message_buffer, bool split);
 uint16_t append_system_info(circular_buffer_t* system_info_buffer, uint16_t start, circular_buffer_t* message_buffer, bool split);
+uint16_t append_state_machine_trace(circular_buffer_t* trace_buffer, uint16_t start, circular_buffer_t* message_buffer, bool split);
+uint16_t append_state_residency(uint16_t start, circular_buffer_t* message_buffer, bool split);
+uint16_t append_buffers_statistics(uint8_t start, circular_buffer_t* message_buffer, bool split);
 
 uint16_t serialize_communication_protocol_error(communication_protocol_type_data_t* communication_protocol_type_data, char* buffer);
 
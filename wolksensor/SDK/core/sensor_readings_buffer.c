@@ -16,6 +16,7 @@ void init_sensor_readings_buffer(bool clear)
 {
 	LOG_PRINT(1, PSTR("Readings buffer init, clear %u\r\n"), clear);
 	circular_buffer_init(&sensor_readings_buffer, sensor_readings_storage, SENSOR_READINGS_BUFFER_SIZE, sizeof(sensor_readings_t), false, clear);
+	circular_buffer_register(&sensor_readings_buffer, PSTR("READINGS"));
 	LOG_PRINT(2, PSTR("Readings buffer size after init %u\r\n"), circular_buffer_size(&sensor_readings_buffer));
 }
 
@@ -0,0 +1,646 @@
+#include "socket_transport.h"
+#include "state_machine.h"
+#include "logger.h"
+#include "event_buffer.h"
+#include "global_dependencies.h"
+
+#define EVENTS_BUFFER_SIZE 10
+#define OPEN_SOCKET_MAX_RETRIES 3
+#define RECEIVE_TIMEOUT 3
+#define RECEIVE_POLL_PERIOD 10
+
+// event type carries index of transport in upper nibble
+#define TRANSPORT_EVENT(transport, event_type) ((uint8_t)(((transport)->index << 4) | (event_type)))
+#define TRANSPORT_INDEX(event_type) ((event_type) >> 4)
+#define TRANSPORT_EVENT_TYPE(event_type) ((event_type) & 0x0f)
+
+typedef enum
+{
+	STATE_SOCKET_CLOSED = 0,
+	STATE_OPENING_SOCKET,
+	STATE_SOCKET_OPENED,
+		STATE_SEND,
+		STATE_RECEIVE,
+	STATE_CLOSING_SOCKET,
+}
+socket_transport_states_t;
+
+typedef enum
+{
+	EVENT_SEND = 0,
+	EVENT_RECEIVE,
+	EVENT_OPEN_SOCKET,
+	EVENT_CLOSE_SOCKET,
+	EVENT_SOCKET_CLOSED,
+	EVENT_TIMEOUT
+}
+socket_transport_events_t;
+
+static circular_buffer_t events_buffer;
+static event_t events_buffer_storage[EVENTS_BUFFER_SIZE];
+
+static socket_transport_t* transports[SOCKET_TRANSPORTS_MAX];
+static uint8_t transports_count = 0;
+
+// transport whose state machine is currently handling an event
+static socket_transport_t* transport = NULL;
+
+// forward declaration of state machine state handlers
+static bool socket_transport_handler(state_machine_state_t* state, event_t* event);
+
+static bool state_socket_closed(state_machine_state_t* state, event_t* event);
+static bool state_opening_socket(state_machine_state_t* state, event_t* event);
+static bool state_socket_opened(state_machine_state_t* state, event_t* event);
+static bool state_send(state_machine_state_t* state, event_t* event);
+static bool state_receive(state_machine_state_t* state, event_t* event);
+static bool state_closing_socket(state_machine_state_t* state, event_t* event);
+
+static void add_transport_event(socket_transport_t* target, uint8_t event_type)
+{
+	add_event_type(&events_buffer, TRANSPORT_EVENT(target, event_type));
+}
+
+static void add_own_event(uint8_t event_type)
+{
+	add_transport_event(transport, event_type);
+}
+
+/*
+* Drops pending events of current transport, events of other transports are kept in order.
+*/
+static void clear_own_events(void)
+{
+	SYNCHRONIZED_BLOCK_START
+
+	uint16_t count = circular_buffer_size(&events_buffer);
+	event_t event;
+
+	while(count--)
+	{
+		circular_buffer_pop(&events_buffer, &event);
+
+		if(TRANSPORT_INDEX(event.type) != transport->index)
+		{
+			circular_buffer_add(&events_buffer, &event);
+		}
+	}
+
+	SYNCHRONIZED_BLOCK_END
+}
+
+static void init_state(socket_transport_states_t id, const char* human_readable_name, state_machine_state_t* parent, int8_t initial_state, state_machine_state_handler handler)
+{
+	state_machine_init_state(id, human_readable_name, parent, transport->states, initial_state, handler);
+}
+
+static void transition(socket_transport_states_t new_state_id)
+{
+	state_machine_transition(transport->states, &transport->state_machine, new_state_id);
+}
+
+static void send_command_response_string(const char* response)
+{
+	global_dependencies.send_response(response, strlen(response));
+}
+
+static void timeout_expired(void* argument)
+{
+	socket_transport_t* target = argument;
+
+	LOG_PRINT(1, PSTR("%S timeout\r\n"), target->name);
+
+	add_transport_event(target, EVENT_TIMEOUT);
+}
+
+static void receive_poll_expired(void* argument)
+{
+	add_transport_event(argument, EVENT_RECEIVE);
+}
+
+static void schedule_timeout(uint16_t period)
+{
+	if(period)
+	{
+		software_timer_start(&transport->timeout_timer, timeout_expired, transport, period * 1000UL, 0);
+	}
+	else
+	{
+		software_timer_stop(&transport->timeout_timer);
+	}
+}
+
+static void set_error(socket_transport_error_type_t error_type, uint8_t state)
+{
+	if(!transport->result.error)
+	{
+		transport->result.error = error_type | state;
+		transport->result.platform_specific_error_code = transport->platform_specific_error_code;
+	}
+}
+
+static void stopwatch_start(void)
+{
+	transport->stopwatch_start_ticks = software_timer_get_ticks();
+}
+
+static uint16_t stopwatch_stop(void)
+{
+	return software_timer_elapsed(transport->stopwatch_start_ticks);
+}
+
+void socket_transport_init(socket_transport_t* transport_in, const char* name, const socket_transport_operations_t* operations)
+{
+	if(transports_count == 0)
+	{
+		circular_buffer_init(&events_buffer, events_buffer_storage, EVENTS_BUFFER_SIZE, sizeof(event_t), true, true);
+		circular_buffer_register(&events_buffer, PSTR("SOCKET_EVENTS"));
+	}
+
+	transport = transport_in;
+
+	memset(transport, 0, sizeof(socket_transport_t));
+	transport->name = name;
+	transport->operations = operations;
+	transport->index = transports_count;
+	transport->open_socket_id = -1;
+
+	transports[transports_count++] = transport;
+
+	// state machine
+	transport->state_machine.id = -1;
+	transport->state_machine.human_readable_name = NULL;
+	transport->state_machine.parent = NULL;
+	transport->state_machine.current_state = STATE_SOCKET_CLOSED;
+	transport->state_machine.handler = socket_transport_handler;
+
+	init_state(STATE_SOCKET_CLOSED, PSTR("SOCKED_CLOSED"),  &transport->state_machine, -1, state_socket_closed);
+	init_state(STATE_OPENING_SOCKET, PSTR("OPENEING_SOCKET"),  &transport->state_machine, -1, state_opening_socket);
+	init_state(STATE_SOCKET_OPENED, PSTR("SOCKET_OPENED"),  &transport->state_machine, -1, state_socket_opened);
+		init_state(STATE_SEND, PSTR("SEND"), &transport->states[STATE_SOCKET_OPENED], -1, state_send);
+		init_state(STATE_RECEIVE, PSTR("RECEIVE"), &transport->states[STATE_SOCKET_OPENED], -1, state_receive);
+	init_state(STATE_CLOSING_SOCKET, PSTR("CLOSING_SOCKET"),  &transport->state_machine, -1, state_closing_socket);
+
+	transition(STATE_SOCKET_CLOSED);
+}
+
+void socket_transport_send(socket_transport_t* target, uint8_t* data_in, uint16_t data_in_size)
+{
+	target->data = data_in;
+	target->data_size = data_in_size;
+
+	memset(&target->result, 0, sizeof(socket_transport_data_t));
+
+	add_transport_event(target, EVENT_SEND);
+}
+
+void socket_transport_receive(socket_transport_t* target, uint8_t* buffer_out, uint16_t buffer_out_size, uint16_t* received_data_size_out)
+{
+	socket_transport_receive_with_timeout(target, buffer_out, buffer_out_size, received_data_size_out, RECEIVE_TIMEOUT * 1000U);
+}
+
+/*
+* Receive ends without data when nothing arrives within timeout (ms).
+*/
+void socket_transport_receive_with_timeout(socket_transport_t* target, uint8_t* buffer_out, uint16_t buffer_out_size, uint16_t* received_data_size_out, uint16_t timeout)
+{
+	target->buffer = buffer_out;
+	target->buffer_size = buffer_out_size;
+	target->received_data_size = received_data_size_out;
+	target->receive_timeout = timeout;
+
+	memset(&target->result, 0, sizeof(socket_transport_data_t));
+
+	add_transport_event(target, EVENT_RECEIVE);
+}
+
+void socket_transport_close_socket(socket_transport_t* target)
+{
+	memset(&target->result, 0, sizeof(socket_transport_data_t));
+
+	add_transport_event(target, EVENT_CLOSE_SOCKET);
+}
+
+bool socket_transport_process(socket_transport_t* target)
+{
+	event_t event;
+	if(pop_event(&events_buffer, &event))
+	{
+		transport = transports[TRANSPORT_INDEX(event.type)];
+		event.type = TRANSPORT_EVENT_TYPE(event.type);
+
+		state_machine_process_event(transport->states, &transport->state_machine, &event);
+		return true;
+	}
+
+	// still busy while receive poll is pending
+	return software_timer_active(&target->receive_poll_timer);
+}
+
+void socket_transport_socket_closed(socket_transport_t* target)
+{
+	if(target->operations->datagram)
+	{
+		return;
+	}
+
+	LOG_PRINT(1, PSTR("%S socket closed\r\n"), target->name);
+
+	add_transport_event(target, EVENT_SOCKET_CLOSED);
+}
+
+void socket_transport_set_platform_specific_error_code(socket_transport_t* target, uint32_t error_code)
+{
+	target->platform_specific_error_code = error_code;
+}
+
+bool socket_transport_waiting_for_data(socket_transport_t* target)
+{
+	return software_timer_active(&target->receive_poll_timer);
+}
+
+static bool socket_transport_handler(state_machine_state_t* state, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG_PRINT(1, PSTR("Entering %S communication module\r\n"), transport->name);
+
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG_PRINT(1, PSTR("Leaving %S communication module\r\n"), transport->name);
+
+			return false;
+		}
+		default:
+		{
+			return true;
+		}
+	}
+}
+
+static bool state_socket_closed(state_machine_state_t* state, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG_PRINT(1, PSTR("Entering %S socket closed state\r\n"), transport->name);
+
+			return true;
+		}
+		case EVENT_SEND:
+		case EVENT_RECEIVE:
+		{
+			LOG_PRINT(1, PSTR("Send or receive in %S socket closed state\r\n"), transport->name);
+
+			if(transport->operations->parameters_set())
+			{
+				add_own_event(event->type);
+				transition(STATE_OPENING_SOCKET);
+			}
+			else
+			{
+				LOG_PRINT(1, PSTR("%S connection parameters missing\r\n"), transport->name);
+				set_error(SOCKET_TRANSPORT_PARAMETERS_MISSING, state->id);
+			}
+
+			return true;
+		}
+		case EVENT_CLOSE_SOCKET:
+		{
+			LOG_PRINT(1, PSTR("%S socket already closed\r\n"), transport->name);
+
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG_PRINT(1, PSTR("Leaving %S socket closed state\r\n"), transport->name);
+
+			return false;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static bool state_opening_socket(state_machine_state_t* state, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG_PRINT(1, PSTR("Entering %S opening socket state\r\n"), transport->name);
+
+			send_command_response_string("STATUS CONNECTING_TO_SERVER;");
+
+			stopwatch_start();
+
+			transport->open_socket_retries = 0;
+
+			add_own_event(EVENT_OPEN_SOCKET);
+
+			return true;
+		}
+		case EVENT_OPEN_SOCKET:
+		{
+			LOG_PRINT(1, PSTR("%S opening socket\r\n"), transport->name);
+
+			if((transport->open_socket_id = transport->operations->open()) >= 0)
+			{
+				LOG_PRINT(1, PSTR("%S socket opened\r\n"), transport->name);
+
+				transition(STATE_SOCKET_OPENED);
+			}
+			else
+			{
+				if(++transport->open_socket_retries == OPEN_SOCKET_MAX_RETRIES)
+				{
+					LOG_PRINT(1, PSTR("%S unable to open socket after %u retries\r\n"), transport->name, transport->open_socket_retries);
+
+					set_error(SOCKET_TRANSPORT_OPERATION_FAILED, state->id);
+
+					clear_own_events();
+
+					transition(STATE_SOCKET_CLOSED);
+				}
+				else // Retry
+				{
+					LOG_PRINT(1, PSTR("%S unable to open socket, retrying\r\n"), transport->name);
+
+					add_own_event(EVENT_OPEN_SOCKET);
+				}
+			}
+
+			return true;
+		}
+		case EVENT_SEND:
+		case EVENT_RECEIVE:
+		{
+			add_own_event(event->type); // retain while opening socket
+
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG_PRINT(1, PSTR("Leaving %S opening socket state\r\n"), transport->name);
+
+			transport->result.connect_to_server_time = stopwatch_stop();
+
+			return false;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static bool state_socket_opened(state_machine_state_t* state, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG_PRINT(1, PSTR("Entering %S socket opened state\r\n"), transport->name);
+
+			state->current_state = -1;
+
+			return true;
+		}
+		case EVENT_SEND:
+		{
+			transition(STATE_SEND);
+
+			return true;
+		}
+		case EVENT_RECEIVE:
+		{
+			transition(STATE_RECEIVE);
+
+			return true;
+		}
+		case EVENT_CLOSE_SOCKET:
+		{
+			LOG_PRINT(1, PSTR("Close socket received in %S socket opened state\r\n"), transport->name);
+
+			transition(STATE_CLOSING_SOCKET);
+
+			return true;
+		}
+		case EVENT_SOCKET_CLOSED:
+		{
+			LOG_PRINT(1, PSTR("Socket closed while in %S socket opened state\r\n"), transport->name);
+
+			set_error(SOCKET_TRANSPORT_SOCKET_CLOSED, state->id);
+
+			clear_own_events();
+
+			transition(STATE_SOCKET_CLOSED);
+
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG_PRINT(1, PSTR("Leaving %S socket opened state\r\n"), transport->name);
+
+			return true;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static bool state_send(state_machine_state_t* state, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG_PRINT(1, PSTR("Entering %S send state\r\n"), transport->name);
+
+			stopwatch_start();
+
+			if(transport->operations->send(transport->open_socket_id, transport->data, transport->data_size) == transport->data_size)
+			{
+				LOG_PRINT(1, PSTR("%S sent data successfully\r\n"), transport->name);
+
+				transition(STATE_SOCKET_OPENED);
+			}
+			else
+			{
+				LOG_PRINT(1, PSTR("%S send data failed\r\n"), transport->name);
+
+				set_error(SOCKET_TRANSPORT_OPERATION_FAILED, state->id);
+
+				clear_own_events();
+
+				transition(STATE_CLOSING_SOCKET);
+			}
+
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG_PRINT(1, PSTR("Leaving %S send state\r\n"), transport->name);
+
+			transport->result.data_exchange_time = stopwatch_stop();
+
+			return false;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static bool state_receive(state_machine_state_t* state, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG_PRINT(1, PSTR("Entering %S receive state\r\n"), transport->name);
+
+			stopwatch_start();
+
+			software_timer_start(&transport->timeout_timer, timeout_expired, transport, transport->receive_timeout, 0);
+
+			add_own_event(EVENT_RECEIVE);
+
+			return true;
+		}
+		case EVENT_RECEIVE:
+		{
+			int received = transport->operations->receive(transport->open_socket_id, transport->buffer, transport->buffer_size);
+			if(received > 0)
+			{
+				LOG_PRINT(1, PSTR("%S received data %d\r\n"), transport->name, received);
+
+				*transport->received_data_size = received;
+
+				transition(STATE_SOCKET_OPENED);
+			}
+			else if(received == 0)
+			{
+				*transport->received_data_size = 0;
+
+				// nothing arrived yet, poll again after a while instead of spinning
+				software_timer_start(&transport->receive_poll_timer, receive_poll_expired, transport, RECEIVE_POLL_PERIOD, 0);
+			}
+			else
+			{
+				LOG_PRINT(1, PSTR("%S receive data failed\r\n"), transport->name);
+
+				*transport->received_data_size = 0;
+				set_error(SOCKET_TRANSPORT_OPERATION_FAILED, state->id);
+
+				clear_own_events();
+
+				transition(STATE_SOCKET_CLOSED);
+			}
+
+			return true;
+		}
+		case EVENT_SOCKET_CLOSED:
+		{
+			LOG_PRINT(1, PSTR("Socket closed while in %S receive state\r\n"), transport->name);
+
+			set_error(SOCKET_TRANSPORT_SOCKET_CLOSED, state->id);
+
+			clear_own_events();
+
+			transition(STATE_SOCKET_CLOSED);
+
+			return true;
+		}
+		case EVENT_TIMEOUT:
+		{
+			LOG_PRINT(1, PSTR("Timeout while %S trying to receive data\r\n"), transport->name);
+
+			clear_own_events();
+
+			transition(STATE_SOCKET_OPENED);
+
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG_PRINT(1, PSTR("Leaving %S receive state\r\n"), transport->name);
+
+			schedule_timeout(0);
+
+			software_timer_stop(&transport->receive_poll_timer);
+
+			transport->result.data_exchange_time = stopwatch_stop();
+
+			return false;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static bool state_closing_socket(state_machine_state_t* state, event_t* event)
+{
+	switch (event->type)
+	{
+		case EVENT_ENTERING_STATE:
+		{
+			LOG_PRINT(1, PSTR("Entering %S closing socket state\r\n"), transport->name);
+
+			stopwatch_start();
+
+			if(transport->operations->close(transport->open_socket_id))
+			{
+				LOG_PRINT(1, PSTR("%S socket closed successfully\r\n"), transport->name);
+
+				transport->open_socket_id = -1;
+			}
+			else
+			{
+				LOG_PRINT(1, PSTR("%S socket could not be closed\r\n"), transport->name);
+
+				set_error(SOCKET_TRANSPORT_OPERATION_FAILED, state->id);
+
+				clear_own_events();
+			}
+
+			transition(STATE_SOCKET_CLOSED);
+
+			return true;
+		}
+		case EVENT_LEAVING_STATE:
+		{
+			LOG_PRINT(1, PSTR("Leaving %S closing socket state\r\n"), transport->name);
+
+			transport->result.disconnect_time = stopwatch_stop();
+
+			return false;
+		}
+		default:
+		{
+			return true;
+		}
+	}
+}
+
+void socket_transport_get_status(socket_transport_t* target, char* status, uint16_t status_length)
+{
+	state_machine_state_t* state = &target->state_machine;
+	while(state->current_state != -1)
+	{
+		state = &target->states[state->current_state];
+	}
+
+	get_state_human_readable_name(target->states, state, status, status_length);
+}
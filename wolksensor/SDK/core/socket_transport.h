@@ -0,0 +1,111 @@
+#ifndef SOCKET_TRANSPORT_H_
+#define SOCKET_TRANSPORT_H_
+
+#include "platform_specific.h"
+#include "state_machine.h"
+#include "communication_module.h"
+#include "software_timer.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define SOCKET_TRANSPORTS_MAX 2
+
+typedef enum
+{
+	SOCKET_TRANSPORT_SUCCESS = 0x00,
+	SOCKET_TRANSPORT_OPERATION_FAILED = 0x10,
+	SOCKET_TRANSPORT_TIMEOUT = 0x20,
+	SOCKET_TRANSPORT_SOCKET_CLOSED = 0x30,
+	SOCKET_TRANSPORT_PARAMETERS_MISSING = 0x40
+}
+socket_transport_error_type_t;
+
+/*
+* Socket operations supplied by transport adapter.
+* Datagram transports are connectionless, so remote socket close notifications are ignored for them.
+*/
+typedef struct
+{
+	bool datagram;
+
+	bool (*parameters_set)(void);
+	int (*open)(void);
+	int (*send)(int socket, uint8_t* data, uint16_t size);
+	int (*receive)(int socket, uint8_t* buffer, uint16_t size);
+	bool (*close)(int socket);
+}
+socket_transport_operations_t;
+
+typedef struct
+{
+	uint8_t error;
+	uint32_t platform_specific_error_code;
+
+	uint16_t connect_to_server_time;
+	uint16_t data_exchange_time;
+	uint16_t disconnect_time;
+}
+socket_transport_data_t;
+
+typedef struct
+{
+	const char* name;
+	const socket_transport_operations_t* operations;
+	uint8_t index;
+
+	state_machine_state_t state_machine;
+	state_machine_state_t states[6];
+
+	int open_socket_id;
+	uint8_t open_socket_retries;
+
+	uint8_t* data;
+	uint16_t data_size;
+
+	uint8_t* buffer;
+	uint16_t buffer_size;
+	uint16_t* received_data_size;
+	uint16_t receive_timeout; /* ms */
+
+	software_timer_t timeout_timer;
+	software_timer_t receive_poll_timer;
+	uint32_t stopwatch_start_ticks;
+
+	uint32_t platform_specific_error_code;
+	socket_transport_data_t result;
+}
+socket_transport_t;
+
+/*
+* Initializes transport instance, name should point to program memory string.
+* All transports share one event buffer, events carry index of transport they belong to.
+*/
+void socket_transport_init(socket_transport_t* transport, const char* name, const socket_transport_operations_t* operations);
+
+void socket_transport_send(socket_transport_t* transport, uint8_t* data_in, uint16_t data_in_size);
+void socket_transport_receive(socket_transport_t* transport, uint8_t* buffer_out, uint16_t buffer_out_size, uint16_t* received_data_size_out);
+void socket_transport_receive_with_timeout(socket_transport_t* transport, uint8_t* buffer_out, uint16_t buffer_out_size, uint16_t* received_data_size_out, uint16_t timeout);
+void socket_transport_close_socket(socket_transport_t* transport);
+
+/*
+* Processes one pending event of any transport.
+* Returns true while there is work left for given transport.
+*/
+bool socket_transport_process(socket_transport_t* transport);
+
+// to be called from adapter's platform listeners
+void socket_transport_socket_closed(socket_transport_t* transport);
+void socket_transport_set_platform_specific_error_code(socket_transport_t* transport, uint32_t error_code);
+
+bool socket_transport_waiting_for_data(socket_transport_t* transport);
+
+void socket_transport_get_status(socket_transport_t* transport, char* status, uint16_t status_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SOCKET_TRANSPORT_H_ */
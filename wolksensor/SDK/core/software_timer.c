@@ -0,0 +1,168 @@
+#include "software_timer.h"
+#include "global_dependencies.h"
+
+#define TICKS_PER_SECOND 512
+
+static software_timer_t* timers = NULL;
+
+static uint32_t to_ticks(uint32_t milliseconds)
+{
+	return (milliseconds / 1000) * TICKS_PER_SECOND + ((milliseconds % 1000) * TICKS_PER_SECOND + 999) / 1000;
+}
+
+static bool before(uint32_t ticks, uint32_t other_ticks)
+{
+	return (int32_t)(ticks - other_ticks) < 0;
+}
+
+static void insert_timer(software_timer_t* timer)
+{
+	software_timer_t** link = &timers;
+	
+	/* timers with same deadline expire in order they were started */
+	while(*link && !before(timer->deadline, (*link)->deadline))
+	{
+		link = &(*link)->next;
+	}
+	
+	timer->next = *link;
+	*link = timer;
+	timer->active = true;
+}
+
+static void remove_timer(software_timer_t* timer)
+{
+	software_timer_t** link = &timers;
+	while(*link && (*link != timer))
+	{
+		link = &(*link)->next;
+	}
+	
+	if(*link)
+	{
+		*link = timer->next;
+	}
+	
+	timer->next = NULL;
+	timer->active = false;
+}
+
+static void set_alarm(void)
+{
+	if(timers)
+	{
+		global_dependencies.rtc_set_alarm(timers->deadline);
+	}
+	else
+	{
+		global_dependencies.rtc_clear_alarm();
+	}
+}
+
+void software_timer_start(software_timer_t* timer, void (*callback)(void* argument), void* argument, uint32_t delay, uint32_t period)
+{
+	SYNCHRONIZED_BLOCK_START
+	
+	software_timer_t* first_timer = timers;
+	
+	if(timer->active)
+	{
+		remove_timer(timer);
+	}
+	
+	timer->callback = callback;
+	timer->argument = argument;
+	timer->deadline = global_dependencies.rtc_get_ticks() + to_ticks(delay);
+	timer->period = to_ticks(period);
+	insert_timer(timer);
+	
+	if(timers != first_timer || timers == timer)
+	{
+		set_alarm();
+	}
+	
+	SYNCHRONIZED_BLOCK_END
+}
+
+void software_timer_stop(software_timer_t* timer)
+{
+	SYNCHRONIZED_BLOCK_START
+	
+	if(timer->active)
+	{
+		bool first = timers == timer;
+		
+		remove_timer(timer);
+		
+		if(first)
+		{
+			set_alarm();
+		}
+	}
+	
+	SYNCHRONIZED_BLOCK_END
+}
+
+bool software_timer_active(software_timer_t* timer)
+{
+	return timer->active;
+}
+
+uint32_t software_timer_get_ticks(void)
+{
+	return global_dependencies.rtc_get_ticks();
+}
+
+uint16_t software_timer_elapsed(uint32_t since)
+{
+	uint32_t ticks = global_dependencies.rtc_get_ticks() - since;
+	if(ticks >= 0xFFFFUL * TICKS_PER_SECOND / 1000)
+	{
+		return 0xFFFF;
+	}
+	
+	return ticks * 1000 / TICKS_PER_SECOND;
+}
+
+void software_timer_expired(void)
+{
+	for(;;)
+	{
+		software_timer_t* expired_timer = NULL;
+		void (*callback)(void* argument) = NULL;
+		void* argument = NULL;
+		
+		SYNCHRONIZED_BLOCK_START
+		
+		if(timers && !before(global_dependencies.rtc_get_ticks(), timers->deadline))
+		{
+			expired_timer = timers;
+			callback = expired_timer->callback;
+			argument = expired_timer->argument;
+			remove_timer(expired_timer);
+			
+			if(expired_timer->period)
+			{
+				expired_timer->deadline += expired_timer->period;
+				insert_timer(expired_timer);
+			}
+		}
+		else
+		{
+			set_alarm();
+		}
+		
+		SYNCHRONIZED_BLOCK_END
+		
+		if(!expired_timer)
+		{
+			return;
+		}
+		
+		/* callback may restart or stop its own timer */
+		if(callback)
+		{
+			callback(argument);
+		}
+	}
+}
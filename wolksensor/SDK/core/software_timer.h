@@ -0,0 +1,55 @@
+#ifndef SOFTWARE_TIMER_H_
+#define SOFTWARE_TIMER_H_
+
+#include "platform_specific.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+* Tickless one shot and periodic timers on free running RTC ticks (1/512 s). Started timers are kept in list
+* sorted by deadline and platform RTC alarm is set for the earliest deadline only, so MCU is not woken up while
+* no timer is due and timers keep running while MCU sleeps. Timer structures are owned by users, number of timers
+* is not limited. Callbacks are called from RTC interrupt.
+*/
+
+typedef struct software_timer
+{
+	struct software_timer* next;
+	void (*callback)(void* argument);
+	void* argument;
+	uint32_t deadline; /* RTC ticks */
+	uint32_t period; /* RTC ticks, 0 for one shot timer */
+	volatile bool active;
+}
+software_timer_t;
+
+/**
+* (Re)starts timer which expires after delay and then every period milliseconds unless period is 0.
+* Times are rounded up to RTC ticks.
+*/
+void software_timer_start(software_timer_t* timer, void (*callback)(void* argument), void* argument, uint32_t delay, uint32_t period);
+
+void software_timer_stop(software_timer_t* timer);
+
+bool software_timer_active(software_timer_t* timer);
+
+uint32_t software_timer_get_ticks(void);
+
+/**
+* Milliseconds elapsed since RTC ticks returned by software_timer_get_ticks, saturated to 0xFFFF.
+*/
+uint16_t software_timer_elapsed(uint32_t since);
+
+/**
+* Calls callbacks of expired timers and sets RTC alarm for next deadline, called by platform from RTC interrupts.
+*/
+void software_timer_expired(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SOFTWARE_TIMER_H_ */
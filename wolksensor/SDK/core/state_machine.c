@@ -1,5 +1,7 @@
 #include "state_machine.h"
 #include "logger.h"
+#include "state_machine_trace.h"
+#include "state_residency.h"
 
 void state_machine_init_state(int8_t id, const char* human_readable_name, state_machine_state_t* parent, state_machine_state_t* states, int8_t initial_state, state_machine_state_handler handler)
 {
@@ -8,11 +10,24 @@ void state_machine_init_state(int8_t id, const char* human_readable_name, state_
 	states[id].parent = parent;
 	states[id].current_state = initial_state;
 	states[id].handler = handler;
+	states[id].defer_mask = 0;
+}
+
+void state_machine_defer_events(state_machine_state_t* state, uint16_t events_mask)
+{
+	state->defer_mask = events_mask;
 }
 
 bool state_machine_process_event(state_machine_state_t* states, state_machine_state_t* state, event_t* event)
 {
 	bool event_processed  = false;
+	
+	/* transitions are traced with event dispatched to top level state */
+	uint8_t previous_traced_event = 0;
+	if(!state->parent)
+	{
+		previous_traced_event = state_machine_trace_set_event(event->type);
+	}
 
 	if(state->current_state != -1)
 	{
@@ -24,6 +39,11 @@ bool state_machine_process_event(state_machine_state_t* states, state_machine_st
 	{
 		event_processed = state->handler(state, event);
 	}
+	
+	if(!state->parent)
+	{
+		state_machine_trace_set_event(previous_traced_event);
+	}
 
 	return event_processed;
 }
@@ -34,6 +54,12 @@ bool state_machine_transition(state_machine_state_t* states, state_machine_state
 
 	event_t event;
 	event.type = EVENT_LEAVING_STATE;
+	
+	uint8_t trace_id = state_machine_trace_get_id(state);
+	if(trace_id != STATE_MACHINE_TRACE_NO_STATE_MACHINE)
+	{
+		state_machine_trace_transition(trace_id, new_state->parent->current_state, new_state_id);
+	}
 
 	if(new_state->parent->current_state != -1)
 	{
@@ -57,7 +83,178 @@ bool state_machine_transition(state_machine_state_t* states, state_machine_state
 			new_state->handler(new_state, &event);
 		}
 	}
+	
+	/* time is accounted to entered leaf state */
+	if(trace_id != STATE_MACHINE_TRACE_NO_STATE_MACHINE)
+	{
+		state_residency_enter(trace_id, new_state->id);
+	}
+
+	return true;
+}
+
+void state_machine_init_event_queue(state_machine_event_queue_t* queue, circular_buffer_t* events, circular_buffer_t* deferred_events, uint8_t reserved_events)
+{
+	queue->events = events;
+	queue->deferred_events = deferred_events;
+	queue->dropped_events = 0;
+	queue->reserved_events = reserved_events;
+}
+
+bool state_machine_queue_event(state_machine_event_queue_t* queue, uint8_t event_type, bool urgent)
+{
+	bool event_added = false;
+	
+	/* may be called from interrupt context, free space check and add must not be interleaved */
+	SYNCHRONIZED_BLOCK_START
+	
+	if(circular_buffer_free_space(queue->events) > queue->reserved_events)
+	{
+		event_added = urgent ? add_urgent_event_type(queue->events, event_type) : add_event_type(queue->events, event_type);
+	}
+	
+	if(!event_added)
+	{
+		queue->dropped_events++;
+	}
+	
+	SYNCHRONIZED_BLOCK_END
+	
+	return event_added;
+}
 
+bool state_machine_queue_reserved_event(state_machine_event_queue_t* queue, uint8_t event_type)
+{
+	bool event_added = add_event_type(queue->events, event_type);
+	if(!event_added)
+	{
+		SYNCHRONIZED_BLOCK_START
+		
+		queue->dropped_events++;
+		
+		SYNCHRONIZED_BLOCK_END
+	}
+	
+	return event_added;
+}
+
+static bool event_deferred(state_machine_state_t* states, state_machine_state_t* state, event_t* event)
+{
+	if(event->type >= 16)
+	{
+		return false;
+	}
+	
+	uint16_t event_mask = STATE_MACHINE_EVENT_MASK(event->type);
+	
+	while(true)
+	{
+		if(state->defer_mask & event_mask)
+		{
+			return true;
+		}
+		
+		if(state->current_state == -1)
+		{
+			return false;
+		}
+		
+		state = &states[state->current_state];
+	}
+}
+
+/*
+* Deferred events carry only type, so same event deferred again is merged with the one already deferred.
+*/
+static bool event_already_deferred(circular_buffer_t* deferred_events, event_t* event)
+{
+	event_t deferred_event;
+	uint16_t i;
+	for(i = 0; i < circular_buffer_size(deferred_events); i++)
+	{
+		circular_buffer_peek(deferred_events, i, &deferred_event);
+		if(deferred_event.type == event->type)
+		{
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+/*
+* Takes out the oldest deferred event that is not deferred anymore, remaining events keep their order.
+*/
+static bool recall_deferred_event(state_machine_state_t* states, state_machine_state_t* state, circular_buffer_t* deferred_events, event_t* event)
+{
+	uint16_t count = circular_buffer_size(deferred_events);
+	uint16_t i;
+	for(i = 0; i < count; i++)
+	{
+		circular_buffer_peek(deferred_events, i, event);
+		if(!event_deferred(states, state, event))
+		{
+			break;
+		}
+	}
+	
+	if(i == count)
+	{
+		return false;
+	}
+	
+	/* rotate buffer once dropping recalled event */
+	event_t deferred_event;
+	uint16_t j;
+	for(j = 0; j < count; j++)
+	{
+		circular_buffer_pop(deferred_events, &deferred_event);
+		if(j != i)
+		{
+			circular_buffer_add(deferred_events, &deferred_event);
+		}
+	}
+	
+	return true;
+}
+
+bool state_machine_dispatch_event(state_machine_state_t* states, state_machine_state_t* state, state_machine_event_queue_t* queue)
+{
+	event_t event;
+	
+	if(recall_deferred_event(states, state, queue->deferred_events, &event))
+	{
+		state_machine_process_event(states, state, &event);
+		return true;
+	}
+	
+	if(!pop_event(queue->events, &event))
+	{
+		return false;
+	}
+	
+	if(event_deferred(states, state, &event))
+	{
+		if(event_already_deferred(queue->deferred_events, &event))
+		{
+			return true;
+		}
+		
+		if(!circular_buffer_add(queue->deferred_events, &event))
+		{
+			SYNCHRONIZED_BLOCK_START
+			
+			queue->dropped_events++;
+			
+			SYNCHRONIZED_BLOCK_END
+			
+			LOG_PRINT(1, PSTR("Deferred event %u dropped\r\n"), event.type);
+		}
+		
+		return true;
+	}
+	
+	state_machine_process_event(states, state, &event);
 	return true;
 }
 
@@ -19,6 +19,9 @@ extern "C"
 #define	EVENT_ENTERING_STATE 254
 #define	EVENT_LEAVING_STATE 255
 
+/* only events with type lower than 16 can be deferred */
+#define STATE_MACHINE_EVENT_MASK(event_type) ((uint16_t)1 << (event_type))
+
 struct state_machine_state;
 
 typedef bool (*state_machine_state_handler)(struct state_machine_state* state, event_t* event);
@@ -30,9 +33,19 @@ typedef struct state_machine_state
 	struct state_machine_state* parent;
 	int8_t current_state;
 	state_machine_state_handler handler;
+	uint16_t defer_mask; /* events deferred while state is active */
 }
 state_machine_state_t;
 
+typedef struct
+{
+	circular_buffer_t* events;
+	circular_buffer_t* deferred_events; /* events put aside by active states, recalled once no active state defers them */
+	uint16_t dropped_events;
+	uint8_t reserved_events; /* free slots in events taken only by reserved events */
+}
+state_machine_event_queue_t;
+
 void state_machine_init_state(int8_t id, const char* human_readable_name, state_machine_state_t* parent, state_machine_state_t* states, int8_t initial_state, state_machine_state_handler handler);
 
 /*
@@ -45,6 +58,36 @@ bool state_machine_process_event(state_machine_state_t* states, state_machine_st
 */
 bool state_machine_transition(state_machine_state_t* states, state_machine_state_t* state, uint8_t new_state_id);
 
+/**
+* Events from mask are not handled while state (or any of its child states) is active, 
+* they are kept in deferred events and processed after state is left.
+*/
+void state_machine_defer_events(state_machine_state_t* state, uint16_t events_mask);
+
+/**
+* Deferred events carry only type, repeated event is merged with the one already deferred,
+* so deferred_events must hold as many events as there are distinct event types deferred.
+* reserved_events free slots in events are kept for events queued with state_machine_queue_reserved_event.
+*/
+void state_machine_init_event_queue(state_machine_event_queue_t* queue, circular_buffer_t* events, circular_buffer_t* deferred_events, uint8_t reserved_events);
+
+/**
+* Queues event, counting it as dropped if there is no space for it besides reserved slots.
+*/
+bool state_machine_queue_event(state_machine_event_queue_t* queue, uint8_t event_type, bool urgent);
+
+/**
+* Queues event into reserved slots as well, for events the state machine drives itself with
+* which must not be lost.
+*/
+bool state_machine_queue_reserved_event(state_machine_event_queue_t* queue, uint8_t event_type);
+
+/*
+* Processes recalled deferred event or next queued event. Returns false if there was nothing to process, 
+* deferred events alone do not keep the state machine busy.
+*/
+bool state_machine_dispatch_event(state_machine_state_t* states, state_machine_state_t* state, state_machine_event_queue_t* queue);
+
 uint16_t get_state_human_readable_name(state_machine_state_t* states, state_machine_state_t* state, char *buffer, uint16_t size);
 
 #ifdef __cplusplus
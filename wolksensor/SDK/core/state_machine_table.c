@@ -0,0 +1,204 @@
+#include "state_machine_table.h"
+#include "logger.h"
+#include "state_machine_trace.h"
+#include "state_residency.h"
+
+static void read_state(state_machine_table_t* state_machine, int8_t state_id, state_machine_table_state_t* state)
+{
+	memcpy_P(state, &state_machine->states[state_id], sizeof(state_machine_table_state_t));
+}
+
+static int8_t read_parent(state_machine_table_t* state_machine, int8_t state_id)
+{
+	return (int8_t)pgm_read_byte(&state_machine->states[state_id].parent);
+}
+
+static state_machine_table_handler read_handler(state_machine_table_t* state_machine, int8_t state_id)
+{
+	state_machine_table_handler handler;
+	memcpy_P(&handler, &state_machine->states[state_id].handler, sizeof(state_machine_table_handler));
+	
+	return handler;
+}
+
+static void notify_state(state_machine_table_state_t* state, int8_t state_id, uint8_t event_type)
+{
+	if(state->handler)
+	{
+		event_t event;
+		event.type = event_type;
+		state->handler(state_id, &event);
+	}
+}
+
+/*
+* Enters state and returns false if state requested another transition while entering.
+*/
+static bool enter_state(state_machine_table_t* state_machine, int8_t state_id, state_machine_table_state_t* state)
+{
+	state_machine->current_state = state_id;
+	
+	read_state(state_machine, state_id, state);
+	notify_state(state, state_id, EVENT_ENTERING_STATE);
+	
+	return state_machine->next_state == STATE_MACHINE_TABLE_NO_STATE;
+}
+
+static void perform_transitions(state_machine_table_t* state_machine)
+{
+	if(state_machine->next_state == STATE_MACHINE_TABLE_NO_STATE)
+	{
+		return;
+	}
+	
+	uint8_t trace_id = state_machine_trace_get_id(state_machine);
+	state_machine_table_state_t state;
+	
+	while(state_machine->next_state != STATE_MACHINE_TABLE_NO_STATE)
+	{
+		int8_t new_state_id = state_machine->next_state;
+		state_machine->next_state = STATE_MACHINE_TABLE_NO_STATE;
+		
+		if(trace_id != STATE_MACHINE_TRACE_NO_STATE_MACHINE)
+		{
+			state_machine_trace_transition(trace_id, state_machine->current_state, new_state_id);
+		}
+		
+		read_state(state_machine, new_state_id, &state);
+		uint16_t new_state_parents = state.ancestors & ~STATE_MACHINE_TABLE_STATE(new_state_id);
+		
+		// leave states up to least common ancestor
+		int8_t state_id = state_machine->current_state;
+		while((state_id != STATE_MACHINE_TABLE_NO_STATE) && !(new_state_parents & STATE_MACHINE_TABLE_STATE(state_id)))
+		{
+			read_state(state_machine, state_id, &state);
+			notify_state(&state, state_id, EVENT_LEAVING_STATE);
+			state_id = state.parent;
+		}
+		
+		state_machine->current_state = state_id;
+		
+		// enter states from least common ancestor down to new state
+		int8_t path[STATE_MACHINE_TABLE_MAX_DEPTH];
+		uint8_t depth = 0;
+		int8_t path_state_id = new_state_id;
+		while((path_state_id != state_id) && (depth < STATE_MACHINE_TABLE_MAX_DEPTH))
+		{
+			path[depth++] = path_state_id;
+			path_state_id = read_parent(state_machine, path_state_id);
+		}
+		
+		bool entering = true;
+		while(entering && depth)
+		{
+			entering = enter_state(state_machine, path[--depth], &state);
+		}
+		
+		// and their initial states
+		while(entering && (state.initial_state != STATE_MACHINE_TABLE_NO_STATE))
+		{
+			entering = enter_state(state_machine, state.initial_state, &state);
+		}
+	}
+	
+	/* time is accounted to entered leaf state */
+	if(trace_id != STATE_MACHINE_TRACE_NO_STATE_MACHINE)
+	{
+		state_residency_enter(trace_id, state_machine->current_state);
+	}
+}
+
+void state_machine_table_init(state_machine_table_t* state_machine, const state_machine_table_state_t* states, state_machine_table_handler handler)
+{
+	state_machine->states = states;
+	state_machine->handler = handler;
+	state_machine->current_state = STATE_MACHINE_TABLE_NO_STATE;
+	state_machine->next_state = STATE_MACHINE_TABLE_NO_STATE;
+	state_machine->handling = false;
+}
+
+bool state_machine_table_process_event(state_machine_table_t* state_machine, event_t* event)
+{
+	state_machine->handling = true;
+	
+	uint8_t previous_traced_event = state_machine_trace_set_event(event->type);
+	
+	bool event_processed = false;
+	
+	int8_t state_id = state_machine->current_state;
+	while(!event_processed && (state_id != STATE_MACHINE_TABLE_NO_STATE))
+	{
+		state_machine_table_handler handler = read_handler(state_machine, state_id);
+		event_processed = handler && handler(state_id, event);
+		state_id = read_parent(state_machine, state_id);
+	}
+	
+	/* no state processed the event */
+	if(!event_processed && state_machine->handler)
+	{
+		event_processed = state_machine->handler(STATE_MACHINE_TABLE_NO_STATE, event);
+	}
+	
+	perform_transitions(state_machine);
+	
+	state_machine->handling = false;
+	
+	state_machine_trace_set_event(previous_traced_event);
+	
+	return event_processed;
+}
+
+void state_machine_table_transition(state_machine_table_t* state_machine, int8_t new_state_id)
+{
+	state_machine->next_state = new_state_id;
+	
+	if(!state_machine->handling)
+	{
+		state_machine->handling = true;
+		perform_transitions(state_machine);
+		state_machine->handling = false;
+	}
+}
+
+uint16_t state_machine_table_get_state_human_readable_name(state_machine_table_t* state_machine, char* buffer, uint16_t size)
+{
+	int8_t path[STATE_MACHINE_TABLE_MAX_DEPTH];
+	uint8_t depth = 0;
+	
+	state_machine_table_state_t state;
+	int8_t state_id = state_machine->current_state;
+	while((state_id != STATE_MACHINE_TABLE_NO_STATE) && (depth < STATE_MACHINE_TABLE_MAX_DEPTH))
+	{
+		path[depth++] = state_id;
+		read_state(state_machine, state_id, &state);
+		state_id = state.parent;
+	}
+	
+	uint16_t length = 0;
+	while(depth && (length + 1 < size))
+	{
+		read_state(state_machine, path[--depth], &state);
+		if(!state.human_readable_name)
+		{
+			continue;
+		}
+		
+		if(length)
+		{
+			buffer[length++] = '-';
+		}
+		
+		length += snprintf_P(buffer + length, size - length, state.human_readable_name);
+		if(length >= size)
+		{
+			length = size - 1;
+		}
+	}
+	
+	if(size)
+	{
+		buffer[length] = '\0';
+	}
+	
+	return length;
+}
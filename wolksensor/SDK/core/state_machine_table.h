@@ -0,0 +1,69 @@
+#ifndef STATE_MACHINE_TABLE_H_
+#define STATE_MACHINE_TABLE_H_
+
+#include "platform_specific.h"
+#include "state_machine.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+* Table driven alternative to state_machine_state_t hierarchy. States are described by constant table
+* kept in PROGMEM, only active leaf state is kept in RAM. Events are dispatched iteratively from active
+* leaf state towards top level and transitions requested from handlers are performed after handler returns,
+* so stack usage does not depend on hierarchy depth or on chained transitions.
+* States are left from active leaf up to (excluding) least common ancestor of active and target state and
+* entered from there down to target and its initial states. Like with state_machine_transition, transition
+* to self or to ancestor leaves and enters target again.
+*/
+
+#define STATE_MACHINE_TABLE_MAX_STATES 16
+#define STATE_MACHINE_TABLE_MAX_DEPTH 4
+#define STATE_MACHINE_TABLE_NO_STATE -1
+
+/* bit of state in ancestors mask */
+#define STATE_MACHINE_TABLE_STATE(state_id) ((uint16_t)1 << (state_id))
+
+typedef bool (*state_machine_table_handler)(int8_t state_id, event_t* event);
+
+typedef struct
+{
+	int8_t parent; /* STATE_MACHINE_TABLE_NO_STATE for top level states */
+	int8_t initial_state; /* child entered after state, STATE_MACHINE_TABLE_NO_STATE for leaf states */
+	uint16_t ancestors; /* precomputed mask of state and all its parents, used to find least common ancestor */
+	const char* human_readable_name; /* string in PROGMEM or NULL */
+	state_machine_table_handler handler;
+}
+state_machine_table_state_t;
+
+typedef struct
+{
+	const state_machine_table_state_t* states; /* table in PROGMEM indexed by state id */
+	state_machine_table_handler handler; /* handles events not handled by any state, called with STATE_MACHINE_TABLE_NO_STATE */
+	int8_t current_state; /* active leaf state */
+	int8_t next_state; /* transition requested while handling event */
+	bool handling; /* set while handlers are called */
+}
+state_machine_table_t;
+
+void state_machine_table_init(state_machine_table_t* state_machine, const state_machine_table_state_t* states, state_machine_table_handler handler);
+
+/**
+* Handles event starting from active leaf state. Returns true if some state or top level handler processed the event.
+*/
+bool state_machine_table_process_event(state_machine_table_t* state_machine, event_t* event);
+
+/**
+* Requests transition, performed immediately if not called from handler.
+*/
+void state_machine_table_transition(state_machine_table_t* state_machine, int8_t new_state_id);
+
+uint16_t state_machine_table_get_state_human_readable_name(state_machine_table_t* state_machine, char* buffer, uint16_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STATE_MACHINE_TABLE_H_ */
@@ -0,0 +1,73 @@
+#include "state_machine_trace.h"
+#include "global_dependencies.h"
+#include "logger.h"
+
+circular_buffer_t state_machine_trace_buffer NO_INIT_MEMORY;
+static state_machine_trace_record_t state_machine_trace_storage[STATE_MACHINE_TRACE_BUFFER_SIZE] NO_INIT_MEMORY;
+static uint32_t last_record_ticks NO_INIT_MEMORY;
+
+static const void* traced_state_machines[STATE_MACHINE_TRACE_STATE_MACHINES_COUNT];
+
+static uint8_t dispatched_event = STATE_MACHINE_TRACE_NO_EVENT;
+
+static void add_record(uint8_t state_machine, int8_t from_state, int8_t to_state, uint8_t event)
+{
+	uint32_t ticks = global_dependencies.rtc_get_ticks();
+	uint32_t time_delta = ticks - last_record_ticks;
+	last_record_ticks = ticks;
+	
+	state_machine_trace_record_t record;
+	record.time_delta = time_delta > 0xFFFF ? 0xFFFF : time_delta;
+	record.state_machine = state_machine;
+	record.from_state = from_state;
+	record.to_state = to_state;
+	record.event = event;
+	
+	circular_buffer_add(&state_machine_trace_buffer, &record);
+}
+
+void init_state_machine_trace(bool clear, uint8_t start_type)
+{
+	LOG_PRINT(1, PSTR("Init state machine trace, clear %u\r\n"), clear);
+	circular_buffer_init(&state_machine_trace_buffer, state_machine_trace_storage, STATE_MACHINE_TRACE_BUFFER_SIZE, sizeof(state_machine_trace_record_t), true, clear);
+	circular_buffer_register(&state_machine_trace_buffer, PSTR("TRACE"));
+	
+	// RTC ticks restart on reset
+	last_record_ticks = global_dependencies.rtc_get_ticks();
+	add_record(STATE_MACHINE_TRACE_RESET, start_type, -1, STATE_MACHINE_TRACE_NO_EVENT);
+}
+
+void state_machine_trace_register(const void* state_machine, state_machine_trace_id_t id)
+{
+	traced_state_machines[id] = state_machine;
+}
+
+uint8_t state_machine_trace_set_event(uint8_t event_type)
+{
+	uint8_t previous_event = dispatched_event;
+	dispatched_event = event_type;
+	
+	return previous_event;
+}
+
+uint8_t state_machine_trace_get_id(const void* state_machine)
+{
+	uint8_t id = 0;
+	while((id < STATE_MACHINE_TRACE_STATE_MACHINES_COUNT) && (traced_state_machines[id] != state_machine))
+	{
+		id++;
+	}
+	
+	return id < STATE_MACHINE_TRACE_STATE_MACHINES_COUNT ? id : STATE_MACHINE_TRACE_NO_STATE_MACHINE;
+}
+
+void state_machine_trace_transition(uint8_t id, int8_t from_state, int8_t to_state)
+{
+	add_record(id, from_state, to_state, dispatched_event);
+}
+
+void state_machine_trace_clear(void)
+{
+	LOG(1, "Clearing state machine trace");
+	circular_buffer_clear(&state_machine_trace_buffer);
+}
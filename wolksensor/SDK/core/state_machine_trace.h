@@ -0,0 +1,73 @@
+#ifndef STATE_MACHINE_TRACE_H_
+#define STATE_MACHINE_TRACE_H_
+
+#include "platform_specific.h"
+#include "circular_buffer.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+* Compact binary trace of state machine transitions kept in memory that is not cleared on watchdog reset.
+* Records are dumped with TRACE command and decoded on host with tools/state_machine_trace_decoder.py,
+* which takes state and event names from state machine sources, so keep ids below in sync with it.
+*/
+
+#define STATE_MACHINE_TRACE_BUFFER_SIZE 64
+#define STATE_MACHINE_TRACE_NO_EVENT 0xFD /* transition not caused by dispatched event, eg. on init */
+#define STATE_MACHINE_TRACE_NO_STATE_MACHINE 0xFF /* state machine not registered for tracing */
+
+typedef enum
+{
+	STATE_MACHINE_TRACE_WOLKSENSOR = 0,
+	STATE_MACHINE_TRACE_WIFI_COMMUNICATION_MODULE,
+	STATE_MACHINE_TRACE_TCP_TRANSPORT,
+	STATE_MACHINE_TRACE_UDP_TRANSPORT,
+	STATE_MACHINE_TRACE_MQTT_COMMUNICATION_PROTOCOL,
+	STATE_MACHINE_TRACE_COAP_COMMUNICATION_PROTOCOL,
+	STATE_MACHINE_TRACE_KNX,
+	STATE_MACHINE_TRACE_STATE_MACHINES_COUNT,
+	STATE_MACHINE_TRACE_RESET = 0xFE /* marks start after reset, from state holds start type */
+}
+state_machine_trace_id_t;
+
+typedef struct
+{
+	uint16_t time_delta; /* RTC ticks since previous record, saturated */
+	uint8_t state_machine;
+	int8_t from_state;
+	int8_t to_state;
+	uint8_t event;
+}
+state_machine_trace_record_t;
+
+extern circular_buffer_t state_machine_trace_buffer NO_INIT_MEMORY;
+
+void init_state_machine_trace(bool clear, uint8_t start_type);
+
+/**
+* Assigns trace id to state machine, state_machine is the top level state or state machine table.
+*/
+void state_machine_trace_register(const void* state_machine, state_machine_trace_id_t id);
+
+/**
+* Sets event that is being dispatched and returns previously set one, to be restored when dispatching is done.
+*/
+uint8_t state_machine_trace_set_event(uint8_t event_type);
+
+/**
+* Returns trace id of registered state machine or STATE_MACHINE_TRACE_NO_STATE_MACHINE.
+*/
+uint8_t state_machine_trace_get_id(const void* state_machine);
+
+void state_machine_trace_transition(uint8_t id, int8_t from_state, int8_t to_state);
+
+void state_machine_trace_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STATE_MACHINE_TRACE_H_ */
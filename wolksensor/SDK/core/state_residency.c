@@ -0,0 +1,179 @@
+#include "state_residency.h"
+#include "global_dependencies.h"
+#include "logger.h"
+
+#define TICKS_PER_HOUR (512UL * 3600UL)
+
+static state_residency_t residency[STATE_RESIDENCY_MAX_SLOTS] NO_INIT_MEMORY;
+static uint8_t first_slot[STATE_RESIDENCY_MACHINES_COUNT] NO_INIT_MEMORY;
+static uint8_t states_count[STATE_RESIDENCY_MACHINES_COUNT] NO_INIT_MEMORY;
+static uint32_t charge NO_INIT_MEMORY; /* uAh */
+static uint32_t charge_remainder NO_INIT_MEMORY; /* uA * ticks, less than uAh */
+
+static uint8_t used_slots = 0;
+static uint16_t registered_machines = 0;
+static const uint32_t* currents[STATE_RESIDENCY_MACHINES_COUNT];
+static int8_t active_state[STATE_RESIDENCY_MACHINES_COUNT];
+static uint32_t active_since[STATE_RESIDENCY_MACHINES_COUNT];
+
+static uint32_t get_current(uint8_t id, int8_t state)
+{
+	return currents[id] ? pgm_read_dword(&currents[id][state]) : 0;
+}
+
+static void account(uint8_t id, uint32_t ticks)
+{
+	int8_t state = active_state[id];
+	uint32_t time = ticks - active_since[id];
+	active_since[id] = ticks;
+	
+	/* frequent short wakeups mostly fall within one tick */
+	if((state == STATE_RESIDENCY_NO_STATE) || !time)
+	{
+		return;
+	}
+	
+	state_residency_t* state_residency = &residency[first_slot[id] + state];
+	state_residency->ticks += time;
+	
+	uint32_t current = get_current(id, state);
+	if(current)
+	{
+		uint64_t state_charge = (uint64_t)time * current + charge_remainder;
+		if(state_charge >= TICKS_PER_HOUR)
+		{
+			charge += state_charge / TICKS_PER_HOUR;
+			state_charge %= TICKS_PER_HOUR;
+		}
+		
+		charge_remainder = state_charge;
+	}
+}
+
+void init_state_residency(bool clear)
+{
+	LOG_PRINT(1, PSTR("Init state residency, clear %u\r\n"), clear);
+	
+	if(clear)
+	{
+		memset(first_slot, 0, sizeof(first_slot));
+		memset(states_count, 0, sizeof(states_count));
+		state_residency_clear();
+	}
+	
+	uint8_t id;
+	for(id = 0; id < STATE_RESIDENCY_MACHINES_COUNT; id++)
+	{
+		active_state[id] = STATE_RESIDENCY_NO_STATE;
+	}
+}
+
+void state_residency_register(uint8_t id, uint8_t count)
+{
+	if((id >= STATE_RESIDENCY_MACHINES_COUNT) || (registered_machines & ((uint16_t)1 << id)) || (used_slots + count > STATE_RESIDENCY_MAX_SLOTS))
+	{
+		LOG_PRINT(1, PSTR("State residency of %u not registered\r\n"), id);
+		return;
+	}
+	
+	/* counters kept over reset belong to different layout */
+	if((first_slot[id] != used_slots) || (states_count[id] != count))
+	{
+		first_slot[id] = used_slots;
+		states_count[id] = count;
+		state_residency_clear();
+	}
+	
+	used_slots += count;
+	registered_machines |= (uint16_t)1 << id;
+}
+
+void state_residency_set_currents(uint8_t id, const uint32_t* states_currents)
+{
+	if(id < STATE_RESIDENCY_MACHINES_COUNT)
+	{
+		currents[id] = states_currents;
+	}
+}
+
+void state_residency_enter(uint8_t id, int8_t state)
+{
+	if((id >= STATE_RESIDENCY_MACHINES_COUNT) || !(registered_machines & ((uint16_t)1 << id)) || ((uint8_t)state >= states_count[id]))
+	{
+		return;
+	}
+	
+	account(id, global_dependencies.rtc_get_ticks());
+	
+	if(state != active_state[id])
+	{
+		active_state[id] = state;
+		
+		state_residency_t* state_residency = &residency[first_slot[id] + state];
+		if(state_residency->entries < 0xFFFF)
+		{
+			state_residency->entries++;
+		}
+	}
+}
+
+void state_residency_update(void)
+{
+	uint32_t ticks = global_dependencies.rtc_get_ticks();
+	
+	uint8_t id;
+	for(id = 0; id < STATE_RESIDENCY_MACHINES_COUNT; id++)
+	{
+		account(id, ticks);
+	}
+}
+
+bool state_residency_get(uint16_t slot, uint8_t* id, int8_t* state, state_residency_t* state_residency)
+{
+	uint8_t i;
+	for(i = 0; i < STATE_RESIDENCY_MACHINES_COUNT; i++)
+	{
+		if((registered_machines & ((uint16_t)1 << i)) && (slot >= first_slot[i]) && (slot < first_slot[i] + states_count[i]))
+		{
+			*id = i;
+			*state = slot - first_slot[i];
+			memcpy(state_residency, &residency[slot], sizeof(state_residency_t));
+			
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+uint16_t state_residency_slots_count(void)
+{
+	return used_slots;
+}
+
+uint32_t state_residency_get_slot_charge(uint16_t slot)
+{
+	uint8_t id;
+	int8_t state;
+	state_residency_t state_residency;
+	if(!state_residency_get(slot, &id, &state, &state_residency))
+	{
+		return 0;
+	}
+	
+	return ((uint64_t)state_residency.ticks * get_current(id, state)) / TICKS_PER_HOUR;
+}
+
+uint32_t state_residency_get_charge(void)
+{
+	return charge;
+}
+
+void state_residency_clear(void)
+{
+	LOG(1, "Clearing state residency");
+	
+	memset(residency, 0, sizeof(residency));
+	charge = 0;
+	charge_remainder = 0;
+}
@@ -0,0 +1,90 @@
+#ifndef STATE_RESIDENCY_H_
+#define STATE_RESIDENCY_H_
+
+#include "platform_specific.h"
+#include "state_machine_trace.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+* Accumulates time spent in and number of entries into states of registered state machines, identified by
+* their trace ids, and of MCU power modes reported by platform. Charge is estimated from per state current
+* tables supplied by platform. Components draw current independently, so only states of component state
+* machines (eg. wifi module and MCU power modes) should have currents and other machines are tracked for time only.
+* Counters are kept in memory that is not cleared on watchdog reset, RTC ticks (1/512 s) counters
+* wrap after 97 days and are reset with ENERGY CLEAR.
+*/
+
+#define STATE_RESIDENCY_MAX_SLOTS 48 /* states of all registered state machines */
+#define STATE_RESIDENCY_NO_STATE -1
+
+/* MCU power modes, tracked under their own id after state machine trace ids */
+#define STATE_RESIDENCY_POWER STATE_MACHINE_TRACE_STATE_MACHINES_COUNT
+#define STATE_RESIDENCY_MACHINES_COUNT (STATE_RESIDENCY_POWER + 1)
+
+typedef enum
+{
+	STATE_POWER_ACTIVE = 0,
+	STATE_POWER_IDLE, /* sleeping, waiting for data */
+	STATE_POWER_SAVE, /* sleeping until next wakeup */
+	STATE_POWER_STATES_COUNT
+}
+state_residency_power_states_t;
+
+typedef struct
+{
+	uint32_t ticks;
+	uint16_t entries;
+}
+state_residency_t;
+
+void init_state_residency(bool clear);
+
+/**
+* Reserves counters for states of state machine. Registration order must not depend on run time conditions,
+* counters kept over reset are cleared if layout of registered state machines changes.
+*/
+void state_residency_register(uint8_t id, uint8_t states_count);
+
+/**
+* Sets table in PROGMEM with current in uA drawn in each state of registered state machine.
+*/
+void state_residency_set_currents(uint8_t id, const uint32_t* currents);
+
+/**
+* Accounts time spent in previously active state and makes state active.
+*/
+void state_residency_enter(uint8_t id, int8_t state);
+
+/**
+* Accounts time spent in active states so far, call before reading counters.
+*/
+void state_residency_update(void);
+
+/**
+* Returns counters of slot with state machine id and state, false if slot is not used.
+*/
+bool state_residency_get(uint16_t slot, uint8_t* id, int8_t* state, state_residency_t* residency);
+
+uint16_t state_residency_slots_count(void);
+
+/**
+* Estimated charge in uAh used in state of slot.
+*/
+uint32_t state_residency_get_slot_charge(uint16_t slot);
+
+/**
+* Estimated charge in uAh used since counters were cleared.
+*/
+uint32_t state_residency_get_charge(void);
+
+void state_residency_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STATE_RESIDENCY_H_ */
@@ -17,6 +17,14 @@ void append_mqtt_communication_protocol_data(mqtt_communication_protocol_data_t*
 	}
 }
 
+void append_coap_communication_protocol_data(coap_communication_protocol_data_t* operation_data, coap_communication_protocol_data_t* total_data)
+{
+	if(total_data->error == 0)
+	{
+		total_data->error = operation_data->error;
+	}
+}
+
 void append_communication_protocol_type_data(communication_protocol_type_data_t* operation_data, communication_protocol_type_data_t* total_data)
 {
 	total_data->type = operation_data->type;
@@ -33,6 +41,11 @@ void append_communication_protocol_type_data(communication_protocol_type_data_t*
 			append_knx_communication_protocol_data(&operation_data->data.knx_communication_protocol_data, &total_data->data.knx_communication_protocol_data);
 			break;
 		}
+		case COMMUNICATION_PROTOCOL_COAP:
+		{
+			append_coap_communication_protocol_data(&operation_data->data.coap_communication_protocol_data, &total_data->data.coap_communication_protocol_data);
+			break;
+		}
 		default:
 		{
 			break;
@@ -52,6 +65,11 @@ bool is_knx_communication_protocol_success(knx_communication_protocol_data_t* kn
 	return knx_communication_protocol_data->error == KNX_SUCCESS;
 }
 
+bool is_coap_communication_protocol_success(coap_communication_protocol_data_t* coap_communication_protocol_data)
+{
+	return coap_communication_protocol_data->error == COAP_SUCCESS;
+}
+
 bool is_communication_protocol_success(communication_protocol_type_data_t* communication_protocol_type_data)
 {
 	bool communication_protocol_success = false;
@@ -68,6 +86,11 @@ bool is_communication_protocol_success(communication_protocol_type_data_t* commu
 			communication_protocol_success = is_knx_communication_protocol_success(&communication_protocol_type_data->data.knx_communication_protocol_data);
 			break;
 		}
+		case COMMUNICATION_PROTOCOL_COAP:
+		{
+			communication_protocol_success = is_coap_communication_protocol_success(&communication_protocol_type_data->data.coap_communication_protocol_data);
+			break;
+		}
 		default:
 		{
 			communication_protocol_success = false;
@@ -139,7 +139,8 @@ bool is_communication_module_success(communication_module_type_data_t* communica
 typedef enum
 {
 	COMMUNICATION_PROTOCOL_MQTT = 0,
-	COMMUNICATION_PROTOCOL_KNX
+	COMMUNICATION_PROTOCOL_KNX,
+	COMMUNICATION_PROTOCOL_COAP
 }
 communication_protocol_type_t;
 
@@ -176,10 +177,28 @@ typedef struct
 }
 knx_communication_protocol_data_t;
 
+typedef enum
+{
+	COAP_SUCCESS = 0x00,
+	ERROR_SENDING_COAP_MESSAGE = 0x10,
+	ERROR_RECEIVING_COAP_MESSAGE = 0x20,
+	ERROR_COAP_RESPONSE_NOT_RECEIVED = 0x30,
+	ERROR_COAP_REQUEST_REJECTED = 0x40,
+	ERROR_COAP_PARAMETERS_MISSING = 0x50
+}
+coap_communication_protocol_error_type_t;
+
+typedef struct
+{
+	uint8_t error;
+}
+coap_communication_protocol_data_t;
+
 typedef union
 {
 	mqtt_communication_protocol_data_t mqtt_communication_protocol_data;
 	knx_communication_protocol_data_t knx_communication_protocol_data;
+	coap_communication_protocol_data_t coap_communication_protocol_data;
 }
 communication_protocol_data_t;
 
@@ -195,15 +214,18 @@ typedef struct
 {
 	communication_protocol_type_data_t communication_protocol_type_data;
 	uint16_t battery_min_voltage;
+	uint16_t charge; /* estimated uAh used since previous data exchange */
 }
 communication_and_battery_data_t;
 
 void append_knx_communication_protocol_data(knx_communication_protocol_data_t* operation_data, knx_communication_protocol_data_t* total_data);
 void append_mqtt_communication_protocol_data(mqtt_communication_protocol_data_t* operation_data, mqtt_communication_protocol_data_t* total_data);
+void append_coap_communication_protocol_data(coap_communication_protocol_data_t* operation_data, coap_communication_protocol_data_t* total_data);
 void append_communication_protocol_type_data(communication_protocol_type_data_t* operation_data, communication_protocol_type_data_t* total_data);
 
 bool is_knx_communication_protocol_success(knx_communication_protocol_data_t* knx_communication_protocol_data);
 bool is_mqtt_communication_protocol_success(mqtt_communication_protocol_data_t* mqtt_communication_protocol_data);
+bool is_coap_communication_protocol_success(coap_communication_protocol_data_t* coap_communication_protocol_data);
 bool is_communication_protocol_success(communication_protocol_type_data_t* communication_protocol_type_data);
 
 void append_communication_and_battery_data(communication_and_battery_data_t* operation_data, communication_and_battery_data_t* total_data);
@@ -16,6 +16,7 @@ void init_system_buffer(bool clear)
 {
 	LOG_PRINT(1, PSTR("Init system buffer, clear %u\r\n"), clear);
 	circular_buffer_init(&system_buffer, system_storage, SYSTEM_BUFFER_SIZE, sizeof(system_t), true, clear);
+	circular_buffer_register(&system_buffer, PSTR("SYSTEM"));
 	LOG_PRINT(2, PSTR("System buffer size after init %u\r\n"), circular_buffer_size(&system_buffer));
 }
 
@@ -16,6 +16,8 @@ communication_module_process_handle_t tcp_communication_module_send(uint8_t* dat
 communication_module_process_handle_t tcp_communication_module_receive(uint8_t* buffer_out, uint16_t buffer_out_size, uint16_t* received_data_size_out);
 communication_module_process_handle_t tcp_communication_module_close_socket(void);
 
+bool tcp_communication_module_waiting_for_data(void);
+
 communication_module_type_data_t get_tcp_communication_module_result(void);
 
 void get_tcp_communication_module_status(char* status, uint16_t status_length);
@@ -17,8 +17,6 @@ typedef struct
 	
 	uint16_t (*serialize_platform_specific_error_code)(uint32_t error_code, char* buffer);
 	
-	void (*add_second_expired_listener)(void (*listener)(void));
-	void (*add_milisecond_expired_listener)(void (*listener)(void));
 	void (*add_socket_closed_listener)(void (*listener)(void));
 	void (*add_platform_specific_error_code_listener)(void (*listener)(uint32_t operation_code));
 }
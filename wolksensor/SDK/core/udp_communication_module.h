@@ -20,8 +20,11 @@ void init_udp_communication_module(void);
 
 communication_module_process_handle_t udp_communication_module_send(uint8_t* data_in, uint16_t data_in_size);
 communication_module_process_handle_t udp_communication_module_receive(uint8_t* buffer_out, uint16_t buffer_out_size, uint16_t* received_data_size_out);
+communication_module_process_handle_t udp_communication_module_receive_with_timeout(uint8_t* buffer_out, uint16_t buffer_out_size, uint16_t* received_data_size_out, uint16_t timeout);
 communication_module_process_handle_t udp_communication_module_close_socket(void);
 
+bool udp_communication_module_waiting_for_data(void);
+
 communication_module_type_data_t get_udp_communication_module_result(void);
 
 void get_udp_communication_module_status(char* status, uint16_t status_length);
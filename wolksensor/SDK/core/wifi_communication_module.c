@@ -1,6 +1,8 @@
 #include "wifi_communication_module.h"
 #include "wifi_communication_module_dependencies.h"
 #include "state_machine.h"
+#include "state_machine_trace.h"
+#include "state_residency.h"
 #include "logger.h"
 #include "event_buffer.h"
 #include "config.h"
@@ -11,6 +13,7 @@
 #include "udp_communication_module.h"
 #include "udp_communication_module_dependencies.h"
 #include "communication_module.h"
+#include "software_timer.h"
 
 #define WIFI_COMMUNICATION_MODULE_EVENTS_BUFFER_SIZE 10
 
@@ -59,10 +62,11 @@ static uint16_t data_size = 0;
 static uint8_t* buffer = NULL;
 static uint16_t buffer_size = 0;
 static uint16_t* received_data_size = NULL;
+static uint16_t receive_from_timeout = WIFI_RECEIVE_TIMEOUT * 1000U; /* ms */
 
-static volatile uint8_t wifi_sequence_timeout_timer = 0;
+static software_timer_t wifi_sequence_timer;
 
-static volatile uint16_t tick_counter = 0;
+static uint32_t stopwatch_start_ticks = 0;
 
 static wifi_communication_module_data_t wifi_communication_module_data;
 
@@ -75,12 +79,8 @@ static communication_module_process_handle_t communication_module_process_handle
 static communication_module_process_handle_t tcp_process_handle = NULL;
 static communication_module_process_handle_t udp_process_handle = NULL;
 
-void (*tcp_second_expired_listener)(void) = NULL;
-void (*tcp_milisecond_expired_listener)(void) = NULL;
 void (*tcp_platform_specific_error_code_listener)(uint32_t operation_code) = NULL;
 
-void (*udp_second_expired_listener)(void) = NULL;
-void (*udp_milisecond_expired_listener)(void) = NULL;
 void (*udp_platform_specific_error_code_listener)(uint32_t operation_code) = NULL;
 
 static bool state_stopped(state_machine_state_t* state, event_t* event);
@@ -103,6 +103,7 @@ static bool state_stopping(state_machine_state_t* state, event_t* event);
 static void init_wifi_communication_module_event_buffer(void)
 {
 	circular_buffer_init(&wifi_communication_module_event_buffer, wifi_communication_module_event_buffer_storage, WIFI_COMMUNICATION_MODULE_EVENTS_BUFFER_SIZE, sizeof(event_t), true, true);
+	circular_buffer_register(&wifi_communication_module_event_buffer, PSTR("WIFI_EVENTS"));
 }
 
 void add_wifi_communication_module_event_type(uint8_t event_type)
@@ -142,42 +143,33 @@ static void transition(wifi_communication_module_states_t new_state_id)
 	state_machine_transition(wifi_communication_module_states, &wifi_communication_module_state_machine, new_state_id);
 }
 
-static void schedule_wifi_sequence_timeout(uint16_t period)
-{
-	wifi_sequence_timeout_timer = period;
-}
-
-static void stopwatch_start(void)
+static void wifi_sequence_timeout_expired(void* argument)
 {
-	tick_counter = 1;
+	LOG(1, "Wifi sequence timeout!");
+	
+	add_wifi_communication_module_event_type(EVENT_WIFI_SEQUENCE_TIMEOUT);
 }
 
-static uint16_t stopwatch_stop(void)
+static void schedule_wifi_sequence_timeout(uint16_t period)
 {
-	uint16_t time = tick_counter;
-	tick_counter = 0;
-	return time;
+	if(period)
+	{
+		software_timer_start(&wifi_sequence_timer, wifi_sequence_timeout_expired, NULL, period * 1000UL, 0);
+	}
+	else
+	{
+		software_timer_stop(&wifi_sequence_timer);
+	}
 }
 
-static void second_expired_listener(void)
+static void stopwatch_start(void)
 {
-	if (wifi_sequence_timeout_timer && (--wifi_sequence_timeout_timer == 0))
-	{
-		LOG(1, "Wifi sequence timeout!");
-		
-		add_wifi_communication_module_event_type(EVENT_WIFI_SEQUENCE_TIMEOUT);
-	}
-	
-	if(tcp_second_expired_listener) tcp_second_expired_listener();
-	if(udp_second_expired_listener) udp_second_expired_listener();
+	stopwatch_start_ticks = software_timer_get_ticks();
 }
 
-static void milisecond_expired_listener(void)
+static uint16_t stopwatch_stop(void)
 {
-	if(tick_counter) tick_counter++;
-	
-	if(tcp_milisecond_expired_listener) tcp_milisecond_expired_listener();
-	if(udp_milisecond_expired_listener) udp_milisecond_expired_listener();
+	return software_timer_elapsed(stopwatch_start_ticks);
 }
 
 static void wifi_connected_listener(void)
@@ -210,16 +202,6 @@ static bool is_static_ip_set(void)
 	return strcmp(wifi_static_ip, "") != 0 && strcmp(wifi_static_mask, "") != 0 && strcmp(wifi_static_gateway, "") != 0 && strcmp(wifi_static_dns, "") != 0;
 }
 
-void add_udp_second_expired_listener(void (*listener)(void))
-{
-	udp_second_expired_listener = listener;
-}
-
-void add_udp_milisecond_expired_listener(void (*listener)(void))
-{
-	udp_milisecond_expired_listener = listener;
-}
-
 void add_udp_platform_specific_error_code_listener(void (*listener)(int operation_code))
 {
 	udp_platform_specific_error_code_listener = listener;
@@ -230,16 +212,6 @@ void add_tcp_platform_specific_error_code_listener(void (*listener)(int operatio
 	tcp_platform_specific_error_code_listener = listener;
 }
 
-void add_tcp_second_expired_listener(void (*listener)(void))
-{
-	tcp_second_expired_listener = listener;
-}
-
-void add_tcp_milisecond_expired_listener(void (*listener)(void))
-{
-	tcp_milisecond_expired_listener = listener;
-}
-
 static void wifi_platform_specific_error_code_listener(uint32_t error_code)
 {
 	platform_specific_error_code = error_code;
@@ -274,9 +246,6 @@ void init_wifi_communication_module(void)
 	LOG(1, "Wifi communication module init");
 	
 	// dependencies
-	wifi_communication_module_dependencies.add_milisecond_expired_listener(milisecond_expired_listener);
-	wifi_communication_module_dependencies.add_second_expired_listener(second_expired_listener);
-		
 	wifi_communication_module_dependencies.add_wifi_connected_listener(wifi_connected_listener);
 	wifi_communication_module_dependencies.add_wifi_ip_address_acquired_listener(wifi_ip_address_acquired_listener);
 	wifi_communication_module_dependencies.add_wifi_disconnected_listener(wifi_disconnected_listener);
@@ -295,6 +264,9 @@ void init_wifi_communication_module(void)
 	wifi_communication_module_state_machine.parent = NULL;
 	wifi_communication_module_state_machine.current_state = STATE_WIFI_STOPPED;
 	wifi_communication_module_state_machine.handler = wifi_communication_module_handler;
+	state_machine_trace_register(&wifi_communication_module_state_machine, STATE_MACHINE_TRACE_WIFI_COMMUNICATION_MODULE);
+	state_residency_register(STATE_MACHINE_TRACE_WIFI_COMMUNICATION_MODULE, STATE_WIFI_STOPPED + 1);
+	state_residency_enter(STATE_MACHINE_TRACE_WIFI_COMMUNICATION_MODULE, STATE_WIFI_STOPPED);
 	
 	init_state(STATE_WIFI_STOPPED, PSTR("STOPPED"), &wifi_communication_module_state_machine, -1, state_stopped);
 	init_state(STATE_WIFI_STARTING, PSTR("STARTING"), &wifi_communication_module_state_machine, -1, state_starting);
@@ -320,8 +292,6 @@ void init_wifi_communication_module(void)
 	tcp_communication_module_dependencies.send = wifi_communication_module_dependencies.wifi_send;
 	tcp_communication_module_dependencies.serialize_platform_specific_error_code = wifi_communication_module_dependencies.serialize_wifi_platform_specific_error_code;
 	
-	tcp_communication_module_dependencies.add_second_expired_listener = add_tcp_second_expired_listener;
-	tcp_communication_module_dependencies.add_milisecond_expired_listener = add_tcp_milisecond_expired_listener;
 	tcp_communication_module_dependencies.add_socket_closed_listener = wifi_communication_module_dependencies.add_wifi_socket_closed_listener;
 	tcp_communication_module_dependencies.add_platform_specific_error_code_listener = add_tcp_platform_specific_error_code_listener;
 	
@@ -334,8 +304,6 @@ void init_wifi_communication_module(void)
 	udp_communication_module_dependencies.receive_from = wifi_communication_module_dependencies.wifi_receive_from;
 	udp_communication_module_dependencies.serialize_platform_specific_error_code = wifi_communication_module_dependencies.serialize_wifi_platform_specific_error_code;
 	
-	udp_communication_module_dependencies.add_second_expired_listener = add_udp_second_expired_listener;
-	udp_communication_module_dependencies.add_milisecond_expired_listener = add_udp_milisecond_expired_listener;
 	udp_communication_module_dependencies.add_platform_specific_error_code_listener = add_udp_platform_specific_error_code_listener;
 	
 	init_udp_communication_module();
@@ -401,9 +369,15 @@ communication_module_process_handle_t wifi_communication_module_receive(uint8_t*
 }
 
 communication_module_process_handle_t wifi_communication_module_receive_from(uint8_t* buffer_out, uint16_t buffer_out_size, uint16_t* received_data_size_out)
+{
+	return wifi_communication_module_receive_from_with_timeout(buffer_out, buffer_out_size, received_data_size_out, WIFI_RECEIVE_TIMEOUT * 1000U);
+}
+
+communication_module_process_handle_t wifi_communication_module_receive_from_with_timeout(uint8_t* buffer_out, uint16_t buffer_out_size, uint16_t* received_data_size_out, uint16_t timeout)
 {
 	LOG(1, "Wifi receive from");
 
+	receive_from_timeout = timeout;
 	buffer = buffer_out;
 	buffer_size = buffer_out_size;
 	received_data_size = received_data_size_out;
@@ -1527,7 +1501,7 @@ static bool state_receive_from(state_machine_state_t* state, event_t* event)
 			
 			stopwatch_start();
 			
-			communication_module_process_handle = udp_communication_module_receive(buffer, buffer_size, received_data_size);
+			communication_module_process_handle = udp_communication_module_receive_with_timeout(buffer, buffer_size, received_data_size, receive_from_timeout);
 			
 			add_wifi_communication_module_event_type(EVENT_WIFI_COMMUNICATION_MODULE_PROCESS);
 			
@@ -1832,6 +1806,11 @@ static bool state_stopping(state_machine_state_t* state, event_t* event)
 	}
 }
 
+bool wifi_communication_module_waiting_for_data(void)
+{
+	return tcp_communication_module_waiting_for_data() || udp_communication_module_waiting_for_data();
+}
+
 communication_module_type_data_t get_wifi_communication_result(void)
 {
 	communication_module_type_data_t communication_module_type_data;
@@ -54,9 +54,12 @@ communication_module_process_handle_t wifi_communication_module_send(uint8_t* da
 communication_module_process_handle_t wifi_communication_module_send_to(uint8_t* data_in, uint16_t data_in_size);
 communication_module_process_handle_t wifi_communication_module_receive(uint8_t* buffer_out, uint16_t buffer_out_size, uint16_t* received_data_size_out);
 communication_module_process_handle_t wifi_communication_module_receive_from(uint8_t* buffer_out, uint16_t buffer_out_size, uint16_t* received_data_size_out);
+communication_module_process_handle_t wifi_communication_module_receive_from_with_timeout(uint8_t* buffer_out, uint16_t buffer_out_size, uint16_t* received_data_size_out, uint16_t timeout);
 communication_module_process_handle_t wifi_communication_module_disconnect(void);
 communication_module_process_handle_t wifi_communication_module_close_socket(void);
 
+bool wifi_communication_module_waiting_for_data(void);
+
 communication_module_type_data_t get_wifi_communication_result(void);
 
 void get_wifi_communication_module_status(char* status, uint16_t status_length);
@@ -24,9 +24,6 @@ typedef struct
 	
 	uint16_t (*serialize_wifi_platform_specific_error_code)(uint32_t error_code, char* buffer);
 	
-	void (*add_second_expired_listener)(void (*listener)(void));
-	void (*add_milisecond_expired_listener)(void (*listener)(void));
-	
 	void (*add_wifi_connected_listener)(void (*listener)(void));
 	void (*add_wifi_ip_address_acquired_listener)(void (*listener)(void));
 	void (*add_wifi_disconnected_listener)(void (*listener)(void));
@@ -0,0 +1,96 @@
+/*
+* Host check that integer BME280_GetReadings rounds exactly as the float path it replaced,
+* lroundf(compensated / divisor * 10), for fixed calibration set and random raw samples
+* within sensor operating range.
+*
+* Build and run from wolksensor directory:
+*     gcc -std=gnu99 -O2 -Iwolksensor/src/OS -o bme280_readings_test tools/bme280_readings_test.c -lm
+*     ./bme280_readings_test [SAMPLES]
+*
+* Exits with 0 when all samples match.
+*/
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+/* long is 32 bit on AVR */
+#define long int
+#include "Sensors/BME280_Compensation.c"
+#undef long
+
+#define DEFAULT_SAMPLES 2000000UL
+
+/* calibration set from BME280 datasheet example, humidity of production sensor */
+static const bme280_calibration_param test_cal_param =
+{
+	.dig_T1 = 27504, .dig_T2 = 26435, .dig_T3 = -1000,
+	.dig_P1 = 36477, .dig_P2 = -10685, .dig_P3 = 3024, .dig_P4 = 2855, .dig_P5 = 140,
+	.dig_P6 = -7, .dig_P7 = 15500, .dig_P8 = -14600, .dig_P9 = 6000,
+	.dig_H1 = 75, .dig_H2 = 362, .dig_H3 = 0, .dig_H4 = 324, .dig_H5 = 0, .dig_H6 = 30
+};
+
+static uint32_t random_state = 1;
+
+static uint32_t next_random(void)
+{
+	random_state = random_state * 1103515245UL + 12345UL;
+	return random_state >> 8;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned long samples = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_SAMPLES;
+	unsigned long tested = 0;
+	unsigned long mismatches = 0;
+
+	cal_param = test_cal_param;
+
+	while(tested < samples)
+	{
+		adc_t = next_random() & 0xFFFFF;
+		adc_p = next_random() & 0xFFFFF;
+		adc_h = next_random() & 0xFFFF;
+
+		/* float path as it was, compensation order matters because of t_fine */
+		int32_t T = BME280_Compensate_T();
+		uint32_t H = BME280_Compensate_H();
+		uint32_t P = BME280_Compensate_P();
+
+		/* operating range: -40..85 DegC, 300..1100 hPa */
+		if(T < -4000 || T > 8500 || P < 30000 || P > 110000)
+		{
+			continue;
+		}
+
+		float temperature = (float)T / 100;
+		float humidity = (float)H / 1024;
+		float pressure = (float)P / 100;
+
+		int16_t expected_temperature = (int16_t)lroundf(temperature * 10);
+		int16_t expected_humidity = (int16_t)lroundf(humidity * 10);
+		int16_t expected_pressure = (int16_t)lroundf(pressure * 10);
+
+		int16_t actual_temperature, actual_humidity, actual_pressure;
+		BME280_GetReadings(&actual_temperature, &actual_humidity, &actual_pressure);
+
+		if(actual_temperature != expected_temperature || actual_humidity != expected_humidity || actual_pressure != expected_pressure)
+		{
+			if(mismatches < 10)
+			{
+				printf("mismatch adc_t=%d adc_p=%d adc_h=%d: %d/%d %d/%d %d/%d\n", adc_t, adc_p, adc_h,
+					actual_temperature, expected_temperature, actual_humidity, expected_humidity, actual_pressure, expected_pressure);
+			}
+
+			mismatches++;
+		}
+
+		tested++;
+	}
+
+	printf("%lu samples, %lu mismatches\n", tested, mismatches);
+
+	return mismatches ? 1 : 0;
+}
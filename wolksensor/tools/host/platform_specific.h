@@ -0,0 +1,59 @@
+#ifndef PLATFORM_SPECIFIC_H_
+#define PLATFORM_SPECIFIC_H_
+
+/*
+* Host build counterpart of wolksensor/WolkSensor/platform_specific.h for SDK tests in tools,
+* program memory is ordinary memory and interrupts are never disabled.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(x) (x)
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strlen_P strlen
+#define strchr_P strchr
+#define memcpy_P memcpy
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+
+typedef uint8_t register8_t;
+extern register8_t SREG;
+#define cli()
+#define sei()
+
+#define FW_VERSION_MAJOR 4 // number 0 -99
+#define FW_VERSION_MINOR 0 // number 0 -99
+#define FW_VERSION_PATCH 0 // number 0 -99
+
+#define SYNCHRONIZED_BLOCK_START register8_t saved_sreg = SREG; cli();
+#define SYNCHRONIZED_BLOCK_END SREG = saved_sreg;
+
+#define WIFI_SECURITY_UNSECURED		0
+#define WIFI_SECURITY_WEP			1
+#define WIFI_SECURITY_WPA			2
+#define WIFI_SECURITY_WPA2			2
+
+#define NO_INIT_MEMORY
+
+#define MAX_BUFFER_SIZE 768
+
+#define NUMBER_OF_ACTUATORS 0 
+
+#define NUMBER_OF_SENSORS 4
+
+#define LOG_FORMAT "%s\r\n"
+
+#endif /* PLATFORM_SPECIFIC_H_ */
@@ -0,0 +1,482 @@
+/*
+* Host test of persistent KNXnet/IP tunnel in SDK/core/knx.c against in-process tunneling server stand-in.
+* Wifi communication module is replaced by the stand-in: every datagram sent by knx.c is handled by the
+* stand-in right away and its responses are returned one per receive, receive without response times out
+* with no data as UDP receive does. Connection state timer is fired by the test.
+*
+* Covers connect, CONNECTIONSTATE heartbeat, connection state request retries, tunnel lost after
+* unanswered requests with reconnect on next send, and reconnect after disconnect request from server.
+*
+* Build and run from wolksensor directory:
+*     gcc -std=gnu99 -Wall -Itools/host -ISDK/core -ISDK/application -o knx_tunnel_test tools/knx_tunnel_test.c \
+*         SDK/core/knx.c SDK/core/state_machine.c SDK/core/event_buffer.c SDK/core/circular_buffer.c SDK/core/system.c
+*     ./knx_tunnel_test
+*
+* Exits with 0 when all checks pass.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "knx.h"
+#include "config.h"
+#include "sensors.h"
+#include "actuators.h"
+#include "command_buffer.h"
+#include "communication_module.h"
+#include "wifi_communication_module.h"
+#include "wifi_communication_module_dependencies.h"
+#include "udp_communication_module.h"
+#include "sensor_readings_buffer.h"
+#include "software_timer.h"
+#include "state_machine_trace.h"
+#include "state_residency.h"
+#include "chrono.h"
+
+#define STANDIN_DATAGRAMS 8
+#define STANDIN_DATAGRAM_SIZE 64
+
+#define TEST_SERVER_PORT 3671
+#define TEST_DATAPOINTS 3 // T, P and H set in reading, M is not
+
+/* tunneling server stand-in */
+
+typedef struct
+{
+	uint8_t data[STANDIN_DATAGRAM_SIZE];
+	uint16_t size;
+}
+datagram_t;
+
+static struct
+{
+	datagram_t responses[STANDIN_DATAGRAMS];
+	uint8_t responses_count;
+
+	bool tunnel_open;
+	uint8_t channel;
+	uint8_t next_channel;
+	uint8_t client_sequence_counter;
+	uint8_t server_sequence_counter;
+	uint8_t acked_sequence_counter; // next server request to be acknowledged
+
+	uint16_t connect_requests;
+	uint16_t tunneling_requests;
+	uint16_t connection_state_requests;
+	uint16_t disconnect_requests;
+	uint16_t acks_received;
+	uint16_t protocol_errors;
+
+	uint8_t connection_state_requests_to_drop;
+	bool disconnect_on_tunneling_request;
+}
+standin;
+
+static void standin_reset(void)
+{
+	memset(&standin, 0, sizeof(standin));
+	standin.next_channel = 7;
+}
+
+static void standin_respond(const uint8_t* data, uint16_t size)
+{
+	if(standin.responses_count < STANDIN_DATAGRAMS)
+	{
+		memcpy(standin.responses[standin.responses_count].data, data, size);
+		standin.responses[standin.responses_count].size = size;
+		standin.responses_count++;
+	}
+}
+
+static void standin_respond_connection(uint16_t service_type, uint8_t channel, uint8_t status, uint8_t size)
+{
+	uint8_t response[20] = {0x06, 0x10, service_type >> 8, service_type & 0xFF, 0x00, size, channel, status, 0x08, 0x01};
+	standin_respond(response, size);
+}
+
+static void standin_handle_datagram(const uint8_t* data, uint16_t size)
+{
+	if(size < 6 || data[0] != 0x06 || data[1] != 0x10 || ((data[4] << 8) | data[5]) != size)
+	{
+		standin.protocol_errors++;
+		return;
+	}
+
+	uint16_t service_type = (data[2] << 8) | data[3];
+	switch(service_type)
+	{
+		case 0x0205: // CONNECT_REQUEST
+		{
+			standin.connect_requests++;
+			standin.tunnel_open = true;
+			standin.channel = standin.next_channel++;
+			standin.client_sequence_counter = 0;
+			standin.server_sequence_counter = 0;
+			standin.acked_sequence_counter = 0;
+
+			standin_respond_connection(0x0206, standin.channel, 0x00, 20);
+			break;
+		}
+		case 0x0207: // CONNECTIONSTATE_REQUEST
+		{
+			standin.connection_state_requests++;
+			if(standin.connection_state_requests_to_drop > 0)
+			{
+				standin.connection_state_requests_to_drop--;
+				break;
+			}
+
+			// E_CONNECTION_ID for unknown channel
+			bool known = standin.tunnel_open && data[6] == standin.channel;
+			standin_respond_connection(0x0208, data[6], known ? 0x00 : 0x21, 8);
+			break;
+		}
+		case 0x0209: // DISCONNECT_REQUEST
+		{
+			standin.disconnect_requests++;
+			standin.tunnel_open = false;
+
+			standin_respond_connection(0x020A, data[6], 0x00, 8);
+			break;
+		}
+		case 0x0420: // TUNNELING_REQUEST
+		{
+			standin.tunneling_requests++;
+			if(!standin.tunnel_open || data[7] != standin.channel || data[8] != standin.client_sequence_counter)
+			{
+				standin.protocol_errors++;
+				break;
+			}
+
+			if(standin.disconnect_on_tunneling_request)
+			{
+				standin.disconnect_on_tunneling_request = false;
+				standin.tunnel_open = false;
+
+				standin_respond_connection(0x0209, standin.channel, 0x00, 16);
+				break;
+			}
+
+			standin.client_sequence_counter++;
+
+			uint8_t ack[] = {0x06, 0x10, 0x04, 0x21, 0x00, 0x0A, 0x04, standin.channel, data[8], 0x00};
+			standin_respond(ack, sizeof(ack));
+
+			// L_Data.con of sent group value write
+			uint8_t confirmation[] = {0x06, 0x10, 0x04, 0x20, 0x00, 0x15, 0x04, standin.channel, standin.server_sequence_counter++, 0x00,
+				0x2E, 0x00, 0xBC, 0xE0, 0x11, 0x01, 0x0A, 0x00, 0x03, 0x00, 0x80};
+			standin_respond(confirmation, sizeof(confirmation));
+			break;
+		}
+		case 0x0421: // TUNNELING_ACK
+		{
+			if(data[7] != standin.channel || data[8] != standin.acked_sequence_counter)
+			{
+				standin.protocol_errors++;
+				break;
+			}
+
+			standin.acked_sequence_counter++;
+			standin.acks_received++;
+			break;
+		}
+		default:
+		{
+			standin.protocol_errors++;
+			break;
+		}
+	}
+}
+
+/* wifi communication module replaced by stand-in */
+
+static uint8_t* receive_buffer;
+static uint16_t receive_buffer_size;
+static uint16_t* received_size;
+
+static bool standin_done(void)
+{
+	return false;
+}
+
+static bool standin_receive(void)
+{
+	*received_size = 0;
+
+	if(standin.responses_count > 0 && standin.responses[0].size <= receive_buffer_size)
+	{
+		memcpy(receive_buffer, standin.responses[0].data, standin.responses[0].size);
+		*received_size = standin.responses[0].size;
+	}
+
+	if(standin.responses_count > 0)
+	{
+		standin.responses_count--;
+		memmove(&standin.responses[0], &standin.responses[1], standin.responses_count * sizeof(datagram_t));
+	}
+
+	return false;
+}
+
+communication_module_process_handle_t wifi_communication_module_connect(void)
+{
+	return standin_done;
+}
+
+communication_module_process_handle_t wifi_communication_module_send_to(uint8_t* data_in, uint16_t data_in_size)
+{
+	standin_handle_datagram(data_in, data_in_size);
+
+	return standin_done;
+}
+
+communication_module_process_handle_t wifi_communication_module_receive_from(uint8_t* buffer_out, uint16_t buffer_out_size, uint16_t* received_data_size_out)
+{
+	receive_buffer = buffer_out;
+	receive_buffer_size = buffer_out_size;
+	received_size = received_data_size_out;
+
+	return standin_receive;
+}
+
+communication_module_type_data_t get_wifi_communication_result(void)
+{
+	communication_module_type_data_t result;
+	memset(&result, 0, sizeof(result));
+	result.type = COMMUNICATION_MODULE_WIFI;
+
+	return result;
+}
+
+static uint32_t get_ip_address(char* ip_address)
+{
+	strcpy(ip_address, "192.168.1.20");
+
+	return 0x1401A8C0;
+}
+
+/* rest of firmware knx.c depends on */
+
+register8_t SREG;
+
+char server_ip[MAX_SERVER_IP_SIZE];
+uint16_t server_port;
+uint8_t knx_physical_address[2];
+uint8_t knx_group_address[2];
+char knx_multicast_address[MAX_KNX_MULTICAST_ADDRESS_SIZE];
+uint16_t knx_multicast_port;
+bool knx_nat;
+
+uint16_t bind_port;
+char destination_address[15];
+uint16_t destination_port;
+
+sensor_t sensors[NUMBER_OF_SENSORS];
+sensor_alarms_t sensors_alarms[NUMBER_OF_SENSORS];
+actuator_t actuators[NUMBER_OF_ACTUATORS];
+
+communication_module_t communication_module;
+wifi_communication_module_dependencies_t wifi_communication_module_dependencies;
+
+bool load_knx_physical_address(void) { return true; }
+bool load_knx_group_address(void) { return true; }
+bool load_knx_multicast_address(void) { return true; }
+bool load_knx_multicast_port(void) { return true; }
+
+bool command_buffer_add(circular_buffer_t* command_buffer, command_t* command) { return true; }
+
+uint32_t rtc_get_ts(void) { return 0; }
+
+static software_timer_t* connection_state_timer;
+static void (*connection_state_timer_callback)(void* argument);
+static uint16_t connection_state_timer_starts;
+
+void software_timer_start(software_timer_t* timer, void (*callback)(void* argument), void* argument, uint32_t delay, uint32_t period)
+{
+	connection_state_timer = timer;
+	connection_state_timer_callback = callback;
+	connection_state_timer_starts++;
+	timer->active = true;
+}
+
+void software_timer_stop(software_timer_t* timer)
+{
+	timer->active = false;
+}
+
+void state_machine_trace_register(const void* state_machine, state_machine_trace_id_t id) {}
+uint8_t state_machine_trace_set_event(uint8_t event_type) { return 0; }
+uint8_t state_machine_trace_get_id(const void* state_machine) { return STATE_MACHINE_TRACE_NO_STATE_MACHINE; }
+void state_machine_trace_transition(uint8_t id, int8_t from_state, int8_t to_state) {}
+void state_residency_enter(uint8_t id, int8_t state) {}
+
+/* test */
+
+static circular_buffer_t test_sensor_readings;
+static sensor_readings_t test_sensor_readings_storage[2];
+static circular_buffer_t test_system_buffer;
+static uint8_t test_system_buffer_storage[4];
+static circular_buffer_t test_commands_buffer;
+static uint8_t test_commands_buffer_storage[16];
+
+static unsigned failures = 0;
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+static void check(bool condition, const char* text, int line)
+{
+	if(!condition)
+	{
+		printf("line %d: %s failed\n", line, text);
+		failures++;
+	}
+}
+
+static void run(communication_protocol_process_handle_t handle)
+{
+	uint16_t steps = 0;
+	while(handle() && ++steps < 1000);
+
+	CHECK(steps < 1000);
+}
+
+static uint8_t knx_error(void)
+{
+	return get_knx_communication_result().data.knx_communication_protocol_data.error;
+}
+
+static uint16_t send_readings(void)
+{
+	uint16_t sent_sensor_readings = 0;
+	uint16_t sent_system_items = 0;
+
+	run(knx_protocol_send_sensor_readings_and_system_data(&test_sensor_readings, &test_system_buffer, &sent_sensor_readings, &sent_system_items));
+
+	return sent_sensor_readings;
+}
+
+static void disconnect(void)
+{
+	run(knx_protocol_disconnect());
+}
+
+static void connection_state_timer_expires(void)
+{
+	CHECK(connection_state_timer && connection_state_timer->active);
+
+	connection_state_timer_callback(NULL);
+	while(knx_protocol_process());
+}
+
+static void test_connect(void)
+{
+	CHECK(send_readings() == 1);
+	CHECK(knx_error() == KNX_SUCCESS);
+	CHECK(standin.connect_requests == 1);
+	CHECK(standin.tunneling_requests == TEST_DATAPOINTS);
+	CHECK(standin.acks_received == TEST_DATAPOINTS);
+
+	disconnect();
+	CHECK(knx_protocol_keeps_connection());
+	CHECK(standin.disconnect_requests == 0);
+
+	// tunnel is reused by next send
+	CHECK(send_readings() == 1);
+	CHECK(standin.connect_requests == 1);
+	CHECK(standin.tunneling_requests == 2 * TEST_DATAPOINTS);
+	disconnect();
+}
+
+static void test_connection_state(void)
+{
+	uint16_t timer_starts = connection_state_timer_starts;
+
+	connection_state_timer_expires();
+	CHECK(standin.connection_state_requests == 1);
+	CHECK(knx_protocol_keeps_connection());
+	CHECK(connection_state_timer_starts == timer_starts + 1);
+}
+
+static void test_connection_state_retry(void)
+{
+	standin.connection_state_requests = 0;
+	standin.connection_state_requests_to_drop = 2;
+
+	connection_state_timer_expires();
+	CHECK(standin.connection_state_requests == 3);
+	CHECK(knx_protocol_keeps_connection());
+
+	// tunnel is lost after all requests are unanswered, next send connects again
+	standin.connection_state_requests = 0;
+	standin.connection_state_requests_to_drop = 3;
+
+	connection_state_timer_expires();
+	CHECK(standin.connection_state_requests == 3);
+	CHECK(!knx_protocol_keeps_connection());
+	CHECK(!connection_state_timer->active);
+
+	CHECK(send_readings() == 1);
+	CHECK(standin.connect_requests == 2);
+	CHECK(knx_protocol_keeps_connection());
+	disconnect();
+}
+
+static void test_reconnect_after_disconnect(void)
+{
+	standin.disconnect_on_tunneling_request = true;
+	uint16_t tunneling_requests = standin.tunneling_requests;
+
+	CHECK(send_readings() == 1);
+	CHECK(knx_error() == KNX_SUCCESS);
+	CHECK(standin.connect_requests == 3);
+	CHECK(standin.tunneling_requests == tunneling_requests + 1 + TEST_DATAPOINTS);
+	CHECK(knx_protocol_keeps_connection());
+	disconnect();
+
+	// connection state of unknown channel closes tunnel
+	standin.tunnel_open = false;
+	connection_state_timer_expires();
+	CHECK(!knx_protocol_keeps_connection());
+
+	// tunnel is closed by disconnect request once it is not persistent
+	CHECK(send_readings() == 1);
+	knx_set_persistent_tunnel(false);
+	disconnect();
+	CHECK(standin.disconnect_requests == 1);
+	CHECK(!knx_protocol_keeps_connection());
+}
+
+int main(void)
+{
+	standin_reset();
+
+	strcpy(server_ip, "192.168.1.10");
+	server_port = TEST_SERVER_PORT;
+
+	sensors[0].id = 'P';
+	sensors[1].id = 'T';
+	sensors[2].id = 'H';
+	sensors[3].id = 'M';
+
+	wifi_communication_module_dependencies.get_ip_address = get_ip_address;
+
+	circular_buffer_init(&test_sensor_readings, test_sensor_readings_storage, 2, sizeof(sensor_readings_t), false, true);
+	circular_buffer_init(&test_system_buffer, test_system_buffer_storage, sizeof(test_system_buffer_storage), sizeof(uint8_t), false, true);
+	circular_buffer_init(&test_commands_buffer, test_commands_buffer_storage, sizeof(test_commands_buffer_storage), sizeof(uint8_t), false, true);
+
+	sensor_readings_t reading = {0, {9650, 235, 451, SENSOR_VALUE_NOT_SET}};
+	circular_buffer_add(&test_sensor_readings, &reading);
+
+	knx_init();
+	knx_set_persistent_tunnel(true);
+
+	test_connect();
+	test_connection_state();
+	test_connection_state_retry();
+	test_reconnect_after_disconnect();
+
+	CHECK(standin.protocol_errors == 0);
+
+	printf("%u failures\n", failures);
+
+	return failures ? 1 : 0;
+}
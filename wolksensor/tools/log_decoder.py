@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""
+Formats tokenized log records sent by firmware built without LOG_TEXT.
+
+Usage: log_decoder.py ELF_FILE [FILE]
+
+FILE (or standard input) is USB terminal output. Lines starting with '#' are log records:
+format string flash address followed by arguments, see SDK/core/logger.c. Format strings
+and %S arguments are read from ELF_FILE, which must be the file flashed to the device.
+Other lines are command responses and are printed unchanged.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+# sizes of printf arguments on AVR
+INT_SIZE = 2
+LONG_SIZE = 4
+POINTER_SIZE = 2
+DOUBLE_SIZE = 4
+
+FLASH_END = 0x800000  # AVR data memory is mapped from 0x800000 in ELF
+SHF_ALLOC = 0x2
+
+CONVERSION = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l)?([diouxXcsSpeEfFgG%])")
+
+
+class Flash(object):
+    def __init__(self, path):
+        with open(path, "rb") as elf_file:
+            data = elf_file.read()
+
+        if data[:4] != b"\x7fELF" or data[4] != 1:
+            raise ValueError("%s is not 32-bit ELF file" % path)
+
+        (section_offset,) = struct.unpack_from("<I", data, 0x20)
+        section_size, section_count = struct.unpack_from("<HH", data, 0x2E)
+
+        self.sections = []
+        for index in range(section_count):
+            _, section_type, flags, address, offset, size = struct.unpack_from("<IIIIII", data, section_offset + index * section_size)
+            # NOBITS sections (.bss, .noinit) have no content
+            if section_type != 8 and flags & SHF_ALLOC and address < FLASH_END:
+                self.sections.append((address, data[offset:offset + size]))
+
+    def string(self, address):
+        for start, content in self.sections:
+            if start <= address < start + len(content):
+                end = content.find(b"\0", address - start)
+                return content[address - start:end if end >= 0 else len(content)].decode("latin-1")
+
+        return "<unknown string 0x%04X>" % address
+
+
+class Record(object):
+    def __init__(self, data):
+        self.data = data
+        self.position = 0
+
+    def integer(self, size, signed=False):
+        if self.position + size > len(self.data):
+            raise IndexError()
+
+        value = int.from_bytes(self.data[self.position:self.position + size], "little", signed=signed)
+        self.position += size
+        return value
+
+    def string(self):
+        end = self.data.find(b"\0", self.position)
+        if end < 0:
+            raise IndexError()
+
+        value = self.data[self.position:end].decode("latin-1")
+        self.position = end + 1
+        return value
+
+    def double(self):
+        if self.position + DOUBLE_SIZE > len(self.data):
+            raise IndexError()
+
+        (value,) = struct.unpack_from("<f", self.data, self.position)
+        self.position += DOUBLE_SIZE
+        return value
+
+
+def format_message(flash, text, record):
+    output = []
+    position = 0
+    for match in CONVERSION.finditer(text):
+        output.append(text[position:match.start()])
+        position = match.end()
+
+        flags, width, precision, length, conversion = match.groups()
+        if conversion == "%":
+            output.append("%")
+            continue
+
+        try:
+            if width == "*":
+                width = str(record.integer(INT_SIZE, True))
+            if precision == "*":
+                precision = str(record.integer(INT_SIZE, True))
+
+            if conversion == "s":
+                value = record.string()
+            elif conversion == "S":
+                value = flash.string(record.integer(POINTER_SIZE))
+                conversion = "s"
+            elif conversion == "p":
+                value = record.integer(POINTER_SIZE)
+                conversion = "x"
+            elif conversion == "c":
+                value = record.integer(1)
+            elif conversion in "eEfFgG":
+                value = record.double()
+            else:
+                size = LONG_SIZE if length in ("l", "ll") else INT_SIZE
+                value = record.integer(size, conversion in "di")
+                conversion = "d" if conversion in "diu" else conversion
+        except IndexError:
+            output.append("<missing>")
+            continue
+
+        specification = "%" + flags + (width or "") + ("." + precision if precision is not None else "") + conversion
+        output.append(specification % value)
+
+    output.append(text[position:])
+    return "".join(output)
+
+
+def decode_line(flash, line):
+    data = bytes.fromhex(line[1:].strip())
+    record = Record(data)
+    address = record.integer(POINTER_SIZE)
+    if not address:
+        return "<%u log records dropped>\r\n" % record.integer(2)
+
+    return format_message(flash, flash.string(address), record)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Format WolkSensor tokenized log")
+    parser.add_argument("elf", help="firmware ELF file")
+    parser.add_argument("file", nargs="?", help="file with USB terminal output, standard input if omitted")
+    arguments = parser.parse_args()
+
+    flash = Flash(arguments.elf)
+    log_file = open(arguments.file, encoding="latin-1", newline="") if arguments.file else sys.stdin
+
+    for line in log_file:
+        if line.startswith("#"):
+            try:
+                line = decode_line(flash, line)
+            except ValueError:
+                pass
+
+        sys.stdout.write(line)
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""
+Decodes state machine trace dumped with TRACE command into readable timeline
+and state residency dumped with ENERGY command into table of states.
+
+Usage: state_machine_trace_decoder.py [-s SDK_DIRECTORY] [FILE]
+
+FILE (or standard input) holds TRACE or ENERGY response, eg. copied from USB terminal:
+    TRACE 0000FEFFFFFD|0003000002FF|...;
+    ENERGY 1234|010F0001E2400003000000C9|...;
+State and event names are read from enums in state machine sources, trace ids
+must match state_machine_trace_id_t in SDK/core/state_machine_trace.h.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+TICKS_PER_SECOND = 512
+
+EVENT_ENTERING_STATE = 0xFE
+EVENT_LEAVING_STATE = 0xFF
+NO_EVENT = 0xFD
+NO_STATE_MACHINE = 0xFF
+RESET = 0xFE
+
+START_TYPES = ["POWER_ON", "BROWNOUT_RESET", "WATCHDOG_RESET"]
+
+# trace id: (name, source files, states enum, events enum)
+STATE_MACHINES = {
+    0: ("WOLKSENSOR", ["application/wolksensor.c"], "wolksensor_states_t", "wolksensor_events_t"),
+    1: ("WIFI", ["core/wifi_communication_module.c", "core/wifi_communication_module.h"], "wifi_communication_module_states_t", "wifi_communication_module_events_t"),
+    2: ("TCP", ["core/socket_transport.c"], "socket_transport_states_t", "socket_transport_events_t"),
+    3: ("UDP", ["core/socket_transport.c"], "socket_transport_states_t", "socket_transport_events_t"),
+    4: ("MQTT", ["core/mqtt_communication_protocol.c"], "mqtt_communication_protocol_states_t", "mqtt_communication_protocol_events_t"),
+    5: ("COAP", ["core/coap_communication_protocol.c"], "coap_communication_protocol_states_t", "coap_communication_protocol_events_t"),
+    6: ("KNX", ["core/knx.c"], "knx_states_t", "knx_events_t"),
+    7: ("POWER", ["core/state_residency.h"], "state_residency_power_states_t", None),
+}
+
+
+def parse_enum(source, enum_name):
+    match = re.search(r"typedef\s+enum\s*\{([^}]*)\}\s*" + enum_name + r"\s*;", source)
+    if not match:
+        return {}
+
+    body = re.sub(r"//[^\n]*|/\*.*?\*/", "", match.group(1), flags=re.S)
+    names = {}
+    value = 0
+    for item in body.split(","):
+        item = item.strip()
+        if not item:
+            continue
+        if "=" in item:
+            name, expression = [part.strip() for part in item.split("=", 1)]
+            value = int(expression, 0)
+        else:
+            name = item
+        names[value] = name
+        value += 1
+
+    return names
+
+
+def load_names(sdk_directory):
+    names = {}
+    for trace_id, (name, files, states_enum, events_enum) in STATE_MACHINES.items():
+        source = ""
+        for file_name in files:
+            path = os.path.join(sdk_directory, file_name)
+            if os.path.exists(path):
+                with open(path, encoding="latin-1") as source_file:
+                    source += source_file.read()
+
+        events = parse_enum(source, events_enum) if events_enum else {}
+        events[EVENT_ENTERING_STATE] = "ENTERING_STATE"
+        events[EVENT_LEAVING_STATE] = "LEAVING_STATE"
+        names[trace_id] = (name, parse_enum(source, states_enum), events)
+
+    return names
+
+
+def parse_records(text):
+    match = re.search(r"TRACE\s*([0-9A-Fa-f|]*)\s*;", text)
+    payload = match.group(1) if match else text
+    for item in re.findall(r"[0-9A-Fa-f]{12}", payload):
+        yield (int(item[0:4], 16), int(item[4:6], 16), to_signed(int(item[6:8], 16)), to_signed(int(item[8:10], 16)), int(item[10:12], 16))
+
+
+def parse_residency(text):
+    match = re.search(r"ENERGY\s*(\d+)\|?([0-9A-Fa-f|]*)\s*;", text)
+    if not match:
+        return None, []
+
+    slots = []
+    for item in re.findall(r"[0-9A-Fa-f]{24}", match.group(2)):
+        slots.append((int(item[0:2], 16), to_signed(int(item[2:4], 16)), int(item[4:12], 16), int(item[12:16], 16), int(item[16:24], 16)))
+
+    return int(match.group(1)), slots
+
+
+def decode_residency(charge, slots, names):
+    lines = ["%-10s %-32s %12s %8s %10s" % ("MACHINE", "STATE", "TIME [s]", "ENTRIES", "CHARGE [uAh]")]
+    for state_machine, state, ticks, entries, state_charge in slots:
+        name, states, _ = names.get(state_machine, (str(state_machine), {}, {}))
+        lines.append("%-10s %-32s %12.3f %8u %10u" % (name, state_name(states, state), ticks / float(TICKS_PER_SECOND), entries, state_charge))
+
+    lines.append("total charge %u uAh" % charge)
+    return lines
+
+
+def to_signed(byte):
+    return byte - 0x100 if byte & 0x80 else byte
+
+
+def state_name(states, state):
+    if state == -1:
+        return "-"
+    return states.get(state, str(state))
+
+
+def decode(records, names):
+    time = 0
+    lines = []
+    for time_delta, state_machine, from_state, to_state, event in records:
+        time += time_delta
+        saturated = "+" if time_delta == 0xFFFF else " "
+        timestamp = "%10.3f%s" % (time / float(TICKS_PER_SECOND), saturated)
+
+        if state_machine == RESET:
+            start_type = START_TYPES[from_state] if 0 <= from_state < len(START_TYPES) else str(from_state)
+            lines.append("%s ---- start after %s ----" % (timestamp, start_type))
+            continue
+
+        if state_machine in names:
+            name, states, events = names[state_machine]
+        else:
+            name, states, events = ("UNKNOWN" if state_machine == NO_STATE_MACHINE else str(state_machine)), {}, {}
+
+        event_name = "-" if event == NO_EVENT else events.get(event, str(event))
+        lines.append("%s %-10s %s -> %s on %s" % (timestamp, name, state_name(states, from_state), state_name(states, to_state), event_name))
+
+    return lines
+
+
+def main():
+    default_sdk_directory = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "SDK")
+
+    parser = argparse.ArgumentParser(description="Decode WolkSensor state machine trace")
+    parser.add_argument("-s", "--sdk", default=default_sdk_directory, help="SDK directory with state machine sources")
+    parser.add_argument("file", nargs="?", help="file with TRACE or ENERGY response, standard input if omitted")
+    arguments = parser.parse_args()
+
+    if arguments.file:
+        with open(arguments.file) as trace_file:
+            text = trace_file.read()
+    else:
+        text = sys.stdin.read()
+
+    names = load_names(arguments.sdk)
+
+    charge, slots = parse_residency(text)
+    lines = decode_residency(charge, slots, names) if charge is not None else decode(parse_records(text), names)
+    for line in lines:
+        print(line)
+
+
+if __name__ == "__main__":
+    main()
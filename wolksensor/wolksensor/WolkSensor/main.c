@@ -32,6 +32,7 @@
 #include "Sensors/sensor.h"
 #include "Sensors/batteryADC.h"
 #include "Sensors/LSM303.h"
+#include "twi_queue.h"
 #include "RTC.h"
 #include "event_buffer.h"
 #include "clock.h"
@@ -49,12 +50,22 @@
 #include "wifi_communication_module_dependencies.h"
 #include "mqtt_communication_protocol.h"
 #include "mqtt_communication_protocol_dependencies.h"
+#include "coap_communication_protocol.h"
+#include "coap_communication_protocol_dependencies.h"
+#include "knx.h"
 #include "wifi_cc3100.h"
 #include "encryption.h"
 #include "global_dependencies.h"
 #include "nonvolatile_memory.h"
 #include "simplelink.h"
 #include "flc_api.h"
+#include "state_machine_trace.h"
+#include "state_residency.h"
+
+// upload readings with CoAP over UDP instead of MQTT over TCP
+#define COAP_COMMUNICATION_PROTOCOL 0
+// send readings as KNX group values, tunnel is kept open while on USB power
+#define KNX_COMMUNICATION_PROTOCOL 0
 
 /* flash code length -- this is loaded in flash by the linker scripts */ 
 const uint32_t ProgramLength __attribute__ ((section (".length"))) = 0x12345678;
@@ -79,6 +90,37 @@ unsigned char timeON = 0;
 // functions from sensors
 void init_sensors(void);
 
+/*
+* Current in uA used to estimate charge, typical datasheet values (XMEGA C3 at 32MHz and 3V, CC3100)
+* which should be replaced with values measured on the board.
+*/
+static const uint32_t power_states_currents[STATE_POWER_STATES_COUNT] PROGMEM =
+{
+	10000,	// STATE_POWER_ACTIVE
+	4000,	// STATE_POWER_IDLE
+	2,		// STATE_POWER_SAVE
+};
+
+static const uint32_t wifi_states_currents[STATE_WIFI_STOPPED + 1] PROGMEM =
+{
+	53000,	// STATE_WIFI_STARTING
+	700,	// STATE_WIFI_STARTED
+	700,	// STATE_WIFI_DISCONNECTED
+	60000,	// STATE_WIFI_CONNECTING
+	60000,	// STATE_WIFI_CONNECTING_TO_AP
+	60000,	// STATE_WIFI_ACQUIRING_IP_ADDRESS
+	700,	// STATE_WIFI_CONNECTED
+	160000,	// STATE_WIFI_SEND
+	160000,	// STATE_WIFI_SEND_TO
+	53000,	// STATE_WIFI_RECEIVE
+	53000,	// STATE_WIFI_RECEIVE_FROM
+	53000,	// STATE_WIFI_CLOSING_SOCKET
+	53000,	// STATE_WIFI_DISCONNECTING
+	53000,	// STATE_WIFI_RESET
+	53000,	// STATE_WIFI_STOPPING
+	4,		// STATE_WIFI_STOPPED, hibernate
+};
+
 void resetCheck(void)
 {
 	if (RST.STATUS & RST_PORF_bm)
@@ -112,6 +154,9 @@ void resetCheck(void)
 static void init_global_dependencies(void)
 {
 	global_dependencies.rtc_get = rtc_get;
+	global_dependencies.rtc_get_ticks = rtc_get_ticks;
+	global_dependencies.rtc_set_alarm = rtc_set_alarm;
+	global_dependencies.rtc_clear_alarm = rtc_clear_alarm;
 	global_dependencies.log = send_command_response;
 	global_dependencies.send_response = send_command_response;
 	global_dependencies.config_read = config_read;
@@ -129,6 +174,7 @@ static void init_wolksensor_dependencies(void)
 	wolksensor_dependencies.add_command_data_received_listener = add_command_data_received_listener;
 	wolksensor_dependencies.add_battery_voltage_listener = add_battery_voltage_listener;
 	wolksensor_dependencies.add_sensors_states_listener = add_sensors_states_listener;
+	wolksensor_dependencies.add_sensors_acquisition_done_listener = add_sensors_acquisition_done_listener;
 	wolksensor_dependencies.system_reset = system_reset;
 	wolksensor_dependencies.enable_movement = enable_movement;
 	wolksensor_dependencies.disable_movement = disable_movement;
@@ -151,9 +197,6 @@ static void init_wifi_communication_module_dependencies(void)
 	
 	wifi_communication_module_dependencies.serialize_wifi_platform_specific_error_code = serialize_wifi_platform_specific_error_code;
 	
-	wifi_communication_module_dependencies.add_milisecond_expired_listener = add_milisecond_expired_listener;
-	wifi_communication_module_dependencies.add_second_expired_listener = add_second_expired_listener;
-	
 	wifi_communication_module_dependencies.add_wifi_connected_listener = add_wifi_connected_listener;
 	wifi_communication_module_dependencies.add_wifi_ip_address_acquired_listener = add_wifi_ip_address_acquired_listener;
 	wifi_communication_module_dependencies.add_wifi_disconnected_listener = add_wifi_disconnected_listener;
@@ -169,6 +212,12 @@ static void init_mqtt_communication_protocol_dependencies(void)
 	mqtt_communication_protocol_dependencies.decrypt = decrypt;
 }
 
+static void init_coap_communication_protocol_dependencies(void)
+{
+	coap_communication_protocol_dependencies.encrypt = encrypt;
+	coap_communication_protocol_dependencies.decrypt = decrypt;
+}
+
 static void wire_wifi_communication_module(void)
 {
 	communication_module.sendd = wifi_communication_module_send;
@@ -176,24 +225,53 @@ static void wire_wifi_communication_module(void)
 	communication_module.stop = wifi_communication_module_stop;
 	communication_module.get_communication_result = get_wifi_communication_result;
 	communication_module.get_status = get_wifi_communication_module_status;
+	communication_module.waiting_for_data = wifi_communication_module_waiting_for_data;
 }
 
 static void wire_mqtt_communication_protocol(void)
 {
 	communication_protocol.send_sensor_readings_and_system_data = mqtt_protocol_send_sensor_readings_and_system_data;
 	communication_protocol.receive_commands = mqtt_protocol_receive_commands;
+	communication_protocol.send_command_responses = mqtt_protocol_send_command_responses;
 	communication_protocol.disconnect = mqtt_protocol_disconnect;
 	communication_protocol.get_communication_result = get_mqtt_communication_result;
 }
 
+static void wire_coap_communication_protocol(void)
+{
+	communication_protocol.send_sensor_readings_and_system_data = coap_protocol_send_sensor_readings_and_system_data;
+	communication_protocol.receive_commands = coap_protocol_receive_commands;
+	communication_protocol.send_command_responses = coap_protocol_send_command_responses;
+	communication_protocol.disconnect = coap_protocol_disconnect;
+	communication_protocol.get_communication_result = get_coap_communication_result;
+}
+
+static void wire_knx_communication_protocol(void)
+{
+	communication_protocol.send_sensor_readings_and_system_data = knx_protocol_send_sensor_readings_and_system_data;
+	communication_protocol.receive_commands = knx_protocol_receive_commands;
+	communication_protocol.disconnect = knx_protocol_disconnect;
+	communication_protocol.get_communication_result = get_knx_communication_result;
+	communication_protocol.keeps_connection = knx_protocol_keeps_connection;
+	communication_protocol.set_persistent_connection = knx_set_persistent_tunnel;
+	communication_protocol.process = knx_protocol_process;
+}
+
 static bool process(void)
 {
-	bool poll = poll_usb_state() || waiting_movement_sensor_enable_timeout();
+	bool poll = poll_usb_state();
+	bool sensors_processing = sensors_process();
 	bool application_processing = wolksensor_process();
 	
 	CC3100_process();
 	
-	return poll || application_processing;
+	if(poll || sensors_processing || application_processing)
+	{
+		return true;
+	}
+	
+	// buffered log records are sent only when there is nothing else to do
+	return log_process();
 }
 
 static void set_sensors_types(void)
@@ -242,9 +320,16 @@ int main(void)
 	init_wolksensor_dependencies();
 	init_wifi_communication_module_dependencies();
 	init_mqtt_communication_protocol_dependencies();
+	init_coap_communication_protocol_dependencies();
 	
 	wire_wifi_communication_module();
+#if COAP_COMMUNICATION_PROTOCOL
+	wire_coap_communication_protocol();
+#elif KNX_COMMUNICATION_PROTOCOL
+	wire_knx_communication_protocol();
+#else
 	wire_mqtt_communication_protocol();
+#endif
 	
 	brd_init();
 	clock_init();
@@ -258,13 +343,27 @@ int main(void)
 	
 	LOG_PRINT(1, PSTR("Reset reason %d\r\n"), reset_reason);
 	
+	init_state_machine_trace(start_type == POWER_ON, start_type);
+	
+	init_state_residency(start_type == POWER_ON);
+	state_residency_register(STATE_RESIDENCY_POWER, STATE_POWER_STATES_COUNT);
+	state_residency_set_currents(STATE_RESIDENCY_POWER, power_states_currents);
+	state_residency_set_currents(STATE_MACHINE_TRACE_WIFI_COMMUNICATION_MODULE, wifi_states_currents);
+	state_residency_enter(STATE_RESIDENCY_POWER, STATE_POWER_ACTIVE);
+	
 	set_sensors_types();
 	init_sensors();
 
 	init_commands();
 
 	init_wifi_communication_module();
+#if COAP_COMMUNICATION_PROTOCOL
+	coap_protocol_init();
+#elif KNX_COMMUNICATION_PROTOCOL
+	knx_init();
+#else
 	mqtt_protocol_init();
+#endif
 	
 	if(start_type != BROWNOUT_RESET)
 	{
@@ -281,19 +380,40 @@ int main(void)
 	reset_system_error.data.system_reset_reason = reset_reason;
 	add_system_error(&reset_system_error);
 	
+	LOG_PRINT(1, PSTR("Config store pages scanned during boot %u\r\n"), config_get_pages_scanned());
+	
 	for (;;) 
 	{
 		bool keep_runing = process();
 		while(keep_runing)
 		{
 			watchdog_reset();
+			
+			// nothing to do until socket poll timer expires or sensor bus transfer finishes, idle until next interrupt
+			// unless interrupt queued application event since processing
+			cli();
+			if(!wolksensor_events_pending() && (communication_module.waiting_for_data() || twi_queue_busy()))
+			{
+				state_residency_enter(STATE_RESIDENCY_POWER, STATE_POWER_IDLE);
+				set_sleep_mode(SLEEP_MODE_IDLE);
+				sleep_enable();
+				sei();
+				sleep_cpu();
+				sleep_disable();
+				state_residency_enter(STATE_RESIDENCY_POWER, STATE_POWER_ACTIVE);
+			}
+			sei();
+			
 			keep_runing = process();
 		}
 		
 		watchdog_reset();
+		state_residency_enter(STATE_RESIDENCY_POWER, STATE_POWER_SAVE);
 		set_sleep_mode(SLEEP_MODE_PWR_SAVE);
 		cli();
 		
+		// acquisition may have finished, movement sensor transfer started or application event queued since processing
+		if(!sensors_busy() && !wolksensor_events_pending())
 		{
 			watchdog_disable();
 			
@@ -306,6 +426,8 @@ int main(void)
 		
 		sei();
 		
+		state_residency_enter(STATE_RESIDENCY_POWER, STATE_POWER_ACTIVE);
+		
 		LOG(1, "Awake!");
 	}
 	
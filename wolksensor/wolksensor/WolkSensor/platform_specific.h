@@ -28,6 +28,9 @@
 
 #define MAX_BUFFER_SIZE 768
 
+// peak size and overflow counters of circular buffers, reported with BUFFERS command
+#define CIRCULAR_BUFFER_STATISTICS
+
 #define NUMBER_OF_ACTUATORS 0 
 
 #define NUMBER_OF_SENSORS 4
@@ -3,6 +3,7 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <avr/sleep.h>
 
 
 // OS
@@ -21,6 +22,12 @@
 
 #define SHUT_DOWN_DELAY			10		// 10ms
 
+// 0 for polled transfers only
+#ifndef SPI_DMA
+#define SPI_DMA					1
+#endif
+#define SPI_DMA_MIN_LENGTH		16		// shorter transfers are polled, DMA setup costs more than they take
+
 #define ASSERT_CS()             PORTB.OUTCLR = 0b00100000;		// ioport_set_pin_level(M_SPI_CS, 0)
 #define DEASSERT_CS()           PORTB.OUTSET = 0b00100000;		// ioport_set_pin_level(M_SPI_CS, 1)
 
@@ -29,6 +36,12 @@ unsigned char tSpiReadHeader[] = {3, 0, 0, 0, 0};
 	
 static void (*pIraEventHandler)(void* pValue) = 0;
 
+#if SPI_DMA
+static volatile bool dma_transfer_done = false;
+
+static const unsigned char dummy_byte = 0xFF;
+#endif
+
 inline long ReadWlanInterruptPin(void) {
 	register8_t saved_sreg = SREG;
 	cli();
@@ -104,6 +117,103 @@ ISR(PORTD_INT0_vect)
 }
 
 
+#if SPI_DMA
+/*
+* DMA channels are triggered by SPIC transfer complete, one byte per trigger. CH0 has higher priority,
+* so on reads received byte is stored before CH1 sends next dummy byte. First byte is written by CPU.
+*/
+ISR(DMA_CH0_vect)
+{
+	DMA.CH0.CTRLB |= DMA_CH_TRNIF_bm;
+	dma_transfer_done = true;
+}
+
+ISR(DMA_CH1_vect)
+{
+	DMA.CH1.CTRLB |= DMA_CH_TRNIF_bm;
+	dma_transfer_done = true;
+}
+
+static void set_channel_addresses(DMA_CH_t* channel, const volatile void* source, volatile void* destination)
+{
+	channel->SRCADDR0 = (uint16_t)source & 0xFF;
+	channel->SRCADDR1 = (uint16_t)source >> 8;
+	channel->SRCADDR2 = 0;
+	channel->DESTADDR0 = (uint16_t)destination & 0xFF;
+	channel->DESTADDR1 = (uint16_t)destination >> 8;
+	channel->DESTADDR2 = 0;
+}
+
+static void start_channel(DMA_CH_t* channel, uint8_t address_control, uint16_t count, bool interrupt)
+{
+	channel->ADDRCTRL = address_control;
+	channel->TRIGSRC = DMA_CH_TRIGSRC_SPIC_gc;
+	channel->TRFCNT = count;
+	channel->REPCNT = 0;
+	channel->CTRLB = DMA_CH_TRNIF_bm | DMA_CH_ERRIF_bm | (interrupt ? DMA_CH_TRNINTLVL_LO_gc : 0);
+	channel->CTRLA = DMA_CH_ENABLE_bm | DMA_CH_SINGLE_bm | DMA_CH_BURSTLEN_1BYTE_gc;
+}
+
+/* CPU idles until channel with interrupt enabled finishes, SPI is used from main context only */
+static void wait_dma_transfer(DMA_CH_t* channel)
+{
+	register8_t saved_sreg = SREG;
+	
+	if(!(saved_sreg & CPU_I_bm))
+	{
+		while(!(channel->CTRLB & (DMA_CH_TRNIF_bm | DMA_CH_ERRIF_bm)));
+		return;
+	}
+	
+	cli();
+	while(!dma_transfer_done && !(channel->CTRLB & DMA_CH_ERRIF_bm))
+	{
+		set_sleep_mode(SLEEP_MODE_IDLE);
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		cli();
+	}
+	SREG = saved_sreg;
+}
+
+static void dma_read(unsigned char *data, int size)
+{
+	dma_transfer_done = false;
+	
+	set_channel_addresses(&DMA.CH0, &SPIC.DATA, data);
+	start_channel(&DMA.CH0, DMA_CH_SRCDIR_FIXED_gc | DMA_CH_DESTRELOAD_NONE_gc | DMA_CH_DESTDIR_INC_gc, size, true);
+	
+	set_channel_addresses(&DMA.CH1, &dummy_byte, &SPIC.DATA);
+	start_channel(&DMA.CH1, DMA_CH_SRCDIR_FIXED_gc | DMA_CH_DESTDIR_FIXED_gc, size - 1, false);
+	
+	SPIC.DATA = 0xFF;
+	
+	wait_dma_transfer(&DMA.CH0);
+	
+	DMA.CH1.CTRLA &= ~DMA_CH_ENABLE_bm;
+	SPIC.STATUS;
+	SPIC.DATA;
+}
+
+static void dma_write(unsigned char *data, int size)
+{
+	dma_transfer_done = false;
+	
+	set_channel_addresses(&DMA.CH1, data + 1, &SPIC.DATA);
+	start_channel(&DMA.CH1, DMA_CH_SRCRELOAD_NONE_gc | DMA_CH_SRCDIR_INC_gc | DMA_CH_DESTDIR_FIXED_gc, size - 1, true);
+	
+	SPIC.DATA = *data;
+	
+	wait_dma_transfer(&DMA.CH1);
+	
+	// last byte is still shifting out
+	while (!(SPIC.STATUS & SPI_IF_bm));
+	SPIC.DATA;
+}
+#endif
+
 int SlStudio_RegisterInterruptHandler(void (*InterruptHdl)(void* pValue), void* pValue)
 {
 	pIraEventHandler = InterruptHdl;
@@ -120,6 +230,11 @@ Fd_t spi_Open(char *ifName, unsigned long flags)
 	PR.PRPC &= ~PR_SPI_bm;						// enable SIP peripheral on port C
 	SPIC.CTRL = 0b11010000;						// setup SPI device
 	SPIC.INTCTRL=SPIC.INTCTRL&~SPI_INTLVL_gm;	//disable SPI interrupt
+	
+#if SPI_DMA
+	PR.PRGEN &= ~PR_DMA_bm;
+	DMA.CTRL = DMA_ENABLE_bm | DMA_PRIMODE_CH0123_gc;
+#endif
 
 	// enable external falling edge interrupt on M_SPI_IRQ
 	PORTD.INT0MASK = 0b01000000;		// M_SPI_IRQ is in int0 group
@@ -142,6 +257,11 @@ int spi_Close(Fd_t fd)
 
 	SPIC.CTRL = 0b10010100;				// disable SPI device
 	PR.PRPC |= PR_SPI_bm;				// disable SIP peripheral on port C
+	
+#if SPI_DMA
+	DMA.CTRL = 0;
+	PR.PRGEN |= PR_DMA_bm;
+#endif
 
 	//SREG = saved_sreg;
 	
@@ -154,6 +274,16 @@ int spi_Read(Fd_t fd, unsigned char *data, int size)
 {
 	ASSERT_CS();
 	
+#if SPI_DMA
+	if (size >= SPI_DMA_MIN_LENGTH)
+	{
+		dma_read(data, size);
+		DEASSERT_CS();
+		
+		return size;
+	}
+#endif
+	
 	long i = 0;
 	unsigned char *data_to_send = tSpiReadHeader;
 
@@ -181,6 +311,15 @@ int spi_Write(Fd_t fd, unsigned char *data, int len)
 	SPIC.STATUS;
 	SPIC.DATA;
 	while (SPIC.STATUS & SPI_IF_bm);
+	
+#if SPI_DMA
+	if (size >= SPI_DMA_MIN_LENGTH)
+	{
+		dma_write(data, size);
+		size = 0;
+	}
+#endif
+	
 	while (size) {
 		SPIC.DATA = *data;
 		while (!(SPIC.STATUS & SPI_IF_bm));
@@ -192,8 +331,6 @@ int spi_Write(Fd_t fd, unsigned char *data, int len)
 	
 	DEASSERT_CS();
 	
-	_delay_ms(10);
-	
 	return len;
 }
 
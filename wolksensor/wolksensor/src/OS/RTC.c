@@ -12,14 +12,21 @@
 #include "RTC.h"
 #include "event_buffer.h"
 #include "logger.h"
+#include "software_timer.h"
 #include "test.h"
 
+#define RTC_TICKS_PER_MINUTE 30720
+
 static void (*minute_expired_listener)(void) = NULL;
 
 bool RTC_interruptEvent=true;
 
 static uint32_t RTC_Minutes __attribute__ ((section (".noinit1")));
 
+/* alarm beyond current minute is set on overflow */
+static uint32_t alarm_ticks = 0;
+static bool alarm_after_overflow = false;
+
 void RTC_init(bool cold_boot) {
 	register8_t saved_sreg = SREG;
 	cli();
@@ -50,6 +57,78 @@ uint32_t rtc_get(void)
 	return tmp;
 }
 
+/* called with interrupts disabled */
+static uint32_t read_minutes(uint16_t* count)
+{
+	uint32_t minutes = RTC_Minutes;
+	*count = RTC.CNT;
+	
+	/* overflow interrupt is pending when called from interrupt */
+	if((RTC.INTFLAGS & RTC_OVFIF_bm) && (*count < RTC_TICKS_PER_MINUTE / 2))
+	{
+		minutes++;
+	}
+	
+	return minutes;
+}
+
+uint32_t rtc_get_ticks(void)
+{
+	register8_t saved_sreg = SREG;
+	cli();
+	uint16_t count;
+	uint32_t ticks = read_minutes(&count) * RTC_TICKS_PER_MINUTE + count;
+	SREG = saved_sreg;
+	
+	return ticks;
+}
+
+void rtc_set_alarm(uint32_t ticks)
+{
+	register8_t saved_sreg = SREG;
+	cli();
+	
+	uint16_t count;
+	uint32_t minute_start = read_minutes(&count) * RTC_TICKS_PER_MINUTE;
+	uint32_t now = minute_start + count;
+	
+	/* compare is not matched if counter passes it before new value is synchronized */
+	if((int32_t)(ticks - now) < 2)
+	{
+		ticks = now + 2;
+	}
+	
+	uint32_t compare = ticks - minute_start;
+	alarm_after_overflow = compare >= RTC_TICKS_PER_MINUTE;
+	alarm_ticks = ticks;
+	
+	if(alarm_after_overflow)
+	{
+		RTC.INTCTRL &= ~RTC_COMPINTLVL_gm;
+	}
+	else
+	{
+		while (RTC.STATUS & RTC_SYNCBUSY_bm) {}
+		RTC.COMP = compare;
+		while (RTC.STATUS & RTC_SYNCBUSY_bm) {}
+		
+		/* low level, timer callbacks may wait for medium level TWI interrupts */
+		RTC.INTFLAGS = RTC_COMPIF_bm;
+		RTC.INTCTRL = (RTC.INTCTRL & ~RTC_COMPINTLVL_gm) | RTC_COMPINTLVL_LO_gc;
+	}
+	
+	SREG = saved_sreg;
+}
+
+void rtc_clear_alarm(void)
+{
+	register8_t saved_sreg = SREG;
+	cli();
+	alarm_after_overflow = false;
+	RTC.INTCTRL &= ~RTC_COMPINTLVL_gm;
+	SREG = saved_sreg;
+}
+
 bool RTC_interruptStatus(void)
 {
 	return RTC_interruptEvent;
@@ -71,5 +150,15 @@ ISR(RTC_OVF_vect)
 	
 	RTC_interruptEvent = true;
 	RTC_Minutes++;
+	
+	if(alarm_after_overflow)
+	{
+		rtc_set_alarm(alarm_ticks);
+	}
+}
+
+ISR(RTC_COMP_vect)
+{
+	software_timer_expired();
 }
 
@@ -7,5 +7,10 @@
 void RTC_init(bool cold_boot);
 void add_minute_expired_listener(void (*)(void));
 uint32_t rtc_get(void);
+uint32_t rtc_get_ticks(void); /* 512 ticks per second */
+void rtc_set_alarm(uint32_t ticks);
+void rtc_clear_alarm(void);
+
+#define RTC_TICKS_PER_SECOND 512
 
 #endif /* RTC_H_ */
\ No newline at end of file
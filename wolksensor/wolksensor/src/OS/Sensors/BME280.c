@@ -15,19 +15,44 @@
 #include "clock.h"
 #include "test.h"
 #include "logger.h"
+#include "twi_queue.h"
+#include "software_timer.h"
 
 #include "Sensors/BME280_Defs.h"
+#include "Sensors/BME280_Compensation.h"
 #include "Sensors/BME280.h"
 #include "config/conf_os.h"
 
 char tmp_data[20];
-bme280_calibration_param cal_param;
-long adc_t, adc_p, adc_h, t_fine;
 
 long Pressure;
 unsigned long Temperature;
 unsigned int Humidity;
 
+#define BME280_MEASUREMENT_TIME 10 // ms, 9.3 ms max for 1x oversampling of all values
+#define BME280_STATUS_POLL_TIME 2 // ms
+#define BME280_MAX_STATUS_POLLS 5
+
+typedef enum
+{
+	MEASUREMENT_IDLE = 0,
+	MEASUREMENT_STARTING,
+	MEASUREMENT_CONVERTING,
+	MEASUREMENT_READING_STATUS,
+	MEASUREMENT_READING_DATA
+}
+measurement_state_t;
+
+static volatile measurement_state_t measurement_state = MEASUREMENT_IDLE;
+static void (*measurement_done)(bool success) = NULL;
+static uint8_t status_polls;
+
+static twi_transaction_t measurement_transaction;
+static uint8_t measurement_write_data[4];
+static uint8_t measurement_read_data[BME280_DATA_FRAME_SIZE];
+
+static software_timer_t measurement_timer;
+
 
 static void I2C_WriteRegister(char wrAddr, char wrData) {
 	tmp_data[0] = wrAddr;
@@ -54,6 +79,19 @@ static char I2C_ReadRegister(char rAddr) {
 }
 
 
+static void store_measurements(volatile uint8_t* data) {
+	adc_h = data[BME280_DATA_FRAME_HUMIDITY_LSB_BYTE];
+	adc_h |= (unsigned long)data[BME280_DATA_FRAME_HUMIDITY_MSB_BYTE] << 8;
+
+	adc_t  = (unsigned long)data[BME280_DATA_FRAME_TEMPERATURE_XLSB_BYTE] >> 4;
+	adc_t |= (unsigned long)data[BME280_DATA_FRAME_TEMPERATURE_LSB_BYTE] << 4;
+	adc_t |= (unsigned long)data[BME280_DATA_FRAME_TEMPERATURE_MSB_BYTE] << 12;
+
+	adc_p  = (unsigned long)data[BME280_DATA_FRAME_PRESSURE_XLSB_BYTE] >> 4;
+	adc_p |= (unsigned long)data[BME280_DATA_FRAME_PRESSURE_LSB_BYTE] << 4;
+	adc_p |= (unsigned long)data[BME280_DATA_FRAME_PRESSURE_MSB_BYTE] << 12;
+}
+
 void BME280_ReadMeasurements() {
 	tmp_data[0] = BME280_PRESSURE_MSB_REG;
 	bool  timeout=false;
@@ -63,16 +101,7 @@ void BME280_ReadMeasurements() {
 	while ((sensor_twi.status != TWIM_STATUS_READY) && !timeout) {timeout=read_auxTimeout();}
 	if(timeout || (sensor_twi.result != TWIM_RESULT_OK)) return;
 	
-	adc_h = sensor_twi.readData[BME280_DATA_FRAME_HUMIDITY_LSB_BYTE];
-	adc_h |= (unsigned long)sensor_twi.readData[BME280_DATA_FRAME_HUMIDITY_MSB_BYTE] << 8;
-
-	adc_t  = (unsigned long)sensor_twi.readData[BME280_DATA_FRAME_TEMPERATURE_XLSB_BYTE] >> 4;
-	adc_t |= (unsigned long)sensor_twi.readData[BME280_DATA_FRAME_TEMPERATURE_LSB_BYTE] << 4;
-	adc_t |= (unsigned long)sensor_twi.readData[BME280_DATA_FRAME_TEMPERATURE_MSB_BYTE] << 12;
-
-	adc_p  = (unsigned long)sensor_twi.readData[BME280_DATA_FRAME_PRESSURE_XLSB_BYTE] >> 4;
-	adc_p |= (unsigned long)sensor_twi.readData[BME280_DATA_FRAME_PRESSURE_LSB_BYTE] << 4;
-	adc_p |= (unsigned long)sensor_twi.readData[BME280_DATA_FRAME_PRESSURE_MSB_BYTE] << 12;
+	store_measurements(sensor_twi.readData);
 }
 
 
@@ -253,89 +282,118 @@ char BME280_IsMeasuring() {
 	return (output & BME280_STAT_REG_MEASURING__MSK);
 }
 
-/****************************************************************************************************/
-/* Returns temperature in DegC, resolution is 0.01 DegC. Output value of 5123 equals 51.23 DegC.  */
-/***************************************************************************************************/
-static long BME280_Compensate_T() {
-	long temp1, temp2, T;
-
-	temp1 = ((((adc_t>>3) -((long)cal_param.dig_T1<<1))) * ((long)cal_param.dig_T2)) >> 11;
-	temp2 = (((((adc_t>>4) - ((long)cal_param.dig_T1)) * ((adc_t>>4) - ((long)cal_param.dig_T1))) >> 12) * ((long)cal_param.dig_T3)) >> 14;
-	t_fine = temp1 + temp2;
-	T = (t_fine * 5 + 128) >> 8;
-	return T;
-}
 
-/************************************************************************************************************/
-/* Returns humidity in %RH as unsigned 32 bit integer in Q22.10 format (22 integer and 10 fractional bits). */
-/* Output value of 47445 represents 47445/1024 = 46.333 %RH */
-/************************************************************************************************************/
-static unsigned long BME280_Compensate_H() {
-	long h1;
-	h1 = (t_fine - ((long)76800));
-	h1 = (((((adc_h << 14) - (((long)cal_param.dig_H4) << 20) - (((long)cal_param.dig_H5) * h1)) +
-	((long)16384)) >> 15) * (((((((h1 * ((long)cal_param.dig_H6)) >> 10) * (((h1 *
-	((long)cal_param.dig_H3)) >> 11) + ((long)32768))) >> 10) + ((long)2097152)) *
-	((long)cal_param.dig_H2) + 8192) >> 14));
-	h1 = (h1 - (((((h1 >> 15) * (h1 >> 15)) >> 7) * ((long)cal_param.dig_H1)) >> 4));
-	h1 = (h1 < 0 ? 0 : h1);
-	h1 = (h1 > 419430400 ? 419430400 : h1);
-	return (unsigned long)(h1>>12);
+
+/*
+* Forced measurement runs as state machine driven by TWI queue and software timer callbacks,
+* so MCU sleeps while sensor converts. measurement_done is called from interrupt context.
+*/
+static void finish_measurement(bool success)
+{
+	measurement_state = MEASUREMENT_IDLE;
+	
+	if(measurement_done) measurement_done(success);
 }
 
-/***********************************************************************************************************/
-/* Returns pressure in Pa as unsigned 32 bit integer. Output value of 96386 equals 96386 Pa = 963.86 hPa */
-/***********************************************************************************************************/
-
-static unsigned long BME280_Compensate_P() {
-	long press1, press2;
-	unsigned long P;
-	
-	press1 = (((long)t_fine)>>1) - (long)64000;
-	press2 = (((press1>>2) * (press1>>2)) >> 11 ) * ((long)cal_param.dig_P6);
-	press2 = press2 + ((press1*((long)cal_param.dig_P5))<<1);
-	press2 = (press2>>2)+(((long)cal_param.dig_P4)<<16);
-	press1 = (((cal_param.dig_P3 * (((press1>>2) * (press1>>2)) >> 13 )) >> 3) + ((((long)cal_param.dig_P2) * press1)>>1))>>18;
-	press1 =((((32768+press1))*((long)cal_param.dig_P1))>>15);
-	if (press1 == 0) {
-		return 0; // avoid exception caused by division by zero
-	}
-	P = (((unsigned long)(((long)1048576)-adc_p)-(press2>>12)))*3125;
-	if (P < 0x80000000) {
-		P = (P << 1) / ((unsigned long)press1);
-		} else {
-		P = (P / (unsigned long)press1) * 2;
+static void queue_measurement_transaction(uint8_t bytes_to_write, uint8_t bytes_to_read)
+{
+	measurement_transaction.address = BME280_I2C_ADDRESS1;
+	measurement_transaction.bytes_to_write = bytes_to_write;
+	measurement_transaction.bytes_to_read = bytes_to_read;
+	
+	if(!twi_queue_add(&measurement_transaction))
+	{
+		finish_measurement(false);
 	}
-	press1 = (((long)cal_param.dig_P9) * ((long)(((P>>3) * (P>>3))>>13)))>>12;
-	press2 = (((long)(P>>2)) * ((long)cal_param.dig_P8))>>13;
-	P = (unsigned long)((long)P + ((press1 + press2 + cal_param.dig_P7) >> 4));
-	return P;
 }
 
-
-float BME280_GetTemperature() {
-	return (float)BME280_Compensate_T() / 100;
+static void read_status(void* argument)
+{
+	measurement_state = MEASUREMENT_READING_STATUS;
+	
+	measurement_write_data[0] = BME280_STAT_REG;
+	queue_measurement_transaction(1, 1);
 }
 
-float BME280_GetHumidity() {
-	return (float)BME280_Compensate_H() / 1024;
+static void measurement_transaction_done(twi_transaction_t* transaction)
+{
+	if(transaction->result != TWIM_RESULT_OK)
+	{
+		LOG_PRINT(1, PSTR("BME280 transaction failed %u\r\n"), transaction->result);
+		finish_measurement(false);
+		return;
+	}
+	
+	switch(measurement_state)
+	{
+		case MEASUREMENT_STARTING:
+		{
+			measurement_state = MEASUREMENT_CONVERTING;
+			status_polls = 0;
+			software_timer_start(&measurement_timer, read_status, NULL, BME280_MEASUREMENT_TIME, 0);
+			break;
+		}
+		case MEASUREMENT_READING_STATUS:
+		{
+			if(measurement_read_data[0] & BME280_STAT_REG_MEASURING__MSK)
+			{
+				if(++status_polls > BME280_MAX_STATUS_POLLS)
+				{
+					LOG(1, "BME280 measurement timeout");
+					finish_measurement(false);
+					break;
+				}
+				
+				measurement_state = MEASUREMENT_CONVERTING;
+				software_timer_start(&measurement_timer, read_status, NULL, BME280_STATUS_POLL_TIME, 0);
+				break;
+			}
+			
+			measurement_state = MEASUREMENT_READING_DATA;
+			measurement_write_data[0] = BME280_PRESSURE_MSB_REG;
+			queue_measurement_transaction(1, BME280_DATA_FRAME_SIZE);
+			break;
+		}
+		case MEASUREMENT_READING_DATA:
+		{
+			store_measurements(measurement_read_data);
+			finish_measurement(true);
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
 }
 
-float BME280_GetPressure() {
-	return (float) BME280_Compensate_P() / 100;
+bool BME280_start_measurement(void (*done)(bool success))
+{
+	if(measurement_state != MEASUREMENT_IDLE)
+	{
+		return false;
+	}
+	
+	measurement_state = MEASUREMENT_STARTING;
+	measurement_done = done;
+	
+	measurement_transaction.write_data = measurement_write_data;
+	measurement_transaction.read_data = measurement_read_data;
+	measurement_transaction.callback = measurement_transaction_done;
+	
+	// humidity settings take effect after ctrl_meas write, both are written in one transaction
+	measurement_write_data[0] = BME280_CTRL_HUMIDITY_REG;
+	measurement_write_data[1] = BME280_OVERSAMP_1X;
+	measurement_write_data[2] = BME280_CTRL_MEAS_REG;
+	measurement_write_data[3] = (BME280_OVERSAMP_1X << BME280_CTRL_MEAS_REG_OVERSAMP_TEMPERATURE__POS) | (BME280_OVERSAMP_1X << BME280_CTRL_MEAS_REG_OVERSAMP_PRESSURE__POS) | BME280_FORCED_MODE;
+	queue_measurement_transaction(4, 0);
+	
+	return true;
 }
 
-
-void BME280_poll()
+bool BME280_measuring(void)
 {
-	BME280_SetOversamplingPressure(BME280_OVERSAMP_1X);                          // Pressure x16 oversampling
-	BME280_SetOversamplingTemperature(BME280_OVERSAMP_1X);                        // Temperature x2 oversampling
-	BME280_SetOversamplingHumidity(BME280_OVERSAMP_1X);                           // Humidity x1 oversampling
-	BME280_SetOversamplingMode(BME280_FORCED_MODE);
-	_delay_ms(50);
-	
-	while(BME280_IsMeasuring());
-	BME280_ReadMeasurements();
+	return measurement_state != MEASUREMENT_IDLE;
 }
 
 bool BME280_init() {
@@ -17,10 +17,11 @@ void BME280_SetOversamplingMode(char Value);
 void BME280_SetFilterCoefficient(char Value);
 void BME280_SetStandbyTime(char Value);
 char BME280_IsMeasuring();
-float BME280_GetTemperature();
-float BME280_GetHumidity();
-float BME280_GetPressure();
+void BME280_GetReadings(int16_t* temperature, int16_t* humidity, int16_t* pressure);
 bool BME280_init();
-void BME280_poll();
+
+/* starts forced measurement, done is called from interrupt when readings are stored or measurement failed */
+bool BME280_start_measurement(void (*done)(bool success));
+bool BME280_measuring(void);
 
 #endif /* BME280_H_ */`
\ No newline at end of file
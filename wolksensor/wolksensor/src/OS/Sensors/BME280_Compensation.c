@@ -0,0 +1,86 @@
+/*
+* Compensation of BME280 raw readings, kept free of hardware dependencies
+* so it can be checked on host (see tools/bme280_readings_test.c).
+*/
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "Sensors/BME280_Defs.h"
+#include "Sensors/BME280_Compensation.h"
+#include "Sensors/BME280.h"
+
+bme280_calibration_param cal_param;
+long adc_t, adc_p, adc_h, t_fine;
+
+/****************************************************************************************************/
+/* Returns temperature in DegC, resolution is 0.01 DegC. Output value of 5123 equals 51.23 DegC.  */
+/***************************************************************************************************/
+static long BME280_Compensate_T() {
+	long temp1, temp2, T;
+
+	temp1 = ((((adc_t>>3) -((long)cal_param.dig_T1<<1))) * ((long)cal_param.dig_T2)) >> 11;
+	temp2 = (((((adc_t>>4) - ((long)cal_param.dig_T1)) * ((adc_t>>4) - ((long)cal_param.dig_T1))) >> 12) * ((long)cal_param.dig_T3)) >> 14;
+	t_fine = temp1 + temp2;
+	T = (t_fine * 5 + 128) >> 8;
+	return T;
+}
+
+/************************************************************************************************************/
+/* Returns humidity in %RH as unsigned 32 bit integer in Q22.10 format (22 integer and 10 fractional bits). */
+/* Output value of 47445 represents 47445/1024 = 46.333 %RH */
+/************************************************************************************************************/
+static unsigned long BME280_Compensate_H() {
+	long h1;
+	h1 = (t_fine - ((long)76800));
+	h1 = (((((adc_h << 14) - (((long)cal_param.dig_H4) << 20) - (((long)cal_param.dig_H5) * h1)) +
+	((long)16384)) >> 15) * (((((((h1 * ((long)cal_param.dig_H6)) >> 10) * (((h1 *
+	((long)cal_param.dig_H3)) >> 11) + ((long)32768))) >> 10) + ((long)2097152)) *
+	((long)cal_param.dig_H2) + 8192) >> 14));
+	h1 = (h1 - (((((h1 >> 15) * (h1 >> 15)) >> 7) * ((long)cal_param.dig_H1)) >> 4));
+	h1 = (h1 < 0 ? 0 : h1);
+	h1 = (h1 > 419430400 ? 419430400 : h1);
+	return (unsigned long)(h1>>12);
+}
+
+/***********************************************************************************************************/
+/* Returns pressure in Pa as unsigned 32 bit integer. Output value of 96386 equals 96386 Pa = 963.86 hPa */
+/***********************************************************************************************************/
+
+static unsigned long BME280_Compensate_P() {
+	long press1, press2;
+	unsigned long P;
+	
+	press1 = (((long)t_fine)>>1) - (long)64000;
+	press2 = (((press1>>2) * (press1>>2)) >> 11 ) * ((long)cal_param.dig_P6);
+	press2 = press2 + ((press1*((long)cal_param.dig_P5))<<1);
+	press2 = (press2>>2)+(((long)cal_param.dig_P4)<<16);
+	press1 = (((cal_param.dig_P3 * (((press1>>2) * (press1>>2)) >> 13 )) >> 3) + ((((long)cal_param.dig_P2) * press1)>>1))>>18;
+	press1 =((((32768+press1))*((long)cal_param.dig_P1))>>15);
+	if (press1 == 0) {
+		return 0; // avoid exception caused by division by zero
+	}
+	P = (((unsigned long)(((long)1048576)-adc_p)-(press2>>12)))*3125;
+	if (P < 0x80000000) {
+		P = (P << 1) / ((unsigned long)press1);
+		} else {
+		P = (P / (unsigned long)press1) * 2;
+	}
+	press1 = (((long)cal_param.dig_P9) * ((long)(((P>>3) * (P>>3))>>13)))>>12;
+	press2 = (((long)(P>>2)) * ((long)cal_param.dig_P8))>>13;
+	P = (unsigned long)((long)P + ((press1 + press2 + cal_param.dig_P7) >> 4));
+	return P;
+}
+
+
+/*
+* Compensates all values of last burst read, temperature first as pressure and humidity depend on its t_fine.
+* Values are in tenths of DegC, %RH and hPa, rounded to nearest.
+*/
+void BME280_GetReadings(int16_t* temperature, int16_t* humidity, int16_t* pressure) {
+	long T = BME280_Compensate_T();
+	*temperature = (T + (T < 0 ? -5 : 5)) / 10;
+	
+	*humidity = (BME280_Compensate_H() * 10 + 512) >> 10;
+	
+	*pressure = (BME280_Compensate_P() + 5) / 10;
+}
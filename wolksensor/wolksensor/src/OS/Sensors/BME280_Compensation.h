@@ -0,0 +1,8 @@
+#ifndef BME280_COMPENSATION_H_
+#define BME280_COMPENSATION_H_
+
+/* calibration and raw readings of last burst read, filled by BME280.c */
+extern bme280_calibration_param cal_param;
+extern long adc_t, adc_p, adc_h, t_fine;
+
+#endif /* BME280_COMPENSATION_H_ */
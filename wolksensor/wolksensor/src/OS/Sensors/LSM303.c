@@ -21,22 +21,61 @@
 #include "config/conf_os.h"
 
 #include "event_buffer.h"
+#include "software_timer.h"
+#include "twi_queue.h"
 
 #define MOVEMENT_SENSOR_DISABLED_TIME 2000 // ms
 
-static volatile uint16_t movement_sensor_disabled_timeout = 0;
+static software_timer_t movement_sensor_disabled_timer;
 
 static bool sensor_detected = false;
 static bool sensor_ready = false;
 
 static uint8_t twi_buff[8];
 
+/* run time accesses are queued, so they are safe from interrupts and do not wait for bus */
+static twi_transaction_t poll_transaction;
+static uint8_t poll_write_data[1] = {0x80 + 0x31};		// INT1_SRC_A, reading clears latched interrupt
+static uint8_t poll_read_data[1];
+
+static twi_transaction_t disable_transaction;
+static uint8_t disable_write_data[2] = {0x80 + 0x20, 0b00000000};		// REG1, power down
+
+static twi_transaction_t enable_transaction;
+static uint8_t enable_write_data[2] = {0x80 + 0x20, 0b01010111};		// REG1, 100Hz, enable XYZ
+
 static volatile int	compass_X;
 static volatile int	compass_Y;
 static volatile int	compass_Z;
 
 void (*sensors_states_listener)(sensor_state_t* sensors_states, uint8_t sensors_count) = NULL;
 
+static void init_transaction(twi_transaction_t* transaction, uint8_t* write_data, uint8_t bytes_to_write, uint8_t* read_data, uint8_t bytes_to_read, void (*callback)(twi_transaction_t* transaction))
+{
+	transaction->address = 0x19;
+	transaction->write_data = write_data;
+	transaction->bytes_to_write = bytes_to_write;
+	transaction->read_data = read_data;
+	transaction->bytes_to_read = bytes_to_read;
+	transaction->callback = callback;
+}
+
+static void poll_done(twi_transaction_t* transaction)
+{
+	if(transaction->result != TWIM_RESULT_OK) return;
+	LOG(1,"LSM303 ready");
+	
+	sensor_ready = true;
+}
+
+static void control_done(twi_transaction_t* transaction)
+{
+	if(transaction->result != TWIM_RESULT_OK)
+	{
+		LOG_PRINT(1, PSTR("LSM303 control failed %u\r\n"), transaction->result);
+	}
+}
+
 bool LSM303_init(void) {
 	bool  timeout=false;
 	start_auxTimeout(10);
@@ -72,6 +111,10 @@ bool LSM303_init(void) {
 	if(timeout || (sensor_twi.result != TWIM_RESULT_OK)) return false;
 
 	sensor_detected = true;
+	
+	init_transaction(&poll_transaction, poll_write_data, sizeof(poll_write_data), poll_read_data, sizeof(poll_read_data), poll_done);
+	init_transaction(&disable_transaction, disable_write_data, sizeof(disable_write_data), NULL, 0, control_done);
+	init_transaction(&enable_transaction, enable_write_data, sizeof(enable_write_data), NULL, 0, control_done);
 
 	// enable external rising edge interrupt for LSM303
 	PORTB.DIR &= 0b11111011;
@@ -96,21 +139,14 @@ void LSM303_poll(void)
 		return;
 	}
 	
-	bool  timeout=false;
-	start_auxTimeout(10);
-	while ((sensor_twi.status != TWIM_STATUS_READY) && !timeout) {timeout=read_auxTimeout();}
-	if(timeout) return;
-	
-	LOG(2,"LSM poll 1");
+	twi_queue_add(&poll_transaction);
+}
 
-	twi_buff[0] = 0x80 + 0x31;
-	TWI_MasterWriteRead(&sensor_twi, 0x19, twi_buff, 1, 1);
-	start_auxTimeout(10);
-	while ((sensor_twi.status != TWIM_STATUS_READY) && !timeout) {timeout=read_auxTimeout();}
-	if(timeout || (sensor_twi.result != TWIM_RESULT_OK)) return;
-	LOG(1,"LSM303 ready");
+static void movement_sensor_disabled_timer_expired(void* argument)
+{
+	LOG(1, "Movement sensor enable");
 	
-	sensor_ready = true;
+	movement_sensor_enable();
 }
 
 ISR(PORTB_INT0_vect) 
@@ -122,7 +158,7 @@ ISR(PORTB_INT0_vect)
 		
 		movement_sensor_disable();
 		
-		movement_sensor_disabled_timeout = MOVEMENT_SENSOR_DISABLED_TIME;
+		software_timer_start(&movement_sensor_disabled_timer, movement_sensor_disabled_timer_expired, NULL, MOVEMENT_SENSOR_DISABLED_TIME, 0);
 		
 		if(movement_status)
 		{
@@ -145,54 +181,24 @@ void movement_sensor_enable(void)
 	LSM303_poll();
 }
 
-void movement_sensor_milisecond_listener(void)
-{
-	if(movement_sensor_disabled_timeout)
-	{
-		if((--movement_sensor_disabled_timeout == 0))
-		{
-			LOG(1, "Movement sensor enable");
-			
-			movement_sensor_enable();
-		}
-	}
-}
-
 void add_sensors_states_listener(void (*listener)(sensor_state_t* sensors_states, uint8_t sensors_count))
 {
 	sensors_states_listener = listener;
 }
 
-bool waiting_movement_sensor_enable_timeout(void)
-{
-	return movement_status && (movement_sensor_disabled_timeout > 0);
-}
-
 
 void disable_movement(void)
 {
-	bool  timeout=false;
-	
-	start_auxTimeout(10);
-	while ((sensor_twi.status != TWIM_STATUS_READY) && !timeout) {timeout=read_auxTimeout();}
-	if(timeout) return false;
+	if (!sensor_detected) return;
 	
 	LOG(1,"Disable movement sensor");
-	twi_buff[0] = 0x80 + 0x20;
-	twi_buff[1] = 0b00000000;	
-	TWI_MasterWriteRead(&sensor_twi, 0x19, twi_buff, 2, 0);
+	twi_queue_add(&disable_transaction);
 }
 
 void enable_movement(void)
 {
-	bool  timeout=false;
-	
-	start_auxTimeout(10);
-	while ((sensor_twi.status != TWIM_STATUS_READY) && !timeout) {timeout=read_auxTimeout();}
-	if(timeout) return false;
+	if (!sensor_detected) return;
 	
 	LOG(1,"Enable movement sensor");
-	twi_buff[0] = 0x80 + 0x20;
-	twi_buff[1] = 0b01010111;	
-	TWI_MasterWriteRead(&sensor_twi, 0x19, twi_buff, 2, 0);
+	twi_queue_add(&enable_transaction);
 }
\ No newline at end of file
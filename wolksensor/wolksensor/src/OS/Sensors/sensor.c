@@ -6,6 +6,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "sensor.h"
 #include "sensors.h"
@@ -17,12 +18,26 @@
 #include "sensor_readings_buffer.h"
 #include "logger.h"
 #include "platform_specific.h"
+#include "twi_queue.h"
 
 
 TWI_Master_t sensor_twi;    /*!< TWI master module. */
 
+static char acquired_sensors_ids[NUMBER_OF_SENSORS];
+static uint8_t acquired_sensors_count = 0;
+
+static volatile bool acquisition_done = false;
+static volatile bool acquisition_success = false;
+
+static void (*sensors_acquisition_done_listener)(void) = NULL;
+
+static int16_t pressure;
+static int16_t temperature;
+static int16_t humidity;
+
 ISR(TWIC_TWIM_vect) {
 	TWI_MasterInterruptHandler(&sensor_twi);
+	twi_queue_interrupt_handler();
 }
 
 void init_sensors(void)
@@ -35,6 +50,7 @@ void init_sensors(void)
 	/* enable power for TWIC */
 	PR.PRPC &= ~PR_TWI_bm;
 	TWI_MasterInit(&sensor_twi, &TWIC, TWI_MASTER_INTLVL_MED_gc, TWI_MasterBaud(CLK_24MHZ));
+	twi_queue_init(&sensor_twi);
 
 	SREG = saved_sreg;
 	
@@ -45,35 +61,73 @@ void init_sensors(void)
 
 static bool get_pressure(int16_t *value)
 {	
-	*value = BME280_GetPressure()*10;
+	if(!acquisition_success) return false;
+	
+	*value = pressure;
 		
 	return true;
 }
 
 static bool get_temperature(int16_t *value)
 {	
-	*value = BME280_GetTemperature()*10;
+	if(!acquisition_success) return false;
+	
+	*value = temperature;
 	
 	return true;
 }
 
 static bool get_humidity(int16_t *value)
 {
-	*value = BME280_GetHumidity()*10;
+	if(!acquisition_success) return false;
+	
+	*value = humidity;
 	
 	return true;
 }
 
+static void measurement_done(bool success)
+{
+	acquisition_success = success;
+	acquisition_done = true;
+}
+
+/*
+* Starts acquisition, sensor states and acquisition done are reported from sensors_process.
+*/
 bool get_sensors_states(char* sensors_ids, uint8_t sensors_count)
 {
 	LOG(1, "Getting sensor values");
 	
-	sensor_twi.interface->MASTER.BAUD = TWI_MasterBaud(CLK_24MHZ);
+	if(BME280_measuring() || acquisition_done)
+	{
+		LOG(1, "Acquisition in progress");
+		return false;
+	}
+	
+	acquired_sensors_count = sensors_count < NUMBER_OF_SENSORS ? sensors_count : NUMBER_OF_SENSORS;
+	memcpy(acquired_sensors_ids, sensors_ids, acquired_sensors_count);
+	
+	// baud rate must not change during movement sensor transfer
+	if(!twi_queue_busy()) sensor_twi.interface->MASTER.BAUD = TWI_MasterBaud(CLK_24MHZ);
+	
+	return BME280_start_measurement(measurement_done);
+}
 
-	BME280_poll();
+static void report_sensors_states(void)
+{
+	if(acquisition_success)
+	{
+		BME280_GetReadings(&temperature, &humidity, &pressure);
+	}
+	else
+	{
+		LOG(1, "Sensors measurement failed");
+	}
+	
+	char* sensors_ids = acquired_sensors_ids;
+	uint8_t sensors_count = acquired_sensors_count;
 	
-	while (sensor_twi.status != TWIM_STATUS_READY) {}
-		
 	sensor_state_t atmo_sensors_states[NUMBER_OF_SENSORS];
 	
 	for(uint8_t i = 0; i < sensors_count; i++)
@@ -119,6 +173,30 @@ bool get_sensors_states(char* sensors_ids, uint8_t sensors_count)
 	}
 	
 	if(sensors_states_listener) sensors_states_listener(atmo_sensors_states, sensors_count);
+}
+
+bool sensors_process(void)
+{
+	if(acquisition_done)
+	{
+		// compensation and listeners run in main context
+		report_sensors_states();
+		acquisition_done = false;
+		
+		if(sensors_acquisition_done_listener) sensors_acquisition_done_listener();
+		
+		return true;
+	}
 	
-	return true;
+	return twi_queue_busy();
+}
+
+bool sensors_busy(void)
+{
+	return acquisition_done || twi_queue_busy();
+}
+
+void add_sensors_acquisition_done_listener(void (*listener)(void))
+{
+	sensors_acquisition_done_listener = listener;
 }
@@ -8,6 +8,12 @@
 #include "twi.h"
 
 bool get_sensors_states(char* sensors_ids, uint8_t sensors_count);
+void add_sensors_acquisition_done_listener(void (*listener)(void));
+
+/* reports finished acquisition, true while there is sensor work left */
+bool sensors_process(void);
+/* true if MCU must not enter power save, sensor bus transfer is running or result is pending */
+bool sensors_busy(void);
 
 extern TWI_Master_t sensor_twi;
 	
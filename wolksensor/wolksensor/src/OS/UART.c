@@ -54,6 +54,7 @@ void uart_init(void) {
 	USARTD0.CTRLB = (USART_TXEN_bm | USART_CLK2X_bm | USART_RXEN_bm);
 	
 	circular_buffer_init(&uart_command_response_buffer, uart_command_response_buffer_storage, UART_COMMAND_RESPONSE_BUFFER_STORAGE_SIZE, sizeof(char), false, true);
+	circular_buffer_register(&uart_command_response_buffer, PSTR("USB_RESPONSES"));
 	
 #ifdef LOG_ENABLED
 	/*settings for DEBUG UART*/
@@ -70,6 +71,7 @@ void uart_init(void) {
 	USARTC0.CTRLB = (USART_TXEN_bm | USART_CLK2X_bm);
 	
 	circular_buffer_init(&log_buffer, log_buffer_storage, LOG_BUFFER_STORAGE_SIZE, sizeof(char), true, true);
+	circular_buffer_register(&log_buffer, PSTR("UART_LOG"));
 #endif
 
 	SREG = saved_sreg;
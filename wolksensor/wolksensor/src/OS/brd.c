@@ -9,6 +9,7 @@
 #include <avr/power.h>
 
 #include "brd.h"
+#include "logger.h"
 
 reset_reason_t reset_reason __attribute__ ((section (".noinit1")));
 
@@ -100,6 +101,9 @@ void brd_init(void) {
 
 void system_reset(void)
 {
+	// send buffered log records before they are lost
+	while(log_process());
+	
 	reset(RST_RELOAD);
 }
 
@@ -14,31 +14,15 @@
 #include "clock.h"
 #include "config/conf_os.h"
 #include "event_buffer.h"
-#include "Sensors/LSM303.h"
-
-#define TIMER_FREQ	375		// timer overflows on 1ms
+#include "software_timer.h"
 
 static speed_t sysSpeed = CLK_UNKNOWN;
 
 static void clock_speed(void);
 
-#define ONE_SECOND_PERIOD 1000
-
-static volatile uint16_t wifi_timeout = 0;
-static volatile uint16_t wifi_timeout_timer = 0;
-static volatile bool wifi_timeout_flag = false;
-
-static volatile uint16_t timer_auxTimeout;
-static volatile bool auxTimeout_flag=false;
-static volatile uint16_t timer_usbChangeStateTime=0;
+static uint32_t auxTimeout_deadline = 0;
 
-static volatile uint16_t oneSecondCount=0;
-
-typedef void (*second_expired_listener_t)(void);
-typedef void (*milisecond_expired_listener_t)(void);
-
-static second_expired_listener_t second_expired_listeners[3] = {NULL, NULL, NULL};
-static milisecond_expired_listener_t milisecond_expired_listeners[2] = {NULL, NULL};
+static software_timer_t usb_change_state_timer;
 
 void clock_init(void) {
 
@@ -92,27 +76,6 @@ void clock_init(void) {
 	/* enable RTC overflow interrupt */
 	RTC.INTCTRL=0b00000011;
 	
-	/* enable power for timer D0*/
-	PR.PRPD &= ~PR_TC0_bm;
-	
-	/* set timer D0 to count periph clk */
-	TCD0.CTRLA = 0b00000000;
-	TCD0.CTRLB = 0b00000000;
-	TCD0.CTRLD = 0b00000000;
-	TCD0.CTRLE = 0b00000000;
-	TCD0.INTCTRLA = 0b00000000;
-	TCD0.INTCTRLB = 0b00000000;
-	TCD0.CNT = 0;
-	TCD0.PER = 0xffff;
-	
-	/* Prescaler: Clk/64 */
-	TCD0.CTRLA = 0b00000101;
-	TCD0.INTCTRLB &= ~0b00110000;		// disable CCC interrupt
-	TCD0.CCC = TCD0.CNT + TIMER_FREQ;
-	TCD0.INTCTRLB |= 0b00010000;		// enable CCC interrupt
-
-
-	
 	/* restore interrupt state */
 	SREG = saved_sreg;
 }
@@ -142,114 +105,23 @@ speed_t clock_get(void) {
 	return sysSpeed;
 }
 
-void add_second_expired_listener(void (*listener)(void))
-{
-	if(second_expired_listeners[0] == NULL)
-	{
-		second_expired_listeners[0] = listener;
-	}
-	else if(second_expired_listeners[1] == NULL)
-	{
-		second_expired_listeners[1] = listener;
-	}
-	else if(second_expired_listeners[2] == NULL)
-	{
-		second_expired_listeners[2] = listener;
-	}
-}
-
-void add_milisecond_expired_listener(void (*listener)(void))
-{
-	if(milisecond_expired_listeners[0] == NULL)
-	{
-		milisecond_expired_listeners[0] = listener;
-	}
-	else
-	{
-		milisecond_expired_listeners[1] = listener;
-	}
-}
-
-void my_callback_os_timer(void)
-{
-	if(milisecond_expired_listeners[0]) milisecond_expired_listeners[0]();
-	if(milisecond_expired_listeners[1]) milisecond_expired_listeners[1]();
-	
-	movement_sensor_milisecond_listener();
-			
-	if (timer_usbChangeStateTime)
-	timer_usbChangeStateTime--;
-	
-	if(wifi_timeout)
-	{
-		if (wifi_timeout_timer >= wifi_timeout)
-		{
-			wifi_timeout_flag = true;
-		}
-		else
-		{
-			wifi_timeout_timer++;
-		}
-	}
-	else
-	{
-		wifi_timeout_flag = false;
-	}
-	
-	if (++oneSecondCount >= ONE_SECOND_PERIOD)
-	{		
-		if(second_expired_listeners[0]) second_expired_listeners[0]();
-		if(second_expired_listeners[1]) second_expired_listeners[1]();
-		oneSecondCount = 0;	
-	}
-	if (timer_auxTimeout)
-	{
-		if (--timer_auxTimeout == 0)
-		auxTimeout_flag = true;
-	}
-}
-
-ISR(TCD0_CCC_vect) {
-	TCD0.CCC = TCD0.CCC + TIMER_FREQ;		// 1 msec. interval
-	my_callback_os_timer();
-}
-
 void start_auxTimeout(uint16_t time)
 {
-	register8_t saved_sreg = SREG;
-	cli();
-	timer_auxTimeout = time;
-	auxTimeout_flag = false;
-	SREG = saved_sreg;
+	/* polled, so it also expires in interrupts that block RTC interrupts */
+	auxTimeout_deadline = rtc_get_ticks() + ((uint32_t)time * RTC_TICKS_PER_SECOND + 999) / 1000 + 1;
 }
 
 bool read_auxTimeout(void)
 {
-	return auxTimeout_flag;
+	return (int32_t)(rtc_get_ticks() - auxTimeout_deadline) >= 0;
 }
 
 void usb_change_state(uint16_t time)
 {
-	register8_t saved_sreg = SREG;
-	cli();
-	timer_usbChangeStateTime = time;
-	SREG = saved_sreg;
+	software_timer_start(&usb_change_state_timer, NULL, NULL, time, 0);
 }
 
-
 bool read_usb_change_state(void)
 {
-	return (timer_usbChangeStateTime != 0);
+	return software_timer_active(&usb_change_state_timer);
 }
-
-void schedule_wifi_timeout(uint16_t period)
-{
-	wifi_timeout = period;
-	wifi_timeout_timer = 0;
-	wifi_timeout_flag = false;
-}
-
-bool is_wifi_timeout(void)
-{
-	return wifi_timeout_flag;
-}
\ No newline at end of file
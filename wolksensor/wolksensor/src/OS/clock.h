@@ -10,10 +10,4 @@ bool read_usb_change_state(void);
 void start_auxTimeout(uint16_t time);
 bool read_auxTimeout(void);
 
-void schedule_wifi_timeout(uint16_t period);
-bool is_wifi_timeout(void);
-
-void add_milisecond_expired_listener(void (*listener)(void));
-void add_second_expired_listener(void (*listener)(void));
-
 #endif /* CLOCK_H_ */
\ No newline at end of file
@@ -33,25 +33,76 @@ static inline void nvm_issue_command(NVM_CMD_t nvm_command) {
 	NVM.CMD = old_cmd;
 }
 
+#define CONFIG_INDEX_SIZE 32 /* config types below this value are indexed, see config.h */
+#define CONFIG_PAGE_NONE 0xFF
+#define CONFIG_PAGES_COUNT ((EEPROM_SIZE-EEPROM_PAGE_SIZE) / EEPROM_PAGE_SIZE)
+
+// page of every config type, built in one pass over eeprom on first access and updated on write
+static uint8_t config_index[CONFIG_INDEX_SIZE];
+static bool config_index_built = false;
+
+// number of eeprom pages examined so far, for measuring config store cost during boot
+static uint16_t config_pages_scanned = 0;
+
+static inline uint8_t config_page_type(uint8_t page) {
+	return *(uint8_t *)(page * EEPROM_PAGE_SIZE + MAPPED_EEPROM_START);
+}
+
+static inline uint8_t config_page_version(uint8_t page) {
+	return *(uint8_t *)(page * EEPROM_PAGE_SIZE + MAPPED_EEPROM_START + 1);
+}
+
+// must be called with eeprom mapping enabled
+static void config_build_index(void) {
+	memset(config_index, CONFIG_PAGE_NONE, sizeof(config_index));
+	uint8_t page = 0;
+	for (; page < CONFIG_PAGES_COUNT; page++) {
+		config_pages_scanned++;
+		uint8_t type = config_page_type(page);
+		if ((type < CONFIG_INDEX_SIZE) && (config_index[type] == CONFIG_PAGE_NONE))
+			config_index[type] = page;
+	}
+	config_index_built = true;
+}
+
+// must be called with eeprom mapping enabled, returns CONFIG_PAGE_NONE if there is no page of given type
+static uint8_t config_find_page(uint8_t type) {
+	if (!config_index_built)
+		config_build_index();
+	if (type < CONFIG_INDEX_SIZE)
+		return config_index[type];
+	uint8_t page = 0;
+	for (; page < CONFIG_PAGES_COUNT; page++) {
+		config_pages_scanned++;
+		if (config_page_type(page) == type)
+			return page;
+	}
+	return CONFIG_PAGE_NONE;
+}
+
+// must be called with eeprom mapping enabled
+static uint8_t config_find_empty_page(void) {
+	uint8_t page = 0;
+	for (; page < CONFIG_PAGES_COUNT; page++) {
+		config_pages_scanned++;
+		if (config_page_type(page) == CFG_EMPTY)
+			return page;
+	}
+	return CONFIG_PAGE_NONE;
+}
+
 // data is stored in chunks of 32 bytes, first byte is the field type and second is version of the field
 static bool config_read_eeprom(void *data, uint8_t type, uint8_t version, uint8_t length) {
 	if (length > (EEPROM_PAGE_SIZE - 2))
 		return false;
 	nvm_wait_until_ready();
 	eeprom_enable_mapping();
-	uint16_t addr = 0;
-	// go through all fields in eeprom until we find one with the matching type and version
-	for (; addr < (EEPROM_SIZE-EEPROM_PAGE_SIZE); addr += EEPROM_PAGE_SIZE) {
-		if ((*(uint8_t *)(addr + MAPPED_EEPROM_START) == type) && 
-		    (*(uint8_t *)(addr + MAPPED_EEPROM_START + 1) == version)) {
-			memcpy(data, (void*)(addr + MAPPED_EEPROM_START + 2), length);
-			break;
-		}
-	}
+	uint8_t page = config_find_page(type);
+	bool found = (page != CONFIG_PAGE_NONE) && (config_page_version(page) == version);
+	if (found)
+		memcpy(data, (void*)(page * EEPROM_PAGE_SIZE + MAPPED_EEPROM_START + 2), length);
 	eeprom_disable_mapping();
-	if (addr == (EEPROM_SIZE-EEPROM_PAGE_SIZE))
-		return false;
-	return true;
+	return found;
 }
 
 
@@ -60,23 +111,17 @@ bool config_write_eeprom(void *data, uint8_t type, uint8_t version, uint8_t leng
 		return false;
 	nvm_wait_until_ready();
 	eeprom_enable_mapping();
-	int empty = -1;
-	uint16_t addr = 0;
-	for (; addr < (EEPROM_SIZE-EEPROM_PAGE_SIZE); addr += EEPROM_PAGE_SIZE) {
-		if (*(uint8_t *)(addr + MAPPED_EEPROM_START) == CFG_EMPTY) {
-			if (empty == -1)
-				empty = addr;
-		} else if (*(uint8_t *)(addr + MAPPED_EEPROM_START) == type) {
-			break;
-		}
-	}
-	if (addr == (EEPROM_SIZE-EEPROM_PAGE_SIZE)) {
-		if (empty == -1) {
+	uint8_t page = config_find_page(type);
+	if (page == CONFIG_PAGE_NONE) {
+		page = config_find_empty_page();
+		if (page == CONFIG_PAGE_NONE) {
+			eeprom_disable_mapping();
 			return false;
-		} else {
-			addr = empty;
 		}
+		if (type < CONFIG_INDEX_SIZE)
+			config_index[type] = page;
 	}
+	uint16_t addr = page * EEPROM_PAGE_SIZE;
 	*(uint8_t *)(MAPPED_EEPROM_START) = type;
 	*(uint8_t *)(MAPPED_EEPROM_START + 1) = version;
 	memcpy((void *)(MAPPED_EEPROM_START + 2), data, length);
@@ -89,6 +134,10 @@ bool config_write_eeprom(void *data, uint8_t type, uint8_t version, uint8_t leng
 	return true;
 }
 
+uint16_t config_get_pages_scanned(void) {
+	return config_pages_scanned;
+}
+
 
 bool config_read(void *data, uint8_t type, uint8_t version, uint8_t length)
 {
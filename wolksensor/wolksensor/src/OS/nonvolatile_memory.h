@@ -12,4 +12,7 @@
 bool config_read(void *data, uint8_t type, uint8_t version, uint8_t length);
 bool config_write(void *data, uint8_t type, uint8_t version, uint8_t length);
 
+// number of eeprom pages examined by config store since reset
+uint16_t config_get_pages_scanned(void);
+
 #endif /* NVM_H_ */
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "twi_queue.h"
+#include "software_timer.h"
+#include "logger.h"
+
+static TWI_Master_t* master = NULL;
+
+static twi_transaction_t* volatile first = NULL;
+static twi_transaction_t* last = NULL;
+
+static software_timer_t timeout_timer;
+
+static void timeout_expired(void* argument);
+
+/* called with interrupts disabled */
+static void start_first(void)
+{
+	while(first)
+	{
+		twi_transaction_t* transaction = first;
+		
+		if(TWI_MasterWriteRead(master, transaction->address, transaction->write_data, transaction->bytes_to_write, transaction->bytes_to_read))
+		{
+			software_timer_start(&timeout_timer, timeout_expired, NULL, TWI_QUEUE_TIMEOUT, 0);
+			return;
+		}
+		
+		/* invalid sizes, driver busy only if used directly */
+		first = transaction->next;
+		transaction->result = TWIM_RESULT_FAIL;
+		if(transaction->callback) transaction->callback(transaction);
+	}
+	
+	last = NULL;
+}
+
+static void finish_first(uint8_t result)
+{
+	twi_transaction_t* transaction = first;
+	
+	software_timer_stop(&timeout_timer);
+	
+	if((result == TWIM_RESULT_OK) && transaction->bytes_to_read)
+	{
+		memcpy(transaction->read_data, (const void*)master->readData, transaction->bytes_to_read);
+	}
+	
+	first = transaction->next;
+	if(!first)
+	{
+		last = NULL;
+	}
+	
+	transaction->result = result;
+	if(transaction->callback) transaction->callback(transaction);
+	
+	/* callback may have queued and started transaction */
+	if(first && (master->status == TWIM_STATUS_READY))
+	{
+		start_first();
+	}
+}
+
+static void timeout_expired(void* argument)
+{
+	register8_t saved_sreg = SREG;
+	cli();
+	
+	if(first && (master->status != TWIM_STATUS_READY))
+	{
+		LOG(1, "TWI transaction timeout");
+		
+		/* release bus and force driver to idle */
+		master->interface->MASTER.CTRLC = TWI_MASTER_CMD_STOP_gc;
+		master->interface->MASTER.STATUS = TWI_MASTER_BUSSTATE_IDLE_gc;
+		master->status = TWIM_STATUS_READY;
+		
+		finish_first(TWIM_RESULT_FAIL);
+	}
+	
+	SREG = saved_sreg;
+}
+
+void twi_queue_init(TWI_Master_t* twi)
+{
+	master = twi;
+	first = NULL;
+	last = NULL;
+}
+
+bool twi_queue_add(twi_transaction_t* transaction)
+{
+	register8_t saved_sreg = SREG;
+	cli();
+	
+	twi_transaction_t* queued = first;
+	while(queued && (queued != transaction))
+	{
+		queued = queued->next;
+	}
+	
+	if(queued)
+	{
+		SREG = saved_sreg;
+		return false;
+	}
+	
+	transaction->next = NULL;
+	transaction->result = TWIM_RESULT_UNKNOWN;
+	
+	if(last)
+	{
+		last->next = transaction;
+		last = transaction;
+	}
+	else
+	{
+		first = transaction;
+		last = transaction;
+		start_first();
+	}
+	
+	SREG = saved_sreg;
+	return true;
+}
+
+bool twi_queue_busy(void)
+{
+	return first != NULL;
+}
+
+void twi_queue_interrupt_handler(void)
+{
+	if(first && (master->status == TWIM_STATUS_READY))
+	{
+		finish_first(master->result);
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef TWI_QUEUE_H_
+#define TWI_QUEUE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "clock.h"
+#include "twi.h"
+
+/*
+* Queue of interrupt driven TWI transactions on sensor bus. Transaction descriptors are owned by callers and must not
+* be changed while queued, write data is copied when transaction starts. Callback is called from TWI interrupt
+* (or RTC interrupt on timeout) with result set, it may queue further transactions.
+*/
+
+#define TWI_QUEUE_TIMEOUT 10 // ms
+
+typedef struct twi_transaction
+{
+	struct twi_transaction* next;
+	uint8_t address;
+	uint8_t* write_data;
+	uint8_t bytes_to_write;
+	uint8_t* read_data;
+	uint8_t bytes_to_read;
+	void (*callback)(struct twi_transaction* transaction);
+	volatile uint8_t result; // TWIM_RESULT_UNKNOWN while pending
+}
+twi_transaction_t;
+
+void twi_queue_init(TWI_Master_t* twi);
+
+/* false if transaction is already queued */
+bool twi_queue_add(twi_transaction_t* transaction);
+
+/* true while transaction is on bus or waiting, TWI clock must run */
+bool twi_queue_busy(void);
+
+/* to be called from TWI interrupt after driver handler */
+void twi_queue_interrupt_handler(void);
+
+#endif /* TWI_QUEUE_H_ */